@@ -9,32 +9,130 @@
 #include "memory_map.h"
 #include "soc.h"
 #include "config.h"
+#include "checkpoint.h"
+#include "replay.h"
+#include "boot_snapshot.h"
+#include "reload.h"
+#include "hash.h"
+#include "semihost.h"
 
 #include "windows.h"
 #include "core_connect.h"
+#include "peri_io.h"
 
 #include "lpc1768_uart.h"
+#include "lpc1768_gpdma.h"
+#include "lpc1768_gpio.h"
+#include "lpc1768_ssp.h"
+#include "cmsis_svd.h"
+#include "plugin.h"
 
-// connect to peripheral monitor
-static core_connect_t *g_peri_connect;
-
-const char short_options[] = "hgc:";
+const char short_options[] = "hgc:f:n:q:k:K:r:p:b:a:u:sv:m:F:D:";
 const struct option long_options[] = {
     {"help",    no_argument,        NULL,   'h'},
     {"gdb",     no_argument,        NULL,   'g'},
     {"client",  required_argument,  NULL,   'c'},
+    {"freq",    required_argument,  NULL,   'f'},
+    {"cores",   required_argument,  NULL,   'n'},
+    {"quantum", required_argument,  NULL,   'q'},
+    {"checkpoint",      required_argument,  NULL,   'k'},
+    {"checkpoint-file", required_argument,  NULL,   'K'},
+    {"record",  required_argument,  NULL,   'r'},
+    {"replay",  required_argument,  NULL,   'p'},
+    {"boot",    required_argument,  NULL,   'b'},
+    {"boot-at", required_argument,  NULL,   'a'},
+    {"uart",    required_argument,  NULL,   'u'},
+    {"semihosting", no_argument,    NULL,   's'},
+    {"svd",     required_argument,  NULL,   'v'},
+    {"plugins", required_argument,  NULL,   'm'},
+    {"spi-flash",   required_argument,  NULL,   'F'},
+    {"sd-card",     required_argument,  NULL,   'D'},
     {0, 0, 0, 0},
 };
 
+/* the boot is done at pc=<addr> or at cycle=<cycles> */
+static int parse_boot_at(char *boot_at)
+{
+    if(strncmp(boot_at, "pc=", 3) == 0){
+        config.boot_at_pc = TRUE;
+        config.boot_pc = strtoul(boot_at + 3, NULL, 0);
+    }else if(strncmp(boot_at, "cycle=", 6) == 0){
+        config.boot_cycle = strtoull(boot_at + 6, NULL, 0);
+    }else{
+        return -1;
+    }
+    return 0;
+}
+
+/* Resume from the boot snapshot of the image. If there is none, boot and take it
+   when the boot is done. */
+static int boot_soc(soc_t *soc, char *image_path)
+{
+    uint64_t image_hash;
+    int retval;
+
+    if(hash_file(image_path, &image_hash) < 0){
+        LOG(LOG_ERROR, "Can't read %s\n", image_path);
+        return -ERROR_INVALID_PATH;
+    }
+    snapshot_t *snapshot = map_boot_snapshot(config.boot_path, image_hash);
+    if(snapshot != NULL){
+        retval = restore_soc(soc, snapshot);
+        unmap_boot_snapshot(&snapshot);
+        if(retval == 0){
+            LOG(LOG_INFO, "Resumed from %s at cycle %llu\n", config.boot_path, (unsigned long long)soc->cpu[0]->cycle);
+        }
+        return retval;
+    }
+    if(!config.boot_at_pc && config.boot_cycle == 0){
+        LOG(LOG_WARN, "No boot snapshot in %s, boot from reset\n", config.boot_path);
+        return 0;
+    }
+    if(soc->cpu_num != 1){
+        LOG(LOG_ERROR, "Boot snapshots are taken on a single core only\n");
+        return -ERROR_SNAPSHOT;
+    }
+
+    cpu_t *cpu = soc->cpu[0];
+    while(config.boot_at_pc ? cpu->get_raw_pc(cpu) != config.boot_pc : cpu->cycle < config.boot_cycle){
+        if(run_soc(soc) == 0){
+            LOG(LOG_ERROR, "The program stops before the boot is done\n");
+            return -ERROR_SNAPSHOT;
+        }
+    }
+    snapshot = create_snapshot();
+    if(snapshot == NULL){
+        return -ERROR_CREATE;
+    }
+    retval = snapshot_soc(soc, snapshot);
+    if(retval == 0){
+        retval = save_boot_snapshot(snapshot, image_hash, config.boot_path);
+    }
+    destory_snapshot(&snapshot);
+    return retval;
+}
 
-/* for other part of the program that want to know the connect to the peripheral */
-core_connect_t *armue_get_peri_connect()
+/* Commands typed while the soc runs:
+       reload [path]    load the image again, or another one, and reset */
+static void* console_thread(void *arg)
 {
-    return g_peri_connect;
+    soc_t *soc = (soc_t*)arg;
+    char line[512];
+
+    while(fgets(line, sizeof(line), stdin) != NULL){
+        line[strcspn(line, "\r\n")] = '\0';
+        if(strncmp(line, "reload", 6) == 0 && (line[6] == '\0' || line[6] == ' ')){
+            request_reload(soc, line[6] == ' ' ? line + 7 : NULL);
+        }else if(line[0] != '\0'){
+            printf("Unknown command: %s\n", line);
+        }
+    }
+    return NULL;
 }
 
 int main(int argc, char **argv)
 {
+    char *image_path = "E:\\GitHub\\ARMUE\\svc_fsm_m3_test\\test.bin";
     char c;
     int option_index;
     while(1){
@@ -54,16 +152,78 @@ int main(int argc, char **argv)
             config.pipe_name = (char *)malloc(strlen(optarg));
             strcpy(config.pipe_name, optarg);
             break;
+        case 'f':
+            config.clock_freq = strtoull(optarg, NULL, 0);
+            break;
+        case 'n':
+            config.cpu_num = atoi(optarg);
+            break;
+        case 'q':
+            config.sync_quantum = strtoull(optarg, NULL, 0);
+            break;
+        case 'k':
+            config.checkpoint_interval = strtoull(optarg, NULL, 0);
+            break;
+        case 'K':
+            config.checkpoint_path = optarg;
+            break;
+        case 'r':
+            config.record_path = optarg;
+            break;
+        case 'p':
+            config.replay_path = optarg;
+            break;
+        case 'b':
+            config.boot_path = optarg;
+            break;
+        case 'a':
+            if(parse_boot_at(optarg) < 0){
+                printf("--boot-at takes pc=<addr> or cycle=<cycles>\n");
+                return 0;
+            }
+            break;
+        case 'u':
+            config.uart_console = optarg;
+            break;
+        case 's':
+            config.semihosting = TRUE;
+            break;
+        case 'v':
+            config.svd_path = optarg;
+            break;
+        case 'm':
+            config.plugin_dir = optarg;
+            break;
+        case 'F':
+            config.spi_flash = optarg;
+            break;
+        case 'D':
+            config.sd_card = optarg;
+            break;
         default:
             printf("Try --help");
             return 0;
         }
     };
 
-    int retval;
+    /* the input comes from the log only */
+    if(config.replay_path != NULL && (config.client || config.gdb_debug)){
+        LOG(LOG_WARN, "The monitor and the debugger are not used when replaying\n");
+        config.client = FALSE;
+        config.gdb_debug = FALSE;
+    }
+
+    /* the debugger steps back from the checkpoints */
+    if(config.gdb_debug && config.checkpoint_interval == 0){
+        config.checkpoint_interval = CHECKPOINT_DEBUG_INTERVAL;
+    }
+
+    int retval, i;
+    // connect to peripheral monitor
+    core_connect_t *peri_connect = NULL;
     if(config.client){
-        g_peri_connect = create_core_connect(1024, config.pipe_name);
-        retval = connect_monitor(g_peri_connect);
+        peri_connect = create_core_connect(1024, config.pipe_name);
+        retval = connect_monitor(peri_connect);
         if(retval != SUCCESS){
             return -1;
         }
@@ -71,11 +231,14 @@ int main(int argc, char **argv)
 
     // register all exsisted modules
     register_all_modules();
+    if(config.plugin_dir != NULL && load_plugin_modules(config.plugin_dir) < 0){
+        return -1;
+    }
 
     memory_map_t *memory_map = create_memory_map();
 
     soc_conf_t soc_conf;
-    soc_conf.cpu_num = 1;
+    soc_conf.cpu_num = config.cpu_num > 0 ? config.cpu_num : 1;
     soc_conf.cpu_name = "arm_cm3";
     soc_conf.exception_num = 255;
     soc_conf.nested_level = 10;
@@ -84,6 +247,7 @@ int main(int argc, char **argv)
     soc_conf.memories[0] = memory_map;
     soc_conf.exclusive_high_address = 0xFFFFFFFF;
     soc_conf.exclusive_low_address = 0;
+    soc_conf.sync_quantum = config.sync_quantum;
 
     // ROM
     rom_t* rom = alloc_rom();
@@ -93,12 +257,14 @@ int main(int argc, char **argv)
     }
     fill_rom_with_zero(rom);
     //fill_rom_with_bin(rom, 0, "E:\\GitHub\\ARMUE\\cortex_m3_test\\test.bin");
-    fill_rom_with_bin(rom, 0, "E:\\GitHub\\ARMUE\\svc_fsm_m3_test\\test.bin");
+    fill_rom_with_bin(rom, 0, image_path);
     //fill_rom_with_bin(rom, "E:\\LPC11U3X_demo_board\\software\\_OK_systick\\test.bin");
     int result = setup_memory_map_rom(memory_map, rom, 0x00);
     if(result < 0){
         LOG(LOG_ERROR, "Faild to setup ROM\n");
     }
+    /* LPC1768 FLASHCFG resets to FLASHTIM = 3, which is 4 cpu clocks per flash access */
+    set_memory_wait_states(memory_map, 0x00, rom->size, 3);
 
     /* RAM */
     ram_t* ram = create_ram(0x8000);
@@ -108,7 +274,6 @@ int main(int argc, char **argv)
     }
 
     // soc
-    uint32_t opcode;
     soc_t* soc = create_soc(&soc_conf);
     if(soc == NULL){
         return -1;
@@ -118,23 +283,104 @@ int main(int argc, char **argv)
         if(soc->stub == NULL){
             return -1;
         }
+        soc->stub->soc = soc;
     }
 
-    lpc1768_uart_init(soc->cpu[0]);
+    if(config.replay_path != NULL || config.record_path != NULL){
+        soc->replay = config.replay_path != NULL ? create_replay(config.replay_path, REPLAY_PLAY) :
+                                                   create_replay(config.record_path, REPLAY_RECORD);
+        if(soc->replay == NULL){
+            return -1;
+        }
+        if(soc->stub != NULL){
+            soc->stub->replay = soc->replay;
+        }
+    }
+
+    soc->peri_connect = peri_connect;
+    /* the console gives no input when replaying */
+    if(peri_connect != NULL || (config.uart_console != NULL && config.replay_path == NULL)){
+        soc->peri_io = create_peri_io(peri_connect);
+        if(soc->peri_io == NULL){
+            LOG(LOG_ERROR, "Failed to read the peripheral input\n");
+            return -1;
+        }
+    }
+    if(config.semihosting){
+        soc->semihost = create_semihost();
+        if(soc->semihost == NULL){
+            return -1;
+        }
+        for(i = 0; i < soc->cpu_num; i++){
+            soc->cpu[i]->semihost = soc->semihost;
+        }
+    }
+    lpc1768_uart_init(soc);
+    lpc1768_gpdma_init(soc);
+    lpc1768_gpio_init(soc);
+    if(lpc1768_ssp_init(soc) < 0){
+        LOG(LOG_ERROR, "Failed to attach the SPI devices\n");
+        return -1;
+    }
+    if(plugin_peripherals_init(soc) < 0){
+        LOG(LOG_ERROR, "Failed to map the plug-in peripherals\n");
+        return -1;
+    }
+    /* the stubs only take the addresses the models above left */
+    if(config.svd_path != NULL && cmsis_svd_init(soc, config.svd_path) < 0){
+        LOG(LOG_ERROR, "Failed to map the peripherals of %s\n", config.svd_path);
+        return -1;
+    }
 
     // main loop for emulation
     startup_soc(soc);
+    /* the image of a replayed run can't change */
+    if(config.replay_path == NULL){
+        soc->reload = create_reload(soc, image_path, 0x00);
+        if(soc->reload == NULL){
+            LOG(LOG_ERROR, "Failed to set up reload\n");
+        }else{
+            /* stdin is the UART input or the semihosting console then */
+            pthread_t console;
+            if((config.uart_console == NULL || strcmp(config.uart_console, "stdio") != 0) && !config.semihosting &&
+               pthread_create(&console, NULL, console_thread, soc) == 0){
+                pthread_detach(console);
+            }
+        }
+    }
     if(config.gdb_debug){
         init_stub(soc->stub);
     }
-    while(1){
-        opcode = run_soc(soc);
-        //getchar();
-        if(opcode == 0)
-            break;
+    if(config.boot_path != NULL && boot_soc(soc, image_path) < 0){
+        LOG(LOG_ERROR, "Failed to boot from %s\n", config.boot_path);
+        return -1;
+    }
+    if(config.checkpoint_interval != 0){
+        soc->checkpoints = create_checkpoint_list(soc, config.checkpoint_interval);
+        if(soc->checkpoints == NULL){
+            LOG(LOG_ERROR, "Failed to take checkpoints\n");
+        }
     }
+    int run_result = run_soc_parallel(soc);
+    if(run_result < 0){
+        LOG(LOG_ERROR, "Failed to run the cores\n");
+    }
+    if(soc->checkpoints != NULL && config.checkpoint_path != NULL){
+        save_checkpoint_file(soc->checkpoints, soc->checkpoints->num - 1, config.checkpoint_path);
+    }
+    if(peri_connect != NULL){
+        pmp_send(peri_connect);
+    }
+    /* the code the program gave with SYS_EXIT is the exit code of the emulator */
+    int exit_code = run_result < 0 ? run_result : soc->semihost != NULL ? soc->semihost->exit_code : 0;
+    cmsis_svd_destory(soc);
+    plugin_peripherals_destory(soc);
+    lpc1768_ssp_destory(soc);
+    lpc1768_gpio_destory(soc);
+    lpc1768_gpdma_destory(soc);
+    lpc1768_uart_destory(soc);
     destory_soc(&soc);
 
     unregister_all_modules();
-    return 0;
+    return exit_code;
 }
@@ -1,14 +0,0 @@
-#ifndef _ARMUE_H_
-#define _ARMUE_H_
-#ifdef __cplusplus
-extern "C"{
-#endif
-
-#include "core_connect.h"
-
-core_connect_t *armue_get_peri_connect();
-
-#ifdef __cplusplus
-}
-#endif
-#endif
@@ -4,6 +4,9 @@
 #include "arm_v7m_ins_decode.h"
 #include "arm_v7m_ins_implement.h"
 #include "cm_system_control_space.h"
+#include "replay.h"
+#include "checkpoint.h"
+#include "reload.h"
 #include <string.h>
 
 
@@ -283,6 +286,8 @@ static int set_registers(char *buf, int start, int end, cpu_t *cpu)
             break;
         }
     }
+    /* the mask registers may be changed */
+    cm_NVIC_update_execution_priority(cpu);
 
     return 0;
 }
@@ -372,7 +377,17 @@ static int read_mem(gdb_stub_t *stub, uint32_t addr, uint32_t size, cpu_t *cpu)
     return retval;
 }
 
-static int write_mem(uint32_t addr, uint32_t size, char *data, cpu_t *cpu)
+/* every write of the debugger goes through here, so that it can be replayed */
+static int set_memory(gdb_stub_t *stub, uint32_t addr, int size, uint8_t *buf, cpu_t *cpu)
+{
+    int ret = armv7m_set_memory_direct(addr, size, buf, cpu);
+    if(ret >= 0){
+        replay_record(stub->replay, cpu, REPLAY_EVENT_MEMORY, &addr, sizeof(addr), buf, size);
+    }
+    return ret;
+}
+
+static int write_mem(gdb_stub_t *stub, uint32_t addr, uint32_t size, char *data, cpu_t *cpu)
 {
     char *recv_buf = data;
     char *start;
@@ -386,7 +401,7 @@ static int write_mem(uint32_t addr, uint32_t size, char *data, cpu_t *cpu)
         *recv_buf = '\0';
         hex = strtohex_u32(start);
         *recv_buf = temp_ch;
-        ret = armv7m_set_memory_direct(addr + i, 1, &hex, cpu);
+        ret = set_memory(stub, addr + i, 1, &hex, cpu);
         if(ret < 0){
             return ret;
         }
@@ -418,7 +433,7 @@ static int set_memory_breakpoint(gdb_stub_t *stub, uint32_t addr, int kind, cpu_
         if(ret < 0){
             goto out;
         }
-        ret = armv7m_set_memory_direct(addr, 2, (uint8_t *)&break_opcode, cpu);
+        ret = set_memory(stub, addr, 2, (uint8_t *)&break_opcode, cpu);
         //armv7m_get_memory_direct(addr, 2, (uint8_t *)&mem, cpu);
         //printf("read back memory %x\n", mem);
         if(ret < 0){
@@ -444,7 +459,7 @@ static int clear_memory_breakpoint(gdb_stub_t *stub, uint32_t addr, int kind, cp
         }
         mem = elem->data.uidata;
         printf("mem is %x\n", mem);
-        ret = armv7m_set_memory_direct(addr, 2, (uint8_t *)&mem, cpu);
+        ret = set_memory(stub, addr, 2, (uint8_t *)&mem, cpu);
         if(ret < 0){
             goto out;
         }
@@ -495,6 +510,125 @@ bool_t is_sw_breakpoint(gdb_stub_t *stub, uint32_t addr)
     return TRUE;
 }
 
+#define BKPT_OPCODE 0xBE00
+
+typedef struct reverse_match_t{
+    gdb_stub_t *stub;
+    int break_num;
+    uint32_t *breaks;   // the breakpoints inserted, NULL to match any instruction
+}reverse_match_t;
+
+static bool_t match_reverse(soc_t *soc, cycle_t start, uint32_t start_pc, void *data)
+{
+    reverse_match_t *match = (reverse_match_t*)data;
+    int i;
+
+    /* a breakpoint run again is not an instruction of the program */
+    if(soc->cpu[0]->run_info.halting == MAYBE && is_sw_breakpoint(match->stub, start_pc)){
+        return FALSE;
+    }
+    if(match->breaks == NULL){
+        return TRUE;
+    }
+    for(i = 0; i < match->break_num; i++){
+        if(match->breaks[i] == start_pc){
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* Visit the breakpoints of the table the memory holds now. With restore set they are
+   taken out, otherwise their addresses are collected. */
+static int inserted_breakpoints(gdb_stub_t *stub, uint32_t *breaks, bool_t restore, cpu_t *cpu)
+{
+    hash_t *hash = stub->sw_breakpoint;
+    uint16_t mem;
+    int i, num = 0;
+    for(i = 0; i < hash->max_size; i++){
+        if(hash->table[i].info != HASH_ELEM_USED){
+            continue;
+        }
+        uint32_t addr = hash->table[i].key;
+        if(armv7m_get_memory_direct(addr, 2, (uint8_t *)&mem, cpu) <= 0 || mem != BKPT_OPCODE){
+            continue;
+        }
+        if(restore){
+            mem = hash->table[i].data.uidata;
+            armv7m_set_memory_direct(addr, 2, (uint8_t *)&mem, cpu);
+        }else{
+            breaks[num++] = addr;
+        }
+    }
+    return num;
+}
+
+/* Reverse step or continue. Returns 1 when stopped, 0 at the start of the history. */
+static int reverse_execute(gdb_stub_t *stub, char command, cpu_t *cpu)
+{
+    soc_t *soc = stub->soc;
+    reverse_match_t match = {stub, 0, NULL};
+    int retval;
+
+    if(soc == NULL || soc->checkpoints == NULL || soc->cpu_num != 1){
+        return -1;
+    }
+    if(command == 'c'){
+        match.breaks = (uint32_t *)malloc(stub->sw_breakpoint->max_size * sizeof(uint32_t));
+        if(match.breaks == NULL){
+            return -1;
+        }
+        match.break_num = inserted_breakpoints(stub, match.breaks, FALSE, cpu);
+    }
+    retval = rewind_checkpoint(soc, soc->checkpoints, cpu->cycle, match_reverse, &match);
+    free(match.breaks);
+
+    /* the memory comes from a checkpoint, which may hold breakpoints of another time */
+    inserted_breakpoints(stub, NULL, TRUE, cpu);
+    cpu->run_info.halting = TRUE;
+    return retval;
+}
+
+/* "monitor reload [path]", the command comes in hex. The core is reset and halted,
+   the debugger should flush its register cache after it. */
+static int monitor_command(gdb_stub_t *stub, char *hex, cpu_t *cpu)
+{
+    char command[MAX_PACKET_SIZE / 2 + 1];
+    int i, len = 0;
+    for(; hex[0] != '\0' && hex[1] != '\0'; hex += 2){
+        command[len++] = char_to_hex(hex[0]) * 0x10 + char_to_hex(hex[1]);
+    }
+    command[len] = '\0';
+
+    if(strncmp(command, "reload", 6) != 0 || (command[6] != '\0' && command[6] != ' ')){
+        return -1;
+    }
+    char *path = command[6] == ' ' ? command + 7 : NULL;
+    if(stub->soc == NULL || stub->soc->reload == NULL){
+        return -1;
+    }
+
+    /* the breakpoints hold instructions of the image before, they are set again in the new one */
+    hash_t *hash = stub->sw_breakpoint;
+    uint32_t *breaks = (uint32_t *)malloc(hash->max_size * sizeof(uint32_t));
+    if(breaks == NULL){
+        return -1;
+    }
+    int break_num = inserted_breakpoints(stub, breaks, FALSE, cpu);
+    inserted_breakpoints(stub, NULL, TRUE, cpu);
+    for(i = 0; i < hash->max_size; i++){
+        if(hash->table[i].info == HASH_ELEM_USED){
+            hash_delete(hash, hash->table[i].key, bp_do_hash);
+        }
+    }
+    int retval = reload_firmware(stub->soc, path);
+    for(i = 0; i < break_num; i++){
+        set_memory_breakpoint(stub, breaks[i], 2, cpu);
+    }
+    free(breaks);
+    return retval;
+}
+
 /* the main handler for RSP */
 int handle_rsp(gdb_stub_t *stub, cpu_t *cpu)
 {
@@ -597,7 +731,7 @@ int handle_rsp(gdb_stub_t *stub, cpu_t *cpu)
         break;
     case 'M':
         next_division(&buf, "x,:", params);
-        retval = write_mem(params[0], params[1], buf, cpu);
+        retval = write_mem(stub, params[0], params[1], buf, cpu);
         if(retval < 0){
             make_packet(stub, "E30");
         }else{
@@ -633,7 +767,27 @@ int handle_rsp(gdb_stub_t *stub, cpu_t *cpu)
         break;
     case 'q':
         if(strncmp(buf, "Supported", 9) == 0){
-            make_packet(stub, "PacketSize=%X", MAX_PACKET_SIZE);
+            if(stub->soc != NULL && stub->soc->checkpoints != NULL){
+                make_packet(stub, "PacketSize=%X;ReverseStep+;ReverseContinue+", MAX_PACKET_SIZE);
+            }else{
+                make_packet(stub, "PacketSize=%X", MAX_PACKET_SIZE);
+            }
+        }else if(strncmp(buf, "Rcmd,", 5) == 0){
+            if(monitor_command(stub, buf + 5, cpu) < 0){
+                make_packet(stub, "E01");
+            }else{
+                make_packet(stub, "OK");
+            }
+        }
+        break;
+    case 'b':
+        retval = reverse_execute(stub, *buf, cpu);
+        if(retval < 0){
+            make_packet(stub, "E01");
+        }else if(retval == 0){
+            make_packet(stub, "T05replaylog:begin;");
+        }else{
+            make_packet(stub, "S05");
         }
         break;
     case 'k':
@@ -31,6 +31,8 @@ typedef struct bp_t{
     int length;
 }bp_t;
 
+struct replay_t;
+struct soc_t;
 typedef struct gdb_stub_t{
     int status;
     int port;
@@ -41,6 +43,8 @@ typedef struct gdb_stub_t{
     char recv_buf[MAX_PACKET_SIZE];
     int recv_len;
     hash_t *sw_breakpoint;
+    struct replay_t *replay;    // records the memory the debugger writes, NULL if not recording
+    struct soc_t *soc;          // the soc debugged, for reverse execution
 }gdb_stub_t;
 
 
@@ -1,9 +1,11 @@
 #include "_types.h"
 #include "arm_v7m_ins_decode.h"
 #include "cm_NVIC.h"
+#include "arm_v7m_timing.h"
 #include "cpu.h"
 #include <stdlib.h>
 #include <assert.h>
+#include <pthread.h>
 
 #define CHECK_UNPREDICTABLE(condition, instruction_name)\
 do{\
@@ -14,6 +16,8 @@ do{\
 }while(0)
 
 thumb_instruct_table_t *M_translate_table; // table for ARMvX-M
+static int M_translate_table_users;         // cores using the table
+static pthread_mutex_t M_translate_table_lock = PTHREAD_MUTEX_INITIALIZER;
 thumb_instruct_table_t *R_translate_table; // table for ARMvX-R, implement in the future
 thumb_instruct_table_t *A_translate_table; // table for ARMvX-A, implement in the future
 
@@ -975,10 +979,20 @@ void _pop_16(uint16_t ins_code, cpu_t* cpu)
 void _bkpt_16(uint16_t ins_code, cpu_t* cpu)
 {
     uint32_t imm32 = LOW_BIT16(ins_code, 8);
-    _bkpt(cpu);
+    _bkpt(imm32, cpu);
     LOG_INSTRUCTION("_bkpt_16 #%d\n", imm32);
 }
 
+void _cps_16(uint16_t ins_code, cpu_t* cpu)
+{
+    uint32_t im = LOW_BIT16(ins_code >> 4, 1);
+    uint32_t affectPRI = LOW_BIT16(ins_code >> 1, 1);
+    uint32_t affectFAULT = LOW_BIT16(ins_code, 1);
+    CHECK_UNPREDICTABLE(InITBlock(cpu->regs) || (affectPRI == 0 && affectFAULT == 0), _cps_16);
+    _cps(im, affectPRI, affectFAULT, cpu);
+    LOG_INSTRUCTION("_cps_16 %s, %s%s\n", im ? "ID" : "IE", affectPRI ? "i" : "", affectFAULT ? "f" : "");
+}
+
 void _it_16(uint16_t ins_code, cpu_t* cpu)
 {
     arm_reg_t* regs = (arm_reg_t*)cpu->regs;
@@ -4033,6 +4047,7 @@ void _mla_reg_32(uint32_t ins_code, cpu_t *cpu)
 
     CHECK_UNPREDICTABLE(IN_RANGE(Rd, 13, 15) || IN_RANGE(Rn, 13, 15) || IN_RANGE(Rm, 13, 15) || Ra == 13, _mla_reg_32);
     _mla_reg(Rm, Rn, Rd, Ra, FALSE, cpu->regs);
+    armv7m_add_timing(cpu, TIMING_MUL_ACC);
     LOG_INSTRUCTION("_mla_reg_32, R%d, R%d, R%d, R%d\n", Rd, Rn, Rm, Ra);
 }
 
@@ -4056,6 +4071,7 @@ void _mls_reg_32(uint32_t ins_code, cpu_t *cpu)
 
     CHECK_UNPREDICTABLE(IN_RANGE(Rd, 13, 15) || IN_RANGE(Rn, 13, 15) || IN_RANGE(Rm, 13, 15) || Ra == 13, _mls_reg_32);
     _mls_reg(Rm, Rn, Rd, Ra, cpu->regs);
+    armv7m_add_timing(cpu, TIMING_MUL_ACC);
     LOG_INSTRUCTION("_mls_reg_32, R%d, R%d, R%d, R%d\n", Rd, Rn, Rm, Ra);
 }
 
@@ -4093,6 +4109,7 @@ void _smull_32(uint32_t ins_code, cpu_t *cpu)
 
     CHECK_UNPREDICTABLE(IN_RANGE(RdLo, 13, 15) || IN_RANGE(RdHi, 13, 15) || IN_RANGE(Rn, 13, 15) || IN_RANGE(Rm, 13, 15), _smull_32);
     _smull(Rm, Rn, RdLo, RdHi, FALSE, cpu->regs);
+    armv7m_add_timing(cpu, TIMING_MUL_LONG);
     LOG_INSTRUCTION("_smull_32, R%d, R%d, R%d, R%d\n", RdLo, RdHi, Rn, Rm);
 }
 
@@ -4113,6 +4130,13 @@ void _sdiv_32(uint32_t ins_code, cpu_t *cpu)
     uint32_t Rd = LONG_MUL_DIV32_Rd(ins_code);
 
     CHECK_UNPREDICTABLE(IN_RANGE(Rn, 13, 15) || IN_RANGE(Rd, 13, 15) || IN_RANGE(Rm, 13, 15), _sdiv_32);
+    /* the magnitudes are taken unsigned, INT32_MIN has none as int32_t */
+    if(ConditionPassed(0, cpu->regs)){
+        int32_t dividend = (int32_t)GET_REG_VAL(cpu->regs, Rn);
+        int32_t divisor = (int32_t)GET_REG_VAL(cpu->regs, Rm);
+        armv7m_add_div_timing(cpu, dividend < 0 ? 0u - (uint32_t)dividend : (uint32_t)dividend,
+                              divisor < 0 ? 0u - (uint32_t)divisor : (uint32_t)divisor);
+    }
     _sdiv(Rm, Rn, Rd, cpu->regs);
     LOG_INSTRUCTION("_sdiv_32, R%d, R%d, R%d\n", Rd, Rn, Rm);
 }
@@ -4136,6 +4160,7 @@ void _umull_32(uint32_t ins_code, cpu_t *cpu)
 
     CHECK_UNPREDICTABLE(IN_RANGE(RdLo, 13, 15) || IN_RANGE(RdHi, 13, 15) || IN_RANGE(Rn, 13, 15) || IN_RANGE(Rm, 13, 15), _umull_32);
     _umull(Rm, Rn, RdLo, RdHi, FALSE, cpu->regs);
+    armv7m_add_timing(cpu, TIMING_MUL_LONG);
     LOG_INSTRUCTION("_umull_32, R%d, R%d, R%d, R%d\n", RdLo, RdHi, Rn, Rm);
 }
 
@@ -4156,6 +4181,9 @@ void _udiv_32(uint32_t ins_code, cpu_t *cpu)
     uint32_t Rd = LONG_MUL_DIV32_Rd(ins_code);
 
     CHECK_UNPREDICTABLE(IN_RANGE(Rn, 13, 15) || IN_RANGE(Rd, 13, 15) || IN_RANGE(Rm, 13, 15), _udiv_32);
+    if(ConditionPassed(0, cpu->regs)){
+        armv7m_add_div_timing(cpu, GET_REG_VAL(cpu->regs, Rn), GET_REG_VAL(cpu->regs, Rm));
+    }
     _udiv(Rm, Rn, Rd, cpu->regs);
     LOG_INSTRUCTION("_udiv_32, R%d, R%d, R%d\n", Rd, Rn, Rm);
 }
@@ -4179,6 +4207,7 @@ void _smlal_32(uint32_t ins_code, cpu_t *cpu)
 
     CHECK_UNPREDICTABLE(IN_RANGE(RdLo, 13, 15) || IN_RANGE(RdHi, 13, 15) || IN_RANGE(Rn, 13, 15) || IN_RANGE(Rm, 13, 15), _smlal_32);
     _smlal(Rm, Rn, RdLo, RdHi, FALSE, cpu->regs);
+    armv7m_add_timing(cpu, TIMING_MUL_LONG);
     LOG_INSTRUCTION("_smlal_32, R%d, R%d, R%d, R%d\n", RdLo, RdHi, Rn, Rm);
 }
 
@@ -4286,6 +4315,7 @@ void init_instruction_table(thumb_instruct_table_t* table)
     set_sub_table_value(table->misc_16bit_ins_table16, 0x16, 0x17, (thumb_translate_t)_uxtb_16,             THUMB_EXCUTER);
     set_sub_table_value(table->misc_16bit_ins_table16, 0x18, 0x1F, (thumb_translate_t)_cbnz_cbz_16,         THUMB_EXCUTER);
     set_sub_table_value(table->misc_16bit_ins_table16, 0x20, 0x2F, (thumb_translate_t)_push_16,             THUMB_EXCUTER);
+    set_sub_table_value(table->misc_16bit_ins_table16, 0x33, 0x33, (thumb_translate_t)_cps_16,              THUMB_EXCUTER);
     set_sub_table_value(table->misc_16bit_ins_table16, 0x48, 0x4F, (thumb_translate_t)_cbnz_cbz_16,         THUMB_EXCUTER);
     set_sub_table_value(table->misc_16bit_ins_table16, 0x50, 0x51, (thumb_translate_t)_rev_16,              THUMB_EXCUTER);
     set_sub_table_value(table->misc_16bit_ins_table16, 0x52, 0x53, (thumb_translate_t)_rev16_16,            THUMB_EXCUTER);
@@ -4560,6 +4590,7 @@ int destory_thumb_state(thumb_state** state)
         return -ERROR_NULL_POINTER;
     }
 
+    destory_fifo(&(*state)->cur_exception);
     free(*state);
     *state = NULL;
 
@@ -4575,8 +4606,13 @@ thumb_global_state* create_thumb_global_state(soc_conf_t *config)
     /* set exclusive state */
     gstate->exclusive_state.low_addr  = config->exclusive_low_address;
     gstate->exclusive_state.high_addr = config->exclusive_high_address;
+    if(pthread_mutex_init(&gstate->exclusive_state.lock, NULL) != 0){
+        goto lock_fail;
+    }
     return gstate;
 
+lock_fail:
+    free(gstate);
 gstate_null:
     return NULL;
 }
@@ -4586,6 +4622,7 @@ int destory_thumb_global_state(thumb_global_state **state)
     if(state == NULL || *state == NULL){
         return -ERROR_NULL_POINTER;
     }
+    pthread_mutex_destroy(&(*state)->exclusive_state.lock);
     free(*state);
     *state = NULL;
 
@@ -4600,7 +4637,7 @@ thumb_instruct_table_t* create_instruction_table()
 void desotry_instruction_table(thumb_instruct_table_t **table)
 {
     free(*table);
-    table = NULL;
+    *table = NULL;
 }
 
 /* create and initialize the instruction as well as the cpu state */
@@ -4613,12 +4650,17 @@ int ins_thumb_init(IOput cpu_t* cpu, soc_conf_t *config)
     }
     set_cpu_spec_info(cpu, state);
 
-    // initialize global info
-    thumb_global_state *global_state = create_thumb_global_state(config);
-    if(global_state == NULL){
-        goto global_state_error;
+    // initialize global info, unless another core of the soc has created it
+    bool_t own_global_state = FALSE;
+    if(cpu->run_info.global_info == NULL){
+        thumb_global_state *global_state = create_thumb_global_state(config);
+        if(global_state == NULL){
+            goto global_state_error;
+        }
+        cpu->run_info.global_info = global_state;
+        own_global_state = TRUE;
     }
-    cpu->run_info.global_info = global_state;
+    ((thumb_global_state*)cpu->run_info.global_info)->users++;
 
     // create registers
     cpu->regs = create_arm_regs();
@@ -4626,20 +4668,29 @@ int ins_thumb_init(IOput cpu_t* cpu, soc_conf_t *config)
         goto regs_error;
     }
 
-    /* translate table will init only once when needed */
+    /* translate table will init only once when needed, socs may be created in parallel */
+    pthread_mutex_lock(&M_translate_table_lock);
     if(M_translate_table == NULL){
         M_translate_table = create_instruction_table();
+        if(M_translate_table == NULL){
+            pthread_mutex_unlock(&M_translate_table_lock);
+            goto table_err;
+        }
+        init_instruction_table(M_translate_table);
     }
-    if(M_translate_table == NULL){
-        goto table_err;
-    }
-    init_instruction_table(M_translate_table);
+    M_translate_table_users++;
+    pthread_mutex_unlock(&M_translate_table_lock);
     return SUCCESS;
 
 table_err:
     destory_arm_regs((arm_reg_t**)&cpu->regs);
 regs_error:
-    destory_thumb_global_state((thumb_global_state**)&cpu->run_info.global_info);
+    ((thumb_global_state*)cpu->run_info.global_info)->users--;
+    if(own_global_state){
+        destory_thumb_global_state((thumb_global_state**)&cpu->run_info.global_info);
+    }else{
+        cpu->run_info.global_info = NULL;
+    }
 global_state_error:
     destory_thumb_state((thumb_state**)&cpu->run_info.cpu_spec_info);
 state_error:
@@ -4648,7 +4699,18 @@ state_error:
 
 int ins_thumb_destory(cpu_t* cpu)
 {
-    desotry_instruction_table(&M_translate_table);
+    pthread_mutex_lock(&M_translate_table_lock);
+    if(--M_translate_table_users == 0){
+        desotry_instruction_table(&M_translate_table);
+    }
+    pthread_mutex_unlock(&M_translate_table_lock);
+
+    /* the global state goes with the last core of the soc */
+    thumb_global_state *global_state = (thumb_global_state*)cpu->run_info.global_info;
+    if(global_state != NULL && --global_state->users == 0){
+        destory_thumb_global_state(&global_state);
+    }
+    cpu->run_info.global_info = NULL;
     destory_arm_regs((arm_reg_t**)&cpu->regs);
     destory_thumb_state((thumb_state**)&cpu->run_info.cpu_spec_info);
     cpu->instruction_data = NULL;
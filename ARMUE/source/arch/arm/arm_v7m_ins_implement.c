@@ -4,7 +4,10 @@
 #include "cpu.h"
 #include "cm_NVIC.h"
 #include "cm_system_control_space.h"
+#include "arm_v7m_timing.h"
+#include "semihost.h"
 #include <assert.h>
+#include <sched.h>
 #include <stdlib.h>
 
 /* sync to the banked field */
@@ -399,9 +402,73 @@ int MemU_with_priv(uint32_t address, int size, IOput uint8_t* buffer, bool_t pri
     return retval;
 }
 
-inline int MemU_unpriv(uint32_t address, int size, IOput uint8_t *buffer, int type, cpu_t *cpu)
+/* A store clears the exclusive reservations other cores hold on the stored address.
+   The lock of the exclusive state must be held. */
+static void ClearExclusiveByAddress(uint32_t address, int size, cpu_t *cpu)
 {
-    return MemU_with_priv(address, size, buffer, FALSE, type, cpu);
+    thumb_global_state* gstate = ARMv7m_GET_GLOBAL_STATE(cpu);
+    arm_exclusive_t *excl_state = &gstate->exclusive_state;
+    int i;
+
+    for(i = 0; i < MAX_CPU_NUM; i++){
+        if(i == cpu->cid || excl_state->local_exclusive_enable[i] == FALSE){
+            continue;
+        }
+        if(excl_state->local_exclusive[i] < address + size &&
+           address < excl_state->local_exclusive[i] + 4){
+            excl_state->local_exclusive_enable[i] = FALSE;
+            __atomic_sub_fetch(&excl_state->exclusive_num, 1, __ATOMIC_SEQ_CST);
+        }
+    }
+}
+
+enum{
+    EXCL_WRITE_NONE,        // a read, or one core
+    EXCL_WRITE_FAST,        // no reservation was held, storing[] is set
+    EXCL_WRITE_LOCKED,
+};
+
+/* A store and the clearing of the reservations it hits are one step under the lock, or a
+   STREX of another core could succeed in between. While no core holds a reservation the
+   store goes on without the lock: the core raises storing[] before it looks at
+   exclusive_num, and an LDREX waits for the stores in flight after raising exclusive_num,
+   so either the store sees the reservation or the LDREX reads what it stored. */
+static inline int LockExclusiveOnWrite(int type, cpu_t *cpu)
+{
+    thumb_global_state* gstate = ARMv7m_GET_GLOBAL_STATE(cpu);
+    arm_exclusive_t *excl_state = &gstate->exclusive_state;
+
+    if(type != MEM_WRITE || gstate->users <= 1){
+        return EXCL_WRITE_NONE;
+    }
+    __atomic_store_n(&excl_state->storing[cpu->cid], TRUE, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&excl_state->exclusive_num, __ATOMIC_SEQ_CST) == 0){
+        return EXCL_WRITE_FAST;
+    }
+    __atomic_store_n(&excl_state->storing[cpu->cid], FALSE, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&excl_state->lock);
+    return EXCL_WRITE_LOCKED;
+}
+
+static inline void UnlockExclusiveOnWrite(uint32_t address, int size, int locked, cpu_t *cpu)
+{
+    thumb_global_state* gstate = ARMv7m_GET_GLOBAL_STATE(cpu);
+
+    if(locked == EXCL_WRITE_FAST){
+        __atomic_store_n(&gstate->exclusive_state.storing[cpu->cid], FALSE, __ATOMIC_RELEASE);
+    }else if(locked == EXCL_WRITE_LOCKED){
+        ClearExclusiveByAddress(address, size, cpu);
+        pthread_mutex_unlock(&gstate->exclusive_state.lock);
+    }
+}
+
+static inline int MemU_unpriv(uint32_t address, int size, IOput uint8_t *buffer, int type, cpu_t *cpu)
+{
+    armv7m_add_access_timing(cpu, address);
+    int locked = LockExclusiveOnWrite(type, cpu);
+    int retval = MemU_with_priv(address, size, buffer, FALSE, type, cpu);
+    UnlockExclusiveOnWrite(address, size, locked, cpu);
+    return retval;
 }
 
 /* TODO: Memory access is not complete for checking some flags like ALIGN and ENDIANs */
@@ -410,7 +477,11 @@ int MemU(uint32_t address, int size, IOput uint8_t* buffer, int type, cpu_t* cpu
 {
     arm_reg_t* regs = (arm_reg_t*)cpu->regs;
     thumb_state* state = (thumb_state*)cpu->run_info.cpu_spec_info;
-    return MemU_with_priv(address, size, buffer, FindPriv(regs, state), type, cpu);
+    armv7m_add_access_timing(cpu, address);
+    int locked = LockExclusiveOnWrite(type, cpu);
+    int retval = MemU_with_priv(address, size, buffer, FindPriv(regs, state), type, cpu);
+    UnlockExclusiveOnWrite(address, size, locked, cpu);
+    return retval;
 }
 
 int MemA_with_priv(uint32_t address, int size, IOput uint8_t* buffer, bool_t priv, int type, cpu_t* cpu)
@@ -441,7 +512,11 @@ int MemA(uint32_t address, int size, IOput uint8_t* buffer, int type, cpu_t* cpu
 {
     arm_reg_t* regs = (arm_reg_t*)cpu->regs;
     thumb_state* state = (thumb_state*)cpu->run_info.cpu_spec_info;
-    return MemA_with_priv(address, size, buffer, FindPriv(regs, state), type, cpu);
+    armv7m_add_access_timing(cpu, address);
+    int locked = LockExclusiveOnWrite(type, cpu);
+    int retval = MemA_with_priv(address, size, buffer, FindPriv(regs, state), type, cpu);
+    UnlockExclusiveOnWrite(address, size, locked, cpu);
+    return retval;
 }
 
 int armv7m_get_memory_direct(uint32_t address, int size, Output uint8_t* buffer, cpu_t *cpu)
@@ -455,13 +530,20 @@ int armv7m_set_memory_direct(uint32_t address, int size, Output uint8_t* buffer,
 }
 
 /* refer to <<ARMv7-M Architecture Referenece Maunal>> page 823 */
-void _bkpt(cpu_t *cpu)
+void _bkpt(uint32_t imm32, cpu_t *cpu)
 {
     arm_reg_t *regs = ARMv7m_GET_REGS(cpu);
     if(!ConditionPassed(0, regs)){
         return;
     }
 
+    /* a semihosting call rather than a stop, the debugger doesn't see it */
+    if(imm32 == SEMIHOST_BKPT_IMM && cpu->semihost != NULL){
+        uint32_t result = semihost_call(cpu->semihost, cpu, GET_REG_VAL_UNCON(regs, 0), GET_REG_VAL_UNCON(regs, 1));
+        SET_REG_VAL_UNCON(regs, 0, result);
+        return;
+    }
+
     // generate halting event
     cm_scs_t *scs = (cm_scs_t *)cpu->system_info;
     uint32_t DHCSR = scs->regs.DHCSR;
@@ -1829,6 +1911,9 @@ void _sdiv(uint32_t Rm, uint32_t Rn, uint32_t Rd, arm_reg_t *regs)
     if(Rm_val == 0){
         // TODO: interger zero divided trapping
         result = 0;
+    }else if(Rn_val == INT32_MIN && Rm_val == -1){
+        // the quotient overflows and wraps to 0x80000000, the host division would trap
+        result = INT32_MIN;
     }else{
         result = Rn_val / Rm_val;
     }
@@ -4206,7 +4291,10 @@ static void ClearExclusiveLocal(int cpuid, cpu_t *cpu)
     thumb_global_state* gstate = ARMv7m_GET_GLOBAL_STATE(cpu);
     arm_exclusive_t *excl_state = &gstate->exclusive_state;
 
-    excl_state->local_exclusive_enable[cpuid] = FALSE;
+    if(excl_state->local_exclusive_enable[cpuid] == TRUE){
+        excl_state->local_exclusive_enable[cpuid] = FALSE;
+        __atomic_sub_fetch(&excl_state->exclusive_num, 1, __ATOMIC_SEQ_CST);
+    }
 }
 
 static int IsExclusiveLocal(uint32_t address, int cpuid, int size, cpu_t *cpu)
@@ -4228,10 +4316,27 @@ static void MarkExclusiveLocal(uint32_t address, int cpuid, int size, cpu_t *cpu
     thumb_global_state* gstate = ARMv7m_GET_GLOBAL_STATE(cpu);
     arm_exclusive_t *excl_state = &gstate->exclusive_state;
 
-    excl_state->local_exclusive_enable[cpuid] = TRUE;
+    if(excl_state->local_exclusive_enable[cpuid] == FALSE){
+        excl_state->local_exclusive_enable[cpuid] = TRUE;
+        __atomic_add_fetch(&excl_state->exclusive_num, 1, __ATOMIC_SEQ_CST);
+    }
     excl_state->local_exclusive[cpuid] = address;
 }
 
+/* the stores that started without the lock before the reservation was seen */
+static void WaitUnlockedStores(cpu_t *cpu)
+{
+    thumb_global_state* gstate = ARMv7m_GET_GLOBAL_STATE(cpu);
+    arm_exclusive_t *excl_state = &gstate->exclusive_state;
+    int i;
+
+    for(i = 0; i < MAX_CPU_NUM; i++){
+        while(i != cpu->cid && __atomic_load_n(&excl_state->storing[i], __ATOMIC_SEQ_CST)){
+            sched_yield();
+        }
+    }
+}
+
 /* B2-698 */
 static int ExclusiveMonitorPass(uint32_t address, int size, cpu_t *cpu)
 {
@@ -4260,6 +4365,40 @@ static void SetExclusiveMonitor(uint32_t address, int size, cpu_t *cpu)
     MarkExclusiveLocal(address, cpuid, size, cpu);
 }
 
+/* Check the monitor and store as a single step, so that the cores running in parallel
+   can't both succeed. The local monitor is cleared whether the store happens or not. */
+static int ExclusiveStore(uint32_t address, int size, uint32_t value, cpu_t *cpu)
+{
+    thumb_global_state* gstate = ARMv7m_GET_GLOBAL_STATE(cpu);
+    arm_exclusive_t *excl_state = &gstate->exclusive_state;
+    arm_reg_t* regs = ARMv7m_GET_REGS(cpu);
+    thumb_state* state = ARMv7m_GET_STATE(cpu);
+
+    pthread_mutex_lock(&excl_state->lock);
+    int passed = ExclusiveMonitorPass(address, size, cpu);
+    if(passed){
+        armv7m_add_access_timing(cpu, address);
+        MemA_with_priv(address, size, (uint8_t*)&value, FindPriv(regs, state), MEM_WRITE, cpu);
+        ClearExclusiveByAddress(address, size, cpu);
+    }
+    ClearExclusiveLocal(ProcessorID(cpu), cpu);
+    pthread_mutex_unlock(&excl_state->lock);
+
+    return passed;
+}
+
+static void ExclusiveLoad(uint32_t address, int size, uint32_t *data, cpu_t *cpu)
+{
+    thumb_global_state* gstate = ARMv7m_GET_GLOBAL_STATE(cpu);
+    arm_exclusive_t *excl_state = &gstate->exclusive_state;
+
+    pthread_mutex_lock(&excl_state->lock);
+    SetExclusiveMonitor(address, size, cpu);
+    WaitUnlockedStores(cpu);
+    MemA(address, size, (uint8_t*)data, MEM_READ, cpu);
+    pthread_mutex_unlock(&excl_state->lock);
+}
+
 /***********************************
 <<ARMv7-M Architecture Reference Manual A7-285>>
 if ConditionPassed() then
@@ -4279,9 +4418,8 @@ void _strex(uint32_t imm32, uint32_t Rn, uint32_t Rd, uint32_t Rt, cpu_t* cpu)
     }
 
     uint32_t address = GET_REG_VAL(regs, Rn) + imm32;
-    if(ExclusiveMonitorPass(address, 4, cpu)){
-        uint32_t Rt_val = GET_REG_VAL(regs, Rt);
-        MemA(address, 4, (uint8_t*)&Rt_val, MEM_WRITE, cpu);
+    uint32_t Rt_val = GET_REG_VAL(regs, Rt);
+    if(ExclusiveStore(address, 4, Rt_val, cpu)){
         SET_REG_VAL(regs, Rd, 0);
     }else{
         SET_REG_VAL(regs, Rd, 1);
@@ -4304,9 +4442,8 @@ void _ldrex(uint32_t imm32, uint32_t Rn, uint32_t Rt, cpu_t* cpu)
     }
 
     uint32_t address = GET_REG_VAL(regs, Rn) + imm32;
-    SetExclusiveMonitor(address, 4, cpu);
     uint32_t data;
-    MemA(address, 4, (uint8_t*)&data, MEM_READ, cpu);
+    ExclusiveLoad(address, 4, &data, cpu);
     SET_REG_VAL(regs, Rt, data);
 }
 
@@ -4418,9 +4555,8 @@ void _strexb_h(uint32_t Rd, uint32_t Rt, uint32_t Rn, cpu_t *cpu, int size)
     }
 
     uint32_t address = GET_REG_VAL(regs, Rn);
-    if(ExclusiveMonitorPass(address, size, cpu)){
-        uint32_t Rt_val = GET_REG_VAL(regs, Rt);
-        MemA(address, size, (uint8_t*)&Rt_val, MEM_WRITE, cpu);
+    uint32_t Rt_val = GET_REG_VAL(regs, Rt);
+    if(ExclusiveStore(address, size, Rt_val, cpu)){
         SET_REG_VAL(regs, Rd, 0);
     }else{
         SET_REG_VAL(regs, Rd, 1);
@@ -4493,9 +4629,8 @@ inline void _ldrexb_h(uint32_t Rn, uint32_t Rt, cpu_t *cpu, int size)
     }
 
     uint32_t address = GET_REG_VAL(regs, Rn);
-    SetExclusiveMonitor(address, size, cpu);
     uint32_t data = 0;
-    MemA(address, size, (uint8_t*)&data, MEM_READ, cpu);
+    ExclusiveLoad(address, size, &data, cpu);
     SET_REG_VAL(regs, Rt, data);
 }
 
@@ -4684,10 +4819,41 @@ void _msr(uint32_t SYSm, uint32_t mask, uint32_t Rn, cpu_t *cpu)
         default:
             break;
         }
+        if(LOW_BIT32(SYSm, 3) <= 0x3){
+            cm_NVIC_update_execution_priority(cpu);
+        }
         break;
     }
 }
 
+/***********************************
+<<ARMv7-M Architecture Reference Manual B5-731>>
+**************************************/
+void _cps(uint32_t disable, uint32_t affectPRI, uint32_t affectFAULT, cpu_t *cpu)
+{
+    arm_reg_t* regs = ARMv7m_GET_REGS(cpu);
+    if(!CurrentModeIsPrivileged(cpu)){
+        return;
+    }
+
+    if(disable){
+        if(affectPRI){
+            SET_PRIMASK(regs, GET_PRIMASK(regs) | 1ul);
+        }
+        if(affectFAULT && ExecutionPriority(cpu) > -1){
+            SET_FAULTMASK(regs, GET_FAULTMASK(regs) | 1ul);
+        }
+    }else{
+        if(affectPRI){
+            SET_PRIMASK(regs, GET_PRIMASK(regs) & ~1ul);
+        }
+        if(affectFAULT){
+            SET_FAULTMASK(regs, GET_FAULTMASK(regs) & ~1ul);
+        }
+    }
+    cm_NVIC_update_execution_priority(cpu);
+}
+
 /***********************************
 <<ARMv7-M Architecture Reference Manual A7-803>>
 **************************************/
@@ -4771,6 +4937,9 @@ void _clrex(cpu_t *cpu)
         return;
     }
 
+    thumb_global_state* gstate = ARMv7m_GET_GLOBAL_STATE(cpu);
+    pthread_mutex_lock(&gstate->exclusive_state.lock);
     ClearExclusiveLocal(ProcessorID(cpu), cpu);
+    pthread_mutex_unlock(&gstate->exclusive_state.lock);
 }
 
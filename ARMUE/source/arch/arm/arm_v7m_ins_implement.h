@@ -7,6 +7,7 @@
 #include "list.h"
 #include <stdint.h>
 #include <assert.h>
+#include <pthread.h>
 #include "_types.h"
 
 typedef enum{
@@ -79,6 +80,11 @@ typedef struct arm_exclusive_t{
     uint32_t global_exclusive;                    // store the global exclusive address;
     bool_t   local_exclusive_enable[MAX_CPU_NUM]; // indicate whether CPU[id] is exclusive
     bool_t   global_exclusive_enable;             // indicate whether the global is exclusive
+
+    /* the cores of a soc run in parallel, so the monitors are only changed under the lock */
+    pthread_mutex_t lock;
+    int      exclusive_num;                       // cores holding a local exclusive, read without the lock
+    bool_t   storing[MAX_CPU_NUM];                // a store of CPU[id] is going on without the lock
 }arm_exclusive_t;
 
 typedef struct thumb_global_state{
@@ -86,6 +92,7 @@ typedef struct thumb_global_state{
     //list_t *global_exclusive;   // stores arm_exclusive_t
 
     arm_exclusive_t exclusive_state;
+    int users;                    // cores of the soc sharing the state
 }thumb_global_state;
 
 static inline uint8_t get_bit(uint32_t* reg, uint32_t bit_pos)
@@ -216,6 +223,8 @@ static inline uint32_t LastInITBlock(arm_reg_t* regs)
     return (ITstate & 0xF) == 0x8;
 }
 
+uint8_t ConditionPassed(uint8_t branch_cond, arm_reg_t* regs);
+
 static inline void ITAdvance(arm_reg_t* regs)
 {
     uint8_t itstat =  GET_ITSTATE(regs);
@@ -326,7 +335,7 @@ int armv7m_get_memory_direct(uint32_t address, int size, Output uint8_t* buffer,
 int armv7m_set_memory_direct(uint32_t address, int size, Output uint8_t* buffer, cpu_t *cpu);
 
 /* implementation of instructions */
-void _bkpt(cpu_t *cpu);
+void _bkpt(uint32_t imm32, cpu_t *cpu);
 void _lsl_imm(uint32_t imm, uint32_t Rm, uint32_t Rd, uint32_t setflags, arm_reg_t* regs);
 void _lsr_imm(uint32_t imm, uint32_t Rm, uint32_t Rd, uint32_t setflags, arm_reg_t* regs);
 void _asr_imm(uint32_t imm, uint32_t Rm, uint32_t Rd, uint32_t setflags, arm_reg_t* regs);
@@ -472,5 +481,6 @@ void _b(int32_t imm32, uint8_t cond, cpu_t* cpu);
 void _bl(int32_t imm32, uint8_t cond, cpu_t *cpu);
 void _msr(uint32_t SYSm, uint32_t mask, uint32_t Rn, cpu_t *cpu);
 void _mrs(uint32_t SYSm, uint32_t Rd, cpu_t *cpu);
+void _cps(uint32_t disable, uint32_t affectPRI, uint32_t affectFAULT, cpu_t *cpu);
 void _clrex(cpu_t *cpu);
 #endif
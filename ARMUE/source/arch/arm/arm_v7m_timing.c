@@ -0,0 +1,33 @@
+#include "arm_v7m_timing.h"
+
+const uint8_t armv7m_timing_table[TIMING_CLASS_NUM] = {
+    [TIMING_DATA_ACCESS]        = 1,
+    [TIMING_BRANCH_REFILL]      = 2,
+    [TIMING_MUL_ACC]            = 1,
+    [TIMING_MUL_LONG]           = 3,
+    [TIMING_DIV]                = 1,
+    [TIMING_EXCEPTION_ENTRY]    = 4,
+};
+
+static int significant_bits(uint32_t val)
+{
+    int bits = 0;
+    while(val != 0){
+        val >>= 1;
+        bits++;
+    }
+    return bits;
+}
+
+/* SDIV/UDIV take 2-12 cycles, terminating early when the quotient is short */
+void armv7m_add_div_timing(cpu_t *cpu, uint32_t dividend, uint32_t divisor)
+{
+    int quotient_bits = 0;
+    if(divisor != 0){
+        quotient_bits = significant_bits(dividend) - significant_bits(divisor) + 1;
+        if(quotient_bits < 0){
+            quotient_bits = 0;
+        }
+    }
+    cpu->run_info.extra_cycles += armv7m_timing_table[TIMING_DIV] + (quotient_bits + 3) / 4;
+}
@@ -0,0 +1,48 @@
+#ifndef _ARM_V7M_TIMING_H_
+#define _ARM_V7M_TIMING_H_
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include "_types.h"
+#include "cpu.h"
+#include "memory_map.h"
+
+/* Cycle-approximate Cortex-M3 timing. Every instruction costs the single cycle of add_cycle,
+   the classes below are the extra cycles charged on top of it, refering to the instruction
+   timing table of the Cortex-M3 Technical Reference Manual. */
+typedef enum armv7m_timing_class_t{
+    TIMING_DATA_ACCESS,         /* every load/store beat, so LDR is 2 and LDM/STM/PUSH/POP are 1+N */
+    TIMING_BRANCH_REFILL,       /* pipeline refill after any write to PC */
+    TIMING_MUL_ACC,             /* MLA/MLS */
+    TIMING_MUL_LONG,            /* SMULL/UMULL/SMLAL, 3-5 cycles with early termination */
+    TIMING_DIV,                 /* SDIV/UDIV, plus one cycle every 4 quotient bits */
+    TIMING_EXCEPTION_ENTRY,     /* on top of the 8 stacking accesses */
+    TIMING_CLASS_NUM,
+}armv7m_timing_class_t;
+
+extern const uint8_t armv7m_timing_table[TIMING_CLASS_NUM];
+
+static inline void armv7m_add_timing(cpu_t *cpu, armv7m_timing_class_t timing_class)
+{
+    cpu->run_info.extra_cycles += armv7m_timing_table[timing_class];
+}
+
+/* a data access also waits for the region it visits */
+static inline void armv7m_add_access_timing(cpu_t *cpu, uint32_t address)
+{
+    cpu->run_info.extra_cycles += armv7m_timing_table[TIMING_DATA_ACCESS] + memory_wait_states(cpu->memory_map, address);
+}
+
+/* the refill fetches from the branch target, so its region wait states are paid as well */
+static inline void armv7m_add_branch_timing(cpu_t *cpu, uint32_t target)
+{
+    cpu->run_info.extra_cycles += armv7m_timing_table[TIMING_BRANCH_REFILL] + memory_wait_states(cpu->memory_map, target);
+}
+
+void armv7m_add_div_timing(cpu_t *cpu, uint32_t dividend, uint32_t divisor);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
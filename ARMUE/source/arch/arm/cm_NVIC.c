@@ -2,6 +2,8 @@
 #include "arm_v7m_ins_decode.h"
 #include "cm_NVIC.h"
 #include "cm_system_control_space.h"
+#include "arm_v7m_timing.h"
+#include "snapshot.h"
 #include <stdlib.h>
 
 enum cm_NVIC_prio{
@@ -23,6 +25,7 @@ inline void DeActivate(int exc_num, cpu_t *cpu)
     if(GET_IPSR(regs) != 0x2ul){
         regs->FAULTMASK &= ~1ul;
     }
+    cm_NVIC_update_execution_priority(cpu);
 }
 
 uint32_t ReturnAddress(int excep_num, cpu_t *cpu)
@@ -118,6 +121,9 @@ void ExceptionTaken(int excep_num, cpu_t *cpu)
         return;
     }
 
+    if(!NVIC_info->vector_table_valid){
+        cm_NVIC_vector_table_init(cpu->cm_NVIC, cpu->memory_map);
+    }
     uint32_t addr = get_vector_value(cpu->cm_NVIC, excep_num);
     SET_REG_VAL(regs, PC_INDEX, addr & 0xFFFFFFFE);
     uint32_t tbit = addr & 1ul;
@@ -133,6 +139,7 @@ void ExceptionTaken(int excep_num, cpu_t *cpu)
 
     NVIC_info->exception_active[excep_num] = 1;
     NVIC_info->nested_exception++;
+    cm_NVIC_update_execution_priority(cpu);
 
     // SCS_UpdateStatusRegs
     // ClearExclusiveLocal
@@ -288,32 +295,35 @@ usage_fault:
     return;
 }
 
-int ExecutionPriority(cpu_t *cpu)
+/* Group priority of an exception priority, the fixed negative priorities have no subgroup */
+static inline int cm_NVIC_group_priority(int prio, int prigroup)
+{
+    int group_val = 0x2ul << prigroup;
+    if(prio <= 0){
+        return prio;
+    }
+    return prio - prio % group_val;
+}
+
+/* Recompute the execution priority cached in cm_NVIC_t. It must be called
+   whenever the active exception, PRIMASK, BASEPRI, FAULTMASK or PRIGROUP changes. */
+void cm_NVIC_update_execution_priority(cpu_t *cpu)
 {
     arm_reg_t *regs = ARMv7m_GET_REGS(cpu);
     thumb_state *state = ARMv7m_GET_STATE(cpu);
     cm_scs_t *scs = (cm_scs_t *)cpu->system_info;
+    cm_NVIC_t *NVIC_info = (cm_NVIC_t *)cpu->cm_NVIC->controller_info;
 
     int cur_excep;
     int highest_pri = 256;
     int boosted_pri = 256;
-    int ret = peek_fifo(state->cur_exception, &cur_excep);
-    if(ret < 0){
-        return highest_pri;
+    if(peek_fifo(state->cur_exception, &cur_excep) == 0){
+        highest_pri = cm_NVIC_group_priority(cpu->cm_NVIC->prio_table[cur_excep], scs->config.prigroup);
     }
 
-    vector_exception_t *vector_excep = cpu->cm_NVIC;
-    highest_pri = vector_excep->prio_table[cur_excep];
-
-    int group_val = 0x2ul << scs->config.prigroup;
-    int sub_group_val = highest_pri % group_val;
-    highest_pri -= sub_group_val;
-
     uint32_t basepri = GET_BASEPRI(regs);
     if(LOW_BIT32(basepri, 8) != 0){
-        boosted_pri = LOW_BIT32(basepri, 8);
-        sub_group_val = boosted_pri % group_val;
-        boosted_pri -= sub_group_val;
+        boosted_pri = cm_NVIC_group_priority(LOW_BIT32(basepri, 8), scs->config.prigroup);
     }
 
     if(LOW_BIT32(GET_PRIMASK(regs), 1) == 1){
@@ -324,35 +334,34 @@ int ExecutionPriority(cpu_t *cpu)
         boosted_pri = -1;
     }
 
-    int priority;
     if(boosted_pri < highest_pri){
-        priority = boosted_pri;
+        NVIC_info->execution_priority = boosted_pri;
     }else{
-        priority = highest_pri;
+        NVIC_info->execution_priority = highest_pri;
     }
+}
 
-    return priority;
+int ExecutionPriority(cpu_t *cpu)
+{
+    return ((cm_NVIC_t *)cpu->cm_NVIC->controller_info)->execution_priority;
 }
 /* ARMv7-M defined operation end */
 
-rom_t* find_startup_rom(memory_map_t* memory)
+/* boot from the ROM at 0x00, or from RAM preloaded with the image */
+memory_region_t* find_startup_region(memory_map_t* memory)
 {
     memory_region_t* region = find_address(memory, 0);
-    if(region == NULL || region->type != MEMORY_REGION_ROM){
+    if(region == NULL || (region->type != MEMORY_REGION_ROM && region->type != MEMORY_REGION_RAM)){
         return NULL;
     }
-    return (rom_t*)region->region_data;
-}
-
-inline int cm_NVIC_get_preempt_proi(int cm_prio, cm_NVIC_t* info)
-{
-    return (cm_prio & info->prio_mask) & info->preempt_mask;
+    return region;
 }
 
-/* Vector table initialization */
+/* Vector table initialization, load the table at VTOR into the cache */
 void cm_NVIC_vector_table_init(vector_exception_t *controller, memory_map_t *memory)
 {
-    uint32_t addr = 0;
+    cm_NVIC_t *info = (cm_NVIC_t *)controller->controller_info;
+    uint32_t addr = info->vector_table_base;
     uint32_t interrput_vector = 0;
     int inpterrupt_table_size = controller->vector_table_size;
     int i;
@@ -361,6 +370,25 @@ void cm_NVIC_vector_table_init(vector_exception_t *controller, memory_map_t *mem
         set_vector_table(controller, interrput_vector, i);
         addr += 4;
     }
+    info->vector_table_valid = TRUE;
+}
+
+/* memory watch callback: the guest wrote to the active vector table */
+static void cm_NVIC_vector_table_written(uint32_t addr, int size, void *data)
+{
+    cm_NVIC_t *info = (cm_NVIC_t *)data;
+    info->vector_table_valid = FALSE;
+}
+
+/* VTOR write, the cache is reloaded on the next exception entry */
+void cm_NVIC_set_vector_table_base(vector_exception_t *controller, uint32_t base)
+{
+    cm_NVIC_t *info = (cm_NVIC_t *)controller->controller_info;
+    info->vector_table_base = base;
+    info->vector_table_valid = FALSE;
+    if(info->vector_table_watch != NULL){
+        set_memory_watch(info->vector_table_watch, base, controller->vector_table_size * 4);
+    }
 }
 
 /* The fixed priority table initialization */
@@ -390,7 +418,7 @@ info_null:
 void destory_cm_NVIC_info(cm_NVIC_t **info)
 {
     free(*info);
-    info = NULL;
+    *info = NULL;
 }
 
 int setup_cm_NVIC_info(vector_exception_t* controller, Input cpu_t *cpu)
@@ -402,12 +430,18 @@ int setup_cm_NVIC_info(vector_exception_t* controller, Input cpu_t *cpu)
     if(info->pending_list == NULL){
         goto pending_list_null;
     }
+    pthread_mutex_init(&info->pending_lock, NULL);
+    info->pending_num = 0;
 
     /* other NVIC variable */
     info->preempt_mask = 0xF;
     info->prio_mask = 0xF;
     info->nested_exception = 0;
+    info->execution_priority = 256;
     info->interrupt_lines = cpu->cm_NVIC->vector_table_size / 32;
+    info->vector_table_base = 0;
+    info->vector_table_valid = FALSE;
+    info->vector_table_watch = NULL;
     int i;
     for(i = 0; i < NVIC_MAX_EXCEPTION; i++){
         info->exception_active[i] = 0;
@@ -427,12 +461,22 @@ int cm_NVIC_startup(cpu_t *cpu)
 
     memory_map_t* memory_map = cpu->memory_map;
 
-    // search for start rom which base address is 0x00
-    rom_t *startup_rom = find_startup_rom(memory_map);
-    if(startup_rom == NULL){
+    // search for start memory which base address is 0x00
+    memory_region_t *startup_region = find_startup_region(memory_map);
+    if(startup_region == NULL){
         return -ERROR_NO_START_ROM;
     }
 
+    cm_NVIC_t *info = (cm_NVIC_t *)cpu->cm_NVIC->controller_info;
+    if(info->vector_table_watch == NULL){
+        info->vector_table_watch = add_memory_watch(memory_map, info->vector_table_base,
+                                                    cpu->cm_NVIC->vector_table_size * 4,
+                                                    cm_NVIC_vector_table_written, info);
+        if(info->vector_table_watch == NULL){
+            LOG(LOG_WARN, "cm_NVIC_startup: vector table writes can't be tracked\n");
+        }
+    }
+
     cm_NVIC_vector_table_init(cpu->cm_NVIC, memory_map);
     cm_NVIC_prio_table_init(cpu->cm_NVIC);
 
@@ -458,6 +502,7 @@ vector_exception_t* cm_NVIC_init(cpu_t* cpu)
 
     /* setup exception interfaces */
     cpu->cm_NVIC->throw_exception = cm_NVIC_throw_exception;
+    cpu->cm_NVIC->clear_exception = cm_NVIC_clear_exception;
     cpu->cm_NVIC->check_exception = cm_NVIC_check_exception;
     cpu->cm_NVIC->handle_exception = cm_NVIC_handle_exception;
 
@@ -469,12 +514,105 @@ create_info_fail:
     return NULL;
 }
 
+/* destory with the cpu, the exception controller itself belongs to the soc */
+void cm_NVIC_destory(cpu_t* cpu)
+{
+    cm_NVIC_t *info = (cm_NVIC_t *)cpu->cm_NVIC->controller_info;
+    if(info == NULL){
+        return;
+    }
+
+    if(info->vector_table_watch != NULL){
+        delete_memory_watch(cpu->memory_map, info->vector_table_watch);
+    }
+    bheap_destory(&info->pending_list);
+    pthread_mutex_destroy(&info->pending_lock);
+    destory_cm_NVIC_info((cm_NVIC_t**)&cpu->cm_NVIC->controller_info);
+}
+
+/* the vector table cache is reloaded from memory after restore */
+int cm_NVIC_snapshot(cpu_t *cpu, snapshot_t *snapshot)
+{
+    vector_exception_t *controller = cpu->cm_NVIC;
+    cm_NVIC_t *info = (cm_NVIC_t *)controller->controller_info;
+
+    if(SNAPSHOT_PUT(snapshot, info->exception_active) < 0 ||
+       SNAPSHOT_PUT(snapshot, info->nested_exception) < 0 ||
+       SNAPSHOT_PUT(snapshot, info->preempt_mask) < 0 ||
+       SNAPSHOT_PUT(snapshot, info->prio_mask) < 0 ||
+       SNAPSHOT_PUT(snapshot, info->execution_priority) < 0 ||
+       SNAPSHOT_PUT(snapshot, info->vector_table_base) < 0 ||
+       SNAPSHOT_PUT(snapshot, controller->vector_table_size) < 0 ||
+       snapshot_put(snapshot, controller->prio_table, controller->vector_table_size * sizeof(int)) < 0){
+        return -ERROR_CREATE;
+    }
+    return snapshot_put_bheap(snapshot, info->pending_list);
+}
+
+int cm_NVIC_restore(cpu_t *cpu, snapshot_t *snapshot)
+{
+    vector_exception_t *controller = cpu->cm_NVIC;
+    cm_NVIC_t *info = (cm_NVIC_t *)controller->controller_info;
+    uint32_t vector_table_base;
+    int vector_table_size;
+
+    if(SNAPSHOT_GET(snapshot, info->exception_active) < 0 ||
+       SNAPSHOT_GET(snapshot, info->nested_exception) < 0 ||
+       SNAPSHOT_GET(snapshot, info->preempt_mask) < 0 ||
+       SNAPSHOT_GET(snapshot, info->prio_mask) < 0 ||
+       SNAPSHOT_GET(snapshot, info->execution_priority) < 0 ||
+       SNAPSHOT_GET(snapshot, vector_table_base) < 0 ||
+       SNAPSHOT_GET(snapshot, vector_table_size) < 0){
+        return -ERROR_SNAPSHOT;
+    }
+    if(vector_table_size != controller->vector_table_size){
+        LOG(LOG_ERROR, "cm_NVIC_restore: vector table size dismatch\n");
+        return -ERROR_SNAPSHOT;
+    }
+    if(snapshot_get(snapshot, controller->prio_table, vector_table_size * sizeof(int)) < 0){
+        return -ERROR_SNAPSHOT;
+    }
+    cm_NVIC_set_vector_table_base(controller, vector_table_base);
+    if(snapshot_get_bheap(snapshot, info->pending_list) < 0){
+        return -ERROR_SNAPSHOT;
+    }
+    __atomic_store_n(&info->pending_num, info->pending_list->current_length, __ATOMIC_RELEASE);
+    return 0;
+}
+
 int cm_NVIC_throw_exception(int vector_num, struct vector_exception_t* controller)
 {
     cm_NVIC_t* NVIC_info = (cm_NVIC_t*)controller->controller_info;
     int prio = controller->prio_table[vector_num];
     int mod_prio = (prio << 9) | (vector_num & 0xFFul);
-    return bheap_insert(NVIC_info->pending_list, &mod_prio, bheap_compare_int_smaller);
+    pthread_mutex_lock(&NVIC_info->pending_lock);
+    int retval = bheap_insert(NVIC_info->pending_list, &mod_prio, bheap_compare_int_smaller);
+    __atomic_store_n(&NVIC_info->pending_num, NVIC_info->pending_list->current_length, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&NVIC_info->pending_lock);
+    return retval;
+}
+
+/* The other pending exceptions are inserted again. The kept ones are never more
+   than the ones read, so the heap can be rebuilt in its own array. */
+int cm_NVIC_clear_exception(int vector_num, struct vector_exception_t* controller)
+{
+    cm_NVIC_t* NVIC_info = (cm_NVIC_t*)controller->controller_info;
+    bheap_t *pending = NVIC_info->pending_list;
+    int *entries = (int*)pending->data;
+    int i, mod_prio;
+
+    pthread_mutex_lock(&NVIC_info->pending_lock);
+    int num = pending->current_length;
+    pending->current_length = 0;
+    for(i = 0; i < num; i++){
+        mod_prio = entries[i];
+        if((mod_prio & 0xFFul) != (vector_num & 0xFFul)){
+            bheap_insert(pending, &mod_prio, bheap_compare_int_smaller);
+        }
+    }
+    __atomic_store_n(&NVIC_info->pending_num, pending->current_length, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&NVIC_info->pending_lock);
+    return 0;
 }
 
 int cm_NVIC_check_exception(cpu_t* cpu)
@@ -482,32 +620,30 @@ int cm_NVIC_check_exception(cpu_t* cpu)
     cm_NVIC_t* NVIC_info = (cm_NVIC_t*)cpu->cm_NVIC->controller_info;
     int mod_prio;
 
+    if(__atomic_load_n(&NVIC_info->pending_num, __ATOMIC_ACQUIRE) == 0){
+        return 0;
+    }
+
     /* peek the first pending exception if it exsits */
+    pthread_mutex_lock(&NVIC_info->pending_lock);
     int retval = bheap_peek_top(NVIC_info->pending_list, &mod_prio);
     if(retval < 0){
+        pthread_mutex_unlock(&NVIC_info->pending_lock);
         return 0;
     }
 
-    /* mod_prio is defined as: exception number | (priority << 9)*/
+    /* mod_prio is defined as: exception number | (priority << 9).
+       The execution priority is always a group boundary, so comparing the raw
+       priority is the same as comparing the group priority. */
     int prio = mod_prio >> 9;
-    thumb_state* state = ARMv7m_GET_STATE(cpu);
-    int cur_exception;
-    peek_fifo(state->cur_exception, &cur_exception);
-
-    /* If in handler, check preempt priority for the preemption */
-    if(state->mode == MODE_HANDLER){
-        int preempt_prio = cm_NVIC_get_preempt_proi(prio, NVIC_info);
-        int handling_preempt_prio = cm_NVIC_get_preempt_proi(cpu->cm_NVIC->prio_table[cur_exception], NVIC_info);
-        if(preempt_prio < handling_preempt_prio){
-            bheap_delete_top(NVIC_info->pending_list, &mod_prio, bheap_compare_int_smaller);
-            retval = mod_prio & 0x1FFul;
-        }else{
-            retval = 0;
-        }
-    }else{
+    if(prio < NVIC_info->execution_priority){
         bheap_delete_top(NVIC_info->pending_list, &mod_prio, bheap_compare_int_smaller);
+        __atomic_store_n(&NVIC_info->pending_num, NVIC_info->pending_list->current_length, __ATOMIC_RELEASE);
         retval = mod_prio & 0x1FFul;
+    }else{
+        retval = 0;
     }
+    pthread_mutex_unlock(&NVIC_info->pending_lock);
     return retval;
 }
 
@@ -515,5 +651,6 @@ int cm_NVIC_handle_exception(int vector_num, cpu_t* cpu)
 {
     PushStack(vector_num, cpu);
     ExceptionTaken(vector_num, cpu);
+    armv7m_add_timing(cpu, TIMING_EXCEPTION_ENTRY);
     return 0;
 }
@@ -8,6 +8,7 @@ extern "C"{
 #include "bheap.h"
 #include "exception_interrupt.h"
 #include <stdint.h>
+#include <pthread.h>
 
 #define NVIC_MAX_EXCEPTION 496
 
@@ -33,17 +34,36 @@ typedef struct cm_NVIC_t
     uint8_t preempt_mask;
     uint8_t prio_mask;
     uint8_t interrupt_lines;
+    /* cached ExecutionPriority, see cm_NVIC_update_execution_priority */
+    int execution_priority;
     pending_list_t* pending_list;
+    /* the devices of the other cores throw exceptions too, the core checks pending_num
+       without the lock */
+    pthread_mutex_t pending_lock;
+    int pending_num;
+    /* vector_table in vector_exception_t caches the guest table at VTOR,
+       it is reloaded on exception entry after the guest writes the table */
+    uint32_t vector_table_base;
+    bool_t vector_table_valid;
+    memory_watch_t *vector_table_watch;
 }cm_NVIC_t;
 
 void ExceptionReturn(uint32_t exc_return, cpu_t *cpu);
 int ExecutionPriority(cpu_t *cpu);
+void cm_NVIC_update_execution_priority(cpu_t *cpu);
 
 vector_exception_t* cm_NVIC_init(cpu_t* cpu);
+void cm_NVIC_destory(cpu_t* cpu);
 int cm_NVIC_startup(cpu_t *cpu);
+void cm_NVIC_vector_table_init(vector_exception_t *controller, memory_map_t *memory);
+void cm_NVIC_set_vector_table_base(vector_exception_t *controller, uint32_t base);
 int cm_NVIC_throw_exception(int vector_num, struct vector_exception_t* controller);
+int cm_NVIC_clear_exception(int vector_num, struct vector_exception_t* controller);
 int cm_NVIC_check_exception(cpu_t *cpu);
 int cm_NVIC_handle_exception(int vector_num, cpu_t* cpu);
+struct snapshot_t;
+int cm_NVIC_snapshot(cpu_t *cpu, struct snapshot_t *snapshot);
+int cm_NVIC_restore(cpu_t *cpu, struct snapshot_t *snapshot);
 
 #ifdef __cplusplus
 }
@@ -1,6 +1,7 @@
 #include "cm_system_control_space.h"
 #include "error_code.h"
 #include "arm_v7m_ins_implement.h"
+#include "snapshot.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -13,49 +14,97 @@
 #define GET_NVIC_INFO(scs) ((cm_NVIC_t*)(scs)->NVIC->controller_info)
 
 /* Interrupt Controller Type Register */
-int ICTR(uint8_t* data, int rw_flag, cm_scs_t *scs)
+static int ICTR_read(void *owner, const reg_desc_t *reg, uint32_t *value)
 {
-    if(rw_flag == MEM_READ){
-        *(uint32_t*)data = GET_NVIC_INFO(scs)->interrupt_lines;
-        return 0;
-    }else{
-        return -1;
-    }
+    cm_scs_t *scs = (cm_scs_t *)owner;
+    *value = GET_NVIC_INFO(scs)->interrupt_lines;
+    return 0;
+}
+
+/* Vector Table Offset Register */
+static int VTOR_read(void *owner, const reg_desc_t *reg, uint32_t *value)
+{
+    cm_scs_t *scs = (cm_scs_t *)owner;
+    *value = GET_NVIC_INFO(scs)->vector_table_base;
+    return 0;
+}
+
+static int VTOR_write(void *owner, const reg_desc_t *reg, uint32_t value)
+{
+    cm_scs_t *scs = (cm_scs_t *)owner;
+    /* TBLOFF[29:7], TBLBASE is bit 29 */
+    cm_NVIC_set_vector_table_base(scs->NVIC, value & 0x3FFFFF80);
+    return 0;
 }
 
 /* Application Interrupt and Reset Control Register */
-int AIRCR(uint8_t *data, int rw_flag, cm_scs_t *scs)
+static int AIRCR_read(void *owner, const reg_desc_t *reg, uint32_t *value)
+{
+    cm_scs_t *scs = (cm_scs_t *)owner;
+    int endian = scs->config.endianess;
+    int prigroup = scs->config.prigroup;
+    *value = (0xFA05 << 16) | (endian << 15) | (prigroup << 8);
+    return 0;
+}
+
+static int AIRCR_write(void *owner, const reg_desc_t *reg, uint32_t value)
 {
-    if(rw_flag == MEM_READ){
-        int endian = scs->config.endianess;
-        int prigroup = scs->config.prigroup;
-        *(uint32_t *)data = (0xFA05 << 16) | (endian << 15) | (prigroup << 8);
+    cm_scs_t *scs = (cm_scs_t *)owner;
+    uint32_t vectorkey = LOW_BIT32(value >> 16, 16);
+    if(vectorkey == 0x05FA){
+        scs->config.endianess = LOW_BIT32(value >> 15, 1);
+        scs->config.prigroup  = LOW_BIT32(value >> 8,  3);
+        cm_NVIC_update_execution_priority(scs->cpu);
         return 0;
     }else{
-        uint32_t val = *(uint32_t *)data;
-        uint32_t vectorkey = LOW_BIT32(val >> 16, 16);
-        if(vectorkey == 0x05FA){
-            scs->config.endianess = LOW_BIT32(val >> 15, 1);
-            scs->config.prigroup  = LOW_BIT32(val >> 8,  3);
-            return 0;
-        }else{
-            return -1;
-        }
+        return -1;
     }
 }
 
 /* Auxiliary Control Register */
 
 /* Software Triggered Interrupt Register */
-int STIR(uint8_t *data, int rw_flag, cm_scs_t *scs)
+static int STIR_read(void *owner, const reg_desc_t *reg, uint32_t *value)
 {
-    if(rw_flag == MEM_READ){
-        return -1;
-    }else{
-        uint32_t excep_num = *(uint32_t*)data;
-        scs->NVIC->throw_exception(excep_num & 0x1FF, scs->NVIC);
-        return 0;
-    }
+    return -1;
+}
+
+static int STIR_write(void *owner, const reg_desc_t *reg, uint32_t value)
+{
+    cm_scs_t *scs = (cm_scs_t *)owner;
+    scs->NVIC->throw_exception(value & 0x1FF, scs->NVIC);
+    return 0;
+}
+
+/* The registers modeled so far. The rest of the space, the NVIC registers,
+   the rest of the SCB, the MPU and the debug registers among them, goes to the
+   user defined access. */
+static const reg_desc_t cm_scs_regs[] = {
+    /* system control not in SCB */
+    {0x004, 4, ICTR_read,       NULL,           0,          0xFFFFFFFF},
+    /* System Tick */
+    {0x010, 4, SYST_CSR_read,   SYST_CSR_write, 0,          0},
+    {0x014, 4, SYST_RVR_read,   SYST_RVR_write, 0,          0},
+    {0x018, 4, SYST_CVR_read,   SYST_CVR_write, 0,          0},
+    {0x01C, 4, SYST_CALIB_read, NULL,           0,          0xFFFFFFFF},
+    /* SCB */
+    {0xD00, 4, NULL,            NULL,           0x412FC230, 0xFFFFFFFF},    // CPUID, Cortex-M3 r2p0
+    {0xD08, 4, VTOR_read,       VTOR_write,     0,          0},
+    {0xD0C, 4, AIRCR_read,      AIRCR_write,    0,          0},
+    /* software trigger interrupt not in SCB */
+    {0xF00, 4, STIR_read,       STIR_write,     0,          0},
+};
+
+static int cm_scs_user_defined_read(void *owner, uint32_t offset, uint8_t *buffer, int size)
+{
+    cm_scs_t *scs = (cm_scs_t *)owner;
+    return ud_read(offset, buffer, size, scs);
+}
+
+static int cm_scs_user_defined_write(void *owner, uint32_t offset, uint8_t *buffer, int size)
+{
+    cm_scs_t *scs = (cm_scs_t *)owner;
+    return ud_write(offset, buffer, size, scs);
 }
 
 cm_scs_t* create_cm_scs()
@@ -65,176 +114,16 @@ cm_scs_t* create_cm_scs()
     return scs;
 }
 
-#define CM_SCS_REGS_ACCESS(rw_flag, user_defined_access) \
-do{\
-    cm_scs_t *scs = (cm_scs_t*)region->region_data;\
-    switch(offset){\
-    /* system control not in SCB */\
-    case 0x004:\
-        return ICTR(buffer, rw_flag, scs);\
-    case 0x008:\
-        return user_defined_access(offset, buffer, size, scs);\
-    /* System Tick */\
-    case 0x010:\
-        return SYST_CSR(buffer, rw_flag, scs);\
-    case 0x014:\
-        return SYST_RVR(buffer, rw_flag, scs);\
-    case 0x018:\
-        return SYST_CVR(buffer, rw_flag, scs);\
-    case 0x1C:\
-        return SYST_CALIB(buffer, rw_flag, scs);\
-    /* NVIC */\
-    case 0x100:\
-        /* NVIC_ISR0*/\
-        /* ...*/\
-    case 0x13C:\
-        /* NVIC_ISR15*/\
-    case 0x180:\
-        /* NVIC_ICER0*/\
-        /* ...*/\
-    case 0x1BC:\
-        /* NVIC_ICER15*/\
-    case 0x200:\
-        /* NVIC_ISPR0*/\
-        /* ...*/\
-    case 0x23C:\
-        /* NVIC_ISPR15*/\
-    case 0x280:\
-        /* NVIC_ICPR0*/\
-        /* ...*/\
-    case 0x2BC:\
-        /* NVIC_ICPR15*/\
-    case 0x300:\
-        /* NVIC_IABR0*/\
-        /* ...*/\
-    case 0x37C:\
-        /* NVIC_IABR15*/\
-    case 0x400:\
-        /* NVIC_IPR0*/\
-        /* ...*/\
-    case 0x7EC:\
-        /* NVIC_IPR123*/\
-    /* SCB */\
-    case 0xD00:\
-        /* CPUID*/\
-    case 0xD04:\
-        /* ICSR*/\
-    case 0xD08:\
-        /* VTOR*/\
-    case 0xD0C:\
-        return AIRCR(buffer, rw_flag, scs);\
-    case 0xD10:\
-        /* SCR*/\
-    case 0xD14:\
-        /* CCR*/\
-    case 0xD18:\
-        /* SHPR1*/\
-    case 0xD1C:\
-        /* SHPR2*/\
-    case 0xD20:\
-        /* SHPR3*/\
-    case 0xD24:\
-        /* SHCSR*/\
-    case 0xD28:\
-        /* CFSR*/\
-    case 0xD2C:\
-        /* HFSR*/\
-    case 0xD30:\
-        /* DFSR*/\
-    case 0xD34:\
-        /* MMFAR*/\
-    case 0xD38:\
-        /* BFAR*/\
-    case 0xD3C:\
-        /* AFSR*/\
-    /***************
-    Implementation defined CPUID reigsters
-    case 0xD00:
-    ...
-    case 0xD7C:
-    ***************/\
-    case 0xD88:\
-        /* CPACR*/\
-    /* MPU */\
-    case 0xD90:\
-        /* MPU_TYPE*/\
-    case 0xD94:\
-        /* MPU_CTRL*/\
-    case 0xD98:\
-        /* MPU_RNR*/\
-    case 0xD9C:\
-        /* MPU_RBAR*/\
-    case 0xDA0:\
-        /* MPU_RASR*/\
-    case 0xDA4:\
-        /* MPU_RBAR_A1*/\
-    case 0xDA8:\
-        /* MPU_RASR_A1*/\
-    case 0xDAC:\
-        /* MPU_RBAR_A2*/\
-    case 0xDB0:\
-        /* MPU_RASR_A2*/\
-    case 0xDB4:\
-        /* MPU_RBAR_A3*/\
-    case 0xDB8:\
-        /* MPU_RASR_A3*/\
-    /* Debug register */\
-    case 0xDF0:\
-        /* DHCSR*/\
-    case 0xDF4:\
-        /* DCRSR*/\
-    case 0xDF8:\
-        /* DCRDR*/\
-    case 0xDFC:\
-        /* DEMCR*/\
-    /* software trigger interrupt not in SCB */\
-    case 0xF00:\
-        return STIR(buffer, rw_flag, scs);\
-    /* FP extension */\
-    case 0xF34:\
-        /* FPCCR*/\
-    case 0xF38:\
-        /* FPCAR*/\
-    case 0xF3C:\
-        /* FPDSCR*/\
-    case 0xF40:\
-        /* MVFR0*/\
-    case 0xF44:\
-        /* MVFR1*/\
-    /****************
-    Implementation defined
-    case 0xF90:
-    case 0xFCF:
-    ****************/\
-    /* MC-spec ID registers not in SCB */\
-    case 0xFD0:\
-        /* PID4
-         ...*/\
-    case 0xFDC:\
-        /* PID7*/\
-    case 0xFE0:\
-        /* PID0
-         ...*/\
-    case 0xFEC:\
-        /* PID3*/\
-    case 0xFF0:\
-        /* CID0
-         ...*/\
-    case 0xFFC:\
-        /* CID3*/\
-    default:\
-        return user_defined_access(offset, buffer, size, scs);\
-    }\
-}while(0)
-
 int cm_scs_read(uint32_t offset, uint8_t *buffer, int size, memory_region_t *region)
 {
-    CM_SCS_REGS_ACCESS(MEM_READ, ud_read);
+    cm_scs_t *scs = (cm_scs_t*)region->region_data;
+    return reg_block_read(scs->registers, offset, buffer, size);
 }
 
 int cm_scs_write(uint32_t offset, uint8_t *buffer, int size, memory_region_t *region)
 {
-    CM_SCS_REGS_ACCESS(MEM_WRITE, ud_write);
+    cm_scs_t *scs = (cm_scs_t*)region->region_data;
+    return reg_block_write(scs->registers, offset, buffer, size);
 }
 
 int cm_scs_init(cpu_t *cpu) //,soc_conf_t* config)
@@ -259,6 +148,13 @@ int cm_scs_init(cpu_t *cpu) //,soc_conf_t* config)
     //scs->user_defined_data =
     //scs->user_defined_read
     //scs->user_defined_write
+    scs->registers = create_reg_block(cm_scs_regs, sizeof(cm_scs_regs) / sizeof(cm_scs_regs[0]), CM_SCS_SIZE, scs);
+    if(scs->registers == NULL){
+        retval = -ERROR_CREATE;
+        goto registers_fail;
+    }
+    scs->registers->fallback_read = cm_scs_user_defined_read;
+    scs->registers->fallback_write = cm_scs_user_defined_write;
     scs->NVIC = cm_NVIC_init(cpu);
     if(scs->NVIC == NULL){
         retval = -ERROR_CREATE;
@@ -286,7 +182,56 @@ int cm_scs_init(cpu_t *cpu) //,soc_conf_t* config)
     return SUCCESS;
 
 NVIC_init_fail:
+    destory_reg_block(&scs->registers);
+registers_fail:
+    free(scs);
 get_region_fail:
 no_memory:
     return retval;
 }
+
+void cm_scs_destory(cpu_t *cpu)
+{
+    cm_scs_t *scs = (cm_scs_t *)cpu->system_info;
+    if(scs == NULL){
+        return;
+    }
+
+    if(scs->systick != NULL){
+        delete_timer(scs->systick);
+    }
+    cm_NVIC_destory(cpu);
+    destory_reg_block(&scs->registers);
+    free(scs);
+    cpu->system_info = NULL;
+}
+
+int cm_scs_snapshot(cpu_t *cpu, snapshot_t *snapshot)
+{
+    cm_scs_t *scs = (cm_scs_t *)cpu->system_info;
+    int retval;
+
+    if(SNAPSHOT_PUT(snapshot, scs->config) < 0 || SNAPSHOT_PUT(snapshot, scs->regs) < 0){
+        return -ERROR_CREATE;
+    }
+    retval = cm_systick_snapshot(scs, snapshot);
+    if(retval < 0){
+        return retval;
+    }
+    return cm_NVIC_snapshot(cpu, snapshot);
+}
+
+int cm_scs_restore(cpu_t *cpu, snapshot_t *snapshot)
+{
+    cm_scs_t *scs = (cm_scs_t *)cpu->system_info;
+    int retval;
+
+    if(SNAPSHOT_GET(snapshot, scs->config) < 0 || SNAPSHOT_GET(snapshot, scs->regs) < 0){
+        return -ERROR_SNAPSHOT;
+    }
+    retval = cm_systick_restore(scs, snapshot);
+    if(retval < 0){
+        return retval;
+    }
+    return cm_NVIC_restore(cpu, snapshot);
+}
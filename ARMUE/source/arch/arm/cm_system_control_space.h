@@ -9,6 +9,7 @@ extern "C"{
 #include "memory_map.h"
 #include "cpu.h"
 #include "timer.h"
+#include "register_block.h"
 
 #define CM_SCS_BASE 0xE000E000
 #define CM_SCS_SIZE 4096
@@ -34,6 +35,7 @@ struct cm_scs_t{
     cpu_t *cpu;
     void* user_defined_data;
     vector_exception_t *NVIC;
+    reg_block_t *registers;
     //cm_systick_t *systick;
     int (*user_defined_read)(uint32_t offset, uint8_t *buffer, int size, struct cm_scs_t *scs);
     int (*user_defined_write)(uint32_t offset, uint8_t *buffer, int size, struct cm_scs_t *scs);
@@ -41,6 +43,10 @@ struct cm_scs_t{
 typedef struct cm_scs_t cm_scs_t;
 
 int cm_scs_init(cpu_t *cpu);
+void cm_scs_destory(cpu_t *cpu);
+struct snapshot_t;
+int cm_scs_snapshot(cpu_t *cpu, struct snapshot_t *snapshot);
+int cm_scs_restore(cpu_t *cpu, struct snapshot_t *snapshot);
 
 #ifdef __cplusplus
 }
@@ -2,6 +2,7 @@
 #include "cm_NVIC.h"
 #include "cm_systick.h"
 #include "arm_v7m_ins_implement.h"
+#include "snapshot.h"
 
 #define CSR_COUNTFLAG (1ul << 16)
 #define CSR_TICKINT (1ul << 1)
@@ -17,8 +18,10 @@
 void disable_systick(cpu_t *cpu)
 {
     cm_scs_t *scs = (cm_scs_t *)cpu->system_info;
-    delete_timer(CM_NVIC_VEC_SYSTICK, cpu->timer_list);
-    scs->systick = NULL;
+    if(scs->systick != NULL){
+        delete_timer(scs->systick);
+        scs->systick = NULL;
+    }
 }
 
 int systick_do_match(timer_t *timer, cpu_t *cpu)
@@ -40,93 +43,168 @@ int systick_do_match(timer_t *timer, cpu_t *cpu)
     return 0;
 }
 
-int SYST_CSR(uint8_t* data, int rw_flag, cm_scs_t *scs)
+int SYST_CSR_read(void *owner, const reg_desc_t *reg, uint32_t *value)
 {
+    cm_scs_t *scs = (cm_scs_t *)owner;
+    *value = SYST_REGS(scs).SYST_CSR & 0x0001000F;
+
+    // clear COUNTFFLAG on read
+    CLR_BITS(SYST_REGS(scs).SYST_CSR, CSR_COUNTFLAG);
+    return 0;
+}
+
+int SYST_CSR_write(void *owner, const reg_desc_t *reg, uint32_t value)
+{
+    cm_scs_t *scs = (cm_scs_t *)owner;
     int retval;
-    if(rw_flag == MEM_READ){
-        *(uint32_t *)data = SYST_REGS(scs).SYST_CSR & 0x0001000F;
 
-        // clear COUNTFFLAG on read
-        CLR_BITS(SYST_REGS(scs).SYST_CSR, CSR_COUNTFLAG);
-    }else{
+    // COUNTFLAG is RO
+    SET_IGNORE_BITS(SYST_REGS(scs).SYST_CSR, value, CSR_COUNTFLAG);
+    LOG(LOG_DEBUG, "writed SYST_CSR: %x\n", SYST_REGS(scs).SYST_CSR);
+    cpu_t *cpu = scs->cpu;
 
-        // COUNTFLAG is RO
-        SET_IGNORE_BITS(SYST_REGS(scs).SYST_CSR, *(uint32_t *)data, CSR_COUNTFLAG);
-        LOG(LOG_DEBUG, "writed SYST_CSR: %x\n", SYST_REGS(scs).SYST_CSR);
-        cpu_t *cpu = scs->cpu;
-
-        // create/delete timer if necessary
-        if(BITS_ARE_SET(SYST_REGS(scs).SYST_CSR, CSR_ENABLE)){
-            // don't create timer if RVR is 0
-            uint32_t reload = LOW_BIT32(SYST_REGS(scs).SYST_RVR, 24);
-            if(reload == 0){
-                return -2;
-            }
-
-            timer_t *timer = create_timer(CM_NVIC_VEC_SYSTICK);
-            if(timer == NULL){
-                return -1;
-            }
-            retval = add_timer(timer, cpu->timer_list, TRUE);
-            start_timer(timer, cpu, reload, systick_do_match);
-            // store timer pointer in scs so we can access the timer without searching in the list every time
-            scs->systick = timer;
+    // create/delete timer if necessary
+    if(BITS_ARE_SET(SYST_REGS(scs).SYST_CSR, CSR_ENABLE)){
+        // don't create timer if RVR is 0
+        uint32_t reload = LOW_BIT32(SYST_REGS(scs).SYST_RVR, 24);
+        if(reload == 0){
+            return 0;
+        }
+
+        // already counting
+        if(scs->systick != NULL){
+            return 0;
+        }
+
+        timer_t *timer = create_timer(CM_NVIC_VEC_SYSTICK);
+        if(timer == NULL){
+            return -1;
+        }
+        start_timer(timer, cpu, reload, systick_do_match);
+        retval = add_timer(timer, cpu->timer_queue);
+        if(retval < 0){
+            destory_timer(&timer);
             return retval;
-        }else{
-            disable_systick(cpu);
         }
+        // store timer pointer in scs so we can access the timer without searching the queue
+        scs->systick = timer;
+        return retval;
+    }else{
+        disable_systick(cpu);
     }
     return 0;
 }
 
-int SYST_RVR(uint8_t *data, int rw_flag, cm_scs_t *scs)
+int SYST_RVR_read(void *owner, const reg_desc_t *reg, uint32_t *value)
 {
-    if(rw_flag == MEM_READ){
-        *(uint32_t *)data = LOW_BIT32(SYST_REGS(scs).SYST_RVR, 24);
-    }else{
-        SYST_REGS(scs).SYST_RVR = LOW_BIT32(*(uint32_t *)data, 24);
-        if(SYST_REGS(scs).SYST_RVR == 0 && scs->systick != NULL){
-            // set a flag to disable timer on next wrap
-            scs->systick->user_data_int = TRUE;
-        }
-        // update reload on next wrap
-        if(scs->systick != NULL){
-            scs->systick->reload = SYST_REGS(scs).SYST_RVR;
-        }
-        LOG(LOG_DEBUG, "writed SYST_RVR: %x\n", SYST_REGS(scs).SYST_RVR);
+    cm_scs_t *scs = (cm_scs_t *)owner;
+    *value = LOW_BIT32(SYST_REGS(scs).SYST_RVR, 24);
+    return 0;
+}
+
+int SYST_RVR_write(void *owner, const reg_desc_t *reg, uint32_t value)
+{
+    cm_scs_t *scs = (cm_scs_t *)owner;
+    SYST_REGS(scs).SYST_RVR = LOW_BIT32(value, 24);
+    if(SYST_REGS(scs).SYST_RVR == 0 && scs->systick != NULL){
+        // set a flag to disable timer on next wrap
+        scs->systick->user_data_int = TRUE;
     }
+    // update reload on next wrap
+    if(scs->systick != NULL){
+        scs->systick->reload = SYST_REGS(scs).SYST_RVR;
+    }
+    LOG(LOG_DEBUG, "writed SYST_RVR: %x\n", SYST_REGS(scs).SYST_RVR);
     return 0;
 }
 
-int SYST_CVR(uint8_t *data, int rw_flag, cm_scs_t *scs)
+int SYST_CVR_read(void *owner, const reg_desc_t *reg, uint32_t *value)
 {
-    if(rw_flag == MEM_READ){
-        // calculate CVR by match and current cycle
-        if(scs->systick != NULL){
-            SYST_REGS(scs).SYST_CVR = negative_timer_count(scs->systick, scs->cpu);
-        }else{
-            SYST_REGS(scs).SYST_CVR = 0;
-        }
-        *(uint32_t *)data = SYST_REGS(scs).SYST_CVR;
+    cm_scs_t *scs = (cm_scs_t *)owner;
+    // calculate CVR by match and current cycle
+    if(scs->systick != NULL){
+        SYST_REGS(scs).SYST_CVR = negative_timer_count(scs->systick, scs->cpu);
     }else{
-        // any write clear the register to 0
         SYST_REGS(scs).SYST_CVR = 0;
-        // COUNTFLAG cleared on write to this register
-        CLR_BITS(SYST_REGS(scs).SYST_CSR, CSR_COUNTFLAG);
-        if(scs->systick != NULL){
-            restart_timer(scs->systick, scs->cpu);
+    }
+    *value = SYST_REGS(scs).SYST_CVR;
+    return 0;
+}
+
+int SYST_CVR_write(void *owner, const reg_desc_t *reg, uint32_t value)
+{
+    cm_scs_t *scs = (cm_scs_t *)owner;
+    // any write clear the register to 0
+    SYST_REGS(scs).SYST_CVR = 0;
+    // COUNTFLAG cleared on write to this register
+    CLR_BITS(SYST_REGS(scs).SYST_CSR, CSR_COUNTFLAG);
+    if(scs->systick != NULL){
+        restart_timer(scs->systick, scs->cpu);
+    }
+    LOG(LOG_DEBUG, "writed SYST_CVR\n");
+    return 0;
+}
+
+int SYST_CALIB_read(void *owner, const reg_desc_t *reg, uint32_t *value)
+{
+    cm_scs_t *scs = (cm_scs_t *)owner;
+    *value = SYST_REGS(scs).SYST_CALIB;
+    return 0;
+}
+
+/* the registers and the counting timer */
+int cm_systick_snapshot(cm_scs_t *scs, snapshot_t *snapshot)
+{
+    timer_t *timer = scs->systick;
+    int32_t counting = timer != NULL;
+
+    if(SNAPSHOT_PUT(snapshot, SYST_REGS(scs)) < 0 || SNAPSHOT_PUT(snapshot, counting) < 0){
+        return -ERROR_CREATE;
+    }
+    if(counting){
+        if(SNAPSHOT_PUT(snapshot, timer->reload) < 0 || SNAPSHOT_PUT(snapshot, timer->start) < 0 ||
+           SNAPSHOT_PUT(snapshot, timer->match) < 0 || SNAPSHOT_PUT(snapshot, timer->user_data_int) < 0){
+            return -ERROR_CREATE;
         }
-        LOG(LOG_DEBUG, "writed SYST_CVR\n");
     }
     return 0;
 }
 
-int SYST_CALIB(uint8_t *data, int rw_flag, cm_scs_t *scs)
+/* the timer is only created when the systick wasn't counting */
+int cm_systick_restore(cm_scs_t *scs, snapshot_t *snapshot)
 {
-    if(rw_flag == MEM_READ){
-        *(uint32_t *)data = SYST_REGS(scs).SYST_CALIB;
+    cycle_t reload, start, match;
+    int32_t counting;
+    int disable_flag;
+
+    if(SNAPSHOT_GET(snapshot, SYST_REGS(scs)) < 0 || SNAPSHOT_GET(snapshot, counting) < 0){
+        return -ERROR_SNAPSHOT;
+    }
+    if(!counting){
+        disable_systick(scs->cpu);
         return 0;
+    }
+    if(SNAPSHOT_GET(snapshot, reload) < 0 || SNAPSHOT_GET(snapshot, start) < 0 ||
+       SNAPSHOT_GET(snapshot, match) < 0 || SNAPSHOT_GET(snapshot, disable_flag) < 0){
+        return -ERROR_SNAPSHOT;
+    }
+
+    timer_t *timer = scs->systick;
+    if(timer == NULL){
+        timer = create_timer(CM_NVIC_VEC_SYSTICK);
+        if(timer == NULL){
+            return -ERROR_CREATE;
+        }
+        timer->do_match = systick_do_match;
+        load_timer(timer, reload, start, match);
+        if(add_timer(timer, scs->cpu->timer_queue) < 0){
+            destory_timer(&timer);
+            return -ERROR_CREATE;
+        }
+        scs->systick = timer;
     }else{
-        return -1;
+        load_timer(timer, reload, start, match);
     }
+    timer->user_data_int = disable_flag;
+    return 0;
 }
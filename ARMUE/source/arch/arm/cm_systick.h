@@ -6,6 +6,7 @@ extern "C"{
 #endif
 
 #include <stdint.h>
+#include "register_block.h"
 
 struct systick_reg_t{
     uint32_t SYST_CSR;
@@ -16,10 +17,17 @@ struct systick_reg_t{
 typedef struct systick_reg_t systick_reg_t;
 
 struct cm_scs_t;
-int SYST_CSR(uint8_t* data, int rw_flag, struct cm_scs_t *scs);
-int SYST_RVR(uint8_t *data, int rw_flag, struct cm_scs_t *scs);
-int SYST_CVR(uint8_t *data, int rw_flag, struct cm_scs_t *scs);
-int SYST_CALIB(uint8_t *data, int rw_flag, struct cm_scs_t *scs);
+/* the handlers in the register block of the scs, owner is the scs */
+int SYST_CSR_read(void *owner, const reg_desc_t *reg, uint32_t *value);
+int SYST_CSR_write(void *owner, const reg_desc_t *reg, uint32_t value);
+int SYST_RVR_read(void *owner, const reg_desc_t *reg, uint32_t *value);
+int SYST_RVR_write(void *owner, const reg_desc_t *reg, uint32_t value);
+int SYST_CVR_read(void *owner, const reg_desc_t *reg, uint32_t *value);
+int SYST_CVR_write(void *owner, const reg_desc_t *reg, uint32_t value);
+int SYST_CALIB_read(void *owner, const reg_desc_t *reg, uint32_t *value);
+struct snapshot_t;
+int cm_systick_snapshot(struct cm_scs_t *scs, struct snapshot_t *snapshot);
+int cm_systick_restore(struct cm_scs_t *scs, struct snapshot_t *snapshot);
 
 #include "cm_system_control_space.h"
 
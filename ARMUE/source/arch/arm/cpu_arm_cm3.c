@@ -6,6 +6,8 @@
 #include "_types.h"
 #include "arm_v7m_ins_decode.h"
 #include "cm_system_control_space.h"
+#include "arm_v7m_timing.h"
+#include "snapshot.h"
 
 static module_t* this_module;
 static int registered = 0;
@@ -108,6 +110,7 @@ void excute_armcm3_cpu(cpu_t* cpu, ins_t ins_info){
     /****** when 16bit coded, PC += 2. when 32bit coded, PC += 4.               */
     /****** But if instruction visits PC, it always returns PC+4                */
     armv7m_next_PC(cpu, ins_info.length);
+    uint32_t next_pc = regs->PC;
     if(ins_info.length == 16){
         ((thumb_translate16_t)ins_info.excute)((uint16_t)ins_info.opcode, cpu);
     }else{
@@ -115,6 +118,11 @@ void excute_armcm3_cpu(cpu_t* cpu, ins_t ins_info){
         ((thumb_translate32_t)ins_info.excute)((uint32_t)ins_info.opcode, cpu);
     }
 
+    /* any write to PC means a taken branch and a pipeline refill */
+    if(regs->PC != next_pc){
+        armv7m_add_branch_timing(cpu, regs->PC);
+    }
+
     if(!check_and_reset_excuting_IT(state) && InITBlock(regs)){
         ITAdvance(regs);
     }
@@ -132,6 +140,79 @@ static void armcm3_set_raw_pc(uint32_t val, cpu_t *cpu)
     SET_REG_VAL(regs, PC_INDEX, val);
 }
 
+/* the exclusive monitor is shared by the cores, the first one saves it */
+static int armcm3_snapshot_exclusive(arm_exclusive_t *exclusive, snapshot_t *snapshot)
+{
+    int retval = 0;
+    pthread_mutex_lock(&exclusive->lock);
+    if(SNAPSHOT_PUT(snapshot, exclusive->low_addr) < 0 || SNAPSHOT_PUT(snapshot, exclusive->high_addr) < 0 ||
+       SNAPSHOT_PUT(snapshot, exclusive->local_exclusive) < 0 || SNAPSHOT_PUT(snapshot, exclusive->global_exclusive) < 0 ||
+       SNAPSHOT_PUT(snapshot, exclusive->local_exclusive_enable) < 0 ||
+       SNAPSHOT_PUT(snapshot, exclusive->global_exclusive_enable) < 0 ||
+       SNAPSHOT_PUT(snapshot, exclusive->exclusive_num) < 0){
+        retval = -ERROR_CREATE;
+    }
+    pthread_mutex_unlock(&exclusive->lock);
+    return retval;
+}
+
+static int armcm3_restore_exclusive(arm_exclusive_t *exclusive, snapshot_t *snapshot)
+{
+    int retval = 0;
+    pthread_mutex_lock(&exclusive->lock);
+    if(SNAPSHOT_GET(snapshot, exclusive->low_addr) < 0 || SNAPSHOT_GET(snapshot, exclusive->high_addr) < 0 ||
+       SNAPSHOT_GET(snapshot, exclusive->local_exclusive) < 0 || SNAPSHOT_GET(snapshot, exclusive->global_exclusive) < 0 ||
+       SNAPSHOT_GET(snapshot, exclusive->local_exclusive_enable) < 0 ||
+       SNAPSHOT_GET(snapshot, exclusive->global_exclusive_enable) < 0 ||
+       SNAPSHOT_GET(snapshot, exclusive->exclusive_num) < 0){
+        retval = -ERROR_SNAPSHOT;
+    }
+    pthread_mutex_unlock(&exclusive->lock);
+    return retval;
+}
+
+/****** save the cpu state. It will set to cpu->snapshot ******/
+static int armcm3_snapshot(cpu_t *cpu, snapshot_t *snapshot)
+{
+    arm_reg_t *regs = ARMv7m_GET_REGS(cpu);
+    thumb_state *state = ARMv7m_GET_STATE(cpu);
+    int retval;
+
+    if(SNAPSHOT_PUT(snapshot, *regs) < 0 ||
+       SNAPSHOT_PUT(snapshot, state->excuting_IT) < 0 || SNAPSHOT_PUT(snapshot, state->mode) < 0 ||
+       snapshot_put_fifo(snapshot, state->cur_exception) < 0){
+        return -ERROR_CREATE;
+    }
+    if(cpu->cid == 0){
+        retval = armcm3_snapshot_exclusive(&ARMv7m_GET_GLOBAL_STATE(cpu)->exclusive_state, snapshot);
+        if(retval < 0){
+            return retval;
+        }
+    }
+    return cm_scs_snapshot(cpu, snapshot);
+}
+
+/****** restore the cpu state. It will set to cpu->restore ******/
+static int armcm3_restore(cpu_t *cpu, snapshot_t *snapshot)
+{
+    arm_reg_t *regs = ARMv7m_GET_REGS(cpu);
+    thumb_state *state = ARMv7m_GET_STATE(cpu);
+    int retval;
+
+    if(SNAPSHOT_GET(snapshot, *regs) < 0 ||
+       SNAPSHOT_GET(snapshot, state->excuting_IT) < 0 || SNAPSHOT_GET(snapshot, state->mode) < 0 ||
+       snapshot_get_fifo(snapshot, state->cur_exception) < 0){
+        return -ERROR_SNAPSHOT;
+    }
+    if(cpu->cid == 0){
+        retval = armcm3_restore_exclusive(&ARMv7m_GET_GLOBAL_STATE(cpu)->exclusive_state, snapshot);
+        if(retval < 0){
+            return retval;
+        }
+    }
+    return cm_scs_restore(cpu, snapshot);
+}
+
 /****** Initialize an instance of the cpu. It will set to module->init_cpu ******/
 int init_armcm3_cpu(cpu_t *cpu, soc_conf_t* config)
 {
@@ -156,11 +237,15 @@ int init_armcm3_cpu(cpu_t *cpu, soc_conf_t* config)
     cpu->excute = excute_armcm3_cpu;
     cpu->get_raw_pc = armcm3_get_raw_pc;
     cpu->set_raw_pc = armcm3_set_raw_pc;
+    cpu->snapshot = armcm3_snapshot;
+    cpu->restore = armcm3_restore;
     set_cpu_module(cpu, this_module);
     cpu->type = CPU_ARM_CM3;
 
     // add cpu to cpu list
+    pthread_mutex_lock(&this_module->lock);
     add_cpu_to_tail(this_module->cpu_list, cpu);
+    pthread_mutex_unlock(&this_module->lock);
 
     return SUCCESS;
 
@@ -172,16 +257,19 @@ init_ins_fail:
 
 error_code_t destory_armcm3_cpu(cpu_t** cpu)
 {
+    cm_scs_destory(*cpu);
     ins_thumb_destory(*cpu);
     // delete from cpu list
+    pthread_mutex_lock(&this_module->lock);
     delete_cpu(this_module->cpu_list, *cpu);
+    pthread_mutex_unlock(&this_module->lock);
 
     dealloc_cpu(cpu);
     return SUCCESS;
 }
 
 /****** This is the unregister entrence used by main system ******/
-error_code_t unregister_armcm3_module()
+error_code_t unregister_armcm3_module(module_t *module)
 {
     if(registered == 0){
         return ERROR_REGISTERED;
@@ -0,0 +1,385 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "getopt.h"
+#include "windows.h"
+#include "module_helper.h"
+#include "memory_map.h"
+#include "soc.h"
+#include "semihost.h"
+#include "work_pool.h"
+
+/*
+ * Run a regression suite of firmware images in parallel, one soc per image.
+ *
+ * Every non-empty line of the manifest not starting with '#' describes an image:
+ *     <binary path> <cycle budget> <expected exit> [semihosting]
+ * where the expected exit is one of
+ *     halt        the firmware stops on the zero operation code
+ *     timeout     the firmware is still running when the budget runs out
+ *     pc=<addr>   the firmware reaches the address
+ *     exit=<code> the firmware calls SYS_EXIT with the code, semihosting is on then
+ * "semihosting" turns it on for the other ones. The paths can't have spaces. The
+ * result is written as JSON, the console output of semihosting goes to stderr so
+ * it never mixes with the result on stdout.
+ */
+
+#define BATCH_PATH_MAX      260
+#define BATCH_FLASH_BASE    0x00000000
+#define BATCH_FLASH_SIZE    0x80000
+#define BATCH_SRAM_BASE     0x10000000
+#define BATCH_SRAM_SIZE     0x8000
+
+typedef enum{
+    BATCH_EXIT_ERROR,
+    BATCH_EXIT_HALT,
+    BATCH_EXIT_TIMEOUT,
+    BATCH_EXIT_PC,
+    BATCH_EXIT_EXIT,
+}batch_exit_t;
+
+static const char *exit_names[] = {"error", "halt", "timeout", "pc", "exit"};
+
+typedef struct batch_task_t{
+    char path[BATCH_PATH_MAX];
+    cycle_t budget;
+    batch_exit_t expect;
+    uint32_t expect_pc;
+    int expect_code;
+    bool_t semihosting;
+
+    /* result */
+    batch_exit_t exit;
+    int exit_code;              // given with SYS_EXIT
+    const char *error;
+    cycle_t instructions;
+    cycle_t cycles;
+    double wall_ms;
+}batch_task_t;
+
+typedef struct batch_t{
+    int task_num;
+    int capacity;
+    batch_task_t *tasks;
+}batch_t;
+
+const char short_options[] = "hj:o:";
+const struct option long_options[] = {
+    {"help",    no_argument,        NULL,   'h'},
+    {"jobs",    required_argument,  NULL,   'j'},
+    {"output",  required_argument,  NULL,   'o'},
+    {0, 0, 0, 0},
+};
+
+static double wall_time_ms()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+static int parse_expect(char *expect, batch_task_t *task)
+{
+    if(strcmp(expect, "halt") == 0){
+        task->expect = BATCH_EXIT_HALT;
+    }else if(strcmp(expect, "timeout") == 0){
+        task->expect = BATCH_EXIT_TIMEOUT;
+    }else if(strncmp(expect, "pc=", 3) == 0){
+        task->expect = BATCH_EXIT_PC;
+        task->expect_pc = strtoul(expect + 3, NULL, 0);
+    }else if(strncmp(expect, "exit=", 5) == 0){
+        task->expect = BATCH_EXIT_EXIT;
+        task->expect_code = strtol(expect + 5, NULL, 0);
+        task->semihosting = TRUE;
+    }else{
+        return -1;
+    }
+    return 0;
+}
+
+static int load_manifest(char *path, batch_t *batch)
+{
+    char line[BATCH_PATH_MAX + 64];
+    char expect[32];
+    char flag[32];
+    unsigned long long budget;
+    int line_num = 0;
+
+    FILE *manifest = fopen(path, "r");
+    if(manifest == NULL){
+        LOG(LOG_ERROR, "load_manifest: can't open %s\n", path);
+        return -ERROR_INVALID_PATH;
+    }
+
+    while(fgets(line, sizeof(line), manifest) != NULL){
+        line_num++;
+        char *start = line + strspn(line, " \t\r\n");
+        if(*start == '\0' || *start == '#'){
+            continue;
+        }
+
+        if(batch->task_num == batch->capacity){
+            int capacity = batch->capacity ? batch->capacity * 2 : 64;
+            batch_task_t *tasks = (batch_task_t*)realloc(batch->tasks, capacity * sizeof(batch_task_t));
+            if(tasks == NULL){
+                fclose(manifest);
+                return -ERROR_CREATE;
+            }
+            batch->tasks = tasks;
+            batch->capacity = capacity;
+        }
+
+        batch_task_t *task = &batch->tasks[batch->task_num];
+        memset(task, 0, sizeof(batch_task_t));
+        int fields = sscanf(start, "%259s %llu %31s %31s", task->path, &budget, expect, flag);
+        if(fields < 3 || parse_expect(expect, task) < 0 ||
+           (fields == 4 && strcmp(flag, "semihosting") != 0)){
+            LOG(LOG_ERROR, "load_manifest: %s:%d is invalid\n", path, line_num);
+            fclose(manifest);
+            return -ERROR_INVALID_PATH;
+        }
+        task->budget = budget;
+        if(fields == 4){
+            task->semihosting = TRUE;
+        }
+        batch->task_num++;
+    }
+
+    fclose(manifest);
+    return SUCCESS;
+}
+
+/* emulate the image until it exits or runs out of its budget */
+static void run_batch_task(int index, void *data)
+{
+    batch_t *batch = (batch_t*)data;
+    batch_task_t *task = &batch->tasks[index];
+    ram_t *flash = NULL, *sram = NULL;
+    soc_t *soc = NULL;
+
+    task->exit = BATCH_EXIT_ERROR;
+    memory_map_t *memory_map = create_memory_map();
+    if(memory_map == NULL){
+        task->error = "can't create memory map";
+        goto out;
+    }
+
+    /* the image is loaded to RAM at the flash address, each soc needs its own copy */
+    flash = create_ram(BATCH_FLASH_SIZE);
+    sram = create_ram(BATCH_SRAM_SIZE);
+    if(flash == NULL || sram == NULL){
+        task->error = "can't create memory";
+        goto out;
+    }
+    if(fill_ram_with_bin(flash, 0, task->path) < 0){
+        task->error = "can't load image";
+        goto out;
+    }
+    if(setup_memory_map_ram(memory_map, flash, BATCH_FLASH_BASE) < 0 ||
+       setup_memory_map_ram(memory_map, sram, BATCH_SRAM_BASE) < 0){
+        task->error = "can't setup memory map";
+        goto out;
+    }
+    set_memory_wait_states(memory_map, BATCH_FLASH_BASE, BATCH_FLASH_SIZE, 3);
+
+    soc_conf_t soc_conf;
+    soc_conf.cpu_num = 1;
+    soc_conf.cpu_name = "arm_cm3";
+    soc_conf.exception_num = 255;
+    soc_conf.nested_level = 10;
+    soc_conf.has_GIC = 0;
+    soc_conf.memory_map_num = 1;
+    soc_conf.memories[0] = memory_map;
+    soc_conf.exclusive_high_address = 0xFFFFFFFF;
+    soc_conf.exclusive_low_address = 0;
+    soc_conf.sync_quantum = 0;
+
+    soc = create_soc(&soc_conf);
+    if(soc == NULL){
+        task->error = "can't create soc";
+        goto out;
+    }
+    /* the soc owns the memory map from now on */
+    memory_map = NULL;
+    if(task->semihosting){
+        soc->semihost = create_semihost();
+        if(soc->semihost == NULL){
+            task->error = "can't create semihosting";
+            goto out;
+        }
+        soc->semihost->console = stderr;
+        soc->cpu[0]->semihost = soc->semihost;
+    }
+    if(startup_soc(soc) < 0){
+        task->error = "can't startup soc";
+        goto out;
+    }
+
+    cpu_t *cpu = soc->cpu[0];
+    double begin = wall_time_ms();
+    task->exit = BATCH_EXIT_TIMEOUT;
+    while(cpu->cycle < task->budget){
+        uint32_t opcode = run_soc(soc);
+        task->instructions++;
+        if(soc->semihost != NULL && soc->semihost->exited){
+            task->exit = BATCH_EXIT_EXIT;
+            task->exit_code = soc->semihost->exit_code;
+            break;
+        }
+        if(opcode == 0){
+            task->exit = BATCH_EXIT_HALT;
+            break;
+        }
+        if(task->expect == BATCH_EXIT_PC && cpu->get_raw_pc(cpu) == task->expect_pc){
+            task->exit = BATCH_EXIT_PC;
+            break;
+        }
+    }
+    task->wall_ms = wall_time_ms() - begin;
+    task->cycles = cpu->cycle;
+
+out:
+    destory_soc(&soc);
+    destory_memory_map(&memory_map);
+    destory_ram(&flash);
+    destory_ram(&sram);
+}
+
+static void print_json_string(FILE *out, const char *string)
+{
+    fputc('"', out);
+    for(; *string != '\0'; string++){
+        if(*string == '"' || *string == '\\'){
+            fputc('\\', out);
+            fputc(*string, out);
+        }else if((unsigned char)*string < 0x20){
+            fprintf(out, "\\u%04x", (unsigned char)*string);
+        }else{
+            fputc(*string, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static double mips(cycle_t instructions, double wall_ms)
+{
+    return wall_ms > 0 ? instructions / wall_ms / 1000.0 : 0;
+}
+
+static int print_result(FILE *out, batch_t *batch, int jobs, double wall_ms)
+{
+    cycle_t instructions = 0;
+    int passed = 0, errors = 0;
+    int i;
+
+    fprintf(out, "{\n  \"images\": [\n");
+    for(i = 0; i < batch->task_num; i++){
+        batch_task_t *task = &batch->tasks[i];
+        const char *result;
+        if(task->exit == BATCH_EXIT_ERROR){
+            result = "error";
+            errors++;
+        }else if(task->exit == task->expect &&
+                 (task->expect != BATCH_EXIT_EXIT || task->exit_code == task->expect_code)){
+            result = "pass";
+            passed++;
+        }else{
+            result = "fail";
+        }
+        instructions += task->instructions;
+
+        fprintf(out, "    {\"image\": ");
+        print_json_string(out, task->path);
+        fprintf(out, ", \"result\": \"%s\", \"exit\": \"%s\", \"expected\": \"%s\"",
+                result, exit_names[task->exit], exit_names[task->expect]);
+        if(task->exit == BATCH_EXIT_EXIT){
+            fprintf(out, ", \"exit_code\": %d", task->exit_code);
+        }
+        if(task->expect == BATCH_EXIT_EXIT){
+            fprintf(out, ", \"expected_exit_code\": %d", task->expect_code);
+        }
+        if(task->error != NULL){
+            fprintf(out, ", \"error\": ");
+            print_json_string(out, task->error);
+        }
+        fprintf(out, ", \"instructions\": %llu, \"cycles\": %llu, \"wall_ms\": %.3f, \"mips\": %.3f}%s\n",
+                (unsigned long long)task->instructions, (unsigned long long)task->cycles,
+                task->wall_ms, mips(task->instructions, task->wall_ms),
+                i + 1 < batch->task_num ? "," : "");
+    }
+    fprintf(out, "  ],\n");
+    fprintf(out, "  \"total\": {\"images\": %d, \"passed\": %d, \"failed\": %d, \"errors\": %d, "
+                 "\"jobs\": %d, \"instructions\": %llu, \"wall_ms\": %.3f, \"mips\": %.3f}\n}\n",
+            batch->task_num, passed, batch->task_num - passed - errors, errors,
+            jobs, (unsigned long long)instructions, wall_ms, mips(instructions, wall_ms));
+
+    return passed == batch->task_num ? 0 : 1;
+}
+
+static int default_jobs()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+}
+
+int main(int argc, char **argv)
+{
+    char c;
+    int option_index;
+    int jobs = default_jobs();
+    char *output_path = NULL;
+    while(1){
+        c = getopt_long(argc, argv, short_options, long_options, &option_index);
+        if(c == -1){
+            break;
+        }
+        switch(c){
+        case 'j':
+            jobs = atoi(optarg);
+            break;
+        case 'o':
+            output_path = optarg;
+            break;
+        case 'h':
+        default:
+            printf("usage: %s [-j jobs] [-o result.json] manifest\n", argv[0]);
+            return 0;
+        }
+    }
+    if(optind >= argc || jobs <= 0){
+        printf("usage: %s [-j jobs] [-o result.json] manifest\n", argv[0]);
+        return -1;
+    }
+
+    batch_t batch = {0};
+    if(load_manifest(argv[optind], &batch) < 0){
+        return -1;
+    }
+
+    FILE *out = stdout;
+    if(output_path != NULL){
+        out = fopen(output_path, "w");
+        if(out == NULL){
+            LOG(LOG_ERROR, "can't open %s\n", output_path);
+            return -1;
+        }
+    }
+
+    // register all exsisted modules
+    register_all_modules();
+
+    double begin = wall_time_ms();
+    run_work_pool(batch.task_num, jobs, run_batch_task, &batch);
+    double wall_ms = wall_time_ms() - begin;
+
+    int retval = print_result(out, &batch, jobs, wall_ms);
+    if(out != stdout){
+        fclose(out);
+    }
+
+    unregister_all_modules();
+    free(batch.tasks);
+    return retval;
+}
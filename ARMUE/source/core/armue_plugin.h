@@ -0,0 +1,84 @@
+#ifndef _ARMUE_PLUGIN_H_
+#define _ARMUE_PLUGIN_H_
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include <stdint.h>
+
+/*
+ * The C ABI of the peripheral plug-ins. A plug-in is a shared object in the
+ * plug-in directory that exports ARMUE_PLUGIN_ENTRY. It only needs this header.
+ *
+ * Each peripheral of the plug-in gets an instance for every soc, mapped at its
+ * base. The emulator calls the accessors and the event callbacks directly on the
+ * thread of the cpu, the instance calls back through armue_host_t. The cores of a
+ * soc make the calls one at a time, and the services are only called from them.
+ *
+ * The structures only grow at their end. Their size member tells how much of the
+ * structure the other side knows, a member past it is taken as NULL. A change
+ * that breaks the ABI bumps ARMUE_PLUGIN_ABI_VERSION and the entry symbol with it.
+ */
+
+#define ARMUE_PLUGIN_ABI_VERSION    1
+#define ARMUE_PLUGIN_ENTRY          "armue_plugin_v1"
+#define ARMUE_PLUGIN_EVENT_MAX      8
+
+#ifdef __linux__
+#define ARMUE_PLUGIN_EXPORT __attribute__((visibility("default")))
+#else
+#define ARMUE_PLUGIN_EXPORT __declspec(dllexport)
+#endif
+
+/* services of the emulator for one instance */
+typedef struct armue_host_t{
+    uint32_t size;                  // sizeof(armue_host_t) of the emulator
+    uint32_t abi_version;
+    void *context;                  // first argument of the services
+    uint32_t base;                  // where the instance is mapped
+    /* irq is the external interrupt number, 0 for the first one after SysTick */
+    int (*raise_irq)(void *context, int irq);
+    /* the bus as seen by the cpu, return the bytes accessed or <0 */
+    int (*read_memory)(void *context, uint32_t address, uint8_t *buffer, int size);
+    int (*write_memory)(void *context, uint32_t address, const uint8_t *buffer, int size);
+    uint64_t (*cycles)(void *context);
+    /* Call the event callback with id after cycles. id is below ARMUE_PLUGIN_EVENT_MAX,
+       scheduling a pending id again moves it. */
+    int (*schedule)(void *context, uint32_t id, uint64_t cycles);
+    int (*cancel)(void *context, uint32_t id);
+}armue_host_t;
+
+typedef struct armue_peripheral_ops_t{
+    uint32_t size;                  // sizeof(armue_peripheral_ops_t) of the plug-in
+    const char *name;
+    uint32_t base;
+    uint32_t length;                // bytes of address space from base
+    /* host lives as long as the instance, NULL fails the creation */
+    void* (*create)(const armue_host_t *host);
+    void (*destory)(void *instance);
+    /* offset from base, size is 1, 2 or 4. <0 faults the access */
+    int (*read)(void *instance, uint32_t offset, int size, uint32_t *value);
+    int (*write)(void *instance, uint32_t offset, int size, uint32_t value);
+    /* events, NULL if not used */
+    void (*event)(void *instance, uint32_t id);
+    /* State for the snapshots. save with a NULL buffer returns the bytes it needs,
+       otherwise the bytes written or <0. load gets what save wrote. */
+    int (*save)(void *instance, uint8_t *buffer, int size);
+    int (*load)(void *instance, const uint8_t *buffer, int size);
+}armue_peripheral_ops_t;
+
+typedef struct armue_plugin_t{
+    uint32_t size;                  // sizeof(armue_plugin_t) of the plug-in
+    uint32_t abi_version;           // ARMUE_PLUGIN_ABI_VERSION of the plug-in
+    const char *name;
+    int peripheral_num;
+    const armue_peripheral_ops_t *const *peripherals;
+}armue_plugin_t;
+
+/* the type of ARMUE_PLUGIN_ENTRY, called once when the plug-in is loaded */
+typedef const armue_plugin_t* (*armue_plugin_entry_t)(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
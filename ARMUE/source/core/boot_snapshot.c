@@ -0,0 +1,83 @@
+#include "boot_snapshot.h"
+#include "error_code.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <windows.h>
+
+int save_boot_snapshot(snapshot_t *snapshot, uint64_t image_hash, char *path)
+{
+    boot_snapshot_head_t head = {BOOT_SNAPSHOT_MAGIC, BOOT_SNAPSHOT_VERSION, image_hash, snapshot->size};
+
+    FILE *file = fopen(path, "wb");
+    if(file == NULL){
+        LOG(LOG_ERROR, "save_boot_snapshot: can't open %s\n", path);
+        return -ERROR_INVALID_PATH;
+    }
+    fwrite(&head, sizeof(head), 1, file);
+    fwrite(snapshot->data, 1, snapshot->size, file);
+    int retval = ferror(file) ? -ERROR_CREATE : 0;
+    fclose(file);
+    return retval;
+}
+
+snapshot_t* map_boot_snapshot(char *path, uint64_t image_hash)
+{
+    LARGE_INTEGER file_size;
+    boot_snapshot_head_t *head;
+
+    HANDLE file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE){
+        goto file_fail;
+    }
+    if(!GetFileSizeEx(file, &file_size) || file_size.QuadPart < (LONGLONG)sizeof(boot_snapshot_head_t)){
+        goto mapping_fail;
+    }
+    HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(mapping == NULL){
+        goto mapping_fail;
+    }
+    /* the view keeps the file open */
+    head = (boot_snapshot_head_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    CloseHandle(file);
+    if(head == NULL){
+        goto file_fail;
+    }
+
+    if(head->magic != BOOT_SNAPSHOT_MAGIC || head->version != BOOT_SNAPSHOT_VERSION ||
+       head->size > (uint64_t)file_size.QuadPart - sizeof(boot_snapshot_head_t)){
+        LOG(LOG_WARN, "map_boot_snapshot: %s is not a boot snapshot\n", path);
+        goto head_fail;
+    }
+    if(head->image_hash != image_hash){
+        LOG(LOG_WARN, "map_boot_snapshot: %s was taken with another firmware image\n", path);
+        goto head_fail;
+    }
+
+    snapshot_t *snapshot = (snapshot_t*)calloc(1, sizeof(snapshot_t));
+    if(snapshot == NULL){
+        goto head_fail;
+    }
+    snapshot->data = (uint8_t*)(head + 1);
+    snapshot->size = head->size;
+    snapshot->capacity = head->size;
+    return snapshot;
+
+head_fail:
+    UnmapViewOfFile(head);
+    return NULL;
+mapping_fail:
+    CloseHandle(file);
+file_fail:
+    return NULL;
+}
+
+void unmap_boot_snapshot(snapshot_t **snapshot)
+{
+    if(snapshot == NULL || *snapshot == NULL){
+        return;
+    }
+    UnmapViewOfFile((*snapshot)->data - sizeof(boot_snapshot_head_t));
+    free(*snapshot);
+    *snapshot = NULL;
+}
@@ -0,0 +1,35 @@
+#ifndef _BOOT_SNAPSHOT_H_
+#define _BOOT_SNAPSHOT_H_
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include "snapshot.h"
+
+/*
+ * A boot snapshot is the machine after the firmware has booted, so that later runs
+ * skip the boot. The file holds the hash of the firmware image it was taken with
+ * and is not used with any other image:
+ *     boot_snapshot_head_t, then the snapshot
+ */
+
+#define BOOT_SNAPSHOT_MAGIC     0x424D5241  // "ARMB"
+#define BOOT_SNAPSHOT_VERSION   1
+
+typedef struct boot_snapshot_head_t{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t image_hash;
+    uint64_t size;          // of the snapshot
+}boot_snapshot_head_t;
+
+int save_boot_snapshot(snapshot_t *snapshot, uint64_t image_hash, char *path);
+/* The file is mapped read-only rather than read, restore_soc is all it can be used
+   for. NULL if it is missing or was taken with another image. */
+snapshot_t* map_boot_snapshot(char *path, uint64_t image_hash);
+void unmap_boot_snapshot(snapshot_t **snapshot);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,407 @@
+#include "checkpoint.h"
+#include "semihost.h"
+#include "replay.h"
+#include "mapped_image.h"
+#include "error_code.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECKPOINT_NEVER    (~(cycle_t)0)
+
+typedef int (*ram_func_t)(ram_t *ram);
+
+static int call_ram_func(memory_region_t *region, void *data)
+{
+    if(region->type != MEMORY_REGION_RAM){
+        return 0;
+    }
+    return ((ram_func_t)data)((ram_t*)region->region_data);
+}
+
+/* the RAM of the shared map and of the private maps */
+static int for_each_soc_ram(soc_t *soc, ram_func_t func)
+{
+    int i, retval;
+    retval = for_each_memory_region(shared_memory_map(soc->cpu[0]->memory_map), call_ram_func, func);
+    for(i = 0; i < soc->cpu_num && retval >= 0; i++){
+        if(soc->cpu[i]->memory_map->shared != NULL){
+            retval = for_each_memory_region(soc->cpu[i]->memory_map, call_ram_func, func);
+        }
+    }
+    return retval;
+}
+
+static int untrack_ram(ram_t *ram)
+{
+    untrack_ram_dirty(ram);
+    return 0;
+}
+
+static int clear_ram(ram_t *ram)
+{
+    clear_ram_dirty(ram);
+    return 0;
+}
+
+checkpoint_list_t* create_checkpoint_list(soc_t *soc, cycle_t interval)
+{
+    int i;
+    checkpoint_list_t *list = (checkpoint_list_t*)calloc(1, sizeof(checkpoint_list_t));
+    if(list == NULL){
+        goto list_null;
+    }
+    list->checkpoints = (checkpoint_t*)calloc(CHECKPOINT_MAX_NUM, sizeof(checkpoint_t));
+    if(list->checkpoints == NULL){
+        goto checkpoints_null;
+    }
+    list->capacity = CHECKPOINT_MAX_NUM;
+    list->interval = interval;
+    list->inputs = create_snapshot();
+    if(list->inputs == NULL){
+        goto take_fail;
+    }
+
+    if(for_each_soc_ram(soc, track_ram_dirty) < 0){
+        goto take_fail;
+    }
+    /* the storage goes back from the pages kept at their first write */
+    for(i = 0; i < soc->image_num; i++){
+        if(track_image_dirty(soc->images[i]) < 0){
+            goto take_fail;
+        }
+    }
+    /* running again from a checkpoint needs what the host gave the program */
+    if(soc->semihost != NULL && semihost_keep_results(soc->semihost) < 0){
+        goto take_fail;
+    }
+    /* nothing is dirty yet, so the first one is taken in full */
+    list->next_cycle = 0;
+    if(take_checkpoint(soc, list) < 0){
+        goto take_fail;
+    }
+    return list;
+
+take_fail:
+    destory_checkpoint_list(soc, &list);
+    return NULL;
+checkpoints_null:
+    free(list);
+list_null:
+    return NULL;
+}
+
+void destory_checkpoint_list(soc_t *soc, checkpoint_list_t **list)
+{
+    int i;
+    if(list == NULL || *list == NULL){
+        return;
+    }
+    for_each_soc_ram(soc, untrack_ram);
+    for(i = 0; i < soc->image_num; i++){
+        untrack_image_dirty(soc->images[i]);
+    }
+    if(soc->semihost != NULL){
+        semihost_drop_results(soc->semihost);
+    }
+    for(i = 0; i < (*list)->num; i++){
+        destory_snapshot(&(*list)->checkpoints[i].snapshot);
+    }
+    destory_snapshot(&(*list)->inputs);
+    free((*list)->checkpoints);
+    free(*list);
+    *list = NULL;
+}
+
+/* the offset of the first input kept after cycle */
+static size_t find_input(snapshot_t *inputs, cycle_t cycle)
+{
+    replay_event_head_t head;
+    size_t pos = 0;
+    while(pos + sizeof(head) <= inputs->size){
+        memcpy(&head, inputs->data + pos, sizeof(head));
+        if(head.cycle > cycle){
+            break;
+        }
+        pos += sizeof(head) + head.length;
+    }
+    return pos;
+}
+
+/* the history before the second full checkpoint is given up */
+static void forget_oldest(soc_t *soc, checkpoint_list_t *list)
+{
+    int i;
+    for(i = 0; i < CHECKPOINT_FULL_EVERY; i++){
+        destory_snapshot(&list->checkpoints[i].snapshot);
+    }
+    list->num -= CHECKPOINT_FULL_EVERY;
+    memmove(list->checkpoints, list->checkpoints + CHECKPOINT_FULL_EVERY, list->num * sizeof(checkpoint_t));
+    /* the input before checkpoints[0] is in it */
+    size_t pos = find_input(list->inputs, list->checkpoints[0].cycle);
+    memmove(list->inputs->data, list->inputs->data + pos, list->inputs->size - pos);
+    list->inputs->size -= pos;
+    if(soc->semihost != NULL){
+        semihost_forget_results(soc->semihost, list->checkpoints[0].cycle);
+    }
+}
+
+int take_checkpoint(soc_t *soc, checkpoint_list_t *list)
+{
+    if(list->num == list->capacity){
+        forget_oldest(soc, list);
+    }
+
+    snapshot_t *snapshot = create_snapshot();
+    if(snapshot == NULL){
+        return -ERROR_CREATE;
+    }
+    bool_t full = list->num % CHECKPOINT_FULL_EVERY == 0;
+    int retval = full ? snapshot_soc(soc, snapshot) : snapshot_soc_dirty(soc, snapshot);
+    if(retval < 0){
+        destory_snapshot(&snapshot);
+        return retval;
+    }
+
+    cycle_t cycle = soc->cpu[0]->cycle;
+    list->checkpoints[list->num].cycle = cycle;
+    list->checkpoints[list->num].full = full;
+    list->checkpoints[list->num].snapshot = snapshot;
+    list->num++;
+    list->next_cycle = list->interval != 0 ? cycle + list->interval : CHECKPOINT_NEVER;
+    return 0;
+}
+
+/* the last checkpoint taken at or before cycle, -1 if none */
+int find_checkpoint(checkpoint_list_t *list, cycle_t cycle)
+{
+    int i;
+    for(i = list->num - 1; i >= 0; i--){
+        if(list->checkpoints[i].cycle <= cycle){
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* the later checkpoints are kept */
+static int load_checkpoint(soc_t *soc, checkpoint_list_t *list, int index)
+{
+    int i, retval;
+    if(index < 0 || index >= list->num){
+        return -ERROR_SNAPSHOT;
+    }
+
+    /* the state comes from the last one, the memory from all of them since a full one */
+    for(i = index; !list->checkpoints[i].full; i--);
+    for(; i <= index; i++){
+        retval = restore_soc(soc, list->checkpoints[i].snapshot);
+        if(retval < 0){
+            return retval;
+        }
+    }
+    for_each_soc_ram(soc, clear_ram);
+    for(i = 0; i < soc->image_num; i++){
+        clear_image_dirty(soc->images[i]);
+    }
+    return 0;
+}
+
+static void drop_checkpoints(soc_t *soc, checkpoint_list_t *list, int num)
+{
+    int i;
+    for(i = num; i < list->num; i++){
+        destory_snapshot(&list->checkpoints[i].snapshot);
+    }
+    list->num = num;
+    list->next_cycle = list->interval != 0 ? soc->cpu[0]->cycle + list->interval : CHECKPOINT_NEVER;
+    /* the input after now is given again, if it comes */
+    list->inputs->size = find_input(list->inputs, soc->cpu[0]->cycle);
+}
+
+int restore_checkpoint(soc_t *soc, checkpoint_list_t *list, int index)
+{
+    int retval = load_checkpoint(soc, list, index);
+    if(retval < 0){
+        return retval;
+    }
+    drop_checkpoints(soc, list, index + 1);
+    /* the program calls the host again from here */
+    if(soc->semihost != NULL){
+        semihost_resume(soc->semihost, soc->cpu[0]->cycle);
+    }
+    return 0;
+}
+
+/*
+ * Run the first core again from checkpoints[index] until its cycle reaches end. The
+ * kept peripheral input is played at the cycles it came at, and the later checkpoints
+ * are applied when their cycle comes, so what the debugger changed in between is
+ * brought back too. Returns 1 and the start cycle of the last instruction that
+ * matched, 0 if none did.
+ */
+static int rerun_checkpoint(soc_t *soc, checkpoint_list_t *list, int index, cycle_t end,
+                            rerun_match_t match, void *data, cycle_t *last)
+{
+    cpu_t *cpu = soc->cpu[0];
+    config_t config = soc->config;
+    replay_t *replay = soc->replay;
+    cycle_t freq_hz = soc->pacing.freq_hz;
+    int next, retval, found = 0;
+
+    /* nothing from outside, no pacing and no new checkpoints while running again. What
+       the program sends out was sent the first time, semihosting gives back the results
+       it gave then and the input comes from the kept log. */
+    soc->config.gdb_debug = FALSE;
+    soc->config.client = FALSE;
+    soc->checkpoints = NULL;
+    soc->replay = NULL;
+    soc->rerunning = TRUE;
+    pacing_init(&soc->pacing, 0, cpu->cycle);
+
+    retval = load_checkpoint(soc, list, index);
+    if(retval >= 0){
+        soc->replay = create_memory_replay(list->inputs, cpu->cycle);
+        retval = soc->replay != NULL ? 0 : -ERROR_CREATE;
+    }
+    if(soc->semihost != NULL){
+        semihost_rerun(soc->semihost, cpu->cycle);
+    }
+    for(next = index + 1; retval >= 0; ){
+        while(next < list->num && list->checkpoints[next].cycle <= cpu->cycle){
+            retval = restore_soc(soc, list->checkpoints[next++].snapshot);
+            if(retval < 0){
+                goto out;
+            }
+        }
+        if(cpu->cycle >= end){
+            break;
+        }
+
+        cycle_t start = cpu->cycle;
+        uint32_t start_pc = cpu->get_raw_pc(cpu);
+        cpu->run_info.halting = FALSE;
+        run_cpu(soc, cpu);
+        if(match != NULL && match(soc, start, start_pc, data)){
+            *last = start;
+            found = 1;
+        }
+    }
+
+out:
+    destory_replay(&soc->replay);
+    soc->replay = replay;
+    soc->config = config;
+    soc->checkpoints = list;
+    soc->rerunning = FALSE;
+    if(soc->semihost != NULL){
+        semihost_resume(soc->semihost, cpu->cycle);
+    }
+    pacing_init(&soc->pacing, freq_hz, cpu->cycle);
+    return retval < 0 ? retval : found;
+}
+
+int rewind_checkpoint(soc_t *soc, checkpoint_list_t *list, cycle_t cycle, rerun_match_t match, void *data)
+{
+    int hi = find_checkpoint(list, cycle - 1);
+    int lo, width, retval;
+    cycle_t end = cycle, last;
+
+    if(cycle == 0 || hi < 0){
+        return 0;
+    }
+    /* the window before cycle grows twice as long each time nothing matches */
+    for(width = 1; ; width *= 2){
+        lo = hi - width + 1 < 0 ? 0 : hi - width + 1;
+        retval = rerun_checkpoint(soc, list, lo, end, match, data, &last);
+        if(retval < 0){
+            return retval;
+        }
+        if(retval > 0){
+            retval = rerun_checkpoint(soc, list, lo, last, NULL, NULL, NULL);
+            if(retval >= 0){
+                retval = 1;
+            }
+            break;
+        }
+        if(lo == 0){
+            retval = rerun_checkpoint(soc, list, 0, list->checkpoints[0].cycle, NULL, NULL, NULL);
+            break;
+        }
+        end = list->checkpoints[lo].cycle;
+        hi = lo - 1;
+    }
+
+    /* the run goes on from here */
+    drop_checkpoints(soc, list, find_checkpoint(list, soc->cpu[0]->cycle) + 1);
+    return retval;
+}
+
+/* file format: count, then size and data of every snapshot */
+int save_checkpoint_file(checkpoint_list_t *list, int index, char *path)
+{
+    int i;
+    if(index < 0 || index >= list->num){
+        return -ERROR_SNAPSHOT;
+    }
+
+    FILE *file = fopen(path, "wb");
+    if(file == NULL){
+        LOG(LOG_ERROR, "save_checkpoint_file: can't open %s\n", path);
+        return -ERROR_INVALID_PATH;
+    }
+    uint32_t count = index + 1;
+    fwrite(&count, sizeof(count), 1, file);
+    for(i = 0; i <= index; i++){
+        snapshot_t *snapshot = list->checkpoints[i].snapshot;
+        uint64_t size = snapshot->size;
+        fwrite(&size, sizeof(size), 1, file);
+        fwrite(snapshot->data, 1, snapshot->size, file);
+    }
+    int retval = ferror(file) ? -ERROR_CREATE : 0;
+    fclose(file);
+    return retval;
+}
+
+int restore_checkpoint_file(soc_t *soc, char *path)
+{
+    uint32_t count, i;
+    uint64_t size;
+    int retval = -ERROR_SNAPSHOT;
+
+    FILE *file = fopen(path, "rb");
+    if(file == NULL){
+        LOG(LOG_ERROR, "restore_checkpoint_file: can't open %s\n", path);
+        return -ERROR_INVALID_PATH;
+    }
+    snapshot_t *snapshot = create_snapshot();
+    if(snapshot == NULL){
+        retval = -ERROR_CREATE;
+        goto snapshot_null;
+    }
+
+    if(fread(&count, sizeof(count), 1, file) != 1){
+        goto read_fail;
+    }
+    for(i = 0; i < count; i++){
+        if(fread(&size, sizeof(size), 1, file) != 1){
+            goto read_fail;
+        }
+        /* reuse the buffer of the one before */
+        snapshot->size = 0;
+        uint8_t *data = snapshot_reserve(snapshot, size);
+        if(data == NULL || fread(data, 1, size, file) != size){
+            goto read_fail;
+        }
+        if(restore_soc(soc, snapshot) < 0){
+            goto read_fail;
+        }
+    }
+    retval = 0;
+
+read_fail:
+    destory_snapshot(&snapshot);
+snapshot_null:
+    fclose(file);
+    return retval;
+}
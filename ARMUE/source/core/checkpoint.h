@@ -0,0 +1,66 @@
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include "soc.h"
+#include "snapshot.h"
+
+/* cycles between checkpoints when a debugger is attached, for reverse execution */
+#define CHECKPOINT_DEBUG_INTERVAL   100000
+/* the oldest CHECKPOINT_FULL_EVERY are dropped when the list is full */
+#define CHECKPOINT_MAX_NUM          256
+#define CHECKPOINT_FULL_EVERY       64
+
+typedef struct checkpoint_t{
+    cycle_t cycle;          // of the first core
+    bool_t full;
+    snapshot_t *snapshot;
+}checkpoint_t;
+
+/* Every CHECKPOINT_FULL_EVERY-th checkpoint, checkpoints[0] among them, is a full
+   snapshot. The others hold the cpu, NVIC and peripheral state in full but only
+   the RAM pages written since the one before. The peripheral input applied since
+   checkpoints[0] is kept in the format of a replay log, running again plays it. */
+typedef struct checkpoint_list_t{
+    int num;
+    int capacity;
+    checkpoint_t *checkpoints;
+    cycle_t interval;       // cycles between checkpoints, 0 to take them by hand only
+    cycle_t next_cycle;
+    snapshot_t *inputs;
+}checkpoint_list_t;
+
+/* starts tracking the written RAM pages and takes checkpoints[0] */
+checkpoint_list_t* create_checkpoint_list(soc_t *soc, cycle_t interval);
+void destory_checkpoint_list(soc_t *soc, checkpoint_list_t **list);
+int take_checkpoint(soc_t *soc, checkpoint_list_t *list);
+int find_checkpoint(checkpoint_list_t *list, cycle_t cycle);
+/* the checkpoints after index are dropped, the run goes on from index */
+int restore_checkpoint(soc_t *soc, checkpoint_list_t *list, int index);
+
+/* Step back to the start of the last instruction of the first core before cycle that
+   matches, by running again from the checkpoints. Returns 1 when found, 0 when history
+   runs out first, which leaves the soc at checkpoints[0]. The checkpoints after the new
+   cycle are dropped. */
+typedef bool_t (*rerun_match_t)(soc_t *soc, cycle_t start, uint32_t start_pc, void *data);
+int rewind_checkpoint(soc_t *soc, checkpoint_list_t *list, cycle_t cycle, rerun_match_t match, void *data);
+
+/* checkpoints[0..index] in one file, restore_checkpoint_file applies them in turn */
+int save_checkpoint_file(checkpoint_list_t *list, int index, char *path);
+int restore_checkpoint_file(soc_t *soc, char *path);
+
+/* called when all the cores are stopped, only a compare unless a checkpoint is due */
+static inline void check_checkpoint(soc_t *soc)
+{
+    checkpoint_list_t *list = soc->checkpoints;
+    if(list != NULL && soc->cpu[0]->cycle >= list->next_cycle){
+        take_checkpoint(soc, list);
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
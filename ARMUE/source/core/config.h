@@ -11,9 +11,27 @@ typedef struct config_t{
     bool_t gdb_debug;
     bool_t client;
     char *pipe_name;
+    cycle_t clock_freq;     /* real-time pacing target in Hz, 0 to run free */
+    int cpu_num;            /* cores of the soc, 0 for single core */
+    cycle_t sync_quantum;   /* cycles between synchronizations of the cores */
+    cycle_t checkpoint_interval;    /* cycles between checkpoints, 0 for none */
+    char *checkpoint_path;          /* where the last checkpoint is saved at exit, NULL for nowhere */
+    char *record_path;      /* log of the external input to record, NULL for none */
+    char *replay_path;      /* log of the external input to replay, NULL for none */
+    char *boot_path;        /* boot snapshot to resume from, or to take when the boot is done */
+    bool_t boot_at_pc;      /* the boot is done at boot_pc rather than at boot_cycle */
+    uint32_t boot_pc;
+    cycle_t boot_cycle;     /* 0 and no boot_at_pc to only resume */
+    char *uart_console;     /* host sink of UART0: stdio, file:<path> or pty, NULL for the monitor */
+    bool_t semihosting;     /* BKPT 0xAB calls the host rather than stopping */
+    char *svd_path;         /* CMSIS-SVD file of the peripherals to stub, NULL for none */
+    char *plugin_dir;       /* directory of the peripheral plug-ins, NULL for none */
+    char *spi_flash;        /* image of the SPI flash on SSP0, NULL for none */
+    char *sd_card;          /* image of the SD card on SSP1, NULL for none */
 }config_t;
 
 
+/* Options from the command line. Every soc starts with a copy of it in soc_t. */
 extern config_t config;
 
 #ifdef __cplusplus
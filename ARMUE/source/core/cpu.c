@@ -1,4 +1,5 @@
 #include "cpu.h"
+#include "timer.h"
 #include <stdlib.h>
 
 cpu_list_t* create_cpu_list()
@@ -184,6 +185,9 @@ error_code_t dealloc_cpu(cpu_t** cpu)
         return ERROR_NULL_POINTER;
 
     destory_memory_map(&(*cpu)->memory_map);
+    destory_timer_queue(&(*cpu)->timer_queue);
+    destory_vector_exception(&(*cpu)->exceptions);
+    destory_vector_exception(&(*cpu)->GIC);
     free(*cpu);
     *cpu = NULL;
 
@@ -230,14 +234,16 @@ int validate_cpu(cpu_t* cpu)
     return 1;
 }
 
+/* the devices of the other cores read it to schedule the timers of this one */
 void add_cycle(cpu_t *cpu)
 {
-    cpu->cycle++;
+    __atomic_store_n(&cpu->cycle, cpu->cycle + 1 + cpu->run_info.extra_cycles, __ATOMIC_RELAXED);
+    cpu->run_info.extra_cycles = 0;
 }
 
 bool_t reach_check_point(cpu_t *cpu)
 {
-    cpu->cycle >= cpu->next_check_point;
+    return cpu->cycle >= cpu->next_check_point;
 }
 
 void updata_check_point(cpu_t *cpu, cycle_t interval)
@@ -21,12 +21,16 @@ typedef struct ins_t{
 }ins_t;
 
 struct cpu_t;
+struct timer_queue_t;
+struct snapshot_t;
+struct semihost_t;
 typedef uint32_t (*cpu_fetch32_func_t)(struct cpu_t* cpu);
 typedef ins_t (*cpu_decode_func_t)(struct cpu_t* cpu, void* opcode);
 typedef void (*cpu_exec_func_t)(struct cpu_t* cpu, ins_t opcode);
 typedef int (*cpu_startup_func_t)(struct cpu_t* cpu);
 typedef uint32_t (*cpu_get_pc_func_t)(struct cpu_t *cpu);
 typedef void (*cpu_set_pc_func_t)(uint32_t val, struct cpu_t *cpu);
+typedef int (*cpu_snapshot_func_t)(struct cpu_t *cpu, struct snapshot_t *snapshot);
 
 typedef struct cpu_list_t
 {
@@ -42,6 +46,8 @@ typedef struct run_info_t
     void *global_info;
     int ins_type;
     bool_t halting;
+    /* cycles the current instruction takes beyond the first one */
+    int extra_cycles;
 }run_info_t;
 
 
@@ -54,7 +60,7 @@ typedef struct cpu_t
     void *regs;
     void *system_info;
     void *instruction_data;
-    list_t *timer_list;
+    struct timer_queue_t *timer_queue;
     cycle_t cycle;
     cycle_t next_check_point;
 
@@ -77,6 +83,7 @@ typedef struct cpu_t
     memory_map_t* io_space;
 
     void* module;        // which cpu module it belongs to
+    struct semihost_t *semihost;    // serves the semihosting calls, NULL if they are breakpoints
 
     /* interfaces */
     cpu_startup_func_t startup;
@@ -85,6 +92,9 @@ typedef struct cpu_t
     cpu_exec_func_t excute;
     cpu_get_pc_func_t get_raw_pc;
     cpu_set_pc_func_t set_raw_pc;
+    /* save and restore the architecture state, see snapshot.h */
+    cpu_snapshot_func_t snapshot;
+    cpu_snapshot_func_t restore;
 
     // cpu list
     struct cpu_t* next_cpu;
@@ -20,6 +20,8 @@ typedef enum
     ERROR_FETCH,
     ERROR_NO_START_ROM,
     ERROR_SOC_STARTUP,
+    ERROR_SNAPSHOT,
+    ERROR_SVD,
 }error_code_t;
 
 #define LOG_NONE             4
@@ -33,6 +33,9 @@ controller_null:
 void destory_vector_exception(vector_exception_t **exceptions)
 {
     vector_exception_t* controller = *exceptions;
+    if(controller == NULL){
+        return;
+    }
     free(controller->prio_table);
     free(controller->vector_table);
     free(controller);
@@ -17,6 +17,8 @@ typedef struct vector_exception_t
     void *controller_info;
 
     int (*throw_exception)(int vector_num, struct vector_exception_t* controller);
+    /* the exception is no longer pending, for the interrupts that follow a level */
+    int (*clear_exception)(int vector_num, struct vector_exception_t* controller);
     int (*check_exception)(struct cpu_t* cpu);
     int (*handle_exception)(int vector_num, struct cpu_t* cpu);
 }vector_exception_t;
@@ -62,6 +62,9 @@ memory_region_t* find_memory_region(memory_map_t *memory, uint32_t address, int
 
     bstree_node_t *node = bstree_find_node(memory->map, &region, memory_region_compare);
     if(node == NULL){
+        if(memory->shared != NULL){
+            return find_memory_region(memory->shared, address, size);
+        }
         return NULL;
     }
     return (memory_region_t*)node->data;
@@ -100,34 +103,29 @@ int general_rom_read(uint32_t offset, uint8_t* buffer, int size, memory_region_t
     rom_t* rom = (rom_t*)region->region_data;
     uint32_t data32;
     int i;
+    pthread_mutex_lock(&rom->lock);
     switch(size){
     case 4:
         data32 = fetch_rom_data32(offset, rom);
         memcpy(buffer, &data32, 4);
-        return 4;
+        i = 4;
+        break;
     default:
-        for(i = 0; i < size; i++){
-            buffer[i] = fetch_rom_data8(offset+i, rom);
-            if(buffer[i] == EOF){
-                break;
-            }
-        }
-        return i;
+        i = read_rom_block(rom, offset, buffer, size);
+        break;
     }
+    pthread_mutex_unlock(&rom->lock);
+    return i;
 }
 
 /* call back function for rom's write */
 int general_rom_write(uint32_t offset, uint8_t *buffer, int size, memory_region_t* region)
 {
     rom_t *rom = (rom_t*)region->region_data;
-    int retval, i;
-    for(i = 0; i < size; i++){
-        retval = send_rom_data8(offset+i, buffer[i], rom);
-        if(retval == EOF){
-            break;
-        }
-    }
-    return i;
+    pthread_mutex_lock(&rom->lock);
+    int retval = write_rom_block(rom, offset, buffer, size);
+    pthread_mutex_unlock(&rom->lock);
+    return retval;
 }
 
 int setup_memory_map_rom(memory_map_t* memory, rom_t* rom, int base_addr)
@@ -144,6 +142,104 @@ int setup_memory_map_rom(memory_map_t* memory, rom_t* rom, int base_addr)
     return add_memroy_region(memory, rom_region);
 }
 
+memory_watch_t* add_memory_watch(memory_map_t *memory, uint32_t addr, uint32_t size, void (*hit)(uint32_t, int, void*), void *data)
+{
+    memory_watch_t *watch = NULL;
+    int i;
+
+    /* watches always live in the shared map so that they see the writes of every core */
+    memory = shared_memory_map(memory);
+    /* reuse a deleted slot first */
+    for(i = 0; i < memory->watch_num; i++){
+        if(memory->watch[i].hit == NULL){
+            watch = &memory->watch[i];
+            break;
+        }
+    }
+    if(watch == NULL){
+        if(memory->watch_num >= MEM_WATCH_MAX){
+            return NULL;
+        }
+        watch = &memory->watch[memory->watch_num++];
+    }
+
+    watch->hit = hit;
+    watch->data = data;
+    set_memory_watch(watch, addr, size);
+    return watch;
+}
+
+/* move a watch to another address range, used when the watched object is relocated */
+void set_memory_watch(memory_watch_t *watch, uint32_t addr, uint32_t size)
+{
+    watch->low_addr = addr;
+    watch->high_addr = addr + size;
+}
+
+/* the slot is only emptied so that the other watches keep their addresses */
+void delete_memory_watch(memory_map_t *memory, memory_watch_t *watch)
+{
+    memory = shared_memory_map(memory);
+    set_memory_watch(watch, 0, 0);
+    watch->hit = NULL;
+    while(memory->watch_num > 0 && memory->watch[memory->watch_num-1].hit == NULL){
+        memory->watch_num--;
+    }
+}
+
+/* the range is rounded out to whole granules */
+void set_memory_wait_states(memory_map_t *memory, uint32_t addr, uint32_t size, int wait_states)
+{
+    if(size == 0){
+        return;
+    }
+    uint32_t first = addr >> MEM_WAIT_GRANULE_SHIFT;
+    uint32_t last = (addr + size - 1) >> MEM_WAIT_GRANULE_SHIFT;
+    uint32_t i;
+    for(i = first; i <= last; i++){
+        memory->wait_states[i] = wait_states;
+    }
+}
+
+static void check_memory_watch(uint32_t addr, int size, memory_map_t *memory)
+{
+    int i;
+    for(i = 0; i < memory->watch_num; i++){
+        memory_watch_t *watch = &memory->watch[i];
+        if(watch->hit != NULL && addr < watch->high_addr && addr + size > watch->low_addr){
+            watch->hit(addr, size, watch->data);
+        }
+    }
+}
+
+/* the devices of a multi-core soc, RAM and ROM look after themselves */
+static inline pthread_mutex_t* region_lock(memory_region_t *region, memory_map_t *memory)
+{
+    if(region->type == MEMORY_REGION_RAM || region->type == MEMORY_REGION_ROM){
+        return NULL;
+    }
+    return shared_memory_map(memory)->device_lock;
+}
+
+static int region_access(memory_region_t *region, uint32_t offset, uint8_t *buffer, int size, memory_map_t *memory, int type)
+{
+    pthread_mutex_t *lock = region_lock(region, memory);
+    int retval;
+
+    if(lock != NULL){
+        pthread_mutex_lock(lock);
+    }
+    if(type == MEM_READ){
+        retval = region->read(offset, buffer, size, region);
+    }else{
+        retval = region->write(offset, buffer, size, region);
+    }
+    if(lock != NULL){
+        pthread_mutex_unlock(lock);
+    }
+    return retval;
+}
+
 /* The main memory write routine */
 int write_memory(uint32_t addr, uint8_t* buffer, int size, memory_map_t* memory)
 {
@@ -154,7 +250,53 @@ int write_memory(uint32_t addr, uint8_t* buffer, int size, memory_map_t* memory)
     }
     uint32_t offset = addr - region->base_addr;
 
-    return region->write(offset, buffer, size, region);
+    int retval = region_access(region, offset, buffer, size, memory, MEM_WRITE);
+    memory_map_t *watched = shared_memory_map(memory);
+    if(watched->watch_num != 0 && retval > 0){
+        check_memory_watch(addr, size, watched);
+    }
+    return retval;
+}
+
+/* A block may cross regions. RAM and ROM take the part they hold in one call,
+   the other regions are accessed a byte at a time. */
+static int access_memory_block(uint32_t addr, uint8_t *buffer, int size, memory_map_t *memory, int type)
+{
+    int done = 0, retval;
+
+    while(done < size){
+        memory_region_t *region = find_address(memory, addr + done);
+        if(region == NULL){
+            LOG(LOG_ERROR, "Can't access address 0x%x\n", addr + done);
+            return -1;
+        }
+        uint32_t offset = addr + done - region->base_addr;
+        int len = 1;
+        if(region->type == MEMORY_REGION_RAM || region->type == MEMORY_REGION_ROM){
+            len = region->size - offset < (uint32_t)(size - done) ? (int)(region->size - offset) : size - done;
+        }
+        retval = region_access(region, offset, buffer + done, len, memory, type);
+        if(retval <= 0){
+            return -1;
+        }
+        done += retval;
+    }
+    return done;
+}
+
+int read_memory_block(uint32_t addr, uint8_t *buffer, int size, memory_map_t *memory)
+{
+    return access_memory_block(addr, buffer, size, memory, MEM_READ);
+}
+
+int write_memory_block(uint32_t addr, uint8_t *buffer, int size, memory_map_t *memory)
+{
+    int retval = access_memory_block(addr, buffer, size, memory, MEM_WRITE);
+    memory_map_t *watched = shared_memory_map(memory);
+    if(watched->watch_num != 0 && retval > 0){
+        check_memory_watch(addr, retval, watched);
+    }
+    return retval;
 }
 
 /* The main memory read routine */
@@ -167,7 +309,7 @@ int read_memory(uint32_t addr, uint8_t* buffer, int size, memory_map_t* memory)
     }
 
     uint32_t offset = addr - region->base_addr;
-    int retval = region->read(offset, buffer, size, region);
+    int retval = region_access(region, offset, buffer, size, memory, MEM_READ);
     if(retval < 0){
         LOG(LOG_ERROR, "Can't read address 0x%x\n", addr);
     }
@@ -177,14 +319,16 @@ int read_memory(uint32_t addr, uint8_t* buffer, int size, memory_map_t* memory)
 int general_ram_read(uint32_t offset, uint8_t* buffer, int size, memory_region_t* ram_region)
 {
     ram_t* ram = (ram_t*)ram_region->region_data;
-    memcpy(buffer, ram->data+offset, size);
+    ram_read(ram, offset, buffer, size);
     return size;
 }
 
 int general_ram_write(uint32_t offset, uint8_t* buffer, int size, memory_region_t* ram_region)
 {
     ram_t* ram = (ram_t*)ram_region->region_data;
-    memcpy(ram->data+offset, buffer, size);
+    if(ram_write(ram, offset, buffer, size) < 0){
+        return -1;
+    }
     return size;
 }
 
@@ -209,6 +353,53 @@ memory_map_t* create_memory_map()
     return map;
 }
 
+/* an empty map backed by the shared one, inheriting its wait states */
+memory_map_t* create_private_memory_map(memory_map_t *shared)
+{
+    memory_map_t* map = create_memory_map();
+    if(map == NULL){
+        return NULL;
+    }
+    map->shared = shared;
+    memcpy(map->wait_states, shared->wait_states, sizeof(map->wait_states));
+    return map;
+}
+
+/* the regions are freed with the map, what they hold stays with the owner */
+static void destory_region_tree(bstree_node_t *node)
+{
+    if(node == NULL){
+        return;
+    }
+    destory_region_tree(node->lchild);
+    destory_region_tree(node->rchild);
+    free(node->data);
+    free(node);
+}
+
+static int walk_region_tree(bstree_node_t *node, memory_region_func_t func, void *data)
+{
+    if(node == NULL){
+        return 0;
+    }
+    int retval = walk_region_tree(node->lchild, func, data);
+    if(retval < 0){
+        return retval;
+    }
+    retval = func((memory_region_t*)node->data, data);
+    if(retval < 0){
+        return retval;
+    }
+    return walk_region_tree(node->rchild, func, data);
+}
+
+/* call func on every region of the map (not the shared one) by address order,
+   stop when it returns negative */
+int for_each_memory_region(memory_map_t *memory, memory_region_func_t func, void *data)
+{
+    return walk_region_tree(memory->map, func, data);
+}
+
 error_code_t destory_memory_map(memory_map_t** map)
 {
     if(map == NULL || *map == NULL){
@@ -216,7 +407,7 @@ error_code_t destory_memory_map(memory_map_t** map)
     }
 
     /* destory contents */
-    // TODO
+    destory_region_tree((*map)->map);
 
     free(*map);
     *map = NULL;
@@ -8,6 +8,7 @@ extern "C"{
 #include "error_code.h"
 #include "ram.h"
 #include "rom.h"
+#include <pthread.h>
 
 typedef enum{
     MEMORY_REGION_UNKNOW,
@@ -24,10 +25,32 @@ typedef enum{
 #define MEM_READ    1
 #define MEM_WRITE   2
 
+/* wait states are kept per 16MB granule so that looking them up costs an array read */
+#define MEM_WAIT_GRANULE_SHIFT 24
+#define MEM_WAIT_TABLE_SIZE (1 << (32 - MEM_WAIT_GRANULE_SHIFT))
+
+#define MEM_WATCH_MAX 4
+
+/* A watch calls hit() after every successful write overlapping [low_addr, high_addr) */
+typedef struct memory_watch_t{
+    uint32_t low_addr;
+    uint32_t high_addr;
+    void (*hit)(uint32_t addr, int size, void *data);
+    void *data;
+}memory_watch_t;
+
 #include "bstree.h"
-typedef struct{
+typedef struct memory_map_t{
     uint32_t size_total;
     bstree_node_t *map;
+    /* A private map (e.g. one core's private peripheral bus) falls back to the
+       shared map for the addresses it doesn't have */
+    struct memory_map_t *shared;
+    int watch_num;
+    memory_watch_t watch[MEM_WATCH_MAX];
+    uint8_t wait_states[MEM_WAIT_TABLE_SIZE];
+    /* the shared map of a multi-core soc: held over the accesses to anything but RAM and ROM */
+    pthread_mutex_t *device_lock;
 }memory_map_t;
 
 typedef struct memory_region_t{
@@ -43,6 +66,13 @@ typedef struct memory_region_t{
 int setup_memory_map_rom(memory_map_t* memory, rom_t* rom, int base_addr);
 int setup_memory_map_ram(memory_map_t* memory, ram_t* ram, int base_addr);
 memory_map_t* create_memory_map();
+memory_map_t* create_private_memory_map(memory_map_t *shared);
+
+/* the map seen by every core, where the peripherals of the soc belong */
+static inline memory_map_t* shared_memory_map(memory_map_t *memory)
+{
+    return memory->shared != NULL ? memory->shared : memory;
+}
 error_code_t destory_memory_map(memory_map_t** map);
 
 //int addr_in_rom(uint32_t addr, memory_map_t* map);
@@ -50,9 +80,24 @@ error_code_t destory_memory_map(memory_map_t** map);
 memory_region_t* find_memory_region(memory_map_t* memory, uint32_t address, int size);
 #define find_address(memory, address) find_memory_region(memory, address, 1)
 memory_region_t* request_memory_region(memory_map_t *memory, uint32_t address, int size);
+typedef int (*memory_region_func_t)(memory_region_t *region, void *data);
+int for_each_memory_region(memory_map_t *memory, memory_region_func_t func, void *data);
+
+memory_watch_t* add_memory_watch(memory_map_t *memory, uint32_t addr, uint32_t size, void (*hit)(uint32_t, int, void*), void *data);
+void set_memory_watch(memory_watch_t *watch, uint32_t addr, uint32_t size);
+void delete_memory_watch(memory_map_t *memory, memory_watch_t *watch);
+
+void set_memory_wait_states(memory_map_t *memory, uint32_t addr, uint32_t size, int wait_states);
+static inline int memory_wait_states(memory_map_t *memory, uint32_t addr)
+{
+    return memory->wait_states[addr >> MEM_WAIT_GRANULE_SHIFT];
+}
 
 int read_memory(uint32_t addr, uint8_t* buffer, int size, memory_map_t* memory);
 int write_memory(uint32_t addr, uint8_t* buffer, int size, memory_map_t* memory);
+/* copy size bytes in one go, for transfers bigger than a word */
+int read_memory_block(uint32_t addr, uint8_t *buffer, int size, memory_map_t *memory);
+int write_memory_block(uint32_t addr, uint8_t *buffer, int size, memory_map_t *memory);
 
 #ifdef __cplusplus
 }
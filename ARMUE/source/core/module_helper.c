@@ -6,6 +6,11 @@
 static module_list_t *g_cpu_module_list = NULL;
 static module_list_t *g_peripheral_module_list = NULL;
 
+/* The module lists are shared by all the socs of the process. Registering is counted
+   so that every user can register and unregister on its own. */
+static pthread_mutex_t g_module_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_module_users = 0;
+
 module_list_t* create_module_list()
 {
     module_list_t* list = (module_list_t*)calloc(1, sizeof(module_list_t));
@@ -22,6 +27,7 @@ module_t* create_module()
     if(module == NULL){
         return NULL;
     }
+    pthread_mutex_init(&module->lock, NULL);
 
     return module;
 }
@@ -145,6 +151,7 @@ error_code_t destory_module(module_t** module)
     if(module == NULL || *module == NULL)
         return ERROR_NULL_POINTER;
 
+    pthread_mutex_destroy(&(*module)->lock);
     free(*module);
     *module = NULL;
 
@@ -187,6 +194,15 @@ error_code_t set_module_unregister(module_t *module, unregister_t unregister)
     return SUCCESS;
 }
 
+error_code_t set_module_path(module_t* module, const char* path)
+{
+    if(strlen(path) >= MODULE_PATH_LENGTH){
+        return ERROR_INVALID_PATH;
+    }
+    strcpy(module->path, path);
+    return SUCCESS;
+}
+
 error_code_t register_prepare()
 {
 
@@ -208,10 +224,11 @@ error_code_t register_module_helper(module_t* module)
     if(module == NULL){
         return ERROR_NULL_POINTER;
     }
+    /* a peripheral module creates its contents itself */
     if( module->name == NULL ||
         module->type == MODULE_INVALID ||
-        module->create_content == NULL ||
-        module->destory_content == NULL ||
+        (module->type == MODULE_CPU && module->create_content == NULL) ||
+        (module->type == MODULE_CPU && module->destory_content == NULL) ||
         module->unregister == NULL){
         if(module->name != NULL){
             LOG(LOG_ERROR, "register_module_helper: register module %s fail\n", module->name);
@@ -232,9 +249,8 @@ error_code_t register_module_helper(module_t* module)
         // add module to cpu module list
         break;
     case MODULE_PERIPHERAL:
-        //module->peripheral_list = create_peripheral_list();
-        //add_module_to_tail(g_peripheral_module_list, module);
         // add module to peripheral module list
+        add_module_to_tail(g_peripheral_module_list, module);
         break;
     default:
         return ERROR_INVALID_MODULE;
@@ -260,8 +276,7 @@ error_code_t unregister_module_helper(module_t* module)
 
         break;
     case MODULE_PERIPHERAL:
-        //destory_peripheral_list(module->peripheral_list);
-
+        delete_module(g_peripheral_module_list, module);
         break;
     default:
         break;
@@ -278,12 +293,15 @@ error_code_t validate_module_file(_TCHAR* module_path)
 /****** Register all the modules to the system ******/
 void register_all_modules(){
 
-    register_prepare();
-
-    // register the module, NEED to be replaced by dll later
-    extern error_code_t register_armcm3_module();
-    register_armcm3_module();
+    pthread_mutex_lock(&g_module_lock);
+    if(g_module_users++ == 0){
+        register_prepare();
 
+        // register the module, NEED to be replaced by dll later
+        extern error_code_t register_armcm3_module();
+        register_armcm3_module();
+    }
+    pthread_mutex_unlock(&g_module_lock);
 }
 
 module_t* get_first_module(module_list_t* list)
@@ -309,7 +327,7 @@ error_code_t unregister_modules_by_list(module_list_t* list)
     if(module != NULL){
         do{
             next_module = get_next_module(module);
-            module->unregister();
+            module->unregister(module);
             module = next_module;
         }while(module != NULL);
     }
@@ -319,21 +337,28 @@ error_code_t unregister_modules_by_list(module_list_t* list)
 
 error_code_t unregister_all_modules()
 {
-    // unregister cpu modules
-    unregister_modules_by_list(g_cpu_module_list);
+    pthread_mutex_lock(&g_module_lock);
+    if(g_module_users > 0 && --g_module_users == 0){
+        // unregister cpu modules
+        unregister_modules_by_list(g_cpu_module_list);
 
-    // unregister peripheral modules
-    unregister_modules_by_list(g_peripheral_module_list);
+        // unregister peripheral modules
+        unregister_modules_by_list(g_peripheral_module_list);
+    }
+    pthread_mutex_unlock(&g_module_lock);
 
     return SUCCESS;
 }
 
 
-module_t* find_module(char* module_name)
+static module_t* find_module_in_list(module_list_t* list, char* module_name)
 {
-    // find cpu_module
+    if(list == NULL){
+        return NULL;
+    }
+
     module_t* next_module;
-    module_t* module = get_first_module(g_cpu_module_list);
+    module_t* module = get_first_module(list);
     if(module != NULL){
         do{
             next_module = get_next_module(module);
@@ -344,18 +369,37 @@ module_t* find_module(char* module_name)
         }while(module != NULL);
     }
 
-    // find peripheral modules
-    module = get_first_module(g_peripheral_module_list);
+    return NULL;
+}
 
-    if(module != NULL){
-        do{
-            next_module = get_next_module(module);
-            if(strcmp(module_name, module->name) == 0){
-                return module;
-            }
-            module = next_module;
-        }while(module != NULL);
+module_t* find_module(char* module_name)
+{
+    pthread_mutex_lock(&g_module_lock);
+
+    // find cpu_module
+    module_t* module = find_module_in_list(g_cpu_module_list, module_name);
+
+    // find peripheral modules
+    if(module == NULL){
+        module = find_module_in_list(g_peripheral_module_list, module_name);
     }
 
-    return NULL;
+    pthread_mutex_unlock(&g_module_lock);
+    return module;
+}
+
+int for_each_module(module_type_t type, int (*func)(module_t *module, void *data), void *data)
+{
+    module_list_t *list = type == MODULE_CPU ? g_cpu_module_list : g_peripheral_module_list;
+    module_t *module;
+    int retval = 0;
+
+    pthread_mutex_lock(&g_module_lock);
+    if(list != NULL){
+        for(module = get_first_module(list); module != NULL && retval >= 0; module = get_next_module(module)){
+            retval = func(module, data);
+        }
+    }
+    pthread_mutex_unlock(&g_module_lock);
+    return retval;
 }
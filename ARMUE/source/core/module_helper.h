@@ -2,6 +2,7 @@
 #define _MODULE_HELPER_H_
 
 #include <tchar.h>
+#include <pthread.h>
 #include "cpu.h"
 #include "soc.h"
 #include "peripheral.h"
@@ -18,15 +19,15 @@ typedef enum
 }module_type_t;
 
 
+struct module_t;
 typedef void* (*create_func_t)(void);
 typedef int (*init_cpu_func_t)(struct cpu_t *cpu, struct soc_conf_t *config);
 
 typedef void (*destory_func_t)(void** content);
 typedef void (*destory_cpu_func_t)(cpu_t** cpu);
-typedef error_code_t (*unregister_t)(void);
+typedef error_code_t (*unregister_t)(struct module_t *module);
 
 
-struct module_t;
 typedef struct module_list_t
 {
     int count;
@@ -39,7 +40,7 @@ typedef struct module_t
     int module_id;                                // module id
     module_type_t type;                            // module type: cpu or peripheral
     char name[MODULE_NAME_LENGTH];                // name of the module
-    _TCHAR path[MODULE_PATH_LENGTH];            // where the module file stores, not use yet
+    _TCHAR path[MODULE_PATH_LENGTH];            // where the module file stores, empty if linked in
     union{
         cpu_list_t* cpu_list;
         void* content_list;
@@ -55,6 +56,7 @@ typedef struct module_t
         destory_func_t destory_content;
     };
     unregister_t unregister;
+    pthread_mutex_t lock;                        // protects the content list, socs may be created in parallel
 
     // module list
     struct module_t* next_module;
@@ -67,16 +69,19 @@ error_code_t    destory_module(module_t** module);
 
 
 error_code_t set_module_type(module_t* module, module_type_t type);
-error_code_t set_module_content(module_t* module, void* content);
+error_code_t set_module_content_list(module_t* module, void* content_list);
 error_code_t set_module_content_create(module_t* module, create_func_t create_func);
 error_code_t set_module_content_destory(module_t* module, destory_func_t destory_func);
 error_code_t set_module_name(module_t* module, char* name);
 error_code_t set_module_unregister(module_t *module, unregister_t unregister);
+error_code_t set_module_path(module_t* module, const char* path);
 
 error_code_t    register_prepare();
 void            register_all_modules();
 error_code_t    unregister_all_modules();
 module_t*        find_module(char* module_name);
+/* func returns <0 to stop, the modules can't be registered or unregistered from it */
+int for_each_module(module_type_t type, int (*func)(module_t *module, void *data), void *data);
 
 
 error_code_t register_module_helper(module_t* module);
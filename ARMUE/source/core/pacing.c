@@ -0,0 +1,68 @@
+#include "pacing.h"
+#include "error_code.h"
+#include <time.h>
+#include <errno.h>
+
+#define NS_PER_SEC 1000000000ull
+
+static uint64_t host_time_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NS_PER_SEC + now.tv_nsec;
+}
+
+/* host time at which cur_cycle is due, split to avoid overflowing 64 bits */
+static uint64_t cycle_due_ns(pacing_t *pacing, cycle_t cur_cycle)
+{
+    cycle_t elapsed = cur_cycle - pacing->base_cycle;
+    uint64_t sec = elapsed / pacing->freq_hz;
+    uint64_t rem = elapsed % pacing->freq_hz;
+    return pacing->base_ns + sec * NS_PER_SEC + rem * NS_PER_SEC / pacing->freq_hz;
+}
+
+/* freq_hz of 0 disables pacing */
+void pacing_init(pacing_t *pacing, cycle_t freq_hz, cycle_t cur_cycle)
+{
+    pacing->freq_hz = freq_hz;
+    pacing->total_lag_ns = 0;
+    if(freq_hz == 0){
+        pacing->quantum = 0;
+        pacing->next_check = ~(cycle_t)0;
+        return;
+    }
+
+    pacing->quantum = freq_hz / PACING_QUANTUM_PER_SEC;
+    if(pacing->quantum == 0){
+        pacing->quantum = 1;
+    }
+    pacing->base_cycle = cur_cycle;
+    pacing->base_ns = host_time_ns();
+    pacing->next_check = cur_cycle + pacing->quantum;
+}
+
+/* Sleep until the host clock catches up with cur_cycle. If the emulation falls behind
+   by more than PACING_MAX_LAG_NS (slow host, halted by gdb), the lag is reported and the
+   schedule restarts from now instead of running flat out to catch up. */
+void pacing_sync(pacing_t *pacing, cycle_t cur_cycle)
+{
+    uint64_t due = cycle_due_ns(pacing, cur_cycle);
+    uint64_t now = host_time_ns();
+
+    if(due > now){
+        struct timespec wake;
+        wake.tv_sec = due / NS_PER_SEC;
+        wake.tv_nsec = due % NS_PER_SEC;
+        /* only a signal wakes it early, any other error gives up the sleep */
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR);
+    }else if(now - due > PACING_MAX_LAG_NS){
+        pacing->total_lag_ns += now - due;
+        LOG(LOG_WARN, "pacing: %llu us behind %llu Hz at cycle %llu, %llu us lost in total\n",
+            (cycle_t)(now - due) / 1000, pacing->freq_hz, cur_cycle, (cycle_t)pacing->total_lag_ns / 1000);
+        pacing->base_cycle = cur_cycle;
+        pacing->base_ns = now;
+    }
+
+    /* a fast-forwarded cycle count has already slept above, just keep the quantum */
+    pacing->next_check = cur_cycle + pacing->quantum;
+}
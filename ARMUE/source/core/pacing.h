@@ -0,0 +1,39 @@
+#ifndef _PACING_H_
+#define _PACING_H_
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include "_types.h"
+
+#define PACING_QUANTUM_PER_SEC  1000    /* check the host clock every 1ms of emulated time */
+#define PACING_MAX_LAG_NS       100000000ull
+
+/* Pacing keeps cpu->cycle in step with a monotonic host clock at freq_hz.
+   When disabled next_check is never reached, so free running only costs a compare. */
+typedef struct pacing_t{
+    cycle_t freq_hz;
+    cycle_t quantum;
+    cycle_t next_check;
+    /* the emulated cycle and host time (ns) that the schedule counts from */
+    cycle_t base_cycle;
+    uint64_t base_ns;
+    uint64_t total_lag_ns;
+}pacing_t;
+
+void pacing_init(pacing_t *pacing, cycle_t freq_hz, cycle_t cur_cycle);
+void pacing_sync(pacing_t *pacing, cycle_t cur_cycle);
+
+static inline void check_pacing(pacing_t *pacing, cycle_t cur_cycle)
+{
+    if(cur_cycle >= pacing->next_check){
+        pacing_sync(pacing, cur_cycle);
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PACING_H_ */
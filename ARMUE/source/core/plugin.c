@@ -0,0 +1,554 @@
+#include "plugin.h"
+#include "armue_plugin.h"
+#include "module_helper.h"
+#include "memory_map.h"
+#include "peripheral.h"
+#include "snapshot.h"
+#include "timer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <dirent.h>
+#ifdef __linux__
+#include <dlfcn.h>
+#else
+#include <windows.h>
+#endif
+
+#ifdef __linux__
+#define PLUGIN_SUFFIX               ".so"
+#define plugin_open(path)           dlopen(path, RTLD_NOW | RTLD_LOCAL)
+#define plugin_symbol(handle, name) dlsym(handle, name)
+#define plugin_close(handle)        dlclose(handle)
+#else
+#define PLUGIN_SUFFIX               ".dll"
+#define plugin_open(path)           ((void*)LoadLibraryA(path))
+#define plugin_symbol(handle, name) ((void*)GetProcAddress((HMODULE)(handle), name))
+#define plugin_close(handle)        FreeLibrary((HMODULE)(handle))
+#endif
+
+/* the members a plug-in must have, the ones after them may be missing */
+#define PLUGIN_MIN_SIZE     (offsetof(armue_plugin_t, peripherals) + sizeof(void*))
+#define OPS_MIN_SIZE        (offsetof(armue_peripheral_ops_t, write) + sizeof(void*))
+
+/* the content of a plug-in module */
+typedef struct plugin_t{
+    void *handle;
+    const armue_plugin_t *desc;
+    armue_peripheral_ops_t *ops;    // copies of the plug-in's, zero past their size
+}plugin_t;
+
+struct plugin_peripheral_t;
+typedef struct plugin_event_t{
+    timer_t *timer;                 // NULL if not pending
+    bool_t armed;                   // scheduled since the timer matched
+    uint32_t id;
+    struct plugin_peripheral_t *peri;
+}plugin_event_t;
+
+/* an instance in a soc */
+typedef struct plugin_peripheral_t{
+    const armue_peripheral_ops_t *ops;
+    void *instance;
+    armue_host_t host;
+    soc_t *soc;
+    memory_region_t *region;
+    plugin_event_t events[ARMUE_PLUGIN_EVENT_MAX];
+}plugin_peripheral_t;
+
+/****** plug-in modules ******/
+static error_code_t unregister_plugin_module(module_t *module)
+{
+    plugin_t *plugin = (plugin_t*)module->content_list;
+
+    LOG(LOG_DEBUG, "unregister_plugin_module: unregister %s.\n", module->name);
+    unregister_module_helper(module);
+    plugin_close(plugin->handle);
+    free(plugin->ops);
+    free(plugin);
+    destory_module(&module);
+    return SUCCESS;
+}
+
+static int validate_plugin(const armue_plugin_t *desc, const char *path)
+{
+    int i;
+
+    if(desc == NULL || desc->size < PLUGIN_MIN_SIZE || desc->name == NULL || desc->peripheral_num < 0 ||
+       (desc->peripheral_num > 0 && desc->peripherals == NULL)){
+        LOG(LOG_ERROR, "plugin: %s gives no valid description\n", path);
+        return -1;
+    }
+    if(desc->abi_version != ARMUE_PLUGIN_ABI_VERSION){
+        LOG(LOG_ERROR, "plugin: %s is built for ABI %d rather than %d\n", path, desc->abi_version, ARMUE_PLUGIN_ABI_VERSION);
+        return -1;
+    }
+    if(strlen(desc->name) >= MODULE_NAME_LENGTH){
+        LOG(LOG_ERROR, "plugin: the name of %s is too long\n", path);
+        return -1;
+    }
+    for(i = 0; i < desc->peripheral_num; i++){
+        const armue_peripheral_ops_t *ops = desc->peripherals[i];
+        if(ops == NULL || ops->size < OPS_MIN_SIZE || ops->length == 0 ||
+           ops->create == NULL || ops->read == NULL || ops->write == NULL){
+            LOG(LOG_ERROR, "plugin: peripheral %d of %s is not valid\n", i, path);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int load_plugin_module(const char *path)
+{
+    plugin_t *plugin;
+    module_t *module;
+    int retval, i;
+
+    void *handle = plugin_open(path);
+    if(handle == NULL){
+        LOG(LOG_ERROR, "plugin: can't load %s\n", path);
+        retval = -ERROR_INVALID_MODULE;
+        goto open_fail;
+    }
+    armue_plugin_entry_t entry = (armue_plugin_entry_t)plugin_symbol(handle, ARMUE_PLUGIN_ENTRY);
+    if(entry == NULL){
+        LOG(LOG_ERROR, "plugin: %s has no %s\n", path, ARMUE_PLUGIN_ENTRY);
+        retval = -ERROR_INVALID_MODULE;
+        goto entry_fail;
+    }
+    const armue_plugin_t *desc = entry();
+    if(validate_plugin(desc, path) < 0){
+        retval = -ERROR_INVALID_MODULE;
+        goto entry_fail;
+    }
+    if(find_module((char*)desc->name) != NULL){
+        LOG(LOG_ERROR, "plugin: a module named %s is registered already\n", desc->name);
+        retval = -ERROR_REGISTERED;
+        goto entry_fail;
+    }
+
+    plugin = (plugin_t*)calloc(1, sizeof(plugin_t));
+    if(plugin == NULL){
+        retval = -ERROR_CREATE;
+        goto entry_fail;
+    }
+    plugin->ops = (armue_peripheral_ops_t*)calloc(desc->peripheral_num + 1, sizeof(armue_peripheral_ops_t));
+    if(plugin->ops == NULL){
+        retval = -ERROR_CREATE;
+        goto ops_fail;
+    }
+    for(i = 0; i < desc->peripheral_num; i++){
+        const armue_peripheral_ops_t *ops = desc->peripherals[i];
+        memcpy(&plugin->ops[i], ops, ops->size < sizeof(armue_peripheral_ops_t) ? ops->size : sizeof(armue_peripheral_ops_t));
+    }
+    plugin->handle = handle;
+    plugin->desc = desc;
+
+    module = create_module();
+    if(module == NULL){
+        retval = -ERROR_CREATE_MODULE;
+        goto module_fail;
+    }
+    set_module_type(module, MODULE_PERIPHERAL);
+    set_module_name(module, (char*)desc->name);
+    if(set_module_path(module, path) != SUCCESS){
+        retval = -ERROR_INVALID_PATH;
+        goto register_fail;
+    }
+    set_module_content_list(module, plugin);
+    set_module_unregister(module, unregister_plugin_module);
+    if(register_module_helper(module) != SUCCESS){
+        retval = -ERROR_INVALID_MODULE;
+        goto register_fail;
+    }
+    LOG(LOG_INFO, "plugin: loaded %s with %d peripherals from %s\n", desc->name, desc->peripheral_num, path);
+    return 0;
+
+register_fail:
+    destory_module(&module);
+module_fail:
+    free(plugin->ops);
+ops_fail:
+    free(plugin);
+entry_fail:
+    plugin_close(handle);
+open_fail:
+    return retval;
+}
+
+/* a plug-in that fails to load is left out, the others are still loaded */
+int load_plugin_modules(const char *dir)
+{
+    char path[MODULE_PATH_LENGTH];
+    struct dirent *entry;
+    int num = 0;
+
+    DIR *d = opendir(dir);
+    if(d == NULL){
+        LOG(LOG_ERROR, "plugin: can't open %s\n", dir);
+        return -ERROR_INVALID_PATH;
+    }
+    while((entry = readdir(d)) != NULL){
+        int len = strlen(entry->d_name);
+        int suffix = strlen(PLUGIN_SUFFIX);
+        if(len <= suffix || strcmp(entry->d_name + len - suffix, PLUGIN_SUFFIX) != 0){
+            continue;
+        }
+        if(snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name) >= (int)sizeof(path)){
+            LOG(LOG_ERROR, "plugin: the path of %s is too long\n", entry->d_name);
+            continue;
+        }
+        if(load_plugin_module(path) == 0){
+            num++;
+        }
+    }
+    closedir(d);
+    return num;
+}
+
+/****** services of the emulator ******/
+static cpu_t* plugin_cpu(plugin_peripheral_t *peri)
+{
+    return peri->soc->cpu[0];
+}
+
+static int host_raise_irq(void *context, int irq)
+{
+    cpu_t *cpu = plugin_cpu((plugin_peripheral_t*)context);
+    return cpu->exceptions->throw_exception(16 + irq, cpu->exceptions);
+}
+
+static int host_read_memory(void *context, uint32_t address, uint8_t *buffer, int size)
+{
+    cpu_t *cpu = plugin_cpu((plugin_peripheral_t*)context);
+    return read_memory_block(address, buffer, size, shared_memory_map(cpu->memory_map));
+}
+
+static int host_write_memory(void *context, uint32_t address, const uint8_t *buffer, int size)
+{
+    cpu_t *cpu = plugin_cpu((plugin_peripheral_t*)context);
+    return write_memory_block(address, (uint8_t*)buffer, size, shared_memory_map(cpu->memory_map));
+}
+
+static uint64_t host_cycles(void *context)
+{
+    return timer_cpu_cycle(plugin_cpu((plugin_peripheral_t*)context));
+}
+
+/* An event is one shot: the timer is deleted after the callback unless the
+   callback scheduled the event again. */
+static int plugin_do_match(timer_t *timer, cpu_t *cpu)
+{
+    plugin_event_t *event = (plugin_event_t*)timer->user_data_ptr;
+    plugin_peripheral_t *peri = event->peri;
+
+    event->armed = FALSE;
+    if(peri->ops->event != NULL){
+        peri->ops->event(peri->instance, event->id);
+    }
+    if(!event->armed && event->timer != NULL){
+        delete_timer(event->timer);
+        event->timer = NULL;
+    }
+    return 0;
+}
+
+static timer_t* create_event_timer(plugin_event_t *event, cpu_t *cpu)
+{
+    timer_t *timer = create_timer(0);
+    if(timer == NULL){
+        return NULL;
+    }
+    timer->user_data_ptr = event;
+    timer->do_match = plugin_do_match;
+    if(add_timer(timer, cpu->timer_queue) < 0){
+        destory_timer(&timer);
+        return NULL;
+    }
+    return timer;
+}
+
+/* the events go on the timers of the first core, the device lock of the soc is held
+   in the callbacks the services are called from */
+static int host_schedule(void *context, uint32_t id, uint64_t cycles)
+{
+    plugin_peripheral_t *peri = (plugin_peripheral_t*)context;
+    cpu_t *cpu = plugin_cpu(peri);
+
+    if(id >= ARMUE_PLUGIN_EVENT_MAX){
+        return -1;
+    }
+    plugin_event_t *event = &peri->events[id];
+    if(event->timer == NULL){
+        event->timer = create_event_timer(event, cpu);
+        if(event->timer == NULL){
+            return -1;
+        }
+    }
+    start_timer(event->timer, cpu, cycles, plugin_do_match);
+    event->armed = TRUE;
+    return 0;
+}
+
+static int host_cancel(void *context, uint32_t id)
+{
+    plugin_peripheral_t *peri = (plugin_peripheral_t*)context;
+
+    if(id >= ARMUE_PLUGIN_EVENT_MAX){
+        return -1;
+    }
+    plugin_event_t *event = &peri->events[id];
+    if(event->timer != NULL){
+        delete_timer(event->timer);
+        event->timer = NULL;
+    }
+    event->armed = FALSE;
+    return 0;
+}
+
+/****** instances ******/
+int plugin_peripheral_read(uint32_t offset, uint8_t *buffer, int size, memory_region_t *region)
+{
+    plugin_peripheral_t *peri = (plugin_peripheral_t *)region->region_data;
+    uint32_t value = 0;
+
+    if(peri == NULL || size > 4 || peri->ops->read(peri->instance, offset, size, &value) < 0){
+        return -1;
+    }
+    memcpy(buffer, &value, size);
+    return size;
+}
+
+int plugin_peripheral_write(uint32_t offset, uint8_t *buffer, int size, memory_region_t *region)
+{
+    plugin_peripheral_t *peri = (plugin_peripheral_t *)region->region_data;
+    uint32_t value = 0;
+
+    if(peri == NULL || size > 4){
+        return -1;
+    }
+    memcpy(&value, buffer, size);
+    if(peri->ops->write(peri->instance, offset, size, value) < 0){
+        return -1;
+    }
+    return size;
+}
+
+/* the state of the plug-in, then the pending events */
+int plugin_peripheral_snapshot(struct snapshot_t *snapshot, void *user_data)
+{
+    plugin_peripheral_t *peri = (plugin_peripheral_t *)user_data;
+    int32_t len = 0;
+    int i;
+
+    if(peri->ops->save != NULL){
+        len = peri->ops->save(peri->instance, NULL, 0);
+    }
+    if(len < 0 || SNAPSHOT_PUT(snapshot, len) < 0){
+        return -ERROR_CREATE;
+    }
+    if(len > 0){
+        uint8_t *state = (uint8_t*)malloc(len);
+        if(state == NULL){
+            return -ERROR_CREATE;
+        }
+        int retval = peri->ops->save(peri->instance, state, len) != len ? -1 : snapshot_put(snapshot, state, len);
+        free(state);
+        if(retval < 0){
+            return -ERROR_CREATE;
+        }
+    }
+
+    for(i = 0; i < ARMUE_PLUGIN_EVENT_MAX; i++){
+        timer_t *timer = peri->events[i].timer;
+        int32_t pending = timer != NULL;
+        if(SNAPSHOT_PUT(snapshot, pending) < 0){
+            return -ERROR_CREATE;
+        }
+        if(pending && (SNAPSHOT_PUT(snapshot, timer->reload) < 0 || SNAPSHOT_PUT(snapshot, timer->start) < 0 ||
+                       SNAPSHOT_PUT(snapshot, timer->match) < 0)){
+            return -ERROR_CREATE;
+        }
+    }
+    return 0;
+}
+
+int plugin_peripheral_restore(struct snapshot_t *snapshot, void *user_data)
+{
+    plugin_peripheral_t *peri = (plugin_peripheral_t *)user_data;
+    cycle_t reload, start, match;
+    int32_t len, pending;
+    int i;
+
+    if(SNAPSHOT_GET(snapshot, len) < 0 || len < 0){
+        return -ERROR_SNAPSHOT;
+    }
+    if(len > 0){
+        uint8_t *state = (uint8_t*)malloc(len);
+        if(state == NULL){
+            return -ERROR_CREATE;
+        }
+        int retval = snapshot_get(snapshot, state, len);
+        if(retval >= 0 && peri->ops->load != NULL){
+            retval = peri->ops->load(peri->instance, state, len);
+        }
+        free(state);
+        if(retval < 0){
+            return -ERROR_SNAPSHOT;
+        }
+    }
+
+    for(i = 0; i < ARMUE_PLUGIN_EVENT_MAX; i++){
+        plugin_event_t *event = &peri->events[i];
+        if(SNAPSHOT_GET(snapshot, pending) < 0){
+            return -ERROR_SNAPSHOT;
+        }
+        if(!pending){
+            host_cancel(peri, i);
+            continue;
+        }
+        if(SNAPSHOT_GET(snapshot, reload) < 0 || SNAPSHOT_GET(snapshot, start) < 0 ||
+           SNAPSHOT_GET(snapshot, match) < 0){
+            return -ERROR_SNAPSHOT;
+        }
+        if(event->timer == NULL){
+            event->timer = create_event_timer(event, plugin_cpu(peri));
+            if(event->timer == NULL){
+                return -ERROR_CREATE;
+            }
+        }
+        load_timer(event->timer, reload, start, match);
+        event->armed = TRUE;
+    }
+    return 0;
+}
+
+static plugin_peripheral_t* create_plugin_peripheral(soc_t *soc, const armue_peripheral_ops_t *ops)
+{
+    memory_map_t *memory = shared_memory_map(soc->cpu[0]->memory_map);
+    int i;
+
+    plugin_peripheral_t *peri = (plugin_peripheral_t *)calloc(1, sizeof(plugin_peripheral_t));
+    if(peri == NULL){
+        goto peri_null;
+    }
+    peri->ops = ops;
+    peri->soc = soc;
+    for(i = 0; i < ARMUE_PLUGIN_EVENT_MAX; i++){
+        peri->events[i].id = i;
+        peri->events[i].peri = peri;
+    }
+    peri->host.size = sizeof(armue_host_t);
+    peri->host.abi_version = ARMUE_PLUGIN_ABI_VERSION;
+    peri->host.context = peri;
+    peri->host.base = ops->base;
+    peri->host.raise_irq = host_raise_irq;
+    peri->host.read_memory = host_read_memory;
+    peri->host.write_memory = host_write_memory;
+    peri->host.cycles = host_cycles;
+    peri->host.schedule = host_schedule;
+    peri->host.cancel = host_cancel;
+
+    peri->instance = ops->create(&peri->host);
+    if(peri->instance == NULL){
+        LOG(LOG_ERROR, "plugin: failed to create %s\n", ops->name != NULL ? ops->name : "");
+        goto instance_null;
+    }
+    peri->region = request_memory_region(memory, ops->base, ops->length);
+    if(peri->region == NULL){
+        LOG(LOG_ERROR, "plugin: %s at 0x%x overlaps a mapped region\n", ops->name != NULL ? ops->name : "", ops->base);
+        goto region_fail;
+    }
+    peri->region->region_data = peri;
+    peri->region->read = plugin_peripheral_read;
+    peri->region->write = plugin_peripheral_write;
+    peri->region->type = MEMORY_REGION_PERI;
+    return peri;
+
+region_fail:
+    for(i = 0; i < ARMUE_PLUGIN_EVENT_MAX; i++){
+        host_cancel(peri, i);
+    }
+    if(ops->destory != NULL){
+        ops->destory(peri->instance);
+    }
+instance_null:
+    free(peri);
+peri_null:
+    return NULL;
+}
+
+static int count_plugin_peripherals(module_t *module, void *data)
+{
+    if(module->unregister != unregister_plugin_module){
+        return 0;
+    }
+    *(int*)data += ((plugin_t*)module->content_list)->desc->peripheral_num;
+    return 0;
+}
+
+typedef struct plugin_init_t{
+    soc_t *soc;
+    int index;
+}plugin_init_t;
+
+static int init_plugin_peripherals(module_t *module, void *data)
+{
+    plugin_t *plugin = (plugin_t*)module->content_list;
+    plugin_init_t *init = (plugin_init_t*)data;
+    int i;
+
+    if(module->unregister != unregister_plugin_module){
+        return 0;
+    }
+    for(i = 0; i < plugin->desc->peripheral_num; i++){
+        plugin_peripheral_t *peri = create_plugin_peripheral(init->soc, &plugin->ops[i]);
+        if(peri == NULL){
+            return -ERROR_CREATE;
+        }
+        peripheral_t peri_plugin = {
+            .user_data = peri,
+            .snapshot = plugin_peripheral_snapshot,
+            .restore = plugin_peripheral_restore,
+        };
+        register_peripheral(init->soc, PERI_PLUGIN, init->index++, &peri_plugin);
+    }
+    return 0;
+}
+
+/* initialize the instances of the plug-ins in the soc */
+int plugin_peripherals_init(soc_t *soc)
+{
+    plugin_init_t init = {soc, 0};
+    int num = 0;
+
+    for_each_module(MODULE_PERIPHERAL, count_plugin_peripherals, &num);
+    if(num == 0){
+        return 0;
+    }
+    if(request_peripheral(soc, PERI_PLUGIN, num) < 0){
+        return -ERROR_CREATE;
+    }
+    return for_each_module(MODULE_PERIPHERAL, init_plugin_peripherals, &init);
+}
+
+void plugin_peripherals_destory(soc_t *soc)
+{
+    int i, id;
+    for(i = 0; i < soc->peri_table[PERI_PLUGIN].num; i++){
+        peripheral_t *peri_plugin = find_peripheral(soc, PERI_PLUGIN, i);
+        plugin_peripheral_t *peri = (plugin_peripheral_t *)peri_plugin->user_data;
+        if(peri == NULL){
+            continue;
+        }
+        for(id = 0; id < ARMUE_PLUGIN_EVENT_MAX; id++){
+            host_cancel(peri, id);
+        }
+        if(peri->ops->destory != NULL){
+            peri->ops->destory(peri->instance);
+        }
+        peri->region->region_data = NULL;
+        free(peri);
+        peri_plugin->user_data = NULL;
+    }
+}
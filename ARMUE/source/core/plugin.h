@@ -0,0 +1,20 @@
+#ifndef _PLUGIN_H_
+#define _PLUGIN_H_
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include "soc.h"
+
+/* Register a peripheral module for each plug-in of the directory, they are
+   unloaded by unregister_all_modules. Returns the number of plug-ins loaded. */
+int load_plugin_modules(const char *dir);
+
+/* map an instance of every plug-in peripheral in the soc */
+int plugin_peripherals_init(soc_t *soc);
+void plugin_peripherals_destory(soc_t *soc);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
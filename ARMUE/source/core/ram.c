@@ -11,6 +11,9 @@ ram_t* create_ram(size_t size)
         goto ram_null;
     }
     ram->size = size;
+    ram->pages = NULL;
+    ram->page_copied = NULL;
+    ram->dirty = NULL;
     ram->data = (uint8_t*)malloc(size);
     if(ram->data == NULL){
         goto data_null;
@@ -25,6 +28,131 @@ ram_null:
     return NULL;
 }
 
+/* The fork shares every page with the origin, which must neither change nor be
+   destoried before the fork is. A forked ram can be forked again. */
+ram_t* fork_ram(ram_t *origin)
+{
+    uint32_t i, page_num = ram_page_num(origin);
+
+    ram_t *ram = (ram_t*)calloc(1, sizeof(ram_t));
+    if(ram == NULL){
+        goto ram_null;
+    }
+    ram->size = origin->size;
+    ram->pages = (uint8_t**)malloc(page_num * sizeof(uint8_t*));
+    if(ram->pages == NULL){
+        goto pages_null;
+    }
+    ram->page_copied = (uint8_t*)calloc(page_num, sizeof(uint8_t));
+    if(ram->page_copied == NULL){
+        goto page_copied_null;
+    }
+
+    for(i = 0; i < page_num; i++){
+        if(origin->pages == NULL){
+            ram->pages[i] = origin->data + (i << RAM_PAGE_SHIFT);
+        }else{
+            ram->pages[i] = origin->pages[i];
+        }
+    }
+    return ram;
+
+page_copied_null:
+    free(ram->pages);
+pages_null:
+    free(ram);
+ram_null:
+    return NULL;
+}
+
+void destory_ram(ram_t **ram)
+{
+    if(ram == NULL || *ram == NULL){
+        return;
+    }
+    if((*ram)->pages != NULL){
+        uint32_t i, page_num = ram_page_num(*ram);
+        for(i = 0; i < page_num; i++){
+            if((*ram)->page_copied[i]){
+                free((*ram)->pages[i]);
+            }
+        }
+        free((*ram)->pages);
+        free((*ram)->page_copied);
+    }
+    free((*ram)->dirty);
+    free((*ram)->data);
+    free(*ram);
+    *ram = NULL;
+}
+
+/* start tracking the written pages, all of them are clean at first */
+int track_ram_dirty(ram_t *ram)
+{
+    if(ram->dirty != NULL){
+        clear_ram_dirty(ram);
+        return 0;
+    }
+    ram->dirty = (uint8_t*)calloc(ram_page_num(ram), sizeof(uint8_t));
+    return ram->dirty != NULL ? 0 : -ERROR_CREATE;
+}
+
+void untrack_ram_dirty(ram_t *ram)
+{
+    free(ram->dirty);
+    ram->dirty = NULL;
+}
+
+void clear_ram_dirty(ram_t *ram)
+{
+    if(ram->dirty != NULL){
+        memset(ram->dirty, 0, ram_page_num(ram));
+    }
+}
+
+/* the access may cross pages */
+void read_forked_ram(ram_t *ram, uint32_t offset, uint8_t *buffer, uint32_t size)
+{
+    uint32_t page_offset, chunk;
+    while(size > 0){
+        page_offset = offset & (RAM_PAGE_SIZE - 1);
+        chunk = RAM_PAGE_SIZE - page_offset < size ? RAM_PAGE_SIZE - page_offset : size;
+        memcpy(buffer, ram->pages[offset >> RAM_PAGE_SHIFT] + page_offset, chunk);
+        offset += chunk;
+        buffer += chunk;
+        size -= chunk;
+    }
+}
+
+int write_forked_ram(ram_t *ram, uint32_t offset, uint8_t *buffer, uint32_t size)
+{
+    uint32_t page, page_offset, chunk;
+    while(size > 0){
+        page = offset >> RAM_PAGE_SHIFT;
+        page_offset = offset & (RAM_PAGE_SIZE - 1);
+        chunk = RAM_PAGE_SIZE - page_offset < size ? RAM_PAGE_SIZE - page_offset : size;
+        if(!ram->page_copied[page]){
+            /* the last page may be shorter */
+            uint32_t page_size = ram->size - (page << RAM_PAGE_SHIFT);
+            if(page_size > RAM_PAGE_SIZE){
+                page_size = RAM_PAGE_SIZE;
+            }
+            uint8_t *copy = (uint8_t*)malloc(RAM_PAGE_SIZE);
+            if(copy == NULL){
+                return -ERROR_CREATE;
+            }
+            memcpy(copy, ram->pages[page], page_size);
+            ram->pages[page] = copy;
+            ram->page_copied[page] = 1;
+        }
+        memcpy(ram->pages[page] + page_offset, buffer, chunk);
+        offset += chunk;
+        buffer += chunk;
+        size -= chunk;
+    }
+    return 0;
+}
+
 int copy_file_to_buffer(char* buffer, size_t max_size, FILE* file)
 {
     char c = getc(file);
@@ -56,7 +184,6 @@ int fill_ram_with_bin(ram_t *ram, uint32_t start_addr, char *path)
 
     }else{
         LOG(LOG_ERROR, "fill_rom_with_bin: Can't open %s\n", path);
-        fclose(bin_file);
         return -3;
     }
 }
@@ -6,14 +6,66 @@ extern "C"{
 
 #include "_types.h"
 #include <stddef.h>
+#include <string.h>
+
+#define RAM_PAGE_SHIFT 12
+#define RAM_PAGE_SIZE (1u << RAM_PAGE_SHIFT)
 
 typedef struct{
     uint32_t size;
-    uint8_t* data;
+    uint8_t* data;          // NULL for a forked ram
+
+    /* A forked ram reads the pages of its origin until it writes them (copy-on-write),
+       page_copied[i] is set when pages[i] is its own */
+    uint8_t **pages;
+    uint8_t *page_copied;
+
+    /* dirty[i] is set when page i is written, NULL if not tracked */
+    uint8_t *dirty;
 }ram_t;
 
 ram_t* create_ram(size_t size);
+ram_t* fork_ram(ram_t *origin);
+void destory_ram(ram_t **ram);
 int fill_ram_with_bin(ram_t *ram, uint32_t start_addr, char *path);
+int track_ram_dirty(ram_t *ram);
+void untrack_ram_dirty(ram_t *ram);
+void clear_ram_dirty(ram_t *ram);
+#define ram_page_num(ram) (((ram)->size + RAM_PAGE_SIZE - 1) >> RAM_PAGE_SHIFT)
+
+void read_forked_ram(ram_t *ram, uint32_t offset, uint8_t *buffer, uint32_t size);
+int write_forked_ram(ram_t *ram, uint32_t offset, uint8_t *buffer, uint32_t size);
+
+static inline void ram_read(ram_t *ram, uint32_t offset, uint8_t *buffer, uint32_t size)
+{
+    if(ram->pages == NULL){
+        memcpy(buffer, ram->data + offset, size);
+    }else{
+        read_forked_ram(ram, offset, buffer, size);
+    }
+}
+
+static inline void mark_ram_dirty(ram_t *ram, uint32_t offset, uint32_t size)
+{
+    uint32_t page = offset >> RAM_PAGE_SHIFT;
+    uint32_t last = (offset + size - 1) >> RAM_PAGE_SHIFT;
+    for(; page <= last; page++){
+        ram->dirty[page] = 1;
+    }
+}
+
+/* fails only when a forked ram can't copy a page */
+static inline int ram_write(ram_t *ram, uint32_t offset, uint8_t *buffer, uint32_t size)
+{
+    if(ram->dirty != NULL && size > 0){
+        mark_ram_dirty(ram, offset, size);
+    }
+    if(ram->pages == NULL){
+        memcpy(ram->data + offset, buffer, size);
+        return 0;
+    }
+    return write_forked_ram(ram, offset, buffer, size);
+}
 
 #ifdef __cplusplus
 }
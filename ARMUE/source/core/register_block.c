@@ -0,0 +1,193 @@
+#include "register_block.h"
+#include "error_code.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* The bytes a register doesn't cover up to the next register or the end of its word
+   belong to it too, they read as zero and the writes to them are dropped. */
+static void cover_word_tails(reg_block_t *block, uint32_t size)
+{
+    uint32_t offset;
+    int16_t last = REG_NONE;
+    for(offset = 0; offset < size; offset++){
+        if(offset % 4 == 0){
+            last = REG_NONE;
+        }
+        if(block->lookup[offset] == REG_NONE){
+            block->lookup[offset] = last;
+        }else{
+            last = block->lookup[offset];
+        }
+    }
+}
+
+reg_block_t* create_reg_block(const reg_desc_t *regs, int reg_num, uint32_t size, void *owner)
+{
+    int i;
+    uint32_t offset;
+
+    reg_block_t *block = (reg_block_t*)calloc(1, sizeof(reg_block_t));
+    if(block == NULL){
+        goto block_null;
+    }
+    block->lookup = (int16_t*)malloc(size * sizeof(int16_t));
+    if(block->lookup == NULL){
+        goto lookup_null;
+    }
+    block->values = (uint32_t*)calloc(reg_num, sizeof(uint32_t));
+    if(block->values == NULL){
+        goto values_null;
+    }
+    for(offset = 0; offset < size; offset++){
+        block->lookup[offset] = REG_NONE;
+    }
+    for(i = 0; i < reg_num; i++){
+        uint32_t end = regs[i].offset + regs[i].width;
+        if(end > size || regs[i].offset / 4 != (end - 1) / 4){
+            LOG(LOG_ERROR, "create_reg_block: register at 0x%x is out of the block or crosses a word\n", regs[i].offset);
+            goto regs_fail;
+        }
+        for(offset = regs[i].offset; offset < end; offset++){
+            if(block->lookup[offset] != REG_NONE){
+                LOG(LOG_ERROR, "create_reg_block: register at 0x%x overlaps\n", regs[i].offset);
+                goto regs_fail;
+            }
+            block->lookup[offset] = i;
+        }
+    }
+    cover_word_tails(block, size);
+
+    block->size = size;
+    block->regs = regs;
+    block->reg_num = reg_num;
+    block->owner = owner;
+    reset_reg_block(block);
+    return block;
+
+regs_fail:
+    free(block->values);
+values_null:
+    free(block->lookup);
+lookup_null:
+    free(block);
+block_null:
+    return NULL;
+}
+
+void destory_reg_block(reg_block_t **block)
+{
+    if(block == NULL || *block == NULL){
+        return;
+    }
+    free((*block)->values);
+    free((*block)->lookup);
+    free(*block);
+    *block = NULL;
+}
+
+void reset_reg_block(reg_block_t *block)
+{
+    int i;
+    for(i = 0; i < block->reg_num; i++){
+        block->values[i] = block->regs[i].reset_value;
+    }
+}
+
+/* the bytes from offset that go to the same register, or to none, at most size */
+static int run_length(reg_block_t *block, uint32_t offset, int size)
+{
+    int16_t index = block->lookup[offset];
+    int len = 1;
+    while(len < size && block->lookup[offset + len] == index){
+        len++;
+    }
+    return len;
+}
+
+static int read_reg(reg_block_t *block, const reg_desc_t *reg, uint32_t shift, uint8_t *buffer, int size)
+{
+    uint32_t value = block->values[reg - block->regs];
+    if(reg->read != NULL && reg->read(block->owner, reg, &value) < 0){
+        return -1;
+    }
+    value |= reg->read_set_mask;
+    memcpy(buffer, (uint8_t*)&value + shift, size);
+    return size;
+}
+
+static int write_reg(reg_block_t *block, const reg_desc_t *reg, uint32_t shift, uint8_t *buffer, int size)
+{
+    uint32_t *stored = &block->values[reg - block->regs];
+    uint32_t value = *stored;
+    reg_read_func_t merge = reg->merge != NULL ? reg->merge : reg->merge_read ? reg->read : NULL;
+    if(merge != NULL && (shift != 0 || size < reg->width) && merge(block->owner, reg, &value) < 0){
+        return -1;
+    }
+    memcpy((uint8_t*)&value + shift, buffer, size);
+    if(reg->width < 4){
+        value &= (1ul << (reg->width * 8)) - 1;
+    }
+    if(reg->w1c_mask != 0){
+        /* only the bytes written can clear bits */
+        uint32_t written = (size == 4 ? 0xFFFFFFFFul : (1ul << (size * 8)) - 1) << (shift * 8);
+        uint32_t cleared = value & written & reg->w1c_mask;
+        value = (value & ~reg->w1c_mask) | (*stored & reg->w1c_mask & ~cleared);
+    }
+    value = (value & ~reg->read_only_mask) | (*stored & reg->read_only_mask);
+
+    if(reg->write != NULL && reg->write(block->owner, reg, value) < 0){
+        return -1;
+    }
+    *stored = value;
+    return size;
+}
+
+/* An access is split between the registers it covers, so a word can hold several
+   narrow ones. The offsets with no register go to the fallback. */
+int reg_block_read(reg_block_t *block, uint32_t offset, uint8_t *buffer, int size)
+{
+    int done, len, retval;
+    if(offset >= block->size){
+        return block->fallback_read ? block->fallback_read(block->owner, offset, buffer, size) : -1;
+    }
+    if(size > (int)(block->size - offset)){
+        size = block->size - offset;
+    }
+    for(done = 0; done < size; done += len){
+        int16_t index = block->lookup[offset + done];
+        len = run_length(block, offset + done, size - done);
+        if(index == REG_NONE){
+            retval = block->fallback_read ? block->fallback_read(block->owner, offset + done, buffer + done, len) : -1;
+        }else{
+            retval = read_reg(block, &block->regs[index], offset + done - block->regs[index].offset, buffer + done, len);
+        }
+        if(retval < 0){
+            return -1;
+        }
+    }
+    return size;
+}
+
+int reg_block_write(reg_block_t *block, uint32_t offset, uint8_t *buffer, int size)
+{
+    int done, len, retval;
+    if(offset >= block->size){
+        return block->fallback_write ? block->fallback_write(block->owner, offset, buffer, size) : -1;
+    }
+    if(size > (int)(block->size - offset)){
+        size = block->size - offset;
+    }
+    for(done = 0; done < size; done += len){
+        int16_t index = block->lookup[offset + done];
+        len = run_length(block, offset + done, size - done);
+        if(index == REG_NONE){
+            retval = block->fallback_write ? block->fallback_write(block->owner, offset + done, buffer + done, len) : -1;
+        }else{
+            retval = write_reg(block, &block->regs[index], offset + done - block->regs[index].offset, buffer + done, len);
+        }
+        if(retval < 0){
+            return -1;
+        }
+    }
+    return size;
+}
@@ -0,0 +1,76 @@
+#ifndef _REGISTER_BLOCK_H_
+#define _REGISTER_BLOCK_H_
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include <stdint.h>
+#include "_types.h"
+
+/*
+ * The registers of a peripheral, described by a table. The lookup array built by
+ * create_reg_block takes each byte of the block to its register in one index. A
+ * word can hold several 8 or 16 bit registers, an access covering more than one is
+ * split between them. A register doesn't cross a word, the bytes after it up to the
+ * next register or the end of its word belong to it and read as zero.
+ *
+ * A register with no handler is stored in the block: it starts at reset_value and a
+ * write keeps the bits of read_only_mask. Writing 1 to a bit of w1c_mask clears it,
+ * writing 0 leaves it alone. A handler gets and returns the whole value of the
+ * register, an access narrower than the register takes the bytes it covers, and a
+ * narrow write merges with the value written last, with the value the register
+ * reads when merge_read is set, or with the value merge gives when it is not NULL.
+ * The bits of read_set_mask always read as 1, for the status bits of hardware
+ * nobody models.
+ */
+
+struct reg_desc_t;
+typedef int (*reg_read_func_t)(void *owner, const struct reg_desc_t *reg, uint32_t *value);
+typedef int (*reg_write_func_t)(void *owner, const struct reg_desc_t *reg, uint32_t value);
+/* for the offsets with no register, NULL fails the access */
+typedef int (*reg_fallback_func_t)(void *owner, uint32_t offset, uint8_t *buffer, int size);
+
+typedef struct reg_desc_t{
+    uint32_t offset;
+    int width;                  // in bytes
+    reg_read_func_t read;       // NULL reads the stored value
+    reg_write_func_t write;     // NULL stores the value
+    uint32_t reset_value;
+    uint32_t read_only_mask;
+    uint32_t w1c_mask;          // write 1 to clear
+    bool_t merge_read;
+    uint32_t read_set_mask;     // read as 1 whatever was written
+    reg_read_func_t merge;      // what a narrow write merges with, NULL for the above
+}reg_desc_t;
+
+typedef struct reg_block_t{
+    uint32_t size;
+    const reg_desc_t *regs;
+    int reg_num;
+    int16_t *lookup;            // index of the register of each byte, -1 for none
+    uint32_t *values;           // the value of each register written last
+    void *owner;                // passed to the handlers
+    reg_fallback_func_t fallback_read;
+    reg_fallback_func_t fallback_write;
+}reg_block_t;
+
+#define REG_NONE    (-1)
+
+/* regs must live as long as the block */
+reg_block_t* create_reg_block(const reg_desc_t *regs, int reg_num, uint32_t size, void *owner);
+void destory_reg_block(reg_block_t **block);
+void reset_reg_block(reg_block_t *block);
+
+int reg_block_read(reg_block_t *block, uint32_t offset, uint8_t *buffer, int size);
+int reg_block_write(reg_block_t *block, uint32_t offset, uint8_t *buffer, int size);
+
+/* the value the register got from reset or from its last write */
+static inline uint32_t reg_block_value(reg_block_t *block, const reg_desc_t *reg)
+{
+    return block->values[reg - block->regs];
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,175 @@
+#include "reload.h"
+#include "checkpoint.h"
+#include "replay.h"
+#include "error_code.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROM_CHUNK_SIZE 4
+
+reload_t* create_reload(soc_t *soc, char *path, uint32_t base_addr)
+{
+    reload_t *reload = (reload_t*)calloc(1, sizeof(reload_t));
+    if(reload == NULL){
+        goto reload_null;
+    }
+    reload->path = strdup(path);
+    if(reload->path == NULL){
+        goto path_null;
+    }
+    reload->base_addr = base_addr;
+    reload->reset_state = create_snapshot();
+    if(reload->reset_state == NULL){
+        goto state_null;
+    }
+    if(snapshot_soc_state(soc, reload->reset_state) < 0){
+        goto snapshot_fail;
+    }
+    pthread_mutex_init(&reload->lock, NULL);
+    return reload;
+
+snapshot_fail:
+    destory_snapshot(&reload->reset_state);
+state_null:
+    free(reload->path);
+path_null:
+    free(reload);
+reload_null:
+    return NULL;
+}
+
+void destory_reload(reload_t **reload)
+{
+    if(reload == NULL || *reload == NULL){
+        return;
+    }
+    pthread_mutex_destroy(&(*reload)->lock);
+    destory_snapshot(&(*reload)->reset_state);
+    free((*reload)->request_path);
+    free((*reload)->path);
+    free(*reload);
+    *reload = NULL;
+}
+
+static int read_region(memory_region_t *region, uint32_t offset, uint8_t *buffer, int size)
+{
+    int i, retval;
+    for(i = 0; i < size; i += retval){
+        retval = region->read(offset + i, buffer + i, size - i < ROM_CHUNK_SIZE ? 1 : ROM_CHUNK_SIZE, region);
+        if(retval <= 0){
+            return -ERROR_FETCH;
+        }
+    }
+    return size;
+}
+
+/* write the pages of the region that differ from the image, the rest of the region is zero */
+static int write_changed_pages(memory_region_t *region, uint32_t offset, FILE *image)
+{
+    uint8_t new_page[RELOAD_PAGE_SIZE], old_page[RELOAD_PAGE_SIZE];
+    int pages = 0, changed = 0;
+
+    for(; offset < region->size; offset += RELOAD_PAGE_SIZE){
+        int size = region->size - offset < RELOAD_PAGE_SIZE ? region->size - offset : RELOAD_PAGE_SIZE;
+        int len = fread(new_page, 1, size, image);
+        memset(new_page + len, 0, size - len);
+        if(read_region(region, offset, old_page, size) < 0){
+            return -ERROR_FETCH;
+        }
+        pages++;
+        if(memcmp(new_page, old_page, size) == 0){
+            continue;
+        }
+        if(region->write(offset, new_page, size, region) != size){
+            return -ERROR_MEMORY_MAP;
+        }
+        changed++;
+    }
+    LOG(LOG_INFO, "reload: %d of %d pages changed\n", changed, pages);
+    return changed;
+}
+
+int reload_firmware(soc_t *soc, char *path)
+{
+    reload_t *reload = soc->reload;
+    int retval;
+
+    if(reload == NULL){
+        return -ERROR_NULL_POINTER;
+    }
+    if(path == NULL){
+        path = reload->path;
+    }
+    memory_region_t *region = find_memory_region(shared_memory_map(soc->cpu[0]->memory_map), reload->base_addr, 1);
+    if(region == NULL || (region->type != MEMORY_REGION_ROM && region->type != MEMORY_REGION_RAM)){
+        LOG(LOG_ERROR, "reload_firmware: no memory at 0x%x\n", reload->base_addr);
+        return -ERROR_MEMORY_MAP;
+    }
+    FILE *image = fopen(path, "rb");
+    if(image == NULL){
+        LOG(LOG_ERROR, "reload_firmware: can't open %s\n", path);
+        return -ERROR_INVALID_PATH;
+    }
+    retval = write_changed_pages(region, reload->base_addr - region->base_addr, image);
+    fclose(image);
+    if(retval < 0){
+        return retval;
+    }
+    /* the cycle goes back to the one after startup, so the events after it count from there */
+    replay_record(soc->replay, soc->cpu[0], REPLAY_EVENT_RELOAD, path, strlen(path), NULL, 0);
+    if(path != reload->path){
+        char *new_path = strdup(path);
+        if(new_path != NULL){
+            free(reload->path);
+            reload->path = new_path;
+        }
+    }
+
+    /* Reset. There is no decode cache, the vector table the NVIC holds is the only
+       state taken from the image and startup loads it again. */
+    retval = restore_soc(soc, reload->reset_state);
+    if(retval < 0){
+        return retval;
+    }
+    retval = startup_soc(soc);
+    if(retval < 0){
+        return retval;
+    }
+
+    /* the history is of the image before */
+    if(soc->checkpoints != NULL){
+        cycle_t interval = soc->checkpoints->interval;
+        destory_checkpoint_list(soc, &soc->checkpoints);
+        soc->checkpoints = create_checkpoint_list(soc, interval);
+    }
+    return SUCCESS;
+}
+
+void request_reload(soc_t *soc, char *path)
+{
+    reload_t *reload = soc->reload;
+    if(reload == NULL){
+        return;
+    }
+    pthread_mutex_lock(&reload->lock);
+    free(reload->request_path);
+    reload->request_path = path != NULL ? strdup(path) : NULL;
+    __atomic_store_n(&reload->requested, TRUE, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&reload->lock);
+}
+
+void do_requested_reload(soc_t *soc)
+{
+    reload_t *reload = soc->reload;
+    pthread_mutex_lock(&reload->lock);
+    char *path = reload->request_path;
+    reload->request_path = NULL;
+    __atomic_store_n(&reload->requested, FALSE, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&reload->lock);
+
+    if(reload_firmware(soc, path) < 0){
+        LOG(LOG_ERROR, "Failed to reload %s\n", path != NULL ? path : reload->path);
+    }
+    free(path);
+}
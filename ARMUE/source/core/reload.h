@@ -0,0 +1,48 @@
+#ifndef _RELOAD_H_
+#define _RELOAD_H_
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include <pthread.h>
+#include "soc.h"
+#include "snapshot.h"
+
+#define RELOAD_PAGE_SIZE    4096
+
+/* Loading a new firmware image into a running soc. Only the pages of the image that
+   changed are written, then the cores and peripherals go back to their state after
+   startup. The monitor and the debugger stay connected. */
+typedef struct reload_t{
+    snapshot_t *reset_state;    // the soc right after startup, without the memory
+    uint32_t base_addr;         // where the image is loaded
+    char *path;                 // the image loaded last
+
+    /* a reload asked for by another thread, done between two instructions */
+    pthread_mutex_t lock;
+    bool_t requested;           // read with __atomic, it is checked without the lock
+    char *request_path;         // NULL for the image loaded last
+}reload_t;
+
+/* called right after startup_soc */
+reload_t* create_reload(soc_t *soc, char *path, uint32_t base_addr);
+void destory_reload(reload_t **reload);
+
+/* path NULL loads the last image again, the soc must not be running. The reload is
+   recorded in the replay log, the image must still be there when replaying. */
+int reload_firmware(soc_t *soc, char *path);
+void request_reload(soc_t *soc, char *path);
+void do_requested_reload(soc_t *soc);
+
+/* called when all the cores are stopped, only a compare unless a reload is asked for */
+static inline void check_reload(soc_t *soc)
+{
+    if(soc->reload != NULL && __atomic_load_n(&soc->reload->requested, __ATOMIC_ACQUIRE)){
+        do_requested_reload(soc);
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
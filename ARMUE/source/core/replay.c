@@ -0,0 +1,293 @@
+#include "replay.h"
+#include "reload.h"
+#include "checkpoint.h"
+#include "error_code.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define REPLAY_BUF_SIZE (64 * 1024)
+
+typedef struct replay_file_head_t{
+    uint32_t magic;
+    uint32_t version;
+}replay_file_head_t;
+
+static int event_phase(int kind)
+{
+    switch(kind){
+    case REPLAY_EVENT_MEMORY:
+    case REPLAY_EVENT_CPU:
+        return REPLAY_PHASE_DEBUG;
+    case REPLAY_EVENT_RELOAD:
+        return REPLAY_PHASE_RELOAD;
+    default:
+        return REPLAY_PHASE_INPUT;
+    }
+}
+
+/* size bytes of the log, from the memory when it is played from there */
+static bool_t read_log(replay_t *replay, void *data, size_t size)
+{
+    if(replay->memory != NULL){
+        return snapshot_get(replay->memory, data, size) == 0;
+    }
+    return size == 0 || fread(data, size, 1, replay->file) == 1;
+}
+
+/* read the head and the payload of the next event, the end of the log never comes due */
+static void read_next_event(replay_t *replay)
+{
+    if(replay->memory != NULL && replay->memory->pos >= replay->memory->size){
+        goto end;
+    }
+    if(!read_log(replay, &replay->next, sizeof(replay->next))){
+        goto end;
+    }
+    if(replay->next.length > replay->payload_capacity){
+        uint8_t *payload = (uint8_t*)realloc(replay->payload, replay->next.length);
+        if(payload == NULL){
+            LOG(LOG_ERROR, "replay: can't hold an event of %u bytes\n", replay->next.length);
+            goto end;
+        }
+        replay->payload = payload;
+        replay->payload_capacity = replay->next.length;
+    }
+    if(!read_log(replay, replay->payload, replay->next.length)){
+        goto end;
+    }
+    return;
+
+end:
+    replay->next.cycle = REPLAY_NEVER;
+}
+
+replay_t* create_replay(char *path, replay_mode_t mode)
+{
+    replay_file_head_t head;
+
+    replay_t *replay = (replay_t*)calloc(1, sizeof(replay_t));
+    if(replay == NULL){
+        goto replay_null;
+    }
+    replay->mode = mode;
+    replay->next.cycle = REPLAY_NEVER;
+
+    replay->file = fopen(path, mode == REPLAY_RECORD ? "wb" : "rb");
+    if(replay->file == NULL){
+        LOG(LOG_ERROR, "create_replay: can't open %s\n", path);
+        goto file_null;
+    }
+    setvbuf(replay->file, NULL, _IOFBF, REPLAY_BUF_SIZE);
+
+    if(mode == REPLAY_RECORD){
+        replay->cpu_state = create_snapshot();
+        if(replay->cpu_state == NULL){
+            goto head_fail;
+        }
+        head.magic = REPLAY_MAGIC;
+        head.version = REPLAY_VERSION;
+        if(fwrite(&head, sizeof(head), 1, replay->file) != 1){
+            goto head_fail;
+        }
+    }else{
+        if(fread(&head, sizeof(head), 1, replay->file) != 1 ||
+           head.magic != REPLAY_MAGIC || head.version != REPLAY_VERSION){
+            LOG(LOG_ERROR, "create_replay: %s is not a replay log\n", path);
+            goto head_fail;
+        }
+        read_next_event(replay);
+    }
+    return replay;
+
+head_fail:
+    destory_snapshot(&replay->cpu_state);
+    fclose(replay->file);
+file_null:
+    free(replay);
+replay_null:
+    return NULL;
+}
+
+replay_t* create_memory_replay(snapshot_t *memory, cycle_t after)
+{
+    replay_t *replay = (replay_t*)calloc(1, sizeof(replay_t));
+    if(replay == NULL){
+        return NULL;
+    }
+    replay->mode = REPLAY_PLAY;
+    replay->memory = memory;
+    memory->pos = 0;
+    do{
+        read_next_event(replay);
+    }while(replay->next.cycle <= after);
+    return replay;
+}
+
+void destory_replay(replay_t **replay)
+{
+    if(replay == NULL || *replay == NULL){
+        return;
+    }
+    if((*replay)->file != NULL){
+        fclose((*replay)->file);
+    }
+    destory_snapshot(&(*replay)->cpu_state);
+    free((*replay)->payload);
+    free(*replay);
+    *replay = NULL;
+}
+
+void replay_record(replay_t *replay, cpu_t *cpu, int kind, const void *head, uint32_t head_len,
+                   const void *data, uint32_t data_len)
+{
+    if(replay == NULL || replay->mode != REPLAY_RECORD || replay->applying){
+        return;
+    }
+    replay_event_head_t event;
+    event.cycle = cpu->cycle;
+    event.length = head_len + data_len;
+    event.kind = kind;
+    event.cid = cpu->cid;
+    fwrite(&event, sizeof(event), 1, replay->file);
+    fwrite(head, 1, head_len, replay->file);
+    if(data_len != 0){
+        fwrite(data, 1, data_len, replay->file);
+    }
+}
+
+int replay_put_event(snapshot_t *log, cpu_t *cpu, int kind, const void *head, uint32_t head_len,
+                     const void *data, uint32_t data_len)
+{
+    replay_event_head_t event;
+    event.cycle = cpu->cycle;
+    event.length = head_len + data_len;
+    event.kind = kind;
+    event.cid = cpu->cid;
+    if(SNAPSHOT_PUT(log, event) < 0 || snapshot_put(log, head, head_len) < 0 ||
+       (data_len != 0 && snapshot_put(log, data, data_len) < 0)){
+        return -ERROR_CREATE;
+    }
+    return 0;
+}
+
+void record_cpu_state(replay_t *replay, cpu_t *cpu)
+{
+    if(replay == NULL || replay->mode != REPLAY_RECORD || cpu->snapshot == NULL){
+        return;
+    }
+    snapshot_t *state = replay->cpu_state;
+    state->size = 0;
+    if(cpu->snapshot(cpu, state) < 0){
+        LOG(LOG_ERROR, "record_cpu_state: can't save cpu %d\n", cpu->cid);
+        return;
+    }
+    replay_record(replay, cpu, REPLAY_EVENT_CPU, state->data, state->size, NULL, 0);
+}
+
+/* running again from a checkpoint applies the input kept with the checkpoints */
+static void keep_peri_event(soc_t *soc, struct data_pkt_head_t *head, pmp_parsed_pkt_t *pkt)
+{
+    checkpoint_list_t *list = soc->checkpoints;
+    if(list != NULL && replay_put_event(list->inputs, soc->cpu[0], REPLAY_EVENT_PERI, head, sizeof(*head),
+                                        pkt->data, pkt->data_len) < 0){
+        LOG(LOG_ERROR, "replay: can't keep the input of cycle %llu\n", (unsigned long long)soc->cpu[0]->cycle);
+    }
+}
+
+int record_peri_event(soc_t *soc, pmp_parsed_pkt_t *pkt)
+{
+    struct data_pkt_head_t head;
+    head.peri_kind = pkt->peri_kind;
+    head.peri_index = pkt->peri_index;
+    head.data_kind = pkt->data_kind;
+    replay_record(soc->replay, soc->cpu[0], REPLAY_EVENT_PERI, &head, sizeof(head), pkt->data, pkt->data_len);
+    keep_peri_event(soc, &head, pkt);
+
+    /* what the peripheral does with it follows from the event */
+    if(soc->replay != NULL){
+        soc->replay->applying = TRUE;
+    }
+    int retval = dispatch_peri_event(soc, pkt);
+    if(soc->replay != NULL){
+        soc->replay->applying = FALSE;
+    }
+    return retval;
+}
+
+static int apply_event(soc_t *soc, replay_event_head_t *event, uint8_t *payload)
+{
+    if(event->cid >= soc->cpu_num){
+        return -ERROR_SNAPSHOT;
+    }
+    cpu_t *cpu = soc->cpu[event->cid];
+
+    switch(event->kind){
+    case REPLAY_EVENT_PERI:{
+        struct data_pkt_head_t head;
+        pmp_parsed_pkt_t pkt;
+        if(event->length < sizeof(head)){
+            return -ERROR_SNAPSHOT;
+        }
+        memcpy(&head, payload, sizeof(head));
+        pkt.pkt_kind = PMP_DATA;
+        pkt.peri_kind = head.peri_kind;
+        pkt.peri_index = head.peri_index;
+        pkt.data_kind = head.data_kind;
+        pkt.data = payload + sizeof(head);
+        pkt.data_len = event->length - sizeof(head);
+        pkt.valid = TRUE;
+        keep_peri_event(soc, &head, &pkt);
+        return dispatch_peri_event(soc, &pkt);
+    }
+    case REPLAY_EVENT_MEMORY:{
+        uint32_t addr;
+        if(event->length < sizeof(addr)){
+            return -ERROR_SNAPSHOT;
+        }
+        memcpy(&addr, payload, sizeof(addr));
+        return write_memory(addr, payload + sizeof(addr), event->length - sizeof(addr), cpu->memory_map);
+    }
+    case REPLAY_EVENT_CPU:{
+        snapshot_t state = {payload, event->length, event->length, 0, event->length};
+        if(cpu->restore == NULL){
+            return -ERROR_SNAPSHOT;
+        }
+        return cpu->restore(cpu, &state);
+    }
+    case REPLAY_EVENT_RELOAD:{
+        char *path = (char*)malloc(event->length + 1);
+        if(path == NULL){
+            return -ERROR_CREATE;
+        }
+        memcpy(path, payload, event->length);
+        path[event->length] = '\0';
+        int retval = reload_firmware(soc, path);
+        free(path);
+        return retval;
+    }
+    default:
+        LOG(LOG_ERROR, "replay: unknown event %d\n", event->kind);
+        return -ERROR_SNAPSHOT;
+    }
+}
+
+/* apply the events of the phase that are due, in the order they were recorded */
+void replay_events(soc_t *soc, cpu_t *cpu, int phase)
+{
+    replay_t *replay = soc->replay;
+    while(cpu->cycle >= replay->next.cycle && event_phase(replay->next.kind) == phase){
+        if(replay->next.cycle != cpu->cycle){
+            LOG(LOG_WARN, "replay: event of cycle %llu applied at %llu\n",
+                (unsigned long long)replay->next.cycle, (unsigned long long)cpu->cycle);
+        }
+        /* the input goes to the devices, which the other cores may be using */
+        lock_devices(soc);
+        int retval = apply_event(soc, &replay->next, replay->payload);
+        unlock_devices(soc);
+        if(retval < 0){
+            LOG(LOG_ERROR, "replay: fail to apply event %d of cycle %llu\n",
+                replay->next.kind, (unsigned long long)replay->next.cycle);
+        }
+        read_next_event(replay);
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef _REPLAY_H_
+#define _REPLAY_H_
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include "soc.h"
+#include "snapshot.h"
+#include "core_connect.h"
+
+/*
+ * The input a machine gets from outside, logged with the cycle of the first core
+ * it is applied at, so that a run can be repeated exactly without the monitor
+ * or the debugger attached. Interrupts are not logged: the models raise them
+ * from what the guest does and from this input, so replaying raises them again.
+ *     header: magic, version
+ *     event:  replay_event_head_t, then length bytes of payload
+ * Events are only appended and go through the stdio buffer, a log cut short by
+ * a crash replays up to its last whole event.
+ */
+
+#define REPLAY_MAGIC    0x524D5241  // "ARMR"
+#define REPLAY_VERSION  1
+#define REPLAY_NEVER    (~(cycle_t)0)
+
+typedef enum{
+    REPLAY_RECORD,
+    REPLAY_PLAY,
+}replay_mode_t;
+
+enum REPLAY_EVENT_KIND{
+    REPLAY_EVENT_PERI = 1,      // data_pkt_head_t, then the data of the packet
+    REPLAY_EVENT_MEMORY,        // the address, then the bytes the debugger wrote
+    REPLAY_EVENT_CPU,           // cpu_t->snapshot of a core the debugger halted
+    REPLAY_EVENT_RELOAD,        // the path of the firmware image loaded
+};
+
+/* Events are applied where they came in: the debugger ones before the instruction,
+   the peripheral ones after it, where the monitor is polled, and the reloads where
+   the cores are stopped */
+enum REPLAY_PHASE{
+    REPLAY_PHASE_DEBUG,
+    REPLAY_PHASE_INPUT,
+    REPLAY_PHASE_RELOAD,
+};
+
+typedef struct replay_event_head_t{
+    uint64_t cycle;
+    uint32_t length;
+    uint16_t kind;
+    uint16_t cid;
+}replay_event_head_t;
+
+typedef struct replay_t{
+    replay_mode_t mode;
+    FILE *file;
+    snapshot_t *memory;         // played instead of the file, see create_memory_replay
+    bool_t applying;            // no recording while an event is applied
+    snapshot_t *cpu_state;      // buffer for REPLAY_EVENT_CPU
+
+    /* playing: the event to apply next, cycle is REPLAY_NEVER at the end */
+    replay_event_head_t next;
+    uint8_t *payload;
+    uint32_t payload_capacity;
+}replay_t;
+
+replay_t* create_replay(char *path, replay_mode_t mode);
+/* play the events of a log kept in memory, from the first one after the cycle */
+replay_t* create_memory_replay(snapshot_t *memory, cycle_t after);
+void destory_replay(replay_t **replay);
+
+/* the recording functions do nothing unless replay is recording */
+void replay_record(replay_t *replay, cpu_t *cpu, int kind, const void *head, uint32_t head_len,
+                   const void *data, uint32_t data_len);
+/* append an event to a log kept in memory, in the format of the file */
+int replay_put_event(snapshot_t *log, cpu_t *cpu, int kind, const void *head, uint32_t head_len,
+                     const void *data, uint32_t data_len);
+void record_cpu_state(replay_t *replay, cpu_t *cpu);
+/* record and apply */
+int record_peri_event(soc_t *soc, pmp_parsed_pkt_t *pkt);
+
+void replay_events(soc_t *soc, cpu_t *cpu, int phase);
+
+/* called by the first core every instruction, only a compare unless an event is due */
+static inline void check_replay(soc_t *soc, cpu_t *cpu, int phase)
+{
+    replay_t *replay = soc->replay;
+    if(replay != NULL && cpu->cycle >= replay->next.cycle){
+        replay_events(soc, cpu, phase);
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
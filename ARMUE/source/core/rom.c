@@ -7,6 +7,9 @@ rom_t* alloc_rom()
 {
     LOG(LOG_DEBUG, "create_rom\n");
     rom_t* rom = (rom_t *)calloc(1, sizeof(rom_t));
+    if(rom != NULL){
+        pthread_mutex_init(&rom->lock, NULL);
+    }
 
     return rom;
 }
@@ -22,6 +25,7 @@ error_code_t destory_rom(rom_t** rom)
         fclose((*rom)->rom_file);
     }
 
+    pthread_mutex_destroy(&(*rom)->lock);
     free(*rom);
     *rom = NULL;
 
@@ -34,7 +38,9 @@ error_code_t clear_rom(rom_t* rom)
         return ERROR_NULL_POINTER;
     }
 
+    pthread_mutex_t lock = rom->lock;
     memset(rom, 0, sizeof(rom_t));
+    rom->lock = lock;
 
     return SUCCESS;
 }
@@ -321,3 +327,38 @@ uint16_t fetch_rom_data16(uint32_t offset_addr, rom_t* rom)
 
     return *(uint16_t*)buf;
 }
+
+/* size bytes at offset with one read of the file, returns the bytes read */
+int read_rom_block(rom_t *rom, uint32_t offset, uint8_t *buffer, uint32_t size)
+{
+    if(offset >= rom->size){
+        return 0;
+    }
+    if(size > rom->size - offset){
+        size = rom->size - offset;
+    }
+    int cur_offset = offset + rom->content_start;
+    fseek(rom->rom_file, cur_offset, SEEK_SET);
+    size_t done = fread(buffer, 1, size, rom->rom_file);
+    rom->rw_flag = ROM_READ;
+    rom->last_offset = cur_offset + done - 1;
+    return done;
+}
+
+/* size bytes at offset with one write and one flush of the file, returns the bytes written */
+int write_rom_block(rom_t *rom, uint32_t offset, uint8_t *buffer, uint32_t size)
+{
+    if(offset >= rom->size){
+        return 0;
+    }
+    if(size > rom->size - offset){
+        size = rom->size - offset;
+    }
+    int cur_offset = offset + rom->content_start;
+    fseek(rom->rom_file, cur_offset, SEEK_SET);
+    size_t done = fwrite(buffer, 1, size, rom->rom_file);
+    fflush(rom->rom_file);
+    rom->rw_flag = ROM_WRITE;
+    rom->last_offset = cur_offset + done - 1;
+    return done;
+}
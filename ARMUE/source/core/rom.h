@@ -6,6 +6,7 @@ extern "C"{
 
 #include <stdio.h>
 #include <tchar.h>
+#include <pthread.h>
 #include "_types.h"
 #include "error_code.h"
 
@@ -23,6 +24,7 @@ typedef struct rom_s_t
     FILE* rom_file;
     uint32_t size;                // the size of the rom in byte
     int rw_flag;
+    pthread_mutex_t lock;        // the file position is shared, cores of a soc access the rom in parallel
 }rom_t;
 
 rom_t* alloc_rom();
@@ -37,6 +39,8 @@ int send_rom_data8(uint32_t addr, uint8_t char_to_send, rom_t* rom);
 uint8_t fetch_rom_data8(uint32_t addr, rom_t* rom);
 uint32_t fetch_rom_data32(uint32_t addr, rom_t* rom);
 uint16_t fetch_rom_data16(uint32_t addr, rom_t* rom);
+int read_rom_block(rom_t *rom, uint32_t offset, uint8_t *buffer, uint32_t size);
+int write_rom_block(rom_t *rom, uint32_t offset, uint8_t *buffer, uint32_t size);
 error_code_t fill_rom_with_zero(rom_t *rom);
 
 #ifdef __cplusplus
@@ -0,0 +1,459 @@
+#include "semihost.h"
+#include "memory_map.h"
+#include "snapshot.h"
+#include "error_code.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define SEMIHOST_FAIL   ((uint32_t)-1)
+
+semihost_t* create_semihost()
+{
+    semihost_t *semihost = (semihost_t*)calloc(1, sizeof(semihost_t));
+    if(semihost == NULL){
+        goto semihost_null;
+    }
+    semihost->buffer = (uint8_t*)malloc(SEMIHOST_BUFFER_SIZE);
+    if(semihost->buffer == NULL){
+        goto buffer_null;
+    }
+    semihost->console = stdout;
+    pthread_mutex_init(&semihost->lock, NULL);
+    return semihost;
+
+buffer_null:
+    free(semihost);
+semihost_null:
+    return NULL;
+}
+
+/* the console may be a file of the host, the program can't close it either */
+static bool_t is_std_stream(semihost_t *semihost, FILE *file)
+{
+    return file == stdin || file == stdout || file == stderr || file == semihost->console;
+}
+
+void destory_semihost(semihost_t **semihost)
+{
+    if(semihost == NULL || *semihost == NULL){
+        return;
+    }
+    int i;
+    for(i = 0; i < SEMIHOST_FILE_MAX; i++){
+        FILE *file = (*semihost)->files[i];
+        if(file != NULL && !is_std_stream(*semihost, file)){
+            fclose(file);
+        }
+    }
+    pthread_mutex_destroy(&(*semihost)->lock);
+    destory_snapshot(&(*semihost)->results);
+    free((*semihost)->buffer);
+    free(*semihost);
+    *semihost = NULL;
+}
+
+static int read_params(cpu_t *cpu, uint32_t param, uint32_t *args, int num)
+{
+    return read_memory_block(param, (uint8_t*)args, num * 4, cpu->memory_map);
+}
+
+static FILE* get_file(semihost_t *semihost, uint32_t handle)
+{
+    if(handle == 0 || handle >= SEMIHOST_FILE_MAX){
+        return NULL;
+    }
+    return semihost->files[handle];
+}
+
+/* ":tt" is the console, its mode tells stdin, the console output or stderr */
+static uint32_t sys_open(semihost_t *semihost, cpu_t *cpu, uint32_t param)
+{
+    static const char *modes[12] = {"r", "rb", "r+", "r+b", "w", "wb", "w+", "w+b", "a", "ab", "a+", "a+b"};
+    char name[SEMIHOST_NAME_MAX];
+    uint32_t args[3], handle;
+    FILE *file;
+
+    if(read_params(cpu, param, args, 3) < 0 || args[1] >= 12 || args[2] >= SEMIHOST_NAME_MAX){
+        return SEMIHOST_FAIL;
+    }
+    if(read_memory_block(args[0], (uint8_t*)name, args[2], cpu->memory_map) < 0){
+        return SEMIHOST_FAIL;
+    }
+    name[args[2]] = '\0';
+
+    for(handle = 1; handle < SEMIHOST_FILE_MAX; handle++){
+        if(semihost->files[handle] == NULL){
+            break;
+        }
+    }
+    if(handle == SEMIHOST_FILE_MAX){
+        semihost->error = EMFILE;
+        return SEMIHOST_FAIL;
+    }
+
+    if(strcmp(name, ":tt") == 0){
+        file = args[1] < 4 ? stdin : args[1] < 8 ? semihost->console : stderr;
+    }else{
+        file = fopen(name, modes[args[1]]);
+        if(file == NULL){
+            semihost->error = errno;
+            return SEMIHOST_FAIL;
+        }
+    }
+    semihost->files[handle] = file;
+    return handle;
+}
+
+static uint32_t sys_close(semihost_t *semihost, cpu_t *cpu, uint32_t param)
+{
+    uint32_t handle;
+    if(read_params(cpu, param, &handle, 1) < 0){
+        return SEMIHOST_FAIL;
+    }
+    FILE *file = get_file(semihost, handle);
+    if(file == NULL){
+        semihost->error = EBADF;
+        return SEMIHOST_FAIL;
+    }
+    semihost->files[handle] = NULL;
+    if(!is_std_stream(semihost, file) && fclose(file) != 0){
+        semihost->error = errno;
+        return SEMIHOST_FAIL;
+    }
+    return 0;
+}
+
+/* the string is copied a byte at a time, it ends at the first NUL */
+static uint32_t sys_write0(semihost_t *semihost, cpu_t *cpu, uint32_t addr)
+{
+    uint8_t c;
+    while(read_memory_block(addr++, &c, 1, cpu->memory_map) > 0 && c != '\0'){
+        fputc(c, semihost->console);
+    }
+    fflush(semihost->console);
+    return 0;
+}
+
+/* returns the bytes not written */
+static uint32_t sys_write(semihost_t *semihost, cpu_t *cpu, uint32_t param)
+{
+    uint32_t args[3];
+    if(read_params(cpu, param, args, 3) < 0){
+        return SEMIHOST_FAIL;
+    }
+    FILE *file = get_file(semihost, args[0]);
+    if(file == NULL){
+        semihost->error = EBADF;
+        return args[2];
+    }
+
+    uint32_t addr = args[1], left = args[2];
+    while(left > 0){
+        int len = left < SEMIHOST_BUFFER_SIZE ? left : SEMIHOST_BUFFER_SIZE;
+        if(read_memory_block(addr, semihost->buffer, len, cpu->memory_map) < 0){
+            break;
+        }
+        int written = fwrite(semihost->buffer, 1, len, file);
+        addr += written;
+        left -= written;
+        if(written != len){
+            semihost->error = errno;
+            break;
+        }
+    }
+    if(is_std_stream(semihost, file)){
+        fflush(file);
+    }
+    return left;
+}
+
+/* returns the bytes not read, all of them at the end of the file */
+static uint32_t sys_read(semihost_t *semihost, cpu_t *cpu, uint32_t param)
+{
+    uint32_t args[3];
+    if(read_params(cpu, param, args, 3) < 0){
+        return SEMIHOST_FAIL;
+    }
+    FILE *file = get_file(semihost, args[0]);
+    if(file == NULL){
+        semihost->error = EBADF;
+        return SEMIHOST_FAIL;
+    }
+
+    uint32_t addr = args[1], left = args[2];
+    while(left > 0){
+        int len = left < SEMIHOST_BUFFER_SIZE ? left : SEMIHOST_BUFFER_SIZE;
+        int got;
+        if(file == stdin){
+            /* a line at a time, like read() on a terminal */
+            char *line = fgets((char*)semihost->buffer, len < SEMIHOST_BUFFER_SIZE ? len + 1 : len, file);
+            got = line != NULL ? (int)strlen(line) : 0;
+        }else{
+            got = fread(semihost->buffer, 1, len, file);
+        }
+        if(got > 0 && write_memory_block(addr, semihost->buffer, got, cpu->memory_map) < 0){
+            break;
+        }
+        addr += got;
+        left -= got;
+        if(got != len){
+            if(ferror(file)){
+                semihost->error = errno;
+            }
+            break;
+        }
+    }
+    return left;
+}
+
+static uint32_t sys_seek(semihost_t *semihost, cpu_t *cpu, uint32_t param)
+{
+    uint32_t args[2];
+    if(read_params(cpu, param, args, 2) < 0){
+        return SEMIHOST_FAIL;
+    }
+    FILE *file = get_file(semihost, args[0]);
+    if(file == NULL || fseek(file, args[1], SEEK_SET) != 0){
+        semihost->error = file == NULL ? EBADF : errno;
+        return SEMIHOST_FAIL;
+    }
+    return 0;
+}
+
+static uint32_t sys_flen(semihost_t *semihost, cpu_t *cpu, uint32_t param)
+{
+    uint32_t handle;
+    if(read_params(cpu, param, &handle, 1) < 0){
+        return SEMIHOST_FAIL;
+    }
+    FILE *file = get_file(semihost, handle);
+    if(file == NULL || is_std_stream(semihost, file)){
+        semihost->error = EBADF;
+        return SEMIHOST_FAIL;
+    }
+    long pos = ftell(file);
+    fseek(file, 0, SEEK_END);
+    long len = ftell(file);
+    fseek(file, pos, SEEK_SET);
+    return len;
+}
+
+static uint32_t sys_istty(semihost_t *semihost, cpu_t *cpu, uint32_t param)
+{
+    uint32_t handle;
+    if(read_params(cpu, param, &handle, 1) < 0){
+        return SEMIHOST_FAIL;
+    }
+    FILE *file = get_file(semihost, handle);
+    if(file == NULL){
+        semihost->error = EBADF;
+        return SEMIHOST_FAIL;
+    }
+    return is_std_stream(semihost, file);
+}
+
+/* On a 32 bit core SYS_EXIT only tells whether the program ended well, the
+   extended one carries the exit code as well */
+static uint32_t sys_exit(semihost_t *semihost, cpu_t *cpu, uint32_t op, uint32_t param)
+{
+    uint32_t args[2] = {param, 0};
+    if(op == SYS_EXIT_EXTENDED && read_params(cpu, param, args, 2) < 0){
+        return SEMIHOST_FAIL;
+    }
+    if(args[0] == ADP_STOPPED_APPLICATION_EXIT){
+        semihost->exit_code = args[1];
+    }else{
+        semihost->exit_code = 1;
+    }
+    __atomic_store_n(&semihost->exited, TRUE, __ATOMIC_RELEASE);
+    LOG(LOG_INFO, "semihosting: exit with %d\n", semihost->exit_code);
+    return 0;
+}
+
+/* the result and what SYS_READ brought into the memory */
+static void keep_result(semihost_t *semihost, cpu_t *cpu, uint32_t op, uint32_t param, uint32_t retval)
+{
+    semihost_result_t result = {cpu->cycle, op, retval, semihost->error, 0, 0};
+    uint32_t args[3];
+    uint8_t *data;
+
+    if(op == SYS_READ && read_params(cpu, param, args, 3) >= 0 && retval <= args[2]){
+        result.addr = args[1];
+        result.length = args[2] - retval;
+    }
+    if(SNAPSHOT_PUT(semihost->results, result) < 0 ||
+       (data = snapshot_reserve(semihost->results, result.length)) == NULL ||
+       read_memory_block(result.addr, data, result.length, cpu->memory_map) < 0){
+        LOG(LOG_ERROR, "semihosting: can't keep the result of cycle %llu\n", cpu->cycle);
+    }
+}
+
+/* The same call at the same cycle as the first time gets the same result. Once the
+   program calls something else, the results kept after it are wrong and dropped. */
+static bool_t give_back_result(semihost_t *semihost, cpu_t *cpu, uint32_t op, uint32_t *retval)
+{
+    snapshot_t *results = semihost->results;
+    semihost_result_t result;
+
+    if(semihost->result_pos + sizeof(result) > results->size){
+        return FALSE;
+    }
+    memcpy(&result, results->data + semihost->result_pos, sizeof(result));
+    if(result.cycle != cpu->cycle || result.op != op){
+        if(semihost->rerunning){
+            LOG(LOG_WARN, "semihosting: the call of cycle %llu is not the one kept\n", cpu->cycle);
+        }
+        results->size = semihost->result_pos;
+        return FALSE;
+    }
+    semihost->result_pos += sizeof(result);
+    if(result.length != 0){
+        write_memory_block(result.addr, results->data + semihost->result_pos, result.length, cpu->memory_map);
+        semihost->result_pos += result.length;
+    }
+    semihost->error = result.error;
+    *retval = result.retval;
+    return TRUE;
+}
+
+uint32_t semihost_call(semihost_t *semihost, cpu_t *cpu, uint32_t op, uint32_t param)
+{
+    uint32_t retval;
+    uint8_t c;
+
+    pthread_mutex_lock(&semihost->lock);
+    if(semihost->results != NULL && op != SYS_EXIT && op != SYS_EXIT_EXTENDED &&
+       give_back_result(semihost, cpu, op, &retval)){
+        pthread_mutex_unlock(&semihost->lock);
+        return retval;
+    }
+
+    switch(op){
+    case SYS_OPEN:
+        retval = sys_open(semihost, cpu, param);
+        break;
+    case SYS_CLOSE:
+        retval = sys_close(semihost, cpu, param);
+        break;
+    case SYS_WRITEC:
+        retval = 0;
+        if(read_memory_block(param, &c, 1, cpu->memory_map) > 0){
+            fputc(c, semihost->console);
+            fflush(semihost->console);
+        }
+        break;
+    case SYS_WRITE0:
+        retval = sys_write0(semihost, cpu, param);
+        break;
+    case SYS_WRITE:
+        retval = sys_write(semihost, cpu, param);
+        break;
+    case SYS_READ:
+        retval = sys_read(semihost, cpu, param);
+        break;
+    case SYS_READC:
+        retval = fgetc(stdin);
+        break;
+    case SYS_ISTTY:
+        retval = sys_istty(semihost, cpu, param);
+        break;
+    case SYS_SEEK:
+        retval = sys_seek(semihost, cpu, param);
+        break;
+    case SYS_FLEN:
+        retval = sys_flen(semihost, cpu, param);
+        break;
+    case SYS_CLOCK:
+        retval = (uint32_t)(clock() / (CLOCKS_PER_SEC / 100));
+        break;
+    case SYS_TIME:
+        retval = (uint32_t)time(NULL);
+        break;
+    case SYS_ERRNO:
+        retval = semihost->error;
+        break;
+    case SYS_EXIT:
+    case SYS_EXIT_EXTENDED:
+        /* running again only goes up to where the program is */
+        retval = semihost->rerunning ? 0 : sys_exit(semihost, cpu, op, param);
+        break;
+    default:
+        LOG(LOG_WARN, "semihosting: operation 0x%x is not supported\n", op);
+        retval = SEMIHOST_FAIL;
+        break;
+    }
+    if(semihost->results != NULL && op != SYS_EXIT && op != SYS_EXIT_EXTENDED){
+        keep_result(semihost, cpu, op, param, retval);
+        semihost->result_pos = semihost->results->size;
+    }
+    pthread_mutex_unlock(&semihost->lock);
+    return retval;
+}
+
+int semihost_keep_results(semihost_t *semihost)
+{
+    if(semihost->results == NULL){
+        semihost->results = create_snapshot();
+    }
+    return semihost->results != NULL ? 0 : -ERROR_CREATE;
+}
+
+void semihost_drop_results(semihost_t *semihost)
+{
+    pthread_mutex_lock(&semihost->lock);
+    destory_snapshot(&semihost->results);
+    semihost->result_pos = 0;
+    semihost->rerunning = FALSE;
+    pthread_mutex_unlock(&semihost->lock);
+}
+
+/* the offset of the first result kept at or after cycle */
+static size_t find_result(snapshot_t *results, cycle_t cycle)
+{
+    size_t pos = 0;
+    semihost_result_t result;
+
+    while(pos + sizeof(result) <= results->size){
+        memcpy(&result, results->data + pos, sizeof(result));
+        if(result.cycle >= cycle){
+            break;
+        }
+        pos += sizeof(result) + result.length;
+    }
+    return pos;
+}
+
+void semihost_rerun(semihost_t *semihost, cycle_t cycle)
+{
+    pthread_mutex_lock(&semihost->lock);
+    if(semihost->results != NULL){
+        semihost->result_pos = find_result(semihost->results, cycle);
+    }
+    semihost->rerunning = TRUE;
+    pthread_mutex_unlock(&semihost->lock);
+}
+
+void semihost_resume(semihost_t *semihost, cycle_t cycle)
+{
+    pthread_mutex_lock(&semihost->lock);
+    if(semihost->results != NULL){
+        semihost->result_pos = find_result(semihost->results, cycle);
+    }
+    semihost->rerunning = FALSE;
+    pthread_mutex_unlock(&semihost->lock);
+}
+
+void semihost_forget_results(semihost_t *semihost, cycle_t cycle)
+{
+    pthread_mutex_lock(&semihost->lock);
+    snapshot_t *results = semihost->results;
+    if(results != NULL){
+        size_t pos = find_result(results, cycle);
+        memmove(results->data, results->data + pos, results->size - pos);
+        results->size -= pos;
+        semihost->result_pos = semihost->result_pos > pos ? semihost->result_pos - pos : 0;
+    }
+    pthread_mutex_unlock(&semihost->lock);
+}
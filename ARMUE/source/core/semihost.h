@@ -0,0 +1,91 @@
+#ifndef _SEMIHOST_H_
+#define _SEMIHOST_H_
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include <stdio.h>
+#include <pthread.h>
+#include "cpu.h"
+
+struct snapshot_t;
+
+/*
+ * ARM semihosting: the program asks the host for file and console I/O with
+ * BKPT 0xAB, the operation in r0 and a pointer to its parameter block in r1.
+ * The result goes back in r0. The buffers are copied through the memory map
+ * in whole blocks.
+ *
+ * While checkpoints are taken the results are kept as well. Running again from
+ * a checkpoint gives them back instead of calling the host, as long as the
+ * program makes the same calls at the same cycles, so nothing is written twice
+ * and the program reads what it read the first time.
+ */
+
+#define SEMIHOST_BKPT_IMM   0xAB
+
+#define SYS_OPEN            0x01
+#define SYS_CLOSE           0x02
+#define SYS_WRITEC          0x03
+#define SYS_WRITE0          0x04
+#define SYS_WRITE           0x05
+#define SYS_READ            0x06
+#define SYS_READC           0x07
+#define SYS_ISTTY           0x09
+#define SYS_SEEK            0x0A
+#define SYS_FLEN            0x0C
+#define SYS_CLOCK           0x10
+#define SYS_TIME            0x11
+#define SYS_ERRNO           0x13
+#define SYS_EXIT            0x18
+#define SYS_EXIT_EXTENDED   0x20
+
+#define ADP_STOPPED_APPLICATION_EXIT    0x20026
+
+#define SEMIHOST_FILE_MAX       32
+#define SEMIHOST_BUFFER_SIZE    (64 * 1024)     // the most copied at a time
+#define SEMIHOST_NAME_MAX       1024
+
+typedef struct semihost_t{
+    FILE *files[SEMIHOST_FILE_MAX];     // by handle, handle 0 is never given
+    FILE *console;                      // the console output, stdout unless the host sets it
+    int error;                          // errno of the last operation that failed
+    bool_t exited;                      // the program called SYS_EXIT
+    int exit_code;
+    uint8_t *buffer;
+    pthread_mutex_t lock;               // the cores call it from their own threads
+
+    /* semihost_result_t and the bytes read into the memory, NULL if not kept */
+    struct snapshot_t *results;
+    size_t result_pos;                  // the next one given back
+    bool_t rerunning;                   // SYS_EXIT doesn't stop the program then
+}semihost_t;
+
+typedef struct semihost_result_t{
+    cycle_t cycle;                      // of the core that called
+    uint32_t op;
+    uint32_t retval;
+    int32_t error;
+    uint32_t addr;                      // where length bytes were read to
+    uint32_t length;
+}semihost_result_t;
+
+semihost_t* create_semihost();
+void destory_semihost(semihost_t **semihost);
+
+/* returns what goes back in r0 */
+uint32_t semihost_call(semihost_t *semihost, cpu_t *cpu, uint32_t op, uint32_t param);
+
+int semihost_keep_results(semihost_t *semihost);
+void semihost_drop_results(semihost_t *semihost);
+/* the program runs again from cycle, to check what it did */
+void semihost_rerun(semihost_t *semihost, cycle_t cycle);
+/* the program goes on from cycle */
+void semihost_resume(semihost_t *semihost, cycle_t cycle);
+/* the ones before cycle are no longer needed */
+void semihost_forget_results(semihost_t *semihost, cycle_t cycle);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
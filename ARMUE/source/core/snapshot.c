@@ -0,0 +1,751 @@
+#include "snapshot.h"
+#include "peripheral.h"
+#include "mapped_image.h"
+#include "error_code.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SNAPSHOT_INIT_SIZE  4096
+
+typedef struct snapshot_header_t{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t cpu_num;
+}snapshot_header_t;
+
+/* what the core part of every cpu_t keeps */
+typedef struct snapshot_cpu_t{
+    uint32_t type;
+    uint32_t halting;
+    int32_t extra_cycles;
+    cycle_t cycle;
+    cycle_t next_check_point;
+    unsigned long long last_pc;
+}snapshot_cpu_t;
+
+/* [offset, offset+length) of a RAM/ROM region of the shared map (index 0)
+   or of the private map of a core (index cid+1) */
+typedef struct snapshot_region_t{
+    uint32_t map_index;
+    uint32_t base_addr;
+    uint32_t size;
+    uint32_t type;
+    uint32_t offset;
+    uint32_t length;
+}snapshot_region_t;
+
+typedef enum{
+    SNAPSHOT_MEMORY_NONE,
+    SNAPSHOT_MEMORY_ALL,
+    SNAPSHOT_MEMORY_DIRTY,      // only the dirty pages of the tracked RAM
+}snapshot_memory_t;
+
+/* A tracked storage image, then its ranges of pages up to one of length 0. A full one
+   has every page written since the tracking started, the others go back to what they
+   were then. An image that isn't tracked is left out, the file is its storage. */
+typedef struct snapshot_image_t{
+    uint32_t index;             // in soc_t->images
+    uint32_t full;
+    uint64_t size;
+}snapshot_image_t;
+
+typedef struct snapshot_range_t{
+    uint64_t offset;
+    uint64_t length;
+}snapshot_range_t;
+
+typedef struct snapshot_peri_t{
+    int32_t kind;
+    int32_t index;
+}snapshot_peri_t;
+
+snapshot_t* create_snapshot()
+{
+    snapshot_t *snapshot = (snapshot_t*)calloc(1, sizeof(snapshot_t));
+    if(snapshot == NULL){
+        goto snapshot_null;
+    }
+    snapshot->data = (uint8_t*)malloc(SNAPSHOT_INIT_SIZE);
+    if(snapshot->data == NULL){
+        goto data_null;
+    }
+    snapshot->capacity = SNAPSHOT_INIT_SIZE;
+    return snapshot;
+
+data_null:
+    free(snapshot);
+snapshot_null:
+    return NULL;
+}
+
+void destory_snapshot(snapshot_t **snapshot)
+{
+    if(snapshot == NULL || *snapshot == NULL){
+        return;
+    }
+    free((*snapshot)->data);
+    free(*snapshot);
+    *snapshot = NULL;
+}
+
+/* make room for size bytes at the end and return where they go */
+uint8_t* snapshot_reserve(snapshot_t *snapshot, size_t size)
+{
+    if(snapshot->size + size > snapshot->capacity){
+        size_t capacity = snapshot->capacity * 2;
+        while(capacity < snapshot->size + size){
+            capacity *= 2;
+        }
+        uint8_t *data = (uint8_t*)realloc(snapshot->data, capacity);
+        if(data == NULL){
+            return NULL;
+        }
+        snapshot->data = data;
+        snapshot->capacity = capacity;
+    }
+    uint8_t *reserved = snapshot->data + snapshot->size;
+    snapshot->size += size;
+    return reserved;
+}
+
+/* take size bytes from the read position, NULL if the snapshot is too short */
+static uint8_t* snapshot_take(snapshot_t *snapshot, size_t size)
+{
+    if(snapshot->pos + size > snapshot->size){
+        LOG(LOG_ERROR, "snapshot: truncated data\n");
+        return NULL;
+    }
+    uint8_t *taken = snapshot->data + snapshot->pos;
+    snapshot->pos += size;
+    return taken;
+}
+
+int snapshot_put(snapshot_t *snapshot, const void *data, size_t size)
+{
+    uint8_t *reserved = snapshot_reserve(snapshot, size);
+    if(reserved == NULL){
+        return -ERROR_CREATE;
+    }
+    memcpy(reserved, data, size);
+    return 0;
+}
+
+int snapshot_get(snapshot_t *snapshot, void *data, size_t size)
+{
+    uint8_t *taken = snapshot_take(snapshot, size);
+    if(taken == NULL){
+        return -ERROR_SNAPSHOT;
+    }
+    memcpy(data, taken, size);
+    return 0;
+}
+
+/* the length is filled in by snapshot_end_section */
+int snapshot_begin_section(snapshot_t *snapshot, uint32_t tag)
+{
+    uint32_t length = 0;
+    snapshot->section = snapshot->size;
+    if(SNAPSHOT_PUT(snapshot, tag) < 0 || SNAPSHOT_PUT(snapshot, length) < 0){
+        return -ERROR_CREATE;
+    }
+    return 0;
+}
+
+void snapshot_end_section(snapshot_t *snapshot)
+{
+    uint32_t length = snapshot->size - snapshot->section - 2 * sizeof(uint32_t);
+    memcpy(snapshot->data + snapshot->section + sizeof(uint32_t), &length, sizeof(length));
+}
+
+/* check the tag of the next section, snapshot_section_left tells whether it has more */
+int snapshot_enter_section(snapshot_t *snapshot, uint32_t tag)
+{
+    uint32_t saved_tag, length;
+    if(SNAPSHOT_GET(snapshot, saved_tag) < 0 || SNAPSHOT_GET(snapshot, length) < 0){
+        return -ERROR_SNAPSHOT;
+    }
+    if(saved_tag != tag || snapshot->pos + length > snapshot->size){
+        LOG(LOG_ERROR, "snapshot: bad section %08x, expect %08x\n", saved_tag, tag);
+        return -ERROR_SNAPSHOT;
+    }
+    snapshot->section = snapshot->pos + length;
+    return 0;
+}
+
+int snapshot_put_fifo(snapshot_t *snapshot, fifo_t *fifo)
+{
+    uint32_t length = fifo->length;
+    uint32_t data_size = fifo->data_size;
+    if(SNAPSHOT_PUT(snapshot, length) < 0 || SNAPSHOT_PUT(snapshot, data_size) < 0 ||
+       SNAPSHOT_PUT(snapshot, fifo->in_index) < 0 || SNAPSHOT_PUT(snapshot, fifo->out_index) < 0 ||
+       SNAPSHOT_PUT(snapshot, fifo->empty) < 0){
+        return -ERROR_CREATE;
+    }
+    return snapshot_put(snapshot, fifo->data, fifo->length * fifo->data_size);
+}
+
+int snapshot_get_fifo(snapshot_t *snapshot, fifo_t *fifo)
+{
+    uint32_t length, data_size;
+    if(SNAPSHOT_GET(snapshot, length) < 0 || SNAPSHOT_GET(snapshot, data_size) < 0){
+        return -ERROR_SNAPSHOT;
+    }
+    if(length != fifo->length || data_size != fifo->data_size){
+        LOG(LOG_ERROR, "snapshot_get_fifo: fifo size dismatch\n");
+        return -ERROR_SNAPSHOT;
+    }
+    if(SNAPSHOT_GET(snapshot, fifo->in_index) < 0 || SNAPSHOT_GET(snapshot, fifo->out_index) < 0 ||
+       SNAPSHOT_GET(snapshot, fifo->empty) < 0){
+        return -ERROR_SNAPSHOT;
+    }
+    return snapshot_get(snapshot, fifo->data, fifo->length * fifo->data_size);
+}
+
+/* only the used part of the heap is saved */
+int snapshot_put_bheap(snapshot_t *snapshot, bheap_t *heap)
+{
+    if(SNAPSHOT_PUT(snapshot, heap->data_size) < 0 || SNAPSHOT_PUT(snapshot, heap->current_length) < 0){
+        return -ERROR_CREATE;
+    }
+    return snapshot_put(snapshot, heap->data, heap->current_length * heap->data_size);
+}
+
+int snapshot_get_bheap(snapshot_t *snapshot, bheap_t *heap)
+{
+    int data_size, length;
+    if(SNAPSHOT_GET(snapshot, data_size) < 0 || SNAPSHOT_GET(snapshot, length) < 0){
+        return -ERROR_SNAPSHOT;
+    }
+    if(data_size != heap->data_size || length < 0 || length > heap->total_length){
+        LOG(LOG_ERROR, "snapshot_get_bheap: heap size dismatch\n");
+        return -ERROR_SNAPSHOT;
+    }
+    heap->current_length = length;
+    return snapshot_get(snapshot, heap->data, length * data_size);
+}
+
+int save_snapshot_file(snapshot_t *snapshot, char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if(file == NULL){
+        LOG(LOG_ERROR, "save_snapshot_file: can't open %s\n", path);
+        return -ERROR_INVALID_PATH;
+    }
+    size_t written = fwrite(snapshot->data, 1, snapshot->size, file);
+    fclose(file);
+    return written == snapshot->size ? 0 : -ERROR_CREATE;
+}
+
+snapshot_t* load_snapshot_file(char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if(file == NULL){
+        LOG(LOG_ERROR, "load_snapshot_file: can't open %s\n", path);
+        goto open_fail;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if(size <= 0){
+        goto size_fail;
+    }
+
+    snapshot_t *snapshot = create_snapshot();
+    if(snapshot == NULL){
+        goto snapshot_null;
+    }
+    uint8_t *data = snapshot_reserve(snapshot, size);
+    if(data == NULL || fread(data, 1, size, file) != (size_t)size){
+        goto read_fail;
+    }
+    fclose(file);
+    return snapshot;
+
+read_fail:
+    destory_snapshot(&snapshot);
+snapshot_null:
+size_fail:
+    fclose(file);
+open_fail:
+    return NULL;
+}
+
+/****** memory ******/
+typedef struct region_walk_t{
+    snapshot_t *snapshot;
+    uint32_t map_index;
+    snapshot_memory_t mode;
+}region_walk_t;
+
+static int snapshot_ram_range(region_walk_t *walk, memory_region_t *region, uint32_t offset, uint32_t length)
+{
+    snapshot_region_t saved = {walk->map_index, region->base_addr, region->size, region->type, offset, length};
+    if(SNAPSHOT_PUT(walk->snapshot, saved) < 0){
+        return -ERROR_CREATE;
+    }
+    uint8_t *content = snapshot_reserve(walk->snapshot, length);
+    if(content == NULL){
+        return -ERROR_CREATE;
+    }
+    ram_read((ram_t*)region->region_data, offset, content, length);
+    return 0;
+}
+
+/* every run of dirty pages is saved as one range, the pages are clean afterwards */
+static int snapshot_dirty_ram(region_walk_t *walk, memory_region_t *region)
+{
+    ram_t *ram = (ram_t*)region->region_data;
+    uint32_t page = 0, first, page_num = ram_page_num(ram);
+    int retval;
+
+    while(page < page_num){
+        if(!ram->dirty[page]){
+            page++;
+            continue;
+        }
+        for(first = page; page < page_num && ram->dirty[page]; page++){
+            ram->dirty[page] = 0;
+        }
+        uint32_t offset = first << RAM_PAGE_SHIFT;
+        uint32_t end = page << RAM_PAGE_SHIFT;
+        retval = snapshot_ram_range(walk, region, offset, (end < ram->size ? end : ram->size) - offset);
+        if(retval < 0){
+            return retval;
+        }
+    }
+    return 0;
+}
+
+static int snapshot_region(memory_region_t *region, void *data)
+{
+    region_walk_t *walk = (region_walk_t*)data;
+    snapshot_t *snapshot = walk->snapshot;
+
+    if(region->type == MEMORY_REGION_RAM){
+        ram_t *ram = (ram_t*)region->region_data;
+        if(walk->mode == SNAPSHOT_MEMORY_DIRTY && ram->dirty != NULL){
+            return snapshot_dirty_ram(walk, region);
+        }
+        /* a full snapshot is the new base of the dirty pages */
+        clear_ram_dirty(ram);
+        return snapshot_ram_range(walk, region, 0, region->size);
+    }
+    /* ROM is rarely written, it is only in the full snapshots */
+    if(region->type != MEMORY_REGION_ROM || walk->mode == SNAPSHOT_MEMORY_DIRTY){
+        return 0;
+    }
+
+    snapshot_region_t saved = {walk->map_index, region->base_addr, region->size, region->type, 0, region->size};
+    if(SNAPSHOT_PUT(snapshot, saved) < 0){
+        return -ERROR_CREATE;
+    }
+    uint8_t *content = snapshot_reserve(snapshot, region->size);
+    if(content == NULL){
+        return -ERROR_CREATE;
+    }
+
+    /* ROM lives in a file, read it at once */
+    if(region->read(0, content, region->size, region) != (int)region->size){
+        return -ERROR_SNAPSHOT;
+    }
+    return 0;
+}
+
+static int restore_region(memory_map_t *memory, snapshot_region_t *saved, uint8_t *content)
+{
+    memory_region_t *region = find_memory_region(memory, saved->base_addr, saved->size);
+    int retval = 0;
+
+    if(region == NULL || region->base_addr != saved->base_addr || region->size != saved->size ||
+       region->type != saved->type || saved->offset > region->size ||
+       saved->length > region->size - saved->offset){
+        LOG(LOG_ERROR, "restore_soc: no region 0x%x for the snapshot\n", saved->base_addr);
+        return -ERROR_SNAPSHOT;
+    }
+    if(region->type == MEMORY_REGION_RAM){
+        return ram_write((ram_t*)region->region_data, saved->offset, content, saved->length);
+    }
+
+    /* ROM is seldom written since the snapshot, only write the file back when it differs */
+    uint8_t *current = (uint8_t*)malloc(saved->length);
+    if(current == NULL){
+        return -ERROR_SNAPSHOT;
+    }
+    if(region->read(saved->offset, current, saved->length, region) != (int)saved->length ||
+       memcmp(current, content, saved->length) != 0){
+        if(region->write(saved->offset, content, saved->length, region) != (int)saved->length){
+            retval = -ERROR_SNAPSHOT;
+        }
+    }
+    free(current);
+    return retval;
+}
+
+/* the private map of every core follows the shared one */
+static memory_map_t* snapshot_memory_map(soc_t *soc, uint32_t map_index)
+{
+    if(map_index == 0){
+        return shared_memory_map(soc->cpu[0]->memory_map);
+    }
+    if(map_index > (uint32_t)soc->cpu_num || soc->cpu[map_index-1]->memory_map->shared == NULL){
+        return NULL;
+    }
+    return soc->cpu[map_index-1]->memory_map;
+}
+
+static int snapshot_memory(soc_t *soc, snapshot_t *snapshot, snapshot_memory_t mode)
+{
+    region_walk_t walk = {snapshot, 0, mode};
+    memory_map_t *memory;
+    int retval;
+
+    for(walk.map_index = 0; walk.map_index <= (uint32_t)soc->cpu_num; walk.map_index++){
+        memory = snapshot_memory_map(soc, walk.map_index);
+        if(memory == NULL){
+            continue;
+        }
+        retval = for_each_memory_region(memory, snapshot_region, &walk);
+        if(retval < 0){
+            return retval;
+        }
+    }
+    return 0;
+}
+
+static int restore_memory(soc_t *soc, snapshot_t *snapshot)
+{
+    snapshot_region_t saved;
+    memory_map_t *memory;
+    int retval;
+
+    while(snapshot_section_left(snapshot)){
+        if(SNAPSHOT_GET(snapshot, saved) < 0){
+            return -ERROR_SNAPSHOT;
+        }
+        uint8_t *content = snapshot_take(snapshot, saved.length);
+        memory = snapshot_memory_map(soc, saved.map_index);
+        if(content == NULL || memory == NULL){
+            return -ERROR_SNAPSHOT;
+        }
+        retval = restore_region(memory, &saved, content);
+        if(retval < 0){
+            return retval;
+        }
+    }
+    return 0;
+}
+
+/****** storage images ******/
+static int snapshot_image_range(snapshot_t *snapshot, mapped_image_t *image, uint64_t first, uint64_t end)
+{
+    snapshot_range_t saved = {first << IMAGE_PAGE_SHIFT, (end - first) << IMAGE_PAGE_SHIFT};
+    if(SNAPSHOT_PUT(snapshot, saved) < 0){
+        return -ERROR_CREATE;
+    }
+    uint8_t *content = snapshot_reserve(snapshot, saved.length);
+    if(content == NULL){
+        return -ERROR_CREATE;
+    }
+    memcpy(content, image->data + saved.offset, saved.length);
+    return 0;
+}
+
+/* every run of pages is saved as one range, the pages are clean afterwards */
+static int snapshot_image(snapshot_t *snapshot, uint32_t index, mapped_image_t *image, snapshot_memory_t mode)
+{
+    snapshot_image_t saved = {index, mode == SNAPSHOT_MEMORY_ALL, image->size};
+    snapshot_range_t end = {0, 0};
+    uint64_t page = 0, first, page_num = image_page_num(image);
+    int retval;
+
+    if(SNAPSHOT_PUT(snapshot, saved) < 0){
+        return -ERROR_CREATE;
+    }
+    while(page < page_num){
+        if(saved.full ? image->base[page] == NULL : !image->dirty[page]){
+            image->dirty[page] = 0;
+            page++;
+            continue;
+        }
+        for(first = page; page < page_num && (saved.full ? image->base[page] != NULL : image->dirty[page]); page++){
+            image->dirty[page] = 0;
+        }
+        retval = snapshot_image_range(snapshot, image, first, page);
+        if(retval < 0){
+            return retval;
+        }
+    }
+    return SNAPSHOT_PUT(snapshot, end) < 0 ? -ERROR_CREATE : 0;
+}
+
+static int snapshot_images(soc_t *soc, snapshot_t *snapshot, snapshot_memory_t mode)
+{
+    int i, retval;
+    for(i = 0; i < soc->image_num; i++){
+        if(soc->images[i]->dirty == NULL){
+            continue;
+        }
+        retval = snapshot_image(snapshot, i, soc->images[i], mode);
+        if(retval < 0){
+            return retval;
+        }
+    }
+    return 0;
+}
+
+static int restore_images(soc_t *soc, snapshot_t *snapshot)
+{
+    snapshot_image_t saved;
+    snapshot_range_t range;
+    mapped_image_t *image;
+
+    while(snapshot_section_left(snapshot)){
+        if(SNAPSHOT_GET(snapshot, saved) < 0){
+            return -ERROR_SNAPSHOT;
+        }
+        image = saved.index < (uint32_t)soc->image_num ? soc->images[saved.index] : NULL;
+        if(image == NULL || image->size != saved.size){
+            LOG(LOG_ERROR, "restore_soc: no image %u for the snapshot\n", saved.index);
+            return -ERROR_SNAPSHOT;
+        }
+        /* an image tracked since another time can't go back, the saved pages still come */
+        if(saved.full){
+            revert_image(image);
+        }
+        while(1){
+            if(SNAPSHOT_GET(snapshot, range) < 0){
+                return -ERROR_SNAPSHOT;
+            }
+            if(range.length == 0){
+                break;
+            }
+            uint8_t *content = snapshot_take(snapshot, range.length);
+            if(content == NULL || range.offset > image->size || range.length > image->size - range.offset){
+                return -ERROR_SNAPSHOT;
+            }
+            mark_image_dirty(image, range.offset, range.length);
+            memcpy(image->data + range.offset, content, range.length);
+        }
+    }
+    return 0;
+}
+
+/****** peripherals ******/
+static int snapshot_peripherals(soc_t *soc, snapshot_t *snapshot)
+{
+    snapshot_peri_t saved;
+    peripheral_t *peri;
+    int retval;
+
+    for(saved.kind = 0; saved.kind < PERI_MAX_KIND; saved.kind++){
+        for(saved.index = 0; saved.index < soc->peri_table[saved.kind].num; saved.index++){
+            peri = find_peripheral(soc, saved.kind, saved.index);
+            if(peri->snapshot == NULL){
+                continue;
+            }
+            if(SNAPSHOT_PUT(snapshot, saved) < 0){
+                return -ERROR_CREATE;
+            }
+            retval = peri->snapshot(snapshot, peri->user_data);
+            if(retval < 0){
+                return retval;
+            }
+        }
+    }
+    return 0;
+}
+
+static int restore_peripherals(soc_t *soc, snapshot_t *snapshot)
+{
+    snapshot_peri_t saved;
+    peripheral_t *peri;
+    int retval;
+
+    while(snapshot_section_left(snapshot)){
+        if(SNAPSHOT_GET(snapshot, saved) < 0){
+            return -ERROR_SNAPSHOT;
+        }
+        peri = find_peripheral(soc, saved.kind, saved.index);
+        if(peri == NULL || peri->restore == NULL){
+            LOG(LOG_ERROR, "restore_soc: no peripheral %d:%d for the snapshot\n", saved.kind, saved.index);
+            return -ERROR_SNAPSHOT;
+        }
+        retval = peri->restore(snapshot, peri->user_data);
+        if(retval < 0){
+            return retval;
+        }
+    }
+    return 0;
+}
+
+/****** soc ******/
+static int take_snapshot(soc_t *soc, snapshot_t *snapshot, snapshot_memory_t mode)
+{
+    snapshot_header_t header = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION, soc->cpu_num};
+    int i, retval;
+
+    snapshot->size = 0;
+    snapshot->pos = 0;
+    if(SNAPSHOT_PUT(snapshot, header) < 0){
+        return -ERROR_CREATE;
+    }
+
+    /* the core part of the cpus */
+    if(snapshot_begin_section(snapshot, SNAPSHOT_TAG_SOC) < 0){
+        return -ERROR_CREATE;
+    }
+    for(i = 0; i < soc->cpu_num; i++){
+        cpu_t *cpu = soc->cpu[i];
+        snapshot_cpu_t saved = {cpu->type, cpu->run_info.halting, cpu->run_info.extra_cycles,
+                                cpu->cycle, cpu->next_check_point, cpu->run_info.last_pc};
+        if(SNAPSHOT_PUT(snapshot, saved) < 0){
+            return -ERROR_CREATE;
+        }
+    }
+    snapshot_end_section(snapshot);
+
+    /* the architecture part */
+    for(i = 0; i < soc->cpu_num; i++){
+        cpu_t *cpu = soc->cpu[i];
+        if(cpu->snapshot == NULL){
+            LOG(LOG_ERROR, "snapshot_soc: cpu %d doesn't support snapshot\n", i);
+            return -ERROR_SNAPSHOT;
+        }
+        if(snapshot_begin_section(snapshot, SNAPSHOT_TAG_CPU) < 0){
+            return -ERROR_CREATE;
+        }
+        retval = cpu->snapshot(cpu, snapshot);
+        if(retval < 0){
+            return retval;
+        }
+        snapshot_end_section(snapshot);
+    }
+
+    if(snapshot_begin_section(snapshot, SNAPSHOT_TAG_MEM) < 0){
+        return -ERROR_CREATE;
+    }
+    if(mode != SNAPSHOT_MEMORY_NONE){
+        retval = snapshot_memory(soc, snapshot, mode);
+        if(retval < 0){
+            return retval;
+        }
+    }
+    snapshot_end_section(snapshot);
+
+    if(snapshot_begin_section(snapshot, SNAPSHOT_TAG_IMAGE) < 0){
+        return -ERROR_CREATE;
+    }
+    if(mode != SNAPSHOT_MEMORY_NONE){
+        retval = snapshot_images(soc, snapshot, mode);
+        if(retval < 0){
+            return retval;
+        }
+    }
+    snapshot_end_section(snapshot);
+
+    if(snapshot_begin_section(snapshot, SNAPSHOT_TAG_PERI) < 0){
+        return -ERROR_CREATE;
+    }
+    retval = snapshot_peripherals(soc, snapshot);
+    if(retval < 0){
+        return retval;
+    }
+    snapshot_end_section(snapshot);
+    return 0;
+}
+
+int snapshot_soc(soc_t *soc, snapshot_t *snapshot)
+{
+    return take_snapshot(soc, snapshot, SNAPSHOT_MEMORY_ALL);
+}
+
+/* the memory section is left empty, so restoring it keeps the memory as it is */
+int snapshot_soc_state(soc_t *soc, snapshot_t *snapshot)
+{
+    return take_snapshot(soc, snapshot, SNAPSHOT_MEMORY_NONE);
+}
+
+/* Only the RAM and image pages written since the last snapshot of the soc are saved,
+   see track_ram_dirty and track_image_dirty. Restoring it on top of that snapshot gives the state now. */
+int snapshot_soc_dirty(soc_t *soc, snapshot_t *snapshot)
+{
+    return take_snapshot(soc, snapshot, SNAPSHOT_MEMORY_DIRTY);
+}
+
+/* the soc must have the same configuration as the one the snapshot was taken from */
+int restore_soc(soc_t *soc, snapshot_t *snapshot)
+{
+    snapshot_header_t header;
+    snapshot_cpu_t saved;
+    int i, retval;
+
+    snapshot->pos = 0;
+    if(SNAPSHOT_GET(snapshot, header) < 0){
+        return -ERROR_SNAPSHOT;
+    }
+    if(header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION ||
+       header.cpu_num != (uint32_t)soc->cpu_num){
+        LOG(LOG_ERROR, "restore_soc: the snapshot doesn't fit the soc\n");
+        return -ERROR_SNAPSHOT;
+    }
+
+    if(snapshot_enter_section(snapshot, SNAPSHOT_TAG_SOC) < 0){
+        return -ERROR_SNAPSHOT;
+    }
+    for(i = 0; i < soc->cpu_num; i++){
+        cpu_t *cpu = soc->cpu[i];
+        if(SNAPSHOT_GET(snapshot, saved) < 0){
+            return -ERROR_SNAPSHOT;
+        }
+        if(saved.type != cpu->type || cpu->restore == NULL){
+            LOG(LOG_ERROR, "restore_soc: cpu %d doesn't fit the snapshot\n", i);
+            return -ERROR_SNAPSHOT;
+        }
+        cpu->run_info.halting = saved.halting;
+        cpu->run_info.extra_cycles = saved.extra_cycles;
+        cpu->cycle = saved.cycle;
+        cpu->next_check_point = saved.next_check_point;
+        cpu->run_info.last_pc = saved.last_pc;
+    }
+    snapshot->pos = snapshot->section;
+
+    for(i = 0; i < soc->cpu_num; i++){
+        if(snapshot_enter_section(snapshot, SNAPSHOT_TAG_CPU) < 0){
+            return -ERROR_SNAPSHOT;
+        }
+        retval = soc->cpu[i]->restore(soc->cpu[i], snapshot);
+        if(retval < 0){
+            return retval;
+        }
+        snapshot->pos = snapshot->section;
+    }
+
+    if(snapshot_enter_section(snapshot, SNAPSHOT_TAG_MEM) < 0){
+        return -ERROR_SNAPSHOT;
+    }
+    retval = restore_memory(soc, snapshot);
+    if(retval < 0){
+        return retval;
+    }
+
+    if(snapshot_enter_section(snapshot, SNAPSHOT_TAG_IMAGE) < 0){
+        return -ERROR_SNAPSHOT;
+    }
+    retval = restore_images(soc, snapshot);
+    if(retval < 0){
+        return retval;
+    }
+
+    if(snapshot_enter_section(snapshot, SNAPSHOT_TAG_PERI) < 0){
+        return -ERROR_SNAPSHOT;
+    }
+    retval = restore_peripherals(soc, snapshot);
+    if(retval < 0){
+        return retval;
+    }
+
+    /* the host clock doesn't go back with the cycles */
+    pacing_init(&soc->pacing, soc->pacing.freq_hz, soc->cpu[0]->cycle);
+    return 0;
+}
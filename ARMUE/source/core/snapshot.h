@@ -0,0 +1,76 @@
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "soc.h"
+#include "fifo.h"
+#include "bheap.h"
+
+/*
+ * A snapshot is the whole machine state in a compact binary format:
+ *     header:  magic, version, cpu number
+ *     section: tag, payload length, payload
+ * The sections are the soc, every core (cpu_t->snapshot), the RAM/ROM
+ * contents, the pages of the tracked storage images (soc_t->images) and the
+ * peripherals (peripheral_t->snapshot), in this order.
+ * Values are stored in host byte order, so a snapshot file only moves
+ * between hosts of the same endianess.
+ */
+
+#define SNAPSHOT_MAGIC      0x534D5241  // "ARMS"
+#define SNAPSHOT_VERSION    3
+
+#define SNAPSHOT_TAG(a, b, c, d) \
+    ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+#define SNAPSHOT_TAG_SOC    SNAPSHOT_TAG('S', 'O', 'C', ' ')
+#define SNAPSHOT_TAG_CPU    SNAPSHOT_TAG('C', 'P', 'U', ' ')
+#define SNAPSHOT_TAG_MEM    SNAPSHOT_TAG('M', 'E', 'M', ' ')
+#define SNAPSHOT_TAG_IMAGE  SNAPSHOT_TAG('I', 'M', 'G', ' ')
+#define SNAPSHOT_TAG_PERI   SNAPSHOT_TAG('P', 'E', 'R', 'I')
+
+typedef struct snapshot_t{
+    uint8_t *data;
+    size_t size;            // bytes written
+    size_t capacity;
+    size_t pos;             // read position
+    size_t section;         // start of the section being written or end of the one being read
+}snapshot_t;
+
+snapshot_t* create_snapshot();
+void destory_snapshot(snapshot_t **snapshot);
+int save_snapshot_file(snapshot_t *snapshot, char *path);
+snapshot_t* load_snapshot_file(char *path);
+
+uint8_t* snapshot_reserve(snapshot_t *snapshot, size_t size);
+int snapshot_put(snapshot_t *snapshot, const void *data, size_t size);
+int snapshot_get(snapshot_t *snapshot, void *data, size_t size);
+#define SNAPSHOT_PUT(snapshot, var) snapshot_put(snapshot, &(var), sizeof(var))
+#define SNAPSHOT_GET(snapshot, var) snapshot_get(snapshot, &(var), sizeof(var))
+
+int snapshot_begin_section(snapshot_t *snapshot, uint32_t tag);
+void snapshot_end_section(snapshot_t *snapshot);
+int snapshot_enter_section(snapshot_t *snapshot, uint32_t tag);
+#define snapshot_section_left(snapshot) ((snapshot)->pos < (snapshot)->section)
+
+/* the capacity of the restored fifo and heap must match the saved one */
+int snapshot_put_fifo(snapshot_t *snapshot, fifo_t *fifo);
+int snapshot_get_fifo(snapshot_t *snapshot, fifo_t *fifo);
+int snapshot_put_bheap(snapshot_t *snapshot, bheap_t *heap);
+int snapshot_get_bheap(snapshot_t *snapshot, bheap_t *heap);
+
+/* The soc must not be running. The snapshot is overwritten, so one buffer can be
+   reused. Restoring copies the state back in place, fast enough to reset the
+   machine between test cases. */
+int snapshot_soc(soc_t *soc, snapshot_t *snapshot);
+int snapshot_soc_state(soc_t *soc, snapshot_t *snapshot);
+int snapshot_soc_dirty(soc_t *soc, snapshot_t *snapshot);
+int restore_soc(soc_t *soc, snapshot_t *snapshot);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -2,11 +2,17 @@
 #include "soc.h"
 //#include "arm_gdb_stub.h"
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <windows.h>
 #include "config.h"
 #include "timer.h"
-#include "armue.h"
+#include "checkpoint.h"
+#include "replay.h"
+#include "reload.h"
+#include "peri_io.h"
+#include "semihost.h"
+#include "mapped_image.h"
 
 int startup_soc(soc_t* soc)
 {
@@ -14,29 +20,40 @@ int startup_soc(soc_t* soc)
         return ERROR_NULL_POINTER;
     }
     int retval = -ERROR_SOC_STARTUP;
+    int i;
 
-    cpu_t *cpu = soc->cpu[0];
+    for(i = 0; i < soc->cpu_num; i++){
+        cpu_t *cpu = soc->cpu[i];
 
-    // halt the cpu at startup
-    if(config.gdb_debug){
-        cpu->run_info.halting = TRUE;
-    }
-    cpu->run_info.last_pc = 0;
+        // halt the cpu at startup, the debugger is attached to the first core
+        if(soc->config.gdb_debug && i == 0){
+            cpu->run_info.halting = TRUE;
+        }
+        cpu->run_info.last_pc = 0;
 
-    /* start the cpu */
-    if(cpu->startup != NULL){
-        retval = cpu->startup(cpu);
+        /* start the cpu */
+        retval = -ERROR_SOC_STARTUP;
+        if(cpu->startup != NULL){
+            retval = cpu->startup(cpu);
+        }
+        if(retval < 0){
+            return retval;
+        }
     }
 
+    pacing_init(&soc->pacing, soc->config.clock_freq, soc->cpu[0]->cycle);
+
     return retval;
 }
 
 #include "arm_v7m_ins_decode.h"
-uint32_t run_soc(soc_t* soc)
+/* Run a single operation code on one core. The debugger, the peripheral input and
+   the pacing belong to the first core only. */
+uint32_t run_cpu(soc_t* soc, cpu_t *cpu)
 {
-    cpu_t *cpu = soc->cpu[0];
+    bool_t first_core = cpu->cid == 0;
 
-    if(config.gdb_debug){
+    if(soc->config.gdb_debug && first_core){
         LOG(LOG_DEBUG, "last pc is %x\n", cpu->run_info.last_pc);
         if(cpu->run_info.halting == MAYBE){
             /* The break operation code is set by debugger. So the last operation code executed
@@ -57,10 +74,31 @@ uint32_t run_soc(soc_t* soc)
         }
 
         /* cpu halting for debug */
-        while(cpu->run_info.halting){
-            handle_rsp(soc->stub, cpu);
+        if(cpu->run_info.halting){
+            /* the output before the stop is shown while stopped */
+            if(soc->peri_connect != NULL){
+                lock_devices(soc);
+                pmp_send(soc->peri_connect);
+                unlock_devices(soc);
+            }
+            while(cpu->run_info.halting){
+                handle_rsp(soc->stub, cpu);
+            }
+            /* the debugger may have changed the registers */
+            record_cpu_state(soc->replay, cpu);
+            /* running again from here doesn't need the debugger */
+            if(soc->checkpoints != NULL && soc->cpu_num == 1){
+                take_checkpoint(soc, soc->checkpoints);
+            }
         }
     }
+    if(first_core){
+        /* the debugger may reload before the first instruction */
+        if(soc->cpu_num == 1){
+            check_replay(soc, cpu, REPLAY_PHASE_RELOAD);
+        }
+        check_replay(soc, cpu, REPLAY_PHASE_DEBUG);
+    }
 
     /* store last pc */
     cpu->run_info.last_pc = cpu->get_raw_pc(cpu);
@@ -73,25 +111,25 @@ uint32_t run_soc(soc_t* soc)
 
     add_cycle(cpu);
     check_timer(cpu);
+    if(first_core){
+        check_pacing(&soc->pacing, cpu->cycle);
+    }
 
-    /* check peripheral input every 100 */
-    pmp_parsed_pkt_t pmp_pkt;
-    int result;
-    if(config.client && reach_check_point(cpu)){
-        core_connect_t *peri_connect = armue_get_peri_connect(cpu);
-        bool_t has_input = pmp_check_input(peri_connect);
-        if(has_input){
-            // start input parsing loop
-            pmp_parse_loop(peri_connect){
-                result = pmp_parse_input(peri_connect, &pmp_pkt);
-                if(result >= 0){
-                    dispatch_peri_event(&pmp_pkt);
-                }
-            }
-            peri_connect->recv_buf[peri_connect->recv_len] = '\0';
-            LOG(LOG_INFO, "Peripheral packet type[%d] received: %s\n", pmp_pkt.pkt_kind, peri_connect->recv_buf);
+    /* apply the peripheral input every PERI_IO_INTERVAL cycles, it is read on another thread.
+       Running again from a checkpoint takes the input from the log kept with them. */
+    if(soc->peri_io != NULL && first_core && !soc->rerunning && reach_check_point(cpu)){
+        lock_devices(soc);
+        if(peri_io_pending(soc->peri_io)){
+            apply_peri_io(soc);
+        }
+        if(soc->peri_connect != NULL){
+            pmp_flush_due(soc->peri_connect, cpu->cycle);
         }
-        updata_check_point(cpu, 10);
+        unlock_devices(soc);
+        updata_check_point(cpu, PERI_IO_INTERVAL);
+    }
+    if(first_core){
+        check_replay(soc, cpu, REPLAY_PHASE_INPUT);
     }
 
     /* exception and interrupt checker/handler */
@@ -104,43 +142,139 @@ uint32_t run_soc(soc_t* soc)
     }
     LOG_REG(cpu);
     //getchar();
+
+    /* between two instructions, a multi-core soc takes them at the barrier */
+    if(first_core && soc->cpu_num == 1){
+        check_checkpoint(soc);
+        check_replay(soc, cpu, REPLAY_PHASE_RELOAD);
+        check_reload(soc);
+    }
+    /* the program ended with SYS_EXIT */
+    if(soc->semihost != NULL && __atomic_load_n(&soc->semihost->exited, __ATOMIC_ACQUIRE)){
+        return 0;
+    }
     return opcode;
 }
 
-static soc_t* create_single_cpu_soc(cpu_t* cpu, memory_map_t *memory_space, memory_map_t *io_space)
+uint32_t run_soc(soc_t* soc)
+{
+    return run_cpu(soc, soc->cpu[0]);
+}
+
+typedef struct core_thread_t{
+    soc_t *soc;
+    cpu_t *cpu;
+    pthread_t thread;
+    pthread_mutex_t *start;     // held until every core has its thread
+}core_thread_t;
+
+/* the cores set it while the others run, so it is only touched atomically */
+static inline bool_t stop_requested(soc_t *soc)
 {
-    soc_t* soc = (soc_t*)calloc(1, sizeof(soc_t));
-    if(soc == NULL){
+    return __atomic_load_n(&soc->stop_request, __ATOMIC_ACQUIRE);
+}
+
+static inline void request_stop(soc_t *soc)
+{
+    __atomic_store_n(&soc->stop_request, TRUE, __ATOMIC_RELEASE);
+}
+
+/* Each core runs a quantum of cycles on its own, then waits for the others at the
+   barrier. The first core to stop the program stops all of them at the end of
+   the quantum. */
+static void* core_thread(void *arg)
+{
+    core_thread_t *core = (core_thread_t*)arg;
+    soc_t *soc = core->soc;
+    cpu_t *cpu = core->cpu;
+    cycle_t quantum_end = cpu->cycle;
+    bool_t stop;
+
+    /* a core whose thread couldn't be created stops the others before they start */
+    pthread_mutex_lock(core->start);
+    pthread_mutex_unlock(core->start);
+    if(stop_requested(soc)){
         return NULL;
     }
 
-    /* cpu id starts from 0 */
-    soc->cpu_num = 1;
-    cpu->cid = 0;
-    soc->cpu[0] = cpu;
-    soc->cpu[0]->memory_space = memory_space;
-    soc->cpu[0]->io_space = io_space;
+    for(;;){
+        quantum_end += soc->quantum;
+        while(cpu->cycle < quantum_end && !stop_requested(soc)){
+            if(run_cpu(soc, cpu) == 0){
+                request_stop(soc);
+            }
+        }
 
-    return soc;
+        pthread_barrier_wait(&soc->barrier);
+        stop = stop_requested(soc);
+        /* all the cores are waiting, so the machine can be saved */
+        if(cpu->cid == 0){
+            check_checkpoint(soc);
+            check_replay(soc, cpu, REPLAY_PHASE_RELOAD);
+            check_reload(soc);
+        }
+        pthread_barrier_wait(&soc->barrier);
+        if(stop){
+            break;
+        }
+    }
+    return NULL;
 }
 
-/* create the soc and initialize the content */
-soc_t* create_soc(soc_conf_t* config)
+/* run all the cores of the soc until the program stops, one host thread per core */
+int run_soc_parallel(soc_t* soc)
 {
-    soc_t* soc = NULL;
-    if(config->cpu_num != 1)
-        return NULL;
+    core_thread_t threads[MAX_CPU_NUM];
+    pthread_mutex_t start = PTHREAD_MUTEX_INITIALIZER;
+    int i, started = 0;
+    int retval = SUCCESS;
+
+    if(soc->cpu_num == 1){
+        while(run_soc(soc) != 0);
+        return SUCCESS;
+    }
 
-    /* find the cpu module and allocate the cpu */
-    module_t* cpu_module = find_module(config->cpu_name);
-    if(cpu_module == NULL){
-        goto find_cpu_module_fail;
+    soc->stop_request = FALSE;
+    if(pthread_barrier_init(&soc->barrier, NULL, soc->cpu_num) != 0){
+        LOG(LOG_ERROR, "run_soc_parallel: can't create barrier\n");
+        return -ERROR_CREATE;
+    }
+
+    pthread_mutex_lock(&start);
+    for(i = 0; i < soc->cpu_num; i++){
+        threads[i].soc = soc;
+        threads[i].cpu = soc->cpu[i];
+        threads[i].start = &start;
+        if(pthread_create(&threads[i].thread, NULL, core_thread, &threads[i]) != 0){
+            LOG(LOG_ERROR, "run_soc_parallel: can't create thread for cpu %d\n", i);
+            break;
+        }
+        started++;
     }
 
+    if(started != soc->cpu_num){
+        /* the started cores would wait at the barrier forever, give up the whole run */
+        request_stop(soc);
+        retval = -ERROR_CREATE;
+    }
+    pthread_mutex_unlock(&start);
+
+    for(i = 0; i < started; i++){
+        pthread_join(threads[i].thread, NULL);
+    }
+    pthread_barrier_destroy(&soc->barrier);
+    pthread_mutex_destroy(&start);
+    return retval;
+}
+
+/* create one core of the soc with its own exception controller and timers */
+static cpu_t* create_soc_cpu(soc_conf_t* config, module_t* cpu_module, soc_t* soc, int cid)
+{
     cpu_t* cpu = alloc_cpu();
     if(cpu == NULL){
         goto alloc_cpu_fail;
     }
+    cpu->cid = cid;
 
     /* create internal exception controller and external GIC */
     cpu->exceptions = create_vector_exception(config->exception_num);
@@ -156,15 +290,26 @@ soc_t* create_soc(soc_conf_t* config)
         cpu->GIC = NULL;
     }
 
-    /* create timer_list */
-    cpu->timer_list = list_create_empty();
+    /* create timer queue */
+    cpu->timer_queue = create_timer_queue();
+    if(cpu->timer_queue == NULL){
+        goto timer_queue_null;
+    }
 
-    /* create the soc */
-    LOG(LOG_DEBUG, "create_soc: created cpu %s\n", cpu_module->name);
-    soc = create_single_cpu_soc(cpu, config->memories[0], config->memories[0]);
-    if(soc == NULL){
-        goto create_soc_fail;
+    /* The cores of a multi-core soc have private maps for their private peripherals
+       and share the rest of the memory */
+    if(soc->shared_memory != NULL){
+        cpu->memory_space = create_private_memory_map(soc->shared_memory);
+        if(cpu->memory_space == NULL){
+            goto memory_null;
+        }
+    }else{
+        cpu->memory_space = config->memories[0];
     }
+    cpu->io_space = cpu->memory_space;
+
+    /* the cores share the global info created by the first core */
+    cpu->run_info.global_info = soc->global_info;
 
     /* Initialize the cpu. It is the cpu specific action.
        CPU need to know the memory map and exceptions, so before init_cpu,
@@ -177,20 +322,18 @@ soc_t* create_soc(soc_conf_t* config)
     /* validate the cpu */
     if(!validate_cpu(cpu)){
         LOG(LOG_ERROR, "create_soc: invalid cpu %s\n", cpu_module->name);
-        goto invalid_cpu;
-    }
-
-    /* global info is created when the first core of the cpu is initialized */
-    if(cpu->run_info.global_info != NULL){
-        soc->global_info = cpu->run_info.global_info;
+        cpu_module->destory_cpu(&cpu);
+        return NULL;
     }
-    return soc;
+    return cpu;
 
-invalid_cpu:
-    cpu_module->destory_cpu(&cpu);
 init_cpu_fail:
-    destory_soc(&soc);
-create_soc_fail:
+    /* the configured memory map is still owned by the caller */
+    if(soc->shared_memory == NULL){
+        cpu->memory_space = NULL;
+    }
+memory_null:
+timer_queue_null:
     if(cpu->GIC){
         destory_vector_exception(&cpu->GIC);
     }
@@ -199,6 +342,73 @@ GIC_null:
 exception_null:
     dealloc_cpu(&cpu);
 alloc_cpu_fail:
+    return NULL;
+}
+
+/* create the soc and initialize the content */
+soc_t* create_soc(soc_conf_t* soc_conf)
+{
+    soc_t* soc = NULL;
+    int i;
+    if(soc_conf->cpu_num < 1 || soc_conf->cpu_num > MAX_CPU_NUM)
+        return NULL;
+
+    /* find the cpu module */
+    module_t* cpu_module = find_module(soc_conf->cpu_name);
+    if(cpu_module == NULL){
+        goto find_cpu_module_fail;
+    }
+
+    soc = (soc_t*)calloc(1, sizeof(soc_t));
+    if(soc == NULL){
+        goto create_soc_fail;
+    }
+    /* start from the process wide configuration, the owner may change it before startup */
+    soc->config = config;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&soc->device_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    soc->peri_table = create_peripheral_table();
+    if(soc->peri_table == NULL){
+        goto create_cpu_fail;
+    }
+    soc->quantum = soc_conf->sync_quantum != 0 ? soc_conf->sync_quantum : SOC_DEFAULT_QUANTUM;
+    if(soc_conf->cpu_num > 1){
+        soc->shared_memory = soc_conf->memories[0];
+        soc->shared_memory->device_lock = &soc->device_lock;
+    }
+
+    /* cpu id starts from 0 */
+    for(i = 0; i < soc_conf->cpu_num; i++){
+        cpu_t *cpu = create_soc_cpu(soc_conf, cpu_module, soc, i);
+        if(cpu == NULL){
+            goto create_cpu_fail;
+        }
+        LOG(LOG_DEBUG, "create_soc: created cpu%d %s\n", i, cpu_module->name);
+        soc->cpu[i] = cpu;
+        /* the devices of any core may schedule on the timers of this one */
+        if(soc_conf->cpu_num > 1){
+            cpu->timer_queue->device_lock = &soc->device_lock;
+        }
+        soc->cpu_num++;
+
+        /* global info is created when the first core of the cpu is initialized */
+        if(soc->global_info == NULL){
+            soc->global_info = cpu->run_info.global_info;
+        }
+    }
+    return soc;
+
+create_cpu_fail:
+    /* leave the configured memory map to the caller */
+    if(soc->shared_memory != NULL){
+        soc->shared_memory->device_lock = NULL;
+    }
+    soc->shared_memory = NULL;
+    destory_soc(&soc);
+create_soc_fail:
 find_cpu_module_fail:
     return NULL;
 }
@@ -210,15 +420,53 @@ error_code_t destory_soc(soc_t **soc)
     }
 
     int i;
+    destory_peri_io(&(*soc)->peri_io);
+    destory_checkpoint_list(*soc, &(*soc)->checkpoints);
+    destory_replay(&(*soc)->replay);
+    destory_reload(&(*soc)->reload);
+    destory_semihost(&(*soc)->semihost);
     for(i = 0; i < (*soc)->cpu_num; i++){
         module_t* cpu_module = (module_t*)get_cpu_module((*soc)->cpu[i]);
         if(cpu_module != NULL){
             cpu_module->destory_cpu(&(*soc)->cpu[i]);
         }
     }
+    if((*soc)->shared_memory != NULL){
+        destory_memory_map(&(*soc)->shared_memory);
+    }
+    if((*soc)->peri_table != NULL){
+        destory_peripheral_table(&(*soc)->peri_table);
+    }
+    pthread_mutex_destroy(&(*soc)->device_lock);
 
     free(*soc);
     *soc = NULL;
 
     return SUCCESS;
 }
+
+/* an image added while the checkpoints are taken is tracked from the next one */
+int add_soc_image(soc_t *soc, struct mapped_image_t *image)
+{
+    if(soc->image_num >= IMAGE_NUM_MAX){
+        return -ERROR_ADD;
+    }
+    if(soc->checkpoints != NULL && track_image_dirty(image) < 0){
+        return -ERROR_CREATE;
+    }
+    soc->images[soc->image_num++] = image;
+    return 0;
+}
+
+/* before the device destroys it */
+void remove_soc_image(soc_t *soc, struct mapped_image_t *image)
+{
+    int i;
+    for(i = 0; i < soc->image_num; i++){
+        if(soc->images[i] == image){
+            soc->image_num--;
+            memmove(soc->images + i, soc->images + i + 1, (soc->image_num - i) * sizeof(soc->images[0]));
+            return;
+        }
+    }
+}
@@ -9,16 +9,58 @@ extern "C"{
 #include "error_code.h"
 //#include "soc.h"
 #include "arm_gdb_stub.h"
+#include "pacing.h"
+#include "config.h"
+#include <pthread.h>
 
 #define MAX_CPU_NUM 2
 #define MEMORY_NUM_MAX 2
+#define IMAGE_NUM_MAX 4
 
-typedef struct {
+/* cycles a core runs ahead before waiting for the others */
+#define SOC_DEFAULT_QUANTUM 1000
+
+struct core_connect_t;
+struct peripheral_table_t;
+struct checkpoint_list_t;
+struct replay_t;
+struct reload_t;
+struct peri_io_t;
+struct semihost_t;
+struct mapped_image_t;
+
+typedef struct soc_t{
     int cpu_num;
     gdb_stub_t *stub;
     cpu_t *cpu[MAX_CPU_NUM];
     void *global_info;
     list_t *timer_list;
+    pacing_t pacing;
+
+    /* multi-core: the memory map shared by all the cores, which the soc owns */
+    memory_map_t *shared_memory;
+    cycle_t quantum;
+    bool_t stop_request;                // set and read by the cores with __atomic
+    pthread_barrier_t barrier;
+    /* The devices, and the timers and exceptions they drive, are shared by the cores.
+       Recursive, a device may access another one. Only taken with more than one core. */
+    pthread_mutex_t device_lock;
+
+    /* Everything a machine uses lives here rather than in globals, so that
+       many socs can run in one process */
+    config_t config;
+    struct core_connect_t *peri_connect;    // connect to the peripheral monitor, NULL if none
+    struct peri_io_t *peri_io;              // reads the input of peri_connect, NULL if none
+    struct peripheral_table_t *peri_table;  // peripherals listening to the monitor
+    struct checkpoint_list_t *checkpoints;  // periodic checkpoints, NULL if none
+    struct replay_t *replay;                // records or replays the external input, NULL if neither
+    struct reload_t *reload;                // loads a new firmware image in place, NULL if not set up
+    struct semihost_t *semihost;            // shared by the cores, NULL if semihosting is off
+    /* the storage of the devices, the devices own them and the snapshots save them */
+    struct mapped_image_t *images[IMAGE_NUM_MAX];
+    int image_num;
+    bool_t rerunning;                       // running again from a checkpoint, nothing goes to the host
+    bool_t forked;                          // a child of a soc_fork_t, it doesn't write the host files
 }soc_t;
 
 typedef struct soc_conf_t{
@@ -35,6 +77,9 @@ typedef struct soc_conf_t{
     int memory_map_num;
     memory_map_t* memories[MEMORY_NUM_MAX];
 
+    /* cycles between synchronizations of the cores, 0 for default */
+    cycle_t sync_quantum;
+
     /* thumb specific configuration */
     uint32_t exclusive_high_address;   // exclusive addr
     uint32_t exclusive_low_address;
@@ -43,7 +88,25 @@ typedef struct soc_conf_t{
 soc_t* create_soc(soc_conf_t* config);
 error_code_t destory_soc(soc_t **soc);
 int startup_soc(soc_t* soc);
+uint32_t run_cpu(soc_t* soc, cpu_t *cpu);
 uint32_t run_soc(soc_t* soc);
+int run_soc_parallel(soc_t* soc);
+int add_soc_image(soc_t *soc, struct mapped_image_t *image);
+void remove_soc_image(soc_t *soc, struct mapped_image_t *image);
+
+static inline void lock_devices(soc_t *soc)
+{
+    if(soc->cpu_num > 1){
+        pthread_mutex_lock(&soc->device_lock);
+    }
+}
+
+static inline void unlock_devices(soc_t *soc)
+{
+    if(soc->cpu_num > 1){
+        pthread_mutex_unlock(&soc->device_lock);
+    }
+}
 
 #ifdef __cplusplus
 }
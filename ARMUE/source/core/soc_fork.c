@@ -0,0 +1,203 @@
+#include "soc_fork.h"
+#include "error_code.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ROM_CHUNK_SIZE 4
+
+/* copy a RAM/ROM region of the origin into a new image */
+static int add_fork_image(memory_region_t *region, void *data)
+{
+    soc_fork_t *fork = (soc_fork_t*)data;
+    uint32_t offset;
+    int retval;
+
+    if(region->type != MEMORY_REGION_RAM && region->type != MEMORY_REGION_ROM){
+        return 0;
+    }
+    if(fork->image_num >= FORK_IMAGE_MAX){
+        LOG(LOG_ERROR, "create_soc_fork: too many memory regions\n");
+        return -ERROR_MEMORY_MAP;
+    }
+
+    ram_t *ram = create_ram(region->size);
+    if(ram == NULL){
+        return -ERROR_CREATE;
+    }
+    fork->images[fork->image_num].base_addr = region->base_addr;
+    fork->images[fork->image_num].ram = ram;
+    fork->image_num++;
+
+    if(region->type == MEMORY_REGION_RAM){
+        ram_read((ram_t*)region->region_data, 0, ram->data, region->size);
+        return 0;
+    }
+
+    /* the children see the ROM as RAM, so they don't share the file */
+    for(offset = 0; offset < region->size; offset += retval){
+        retval = region->read(offset, ram->data + offset,
+                              region->size - offset < ROM_CHUNK_SIZE ? 1 : ROM_CHUNK_SIZE, region);
+        if(retval <= 0){
+            return -ERROR_FETCH;
+        }
+    }
+    return 0;
+}
+
+soc_fork_t* create_soc_fork(soc_t *origin, soc_conf_t *soc_conf, soc_setup_func_t setup, soc_cleanup_func_t cleanup)
+{
+    soc_fork_t *fork = (soc_fork_t*)calloc(1, sizeof(soc_fork_t));
+    if(fork == NULL){
+        goto fork_null;
+    }
+    fork->conf = *soc_conf;
+    fork->config = origin->config;
+    fork->setup = setup;
+    fork->cleanup = cleanup;
+
+    fork->state = create_snapshot();
+    if(fork->state == NULL){
+        goto state_null;
+    }
+    if(snapshot_soc_state(origin, fork->state) < 0){
+        goto snapshot_fail;
+    }
+
+    memory_map_t *memory = shared_memory_map(origin->cpu[0]->memory_map);
+    memcpy(fork->wait_states, memory->wait_states, sizeof(fork->wait_states));
+    if(for_each_memory_region(memory, add_fork_image, fork) < 0){
+        goto snapshot_fail;
+    }
+    return fork;
+
+snapshot_fail:
+state_null:
+    destory_soc_fork(&fork);
+fork_null:
+    return NULL;
+}
+
+void destory_soc_fork(soc_fork_t **fork)
+{
+    int i;
+    if(fork == NULL || *fork == NULL){
+        return;
+    }
+    for(i = 0; i < (*fork)->image_num; i++){
+        destory_ram(&(*fork)->images[i].ram);
+    }
+    destory_snapshot(&(*fork)->state);
+    free(*fork);
+    *fork = NULL;
+}
+
+/* the forked rams are held by the regions only, collect them before the map goes */
+typedef struct forked_rams_t{
+    int num;
+    ram_t *rams[FORK_IMAGE_MAX];
+}forked_rams_t;
+
+static int collect_forked_ram(memory_region_t *region, void *data)
+{
+    forked_rams_t *forked = (forked_rams_t*)data;
+    if(region->type == MEMORY_REGION_RAM && forked->num < FORK_IMAGE_MAX){
+        forked->rams[forked->num++] = (ram_t*)region->region_data;
+    }
+    return 0;
+}
+
+static void destory_forked_memory(memory_map_t **memory)
+{
+    forked_rams_t forked = {0};
+    int i;
+
+    for_each_memory_region(*memory, collect_forked_ram, &forked);
+    destory_memory_map(memory);
+    for(i = 0; i < forked.num; i++){
+        destory_ram(&forked.rams[i]);
+    }
+}
+
+static memory_map_t* fork_memory_map(soc_fork_t *fork)
+{
+    int i;
+    memory_map_t *memory = create_memory_map();
+    if(memory == NULL){
+        return NULL;
+    }
+    memcpy(memory->wait_states, fork->wait_states, sizeof(memory->wait_states));
+
+    for(i = 0; i < fork->image_num; i++){
+        ram_t *ram = fork_ram(fork->images[i].ram);
+        if(ram == NULL){
+            goto fork_fail;
+        }
+        if(setup_memory_map_ram(memory, ram, fork->images[i].base_addr) < 0){
+            destory_ram(&ram);
+            goto fork_fail;
+        }
+    }
+    return memory;
+
+fork_fail:
+    destory_forked_memory(&memory);
+    return NULL;
+}
+
+/* create a child soc in the state of the origin when the fork was created */
+soc_t* fork_soc(soc_fork_t *fork)
+{
+    soc_conf_t soc_conf = fork->conf;
+    /* every child reads the state on its own */
+    snapshot_t state = *fork->state;
+    soc_t *soc;
+
+    memory_map_t *memory = fork_memory_map(fork);
+    if(memory == NULL){
+        goto memory_null;
+    }
+    soc_conf.memory_map_num = 1;
+    soc_conf.memories[0] = memory;
+
+    soc = create_soc(&soc_conf);
+    if(soc == NULL){
+        goto create_soc_fail;
+    }
+    /* the soc owns the memory map from now on */
+    soc->config = fork->config;
+    soc->forked = TRUE;
+    if(fork->setup != NULL && fork->setup(soc) < 0){
+        goto setup_fail;
+    }
+    if(startup_soc(soc) < 0 || restore_soc(soc, &state) < 0){
+        goto restore_fail;
+    }
+    return soc;
+
+restore_fail:
+setup_fail:
+    destory_forked_soc(fork, &soc);
+    return NULL;
+create_soc_fail:
+    destory_forked_memory(&memory);
+memory_null:
+    return NULL;
+}
+
+void destory_forked_soc(soc_fork_t *fork, soc_t **soc)
+{
+    forked_rams_t forked = {0};
+    int i;
+
+    if(soc == NULL || *soc == NULL){
+        return;
+    }
+    if(fork->cleanup != NULL){
+        fork->cleanup(*soc);
+    }
+    for_each_memory_region(shared_memory_map((*soc)->cpu[0]->memory_map), collect_forked_ram, &forked);
+    destory_soc(soc);
+    for(i = 0; i < forked.num; i++){
+        destory_ram(&forked.rams[i]);
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef _SOC_FORK_H_
+#define _SOC_FORK_H_
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include "soc.h"
+#include "snapshot.h"
+
+#define FORK_IMAGE_MAX (ROM_MAX + RAM_MAX)
+
+/* the soc specific part of the machine, e.g. the peripherals of the chip */
+typedef int (*soc_setup_func_t)(soc_t *soc);
+typedef void (*soc_cleanup_func_t)(soc_t *soc);
+
+/* a frozen copy of a RAM/ROM region, the pages are shared by the children */
+typedef struct fork_image_t{
+    uint32_t base_addr;
+    ram_t *ram;
+}fork_image_t;
+
+/*
+ * A fork is the frozen state of a running soc. Every child forked from it starts
+ * from that state and shares the memory pages with the others until it writes
+ * them (copy-on-write), so booting once serves any number of test inputs.
+ * The origin may go on running or be destoried once the fork is created, but
+ * the children must be destoried before the fork.
+ */
+typedef struct soc_fork_t{
+    soc_conf_t conf;                // the configuration the origin was created with
+    config_t config;
+    soc_setup_func_t setup;         // called on every child before startup, may be NULL
+    soc_cleanup_func_t cleanup;     // called on every child before destory, may be NULL
+    snapshot_t *state;              // cpu and peripheral state, the memory is in the images
+    uint8_t wait_states[MEM_WAIT_TABLE_SIZE];
+    int image_num;
+    fork_image_t images[FORK_IMAGE_MAX];
+}soc_fork_t;
+
+/* the origin must not be running */
+soc_fork_t* create_soc_fork(soc_t *origin, soc_conf_t *soc_conf, soc_setup_func_t setup, soc_cleanup_func_t cleanup);
+void destory_soc_fork(soc_fork_t **fork);
+
+/* the children of a fork can be created, run and destoried on different threads */
+soc_t* fork_soc(soc_fork_t *fork);
+void destory_forked_soc(soc_fork_t *fork, soc_t **soc);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
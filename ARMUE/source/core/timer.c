@@ -1,18 +1,48 @@
 #include "timer.h"
-#include "list.h"
 #include <stdlib.h>
 #include "cpu.h"
 
+#define TIMER_QUEUE_INIT_SIZE 8
 
-typedef list_t timer_list_t;
+timer_queue_t *create_timer_queue()
+{
+    timer_queue_t *queue = (timer_queue_t *)calloc(1, sizeof(timer_queue_t));
+    if(queue == NULL){
+        goto queue_error;
+    }
 
-list_t *create_timer_list()
+    queue->heap = (timer_t **)calloc(TIMER_QUEUE_INIT_SIZE, sizeof(timer_t *));
+    if(queue->heap == NULL){
+        goto heap_error;
+    }
+    queue->capacity = TIMER_QUEUE_INIT_SIZE;
+    queue->count = 0;
+    queue->next_match = TIMER_CYCLE_NEVER;
+    return queue;
+
+heap_error:
+    free(queue);
+queue_error:
+    return NULL;
+}
+
+/* the timers still in the queue are destoried as well */
+int destory_timer_queue(timer_queue_t **queue)
 {
-    list_t *timer_list = list_create_empty();
-    return timer_list;
+    if(queue == NULL || *queue == NULL){
+        return -1;
+    }
+
+    int i;
+    for(i = 0; i < (*queue)->count; i++){
+        destory_timer(&(*queue)->heap[i]);
+    }
+    free((*queue)->heap);
+    free(*queue);
+    *queue = NULL;
+    return 0;
 }
 
-/* create timer and add to the list */
 timer_t *create_timer(int exception_num)
 {
     timer_t *timer = (timer_t *)calloc(1, sizeof(timer_t));
@@ -20,6 +50,8 @@ timer_t *create_timer(int exception_num)
         goto timer_error;
     }
     timer->exception_num = exception_num;
+    timer->queue = NULL;
+    timer->heap_index = -1;
     return timer;
 
 timer_error:
@@ -33,102 +65,170 @@ int destory_timer(timer_t **timer)
     return 0;
 }
 
-/* find timer in the list using exception number as the id */
-list_t *find_timer(int exception_num, list_t *timer_list)
+static inline void set_next_match(timer_queue_t *queue, cycle_t match)
+{
+    __atomic_store_n(&queue->next_match, match, __ATOMIC_RELAXED);
+}
+
+static inline void timer_heap_set(timer_queue_t *queue, int index, timer_t *timer)
+{
+    queue->heap[index] = timer;
+    timer->heap_index = index;
+}
+
+static void timer_sift_up(timer_queue_t *queue, int index)
 {
-    list_t *cur;
-    timer_t *cur_timer;
-    for_each_list_node(cur, timer_list){
-        cur_timer = (timer_t *)cur->data.pdata;
-        if(cur_timer->exception_num == exception_num){
-            return cur;
+    timer_t *timer = queue->heap[index];
+    int parent;
+    while(index > 0){
+        parent = (index - 1) / 2;
+        if(queue->heap[parent]->match <= timer->match){
+            break;
         }
+        timer_heap_set(queue, index, queue->heap[parent]);
+        index = parent;
     }
-    return NULL;
+    timer_heap_set(queue, index, timer);
+}
+
+static void timer_sift_down(timer_queue_t *queue, int index)
+{
+    timer_t *timer = queue->heap[index];
+    int child;
+    while((child = index * 2 + 1) < queue->count){
+        if(child + 1 < queue->count && queue->heap[child + 1]->match < queue->heap[child]->match){
+            child++;
+        }
+        if(timer->match <= queue->heap[child]->match){
+            break;
+        }
+        timer_heap_set(queue, index, queue->heap[child]);
+        index = child;
+    }
+    timer_heap_set(queue, index, timer);
+}
+
+/* restore the heap after the match of heap[index] changed */
+static void timer_queue_update(timer_queue_t *queue, int index)
+{
+    if(index > 0 && queue->heap[(index - 1) / 2]->match > queue->heap[index]->match){
+        timer_sift_up(queue, index);
+    }else{
+        timer_sift_down(queue, index);
+    }
+    set_next_match(queue, queue->heap[0]->match);
 }
 
-int add_timer(timer_t *timer, list_t *timer_list, bool_t ignore_duplicate)
+/* returns 1 if the timer is already in a queue */
+int add_timer(timer_t *timer, timer_queue_t *queue)
 {
-    if(timer_list == NULL || timer == NULL){
+    if(queue == NULL || timer == NULL){
         return -1;
     }
 
-    // check whether the timer is exist in the list already
-    timer_t *timer_found;
-    list_t *cur = find_timer(timer->exception_num, timer_list);
-    if(cur != NULL){
-        LOG(LOG_DEBUG, "add_timer: timer with exp_num %d is in the list\n", timer->exception_num);
-        if(ignore_duplicate){
-            return 1;
-        }else{
-            timer_found = (timer_t *)cur->data.pdata;
-            timer_found->match = timer->match;
-            timer_found->reload = timer->reload;
-            return 1;
-        }
+    if(timer->queue != NULL){
+        LOG(LOG_DEBUG, "add_timer: timer with exp_num %d is in the queue\n", timer->exception_num);
+        return 1;
     }
 
-    list_t *new_node = list_create_node_ptr(timer);
-    if(new_node == NULL){
-        goto error;
+    if(queue->count == queue->capacity){
+        timer_t **heap = (timer_t **)realloc(queue->heap, queue->capacity * 2 * sizeof(timer_t *));
+        if(heap == NULL){
+            return -1;
+        }
+        queue->heap = heap;
+        queue->capacity *= 2;
     }
-    list_append(timer_list, new_node);
-    return 0;
 
-error:
-    return -1;
+    timer->queue = queue;
+    timer_heap_set(queue, queue->count++, timer);
+    timer_queue_update(queue, timer->heap_index);
+    return 0;
 }
 
-int delete_timer(int exception_num, list_t *timer_list)
+/* remove the timer from its queue and destory it */
+int delete_timer(timer_t *timer)
 {
-    timer_t *timer_deleted;
-    list_t *found;
-    found = find_timer(exception_num, timer_list);
-    if(found != NULL){
-        timer_deleted = list_delete(&found).pdata;
-        LOG(LOG_DEBUG, "delete_timer: deleted excep_num = %d\n", timer_deleted->exception_num);
-        destory_timer(&timer_deleted);
+    if(timer == NULL){
+        return -1;
+    }
+
+    timer_queue_t *queue = timer->queue;
+    if(queue != NULL){
+        int index = timer->heap_index;
+        queue->count--;
+        if(index != queue->count){
+            timer_heap_set(queue, index, queue->heap[queue->count]);
+            timer_queue_update(queue, index);
+        }else if(queue->count == 0){
+            set_next_match(queue, TIMER_CYCLE_NEVER);
+        }else{
+            set_next_match(queue, queue->heap[0]->match);
+        }
     }
+
+    LOG(LOG_DEBUG, "delete_timer: deleted excep_num = %d\n", timer->exception_num);
+    destory_timer(&timer);
     return 0;
 }
 
+static inline void set_timer_match(timer_t *timer, cycle_t match)
+{
+    timer->match = match;
+    if(timer->queue != NULL){
+        timer_queue_update(timer->queue, timer->heap_index);
+    }
+}
+
 void start_timer(timer_t *timer, cpu_t *cpu, cycle_t reload, int (*do_match)(timer_t *timer, cpu_t *cpu))
 {
     timer->reload = reload;
     timer->do_match = do_match;
-    timer->match = calc_timer_match(cpu, reload);
-    timer->start = cpu->cycle;
+    timer->start = timer_cpu_cycle(cpu);
+    set_timer_match(timer, calc_timer_match(cpu, reload));
 }
 
 void restart_timer(timer_t *timer, cpu_t *cpu)
 {
-    timer->match = calc_timer_match(cpu, timer->reload);
-    timer->start = cpu->cycle;
+    timer->start = timer_cpu_cycle(cpu);
+    set_timer_match(timer, calc_timer_match(cpu, timer->reload));
+}
+
+/* put back a saved timer, the queue is reordered for the new match */
+void load_timer(timer_t *timer, cycle_t reload, cycle_t start, cycle_t match)
+{
+    timer->reload = reload;
+    timer->start = start;
+    set_timer_match(timer, match);
 }
 
 cycle_t positive_timer_count(timer_t *timer, cpu_t *cpu)
 {
-    return cpu->cycle - timer->start;
+    return timer_cpu_cycle(cpu) - timer->start;
 }
 
 cycle_t negative_timer_count(timer_t *timer, cpu_t *cpu)
 {
-    return timer->match - cpu->cycle;
+    return timer->match - timer_cpu_cycle(cpu);
 }
 
-void check_timer(cpu_t *cpu)
+/* The slow path of check_timer. A matched timer is rearmed before do_match,
+   so do_match is free to restart or delete it. */
+void run_timers(cpu_t *cpu)
 {
-    list_t *timer_list = cpu->timer_list;
-    cycle_t cur_cycle = cpu->cycle;
-
-    int retval;
-    list_t *cur_node, *next_node;
+    timer_queue_t *queue = cpu->timer_queue;
     timer_t *timer;
-    for_each_list_node_safe(cur_node, next_node, timer_list){
-        timer = (timer_t *)cur_node->data.pdata;
-        if(timer->match <= cur_cycle){
-            retval = timer->do_match(timer, cpu);
-            restart_timer(timer, cpu);
-        }
+    if(queue->device_lock != NULL){
+        pthread_mutex_lock(queue->device_lock);
+    }
+    while(queue->count > 0 && queue->heap[0]->match <= cpu->cycle){
+        timer = queue->heap[0];
+        timer->start = cpu->cycle;
+        /* a zero reload matches every cycle rather than spinning here */
+        set_timer_match(timer, calc_timer_match(cpu, timer->reload ? timer->reload : 1));
+        timer->do_match(timer, cpu);
+    }
+    if(queue->device_lock != NULL){
+        pthread_mutex_unlock(queue->device_lock);
     }
 }
@@ -6,9 +6,12 @@ extern "C"{
 #endif
 
 #include "_types.h"
-#include "list.h"
 #include "cpu.h"
+#include <pthread.h>
 
+#define TIMER_CYCLE_NEVER (~(cycle_t)0)
+
+struct timer_queue_t;
 struct timer_t{
     cycle_t reload;
     cycle_t match;
@@ -19,21 +22,54 @@ struct timer_t{
         void *user_data_ptr;
         int user_data_int;
     };
+    /* position in the queue, only valid when queue is not NULL */
+    struct timer_queue_t *queue;
+    int heap_index;
 };
 typedef struct timer_t timer_t;
 
+/* Timers are kept in a binary min-heap ordered by match, so the earliest
+   deadline is always heap[0] and is cached in next_match for check_timer.
+   On a multi-core soc the devices of any core may change the queue, they do
+   it under device_lock and next_match is read without it. */
+typedef struct timer_queue_t{
+    timer_t **heap;
+    int count;
+    int capacity;
+    cycle_t next_match;
+    pthread_mutex_t *device_lock;   // NULL with one core
+}timer_queue_t;
+
+/* the cycle of the core the queue belongs to, which may not be the calling one */
+static inline cycle_t timer_cpu_cycle(cpu_t *cpu)
+{
+    return __atomic_load_n(&cpu->cycle, __ATOMIC_RELAXED);
+}
+
 static inline cycle_t calc_timer_match(cpu_t *cpu, cycle_t reload)
 {
-    return cpu->cycle + reload;
+    return timer_cpu_cycle(cpu) + reload;
+}
+
+void run_timers(cpu_t *cpu);
+
+/* called every cycle, only a compare unless some timer matches */
+static inline void check_timer(cpu_t *cpu)
+{
+    if(cpu->cycle >= __atomic_load_n(&cpu->timer_queue->next_match, __ATOMIC_RELAXED)){
+        run_timers(cpu);
+    }
 }
 
-void check_timer(cpu_t *cpu);
+timer_queue_t *create_timer_queue();
+int destory_timer_queue(timer_queue_t **queue);
 timer_t *create_timer(int exception_num);
 int destory_timer(timer_t **timer);
-int add_timer(timer_t *timer, list_t *timer_list, bool_t ignore_duplicate);
-int delete_timer(int exception_num, list_t *timer_list);
+int add_timer(timer_t *timer, timer_queue_t *queue);
+int delete_timer(timer_t *timer);
 void restart_timer(timer_t *timer, cpu_t *cpu);
 void start_timer(timer_t *timer, cpu_t *cpu, cycle_t reload, int (*do_match)(timer_t *timer, cpu_t *cpu));
+void load_timer(timer_t *timer, cycle_t reload, cycle_t start, cycle_t match);
 cycle_t positive_timer_count(timer_t *timer, cpu_t *cpu);
 cycle_t negative_timer_count(timer_t *timer, cpu_t *cpu);
 
@@ -4,7 +4,99 @@
 #include "io.h"
 #include <assert.h>
 
-static long int pipe_recv(char *buffer, long int max_size, pipe_t *pipe, bool_t block)
+#ifdef __linux__
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static long int pipe_recv(char *buffer, long int max_size, pipe_t pipe, bool_t block)
+{
+    long int size_recved = recv(pipe, buffer, max_size, block ? 0 : MSG_DONTWAIT);
+    if(size_recved < 0 && !block && (errno == EAGAIN || errno == EWOULDBLOCK)){
+        return 0;
+    }
+    // the other side is gone
+    if(size_recved == 0){
+        return -1;
+    }
+    return size_recved;
+}
+
+static long int pipe_send(char *buffer, long int send_size, pipe_t pipe)
+{
+    return send(pipe, buffer, send_size, MSG_NOSIGNAL);
+}
+
+static bool_t pipe_wait_input(pipe_t pipe, int timeout_ms)
+{
+    struct pollfd fd = {pipe, POLLIN, 0};
+    return poll(&fd, 1, timeout_ms) > 0;
+}
+
+static int pipe_address(const char *name, struct sockaddr_un *addr)
+{
+    if(strlen(name) >= sizeof(addr->sun_path)){
+        LOG(LOG_ERROR, "The pipe name is too long: %s\n", name);
+        return -1;
+    }
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, name);
+    return 0;
+}
+
+/* wait for the monitor to create the socket, like WaitNamedPipe does */
+static pipe_t pipe_open(const char *name)
+{
+    struct sockaddr_un addr;
+    if(pipe_address(name, &addr) < 0){
+        return PIPE_NONE;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0){
+        return PIPE_NONE;
+    }
+    while(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+        if(errno != ENOENT && errno != ECONNREFUSED){
+            LOG(LOG_ERROR, "Can't connect to the pipe: %s. Error is %d\n", name, errno);
+            close(fd);
+            return PIPE_NONE;
+        }
+        usleep(1000);
+    }
+    return fd;
+}
+
+/* create the socket and wait for the core */
+static pipe_t pipe_create(const char *name)
+{
+    struct sockaddr_un addr;
+    if(pipe_address(name, &addr) < 0){
+        return PIPE_NONE;
+    }
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listen_fd < 0){
+        return PIPE_NONE;
+    }
+    unlink(name);
+    int fd = -1;
+    if(bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 && listen(listen_fd, 1) == 0){
+        fd = accept(listen_fd, NULL, NULL);
+    }
+    close(listen_fd);
+    unlink(name);
+    return fd < 0 ? PIPE_NONE : fd;
+}
+
+static void pipe_close(pipe_t pipe)
+{
+    close(pipe);
+}
+#else
+static long int pipe_recv(char *buffer, long int max_size, pipe_t pipe, bool_t block)
 {
     DWORD size_recved;
     // if nonblock mode, check the pipe first
@@ -22,7 +114,7 @@ static long int pipe_recv(char *buffer, long int max_size, pipe_t *pipe, bool_t
     }
 }
 
-static long int pipe_send(char *buffer, long int send_size, pipe_t *pipe)
+static long int pipe_send(char *buffer, long int send_size, pipe_t pipe)
 {
     DWORD size_sent;
     BOOL success = WriteFile(pipe, buffer, send_size, &size_sent, NULL);
@@ -33,6 +125,78 @@ static long int pipe_send(char *buffer, long int send_size, pipe_t *pipe)
     }
 }
 
+/* A read blocking on a pipe would hold up the writes to it, so the pipe is looked
+   at every millisecond. */
+static bool_t pipe_wait_input(pipe_t pipe, int timeout_ms)
+{
+    DWORD size_recved = 0;
+    int waited;
+    for(waited = 0; waited <= timeout_ms; waited++){
+        if(PeekNamedPipe(pipe, NULL, 0, NULL, &size_recved, NULL) && size_recved != 0){
+            return TRUE;
+        }
+        Sleep(1);
+    }
+    return FALSE;
+}
+
+static pipe_t pipe_open(const char *name)
+{
+    BOOL pipe_ok = WaitNamedPipe(name, NMPWAIT_WAIT_FOREVER);
+    if(!pipe_ok){
+        LOG(LOG_ERROR, "Can't wait for the pipe: %s. Last error is %ld\n", name, GetLastError());
+        return PIPE_NONE;
+    }
+    pipe_t pipe = CreateFile(name, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+    return pipe == INVALID_HANDLE_VALUE ? PIPE_NONE : pipe;
+}
+
+static pipe_t pipe_create(const char *name)
+{
+    pipe_t pipe = CreateNamedPipe(name, PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED, PIPE_TYPE_BYTE, 1, 1024, 1024, 0, NULL);
+    if(pipe == INVALID_HANDLE_VALUE){
+        LOG(LOG_ERROR, "Can't create pipe\n");
+        return PIPE_NONE;
+    }
+    if(!ConnectNamedPipe(pipe, NULL)){
+        CloseHandle(pipe);
+        return PIPE_NONE;
+    }
+    return pipe;
+}
+
+static void pipe_close(pipe_t pipe)
+{
+    CloseHandle(pipe);
+}
+#endif
+
+/* the data goes after the bytes kept by pmp_keep_unparsed */
+static long int connect_recv(core_connect_t *connect, bool_t block)
+{
+    char *buffer = connect->recv_buf + connect->recv_kept;
+    long int max_size = connect->recv_buf_len - connect->recv_kept;
+    long int recv_len;
+    if(connect->shm != NULL){
+        recv_len = shm_recv(connect->shm, buffer, max_size, block);
+    }else{
+        recv_len = pipe_recv(buffer, max_size, connect->in_pipe, block);
+    }
+    if(recv_len > 0){
+        connect->recv_len = connect->recv_kept + recv_len;
+        connect->recv_kept = 0;
+    }
+    return recv_len;
+}
+
+static long int connect_send(core_connect_t *connect, char *buffer, long int send_size)
+{
+    if(connect->shm != NULL){
+        return shm_send(connect->shm, buffer, send_size);
+    }
+    return pipe_send(buffer, send_size, connect->out_pipe);
+}
+
 core_connect_t *create_core_connect(unsigned int buf_len, const char *pipe_name)
 {
     char *recv_buf = (char *)malloc(buf_len);
@@ -53,6 +217,10 @@ core_connect_t *create_core_connect(unsigned int buf_len, const char *pipe_name)
     connect->send_buf = send_buf;
     connect->send_buf_len = buf_len;
     connect->pipe_name = pipe_name;
+    connect->last_pkt = -1;
+    connect->batch_size = buf_len < PMP_BATCH_SIZE ? buf_len : PMP_BATCH_SIZE;
+    connect->batch_cycles = PMP_BATCH_CYCLES;
+    connect->pending_since = PMP_NEVER;
     return connect;
 
 connect_null:
@@ -69,6 +237,10 @@ void destory_core_connect(core_connect_t **connect)
         return;
     }
 
+    destory_shm_connect(&(*connect)->shm);
+    if((*connect)->in_pipe != PIPE_NONE){
+        pipe_close((*connect)->in_pipe);
+    }
     free((*connect)->send_buf);
     free((*connect)->recv_buf);
     free(*connect);
@@ -79,7 +251,7 @@ void destory_core_connect(core_connect_t **connect)
 int connect_monitor(core_connect_t *monitor_connect)
 {
     // already connected
-    if(monitor_connect->in_pipe != NULL && monitor_connect->out_pipe != NULL){
+    if((monitor_connect->in_pipe != PIPE_NONE && monitor_connect->out_pipe != PIPE_NONE) || monitor_connect->shm != NULL){
         return 1;
     }
 
@@ -87,18 +259,19 @@ int connect_monitor(core_connect_t *monitor_connect)
         LOG(LOG_ERROR, "No pipe name specified\n");
         return -1;
     }
-
-    BOOL pipe_ok = WaitNamedPipe(monitor_connect->pipe_name, NMPWAIT_WAIT_FOREVER);
-    if(!pipe_ok){
-        LOG(LOG_ERROR, "Can't wait for the pipe: %s. Last error is %ld\n", monitor_connect->pipe_name, GetLastError());
-        return -3;
+    if(is_shm_connect_name(monitor_connect->pipe_name)){
+        monitor_connect->shm = shm_connect_core_side(monitor_connect->pipe_name);
+        if(monitor_connect->shm == NULL){
+            LOG(LOG_ERROR, "Can't connect to peripheral monitor\n");
+            return -4;
+        }
+        return 0;
     }
-    monitor_connect->in_pipe = CreateFile(monitor_connect->pipe_name,
-                          GENERIC_READ | GENERIC_WRITE,
-                          0, NULL, OPEN_EXISTING, 0, NULL);
-    // out pipe is the same as in pipe under Windows
+
+    monitor_connect->in_pipe = pipe_open(monitor_connect->pipe_name);
+    // the pipe goes both ways
     monitor_connect->out_pipe = monitor_connect->in_pipe;
-    if(monitor_connect->in_pipe == INVALID_HANDLE_VALUE){
+    if(monitor_connect->in_pipe == PIPE_NONE){
         LOG(LOG_ERROR, "Can't connect to peripheral monitor\n");
         return -4;
     }
@@ -109,10 +282,9 @@ int connect_monitor(core_connect_t *monitor_connect)
 /* check whether there has data sent from peripherals and receive it if it's true */
 bool_t pmp_check_input(core_connect_t *monitor_connect)
 {
-    long int recv_len = pipe_recv(monitor_connect->recv_buf, monitor_connect->recv_buf_len, monitor_connect->in_pipe, FALSE);
+    long int recv_len = connect_recv(monitor_connect, FALSE);
     bool_t retval;
     if(recv_len > 0){
-        monitor_connect->recv_len = recv_len;
         retval = TRUE;
     }else{
         retval = FALSE;
@@ -120,15 +292,25 @@ bool_t pmp_check_input(core_connect_t *monitor_connect)
     return retval;
 }
 
+/* wait for input for timeout_ms at most, TRUE if there is some */
+bool_t pmp_wait_input(core_connect_t *connect, int timeout_ms)
+{
+    if(connect->shm != NULL){
+        return shm_wait_input(connect->shm, timeout_ms);
+    }
+    return pipe_wait_input(connect->in_pipe, timeout_ms);
+}
+
 /* directly send data to peripheral without using buffer */
 int send_to_monitor_direct(core_connect_t *monitor_connect, char *data, unsigned int len)
 {
-    return pipe_send(data, len, monitor_connect->out_pipe);
+    return connect_send(monitor_connect, data, len);
 }
 
 void restart_send_packet(core_connect_t *connect)
 {
     connect->send_len = 0;
+    connect->last_pkt = -1;
     connect->retry = 0;
 }
 
@@ -162,10 +344,64 @@ int make_pmp_data_packet(core_connect_t *connect, uint8_t peri_kind, uint16_t pe
     buf_start += sizeof(struct data_pkt_head_t);
     memcpy(buf_start, data, data_len);
 
+    connect->last_pkt = connect->send_len;
     connect->send_len += packet_len;
     return 0;
 }
 
+/* append the data to the last packet if it goes to the same place */
+static bool_t extend_last_packet(core_connect_t *connect, uint8_t peri_kind, uint16_t peri_index, uint8_t data_kind, uint8_t *data, uint32_t data_len)
+{
+    if(connect->last_pkt < 0 || connect->send_buf_len - connect->send_len < data_len){
+        return FALSE;
+    }
+    struct pmp_pkt_head_t *pmp_head = (struct pmp_pkt_head_t *)&connect->send_buf[connect->last_pkt];
+    struct data_pkt_head_t *data_head = (struct data_pkt_head_t *)(pmp_head + 1);
+    if(pmp_head->packet_kind != PMP_DATA || data_head->peri_kind != peri_kind ||
+       data_head->peri_index != peri_index || data_head->data_kind != data_kind){
+        return FALSE;
+    }
+    memcpy(&connect->send_buf[connect->send_len], data, data_len);
+    pmp_head->packet_len += data_len;
+    connect->send_len += data_len;
+    return TRUE;
+}
+
+/* Queue the data rather than send it now. Data for the same peripheral is merged into
+   one packet, and all of it is sent when the batch is full or by pmp_flush_due.
+   The cores of a soc queue and flush with the device lock of the soc held. */
+int pmp_queue_data(core_connect_t *connect, uint8_t peri_kind, uint16_t peri_index, uint8_t data_kind, uint8_t *data, uint32_t data_len)
+{
+    if(connect == NULL){
+        return -1;
+    }
+    if(!extend_last_packet(connect, peri_kind, peri_index, data_kind, data, data_len)){
+        if(make_pmp_data_packet(connect, peri_kind, peri_index, data_kind, data, data_len) == -2){
+            pmp_send(connect);
+            if(make_pmp_data_packet(connect, peri_kind, peri_index, data_kind, data, data_len) < 0){
+                return -2;
+            }
+        }
+    }
+    if(connect->send_len >= connect->batch_size){
+        pmp_send(connect);
+    }
+    return 0;
+}
+
+/* called now and then from the cpu loop, sends what has waited for batch_cycles */
+void pmp_flush_due(core_connect_t *connect, cycle_t now)
+{
+    if(connect->send_len == 0){
+        connect->pending_since = PMP_NEVER;
+    }else if(connect->pending_since == PMP_NEVER){
+        connect->pending_since = now;
+    }else if(now - connect->pending_since >= connect->batch_cycles){
+        pmp_send(connect);
+        connect->pending_since = PMP_NEVER;
+    }
+}
+
 /* parse data packet */
 static int pmp_data_packet(uint8_t *buf, uint32_t len, pmp_parsed_pkt_t *pkt)
 {
@@ -174,6 +410,9 @@ static int pmp_data_packet(uint8_t *buf, uint32_t len, pmp_parsed_pkt_t *pkt)
     struct data_pkt_head_t *data_head = (struct data_pkt_head_t *)buffer;
     buffer += sizeof(struct data_pkt_head_t);
 
+    if(len < sizeof(struct data_pkt_head_t)){
+        return -1;
+    }
     uint32_t data_len = len - sizeof(struct data_pkt_head_t);
 
     pkt->peri_kind = data_head->peri_kind;
@@ -202,6 +441,9 @@ static int parse_packet_once(uint8_t *buf, unsigned int recv_len, pmp_parsed_pkt
         LOG(LOG_DEBUG, "parse_packet_once: received packet uncomplete\n");
         return -PMP_ERR_DATA_LEN;
     }
+    if(pmp_head->packet_len < sizeof(struct pmp_pkt_head_t)){
+        return -PMP_ERR_DATA_SEND;
+    }
 
     pkt->pkt_kind = pmp_head->packet_kind;
 
@@ -261,46 +503,48 @@ void pmp_clear_recv_buffer(core_connect_t *connect)
     connect->recv_len = 0;
 }
 
+/* A packet can be split between two reads. Its first part is moved to the start
+   of the buffer and the next read goes after it. */
+void pmp_keep_unparsed(core_connect_t *connect)
+{
+    int rest = connect->recv_len - connect->recv_parsed;
+    memmove(connect->recv_buf, connect->recv_buf + connect->recv_parsed, rest);
+    connect->recv_kept = rest;
+    connect->recv_len = 0;
+}
+
 /* monitor side */
 int connect_armue_core(core_connect_t *connect)
 {
     if(connect->pipe_name == NULL){
         return -1;
     }
-    // create pipe if pipe is not exsisted
-    if(connect->in_pipe == NULL && connect->out_pipe == NULL){
-        connect->in_pipe = CreateNamedPipe(connect->pipe_name, PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED, PIPE_TYPE_BYTE, 1, 1024, 1024, 0, NULL);
-        // the pipe is duplex accessable under Windows
-        connect->out_pipe = connect->in_pipe;
-        if(connect->in_pipe == INVALID_HANDLE_VALUE){
-            LOG(LOG_ERROR, "Can't create pipe\n");
+    if(is_shm_connect_name(connect->pipe_name)){
+        if(connect->shm == NULL){
+            connect->shm = shm_connect_monitor_side(connect->pipe_name);
+        }
+        if(connect->shm == NULL){
+            LOG(LOG_ERROR, "Can't connect to core\n");
             return -2;
         }
+        return SUCCESS;
     }
-
-    if(connect->in_pipe == NULL){
-        connect->in_pipe = connect->out_pipe;
-    }else if(connect->out_pipe == NULL){
+    // create pipe if pipe is not exsisted
+    if(connect->in_pipe == PIPE_NONE && connect->out_pipe == PIPE_NONE){
+        connect->in_pipe = pipe_create(connect->pipe_name);
+        // the pipe goes both ways
         connect->out_pipe = connect->in_pipe;
+        if(connect->in_pipe == PIPE_NONE){
+            LOG(LOG_ERROR, "Can't connect to core\n");
+            return -2;
+        }
     }
-
-    // connect pipe;
-    BOOL connected = ConnectNamedPipe(connect->in_pipe, NULL);
-    if(connected){
-        return SUCCESS;
-    }else{
-        LOG(LOG_ERROR, "Can't connect to core\n");
-        return -2;
-    }
+    return SUCCESS;
 }
 
 int pmp_recv(core_connect_t *connect, bool_t block)
 {
-    long int recv_len = pipe_recv(connect->recv_buf, connect->recv_buf_len, connect->in_pipe, block);
-    if(recv_len > 0){
-        connect->recv_len = recv_len;
-    }
-    return recv_len;
+    return connect_recv(connect, block);
 }
 
 int pmp_send(core_connect_t *connect)
@@ -313,9 +557,12 @@ int pmp_send(core_connect_t *connect)
         return 0;
     }
 
-    long int sent = pipe_send(connect->send_buf, connect->send_len, connect->out_pipe);
+    /* what didn't go out is moved to the front and sent the next time */
+    long int sent = connect_send(connect, connect->send_buf, connect->send_len);
     if(sent > 0){
         connect->send_len -= sent;
+        memmove(connect->send_buf, connect->send_buf + sent, connect->send_len);
+        connect->last_pkt = -1;
     }
     return sent;
 }
@@ -5,11 +5,19 @@
 extern "C"{
 #endif
 
+#ifndef __linux__
 #include <windows.h>
+#endif
 #include "_types.h"
+#include "shm_connect.h"
 
 #define PMP_MAX_RETRY 10
 
+/* data is sent once this much is queued, or this many cycles after it was queued */
+#define PMP_BATCH_SIZE      512
+#define PMP_BATCH_CYCLES    10000
+#define PMP_NEVER           ((cycle_t)-1)
+
 enum PMP_PKT_KIND{
     PMP_DATA,
     PMP_CHECKSUM_OK,
@@ -51,16 +59,29 @@ struct data_pkt_head_t{
 };
 #pragma pack()
 
+/* a named pipe under Windows, a unix domain socket on Linux. Both go both ways. */
+#ifdef __linux__
+typedef int pipe_t;
+#define PIPE_NONE 0
+#else
 typedef HANDLE pipe_t;
+#define PIPE_NONE NULL
+#endif
 typedef struct core_connect_t{
     const char *pipe_name;
     pipe_t in_pipe;
     pipe_t out_pipe;
+    shm_connect_t *shm;     // used instead of the pipes when the name starts with "shm:"
     int recv_buf_len;
     int recv_len;
     int recv_parsed;
+    int recv_kept;          // bytes of a split packet at the start of recv_buf
     int send_buf_len;
     int send_len;
+    int last_pkt;           // offset of the last packet in send_buf, -1 if it can't be extended
+    int batch_size;
+    cycle_t batch_cycles;
+    cycle_t pending_since;  // when the data in send_buf was first seen unsent
     char *recv_buf;
     char *send_buf;
     int retry;
@@ -82,7 +103,10 @@ core_connect_t *create_core_connect(unsigned int buf_len, const char *pipe_name)
 void destory_core_connect(core_connect_t **connect);
 void restart_send_packet(core_connect_t *connect);
 void pmp_clear_recv_buffer(core_connect_t *connect);
+void pmp_keep_unparsed(core_connect_t *connect);
 int make_pmp_data_packet(core_connect_t *connect, uint8_t peri_kind, uint16_t peri_index, uint8_t data_kind, uint8_t *data, uint32_t data_len);
+int pmp_queue_data(core_connect_t *connect, uint8_t peri_kind, uint16_t peri_index, uint8_t data_kind, uint8_t *data, uint32_t data_len);
+void pmp_flush_due(core_connect_t *connect, cycle_t now);
 int pmp_parse_input(core_connect_t *monitor_connect, pmp_parsed_pkt_t *pkt);
 void pmp_start_parse_input(core_connect_t *monitor_connect);
 bool_t is_pmp_parse_finish(core_connect_t *monitor_connect);
@@ -90,6 +114,7 @@ bool_t is_pmp_parse_finish(core_connect_t *monitor_connect);
     pmp_start_parse_input(connect); \
     while(!is_pmp_parse_finish(connect))
 bool_t pmp_check_input(core_connect_t *peri_connect);
+bool_t pmp_wait_input(core_connect_t *connect, int timeout_ms);
 
 
 /* functions used on core side */
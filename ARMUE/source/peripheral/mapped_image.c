@@ -0,0 +1,241 @@
+#include "mapped_image.h"
+#include "error_code.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#include <windows.h>
+#endif
+
+static uint64_t image_size(uint64_t file_size, uint64_t default_size, uint64_t align)
+{
+    uint64_t size = file_size != 0 ? file_size : default_size;
+    return (size + align - 1) & ~(align - 1);
+}
+
+#ifdef __linux__
+/* the file grows sparse, then the mapping is filled */
+static uint8_t* map_file(const char *path, uint64_t default_size, uint64_t align, uint64_t *size, uint64_t *old_size)
+{
+    struct stat st;
+    uint8_t *data;
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(fd < 0){
+        return NULL;
+    }
+    if(fstat(fd, &st) < 0){
+        goto map_fail;
+    }
+    *old_size = st.st_size;
+    *size = image_size(*old_size, default_size, align);
+    if(*size > *old_size && ftruncate(fd, *size) < 0){
+        goto map_fail;
+    }
+    data = (uint8_t*)mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return data == MAP_FAILED ? NULL : data;
+
+map_fail:
+    close(fd);
+    return NULL;
+}
+
+/* the pages of the file are copied when written, the part past its end is anonymous */
+static uint8_t* copy_file(const char *path, uint64_t default_size, uint64_t align, uint64_t *size, uint64_t *old_size)
+{
+    struct stat st;
+
+    int fd = open(path, O_RDONLY);
+    *old_size = fd >= 0 && fstat(fd, &st) == 0 ? st.st_size : 0;
+    *size = image_size(*old_size, default_size, align);
+    uint8_t *data = (uint8_t*)mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(data != MAP_FAILED && *old_size != 0 &&
+       mmap(data, *old_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED){
+        munmap(data, *size);
+        data = (uint8_t*)MAP_FAILED;
+    }
+    if(fd >= 0){
+        close(fd);
+    }
+    return data == MAP_FAILED ? NULL : data;
+}
+#else
+/* the mapping grows the file, the view keeps it open */
+static uint8_t* map_file(const char *path, uint64_t default_size, uint64_t align, uint64_t *size, uint64_t *old_size)
+{
+    LARGE_INTEGER file_size;
+    uint8_t *data = NULL;
+
+    HANDLE file = CreateFile(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS,
+                             FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE){
+        return NULL;
+    }
+    if(!GetFileSizeEx(file, &file_size)){
+        goto map_fail;
+    }
+    *old_size = file_size.QuadPart;
+    *size = image_size(*old_size, default_size, align);
+    HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READWRITE, (DWORD)(*size >> 32), (DWORD)*size, NULL);
+    if(mapping == NULL){
+        goto map_fail;
+    }
+    data = (uint8_t*)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, (SIZE_T)*size);
+    CloseHandle(mapping);
+
+map_fail:
+    CloseHandle(file);
+    return data;
+}
+
+/* a view can't be larger than the file without growing it, so the file is read */
+static uint8_t* copy_file(const char *path, uint64_t default_size, uint64_t align, uint64_t *size, uint64_t *old_size)
+{
+    LARGE_INTEGER file_size;
+    uint64_t done = 0;
+    DWORD got;
+
+    HANDLE file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &file_size)){
+        file_size.QuadPart = 0;
+    }
+    *old_size = file_size.QuadPart;
+    *size = image_size(*old_size, default_size, align);
+    uint8_t *data = (uint8_t*)VirtualAlloc(NULL, (SIZE_T)*size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    while(data != NULL && done < *old_size){
+        DWORD chunk = *old_size - done > 0x40000000 ? 0x40000000 : (DWORD)(*old_size - done);
+        if(!ReadFile(file, data + done, chunk, &got, NULL) || got == 0){
+            VirtualFree(data, 0, MEM_RELEASE);
+            data = NULL;
+            break;
+        }
+        done += got;
+    }
+    if(file != INVALID_HANDLE_VALUE){
+        CloseHandle(file);
+    }
+    return data;
+}
+#endif
+
+mapped_image_t* map_image_file(const char *path, uint64_t default_size, uint64_t align, uint8_t fill, bool_t copy)
+{
+    uint64_t old_size;
+
+    mapped_image_t *image = (mapped_image_t*)calloc(1, sizeof(mapped_image_t));
+    if(image == NULL){
+        goto image_null;
+    }
+    image->copy = copy;
+    image->data = copy ? copy_file(path, default_size, align, &image->size, &old_size) :
+                         map_file(path, default_size, align, &image->size, &old_size);
+    if(image->data == NULL){
+        LOG(LOG_ERROR, "map_image_file: can't map %s\n", path);
+        goto map_fail;
+    }
+    /* the part past the end of the file is zeros, the device may read another value when erased */
+    if(image->size > old_size && fill != 0){
+        memset(image->data + old_size, fill, image->size - old_size);
+    }
+    return image;
+
+map_fail:
+    free(image);
+image_null:
+    return NULL;
+}
+
+void unmap_image_file(mapped_image_t **image)
+{
+    if(image == NULL || *image == NULL){
+        return;
+    }
+    untrack_image_dirty(*image);
+#ifdef __linux__
+    munmap((*image)->data, (*image)->size);
+#else
+    if((*image)->copy){
+        VirtualFree((*image)->data, 0, MEM_RELEASE);
+    }else{
+        UnmapViewOfFile((*image)->data);
+    }
+#endif
+    free(*image);
+    *image = NULL;
+}
+
+int track_image_dirty(mapped_image_t *image)
+{
+    if(image->dirty != NULL){
+        return 0;
+    }
+    image->dirty = (uint8_t*)calloc(image_page_num(image), 1);
+    image->base = (uint8_t**)calloc(image_page_num(image), sizeof(uint8_t*));
+    if(image->dirty == NULL || image->base == NULL){
+        untrack_image_dirty(image);
+        return -ERROR_CREATE;
+    }
+    return 0;
+}
+
+void untrack_image_dirty(mapped_image_t *image)
+{
+    uint64_t page;
+    if(image->base != NULL){
+        for(page = 0; page < image_page_num(image); page++){
+            free(image->base[page]);
+        }
+    }
+    free(image->base);
+    free(image->dirty);
+    image->base = NULL;
+    image->dirty = NULL;
+}
+
+void clear_image_dirty(mapped_image_t *image)
+{
+    if(image->dirty != NULL){
+        memset(image->dirty, 0, image_page_num(image));
+    }
+}
+
+/* the first write of a page since the tracking started keeps what it was */
+void keep_image_pages(mapped_image_t *image, uint64_t offset, uint64_t size)
+{
+    uint64_t page = offset >> IMAGE_PAGE_SHIFT;
+    uint64_t last = (offset + size - 1) >> IMAGE_PAGE_SHIFT;
+    for(; page <= last; page++){
+        image->dirty[page] = 1;
+        if(image->base[page] != NULL){
+            continue;
+        }
+        image->base[page] = (uint8_t*)malloc(IMAGE_PAGE_SIZE);
+        if(image->base[page] == NULL){
+            LOG(LOG_ERROR, "keep_image_pages: page 0x%llx won't go back with the checkpoints\n",
+                (unsigned long long)page);
+            continue;
+        }
+        memcpy(image->base[page], image->data + (page << IMAGE_PAGE_SHIFT), IMAGE_PAGE_SIZE);
+    }
+}
+
+void revert_image(mapped_image_t *image)
+{
+    uint64_t page;
+    if(image->base == NULL){
+        return;
+    }
+    for(page = 0; page < image_page_num(image); page++){
+        if(image->base[page] != NULL){
+            memcpy(image->data + (page << IMAGE_PAGE_SHIFT), image->base[page], IMAGE_PAGE_SIZE);
+            image->dirty[page] = 1;
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef _MAPPED_IMAGE_H_
+#define _MAPPED_IMAGE_H_
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "_types.h"
+
+/*
+ * The storage of a memory device, a host image file mapped shared. The models read
+ * and store through data, so the file is the medium itself and keeps what the guest
+ * wrote when the emulator exits. A private image is a copy of the file instead,
+ * what the guest writes is lost at exit and the file is never changed.
+ */
+typedef struct mapped_image_t{
+    uint8_t *data;
+    uint64_t size;
+    bool_t copy;            // private, the file is left as it is
+
+    /* Tracked for the checkpoints, NULL if not: dirty[i] is set when page i is written
+       since the last snapshot, base[i] is what page i was when the tracking started,
+       NULL until it is written */
+    uint8_t *dirty;
+    uint8_t **base;
+}mapped_image_t;
+
+#define IMAGE_PAGE_SHIFT 12
+#define IMAGE_PAGE_SIZE (1u << IMAGE_PAGE_SHIFT)
+#define image_page_num(image) ((image)->size >> IMAGE_PAGE_SHIFT)
+
+/* The size is the one of the file, or default_size if it is empty or missing, rounded
+   up to align (a power of 2). The part past the end of the file reads as fill. */
+mapped_image_t* map_image_file(const char *path, uint64_t default_size, uint64_t align, uint8_t fill, bool_t copy);
+void unmap_image_file(mapped_image_t **image);
+
+int track_image_dirty(mapped_image_t *image);
+void untrack_image_dirty(mapped_image_t *image);
+void clear_image_dirty(mapped_image_t *image);
+void keep_image_pages(mapped_image_t *image, uint64_t offset, uint64_t size);
+/* the pages written since the tracking started go back to what they were then */
+void revert_image(mapped_image_t *image);
+
+/* the models call it before they store into data */
+static inline void mark_image_dirty(mapped_image_t *image, uint64_t offset, uint64_t size)
+{
+    if(image->dirty != NULL && size > 0){
+        keep_image_pages(image, offset, size);
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
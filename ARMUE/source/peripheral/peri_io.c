@@ -0,0 +1,141 @@
+#include "peri_io.h"
+#include "replay.h"
+#include "error_code.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PERI_IO_FULL_WAIT_US 1000
+
+/* called by the thread that owns the queue */
+void queue_peri_io_event(peri_io_t *io, spsc_queue_t *queue, pmp_parsed_pkt_t *pkt)
+{
+    peri_io_event_t *event = (peri_io_event_t*)malloc(sizeof(peri_io_event_t) + pkt->data_len);
+    if(event == NULL){
+        LOG(LOG_ERROR, "peri_io: drop a packet of %u bytes\n", pkt->data_len);
+        return;
+    }
+    event->pkt = *pkt;
+    event->pkt.data = (uint8_t*)(event + 1);
+    memcpy(event->pkt.data, pkt->data, pkt->data_len);
+
+    /* the cpu loop takes them out at the next check point */
+    while(spsc_push(queue, event) < 0){
+        if(io->stop){
+            free(event);
+            return;
+        }
+        usleep(PERI_IO_FULL_WAIT_US);
+    }
+    __atomic_store_n(&io->pending, 1, __ATOMIC_RELEASE);
+}
+
+static void* peri_io_thread(void *arg)
+{
+    peri_io_t *io = (peri_io_t*)arg;
+    core_connect_t *connect = io->connect;
+    pmp_parsed_pkt_t pkt;
+    int result;
+
+    while(!io->stop){
+        if(!pmp_wait_input(connect, PERI_IO_WAIT_MS) || !pmp_check_input(connect)){
+            continue;
+        }
+        result = 0;
+        pmp_parse_loop(connect){
+            result = pmp_parse_input(connect, &pkt);
+            if(result < 0){
+                break;
+            }
+            queue_peri_io_event(io, io->queues[0], &pkt);
+        }
+        /* the rest of the packet comes with the next read */
+        if(result == -PMP_ERR_DATA_LEN){
+            pmp_keep_unparsed(connect);
+        }else{
+            if(result < 0){
+                LOG(LOG_WARN, "peri_io: drop a bad packet\n");
+            }
+            pmp_clear_recv_buffer(connect);
+        }
+    }
+    return NULL;
+}
+
+spsc_queue_t* add_peri_io_source(peri_io_t *io)
+{
+    if(io->source_num >= PERI_IO_MAX_SOURCE){
+        return NULL;
+    }
+    spsc_queue_t *queue = create_spsc_queue(PERI_IO_QUEUE_LEN);
+    if(queue != NULL){
+        io->queues[io->source_num++] = queue;
+    }
+    return queue;
+}
+
+peri_io_t* create_peri_io(core_connect_t *connect)
+{
+    peri_io_t *io = (peri_io_t*)calloc(1, sizeof(peri_io_t));
+    if(io == NULL){
+        goto io_null;
+    }
+    io->connect = connect;
+    if(connect == NULL){
+        return io;
+    }
+    if(add_peri_io_source(io) == NULL){
+        goto queue_null;
+    }
+    if(pthread_create(&io->thread, NULL, peri_io_thread, io) != 0){
+        goto thread_fail;
+    }
+    return io;
+
+thread_fail:
+    destory_spsc_queue(&io->queues[0]);
+queue_null:
+    free(io);
+io_null:
+    return NULL;
+}
+
+/* the other sources must be stopped first */
+void destory_peri_io(peri_io_t **io)
+{
+    if(io == NULL || *io == NULL){
+        return;
+    }
+    peri_io_event_t *event;
+    int i;
+    (*io)->stop = TRUE;
+    if((*io)->connect != NULL){
+        pthread_join((*io)->thread, NULL);
+    }
+    for(i = 0; i < (*io)->source_num; i++){
+        while((event = (peri_io_event_t*)spsc_pop((*io)->queues[i])) != NULL){
+            free(event);
+        }
+        destory_spsc_queue(&(*io)->queues[i]);
+    }
+    free(*io);
+    *io = NULL;
+}
+
+/* on the thread of the first core */
+void apply_peri_io(soc_t *soc)
+{
+    peri_io_t *io = soc->peri_io;
+    peri_io_event_t *event;
+    int i;
+
+    /* cleared first, so a packet queued while draining raises it again */
+    __atomic_store_n(&io->pending, 0, __ATOMIC_SEQ_CST);
+    for(i = 0; i < io->source_num; i++){
+        while((event = (peri_io_event_t*)spsc_pop(io->queues[i])) != NULL){
+            LOG(LOG_INFO, "Peripheral packet type[%d] received\n", event->pkt.pkt_kind);
+            record_peri_event(soc, &event->pkt);
+            free(event);
+        }
+    }
+}
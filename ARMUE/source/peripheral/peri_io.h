@@ -0,0 +1,52 @@
+#ifndef _PERI_IO_H_
+#define _PERI_IO_H_
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include <pthread.h>
+#include "soc.h"
+#include "core_connect.h"
+#include "spsc_queue.h"
+
+#define PERI_IO_QUEUE_LEN   1024
+#define PERI_IO_MAX_SOURCE  4       // threads giving input, each has a queue of its own
+#define PERI_IO_INTERVAL    100     // cycles between two looks at the queue
+#define PERI_IO_WAIT_MS     100     // how long the thread waits before looking at stop
+
+/* The input from the peripheral monitor is read and parsed on a thread of its own.
+   The cpu loop only looks at the pending flag, and takes the packets out of the queues
+   at a check point, so they are applied between two instructions. Other host input,
+   like a UART console, comes in as packets too, from its own thread and queue. */
+typedef struct peri_io_t{
+    core_connect_t *connect;    // NULL if there is no monitor
+    int source_num;
+    spsc_queue_t *queues[PERI_IO_MAX_SOURCE];   // of peri_io_event_t*, the first is the monitor's
+    uint32_t pending;           // set after packets are queued
+    volatile bool_t stop;
+    pthread_t thread;
+}peri_io_t;
+
+/* a parsed packet, the data follows it */
+typedef struct peri_io_event_t{
+    pmp_parsed_pkt_t pkt;
+}peri_io_event_t;
+
+peri_io_t* create_peri_io(core_connect_t *connect);
+void destory_peri_io(peri_io_t **io);
+void apply_peri_io(soc_t *soc);
+/* a queue for one more thread to give input through, NULL if there are too many */
+spsc_queue_t* add_peri_io_source(peri_io_t *io);
+void queue_peri_io_event(peri_io_t *io, spsc_queue_t *queue, pmp_parsed_pkt_t *pkt);
+
+static inline bool_t peri_io_pending(peri_io_t *io)
+{
+    return __atomic_load_n(&io->pending, __ATOMIC_ACQUIRE) != 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
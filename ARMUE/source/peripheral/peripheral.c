@@ -1,9 +1,23 @@
 #include "peripheral.h"
 #include "error_code.h"
 #include <string.h>
+#include <stdlib.h>
 
 // peripheral table contains all the information of the registered peripherals
-peripheral_table_t g_peri_table[PERI_MAX_KIND];
+peripheral_table_t* create_peripheral_table()
+{
+    return (peripheral_table_t *)calloc(PERI_MAX_KIND, sizeof(peripheral_table_t));
+}
+
+void destory_peripheral_table(peripheral_table_t **table)
+{
+    int i;
+    for(i = 0; i < PERI_MAX_KIND; i++){
+        free((*table)[i].real_peri);
+    }
+    free(*table);
+    *table = NULL;
+}
 
 // requeset the amount of such peripheral
 int _request_peripheral(peripheral_table_t *table, int peri_kind, int peri_amount)
@@ -31,9 +45,9 @@ int _request_peripheral(peripheral_table_t *table, int peri_kind, int peri_amoun
     return 0;
 }
 
-int request_peripheral(int peri_kind, int peri_amount)
+int request_peripheral(soc_t *soc, int peri_kind, int peri_amount)
 {
-    return _request_peripheral(g_peri_table, peri_kind, peri_amount);
+    return _request_peripheral(soc->peri_table, peri_kind, peri_amount);
 }
 
 int _register_peripheral(peripheral_table_t *table, int peri_kind, int peri_index, peripheral_t *peri_data)
@@ -52,9 +66,18 @@ int _register_peripheral(peripheral_table_t *table, int peri_kind, int peri_inde
     return 0;
 }
 
-int register_peripheral(int peri_kind, int peri_index, peripheral_t *peri_data)
+int register_peripheral(soc_t *soc, int peri_kind, int peri_index, peripheral_t *peri_data)
 {
-    return _register_peripheral(g_peri_table, peri_kind, peri_index, peri_data);
+    return _register_peripheral(soc->peri_table, peri_kind, peri_index, peri_data);
+}
+
+peripheral_t* find_peripheral(soc_t *soc, int peri_kind, int peri_index)
+{
+    peripheral_table_t *table = soc->peri_table;
+    if(peri_kind >= PERI_MAX_KIND || peri_index >= table[peri_kind].num){
+        return NULL;
+    }
+    return &table[peri_kind].real_peri[peri_index];
 }
 
 /* dispatch the peripheral event by parsed packet */
@@ -86,7 +109,7 @@ int _dispatch_peri_event(pmp_parsed_pkt_t *pkt, peripheral_table_t *peri_table)
     return 0;
 }
 
-int dispatch_peri_event(pmp_parsed_pkt_t *pkt)
+int dispatch_peri_event(soc_t *soc, pmp_parsed_pkt_t *pkt)
 {
-    _dispatch_peri_event(pkt, g_peri_table);
+    return _dispatch_peri_event(pkt, soc->peri_table);
 }
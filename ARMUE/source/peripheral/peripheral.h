@@ -12,12 +12,21 @@ enum peripheral_kind_t{
     PERI_UNKNOW = -1,
     PERI_I2C = 0,
     PERI_UART,
+    PERI_DMA,
+    PERI_SVD,
+    PERI_PLUGIN,
+    PERI_GPIO,
+    PERI_SPI,
     PERI_MAX_KIND,
 };
 
+struct snapshot_t;
 typedef struct peripheral_t{
     void *user_data;
     int (*data_process)(int packet_kind, uint8_t *data, unsigned int len, void *user_data);
+    /* save and restore the model state, NULL if it has none */
+    int (*snapshot)(struct snapshot_t *snapshot, void *user_data);
+    int (*restore)(struct snapshot_t *snapshot, void *user_data);
 }peripheral_t;
 
 typedef struct peripheral_table_t{
@@ -26,9 +35,13 @@ typedef struct peripheral_table_t{
 }peripheral_table_t;
 
 #include "core_connect.h"
-int request_peripheral(int peri_kind, int peri_amount);
-int register_peripheral(int peri_kind, int peri_index, peripheral_t *peri_data);
-int dispatch_peri_event(struct pmp_parsed_pkt_t *pkt);
+/* every soc has its own table of PERI_MAX_KIND entries */
+peripheral_table_t* create_peripheral_table();
+void destory_peripheral_table(peripheral_table_t **table);
+int request_peripheral(soc_t *soc, int peri_kind, int peri_amount);
+int register_peripheral(soc_t *soc, int peri_kind, int peri_index, peripheral_t *peri_data);
+peripheral_t* find_peripheral(soc_t *soc, int peri_kind, int peri_index);
+int dispatch_peri_event(soc_t *soc, struct pmp_parsed_pkt_t *pkt);
 
 #ifdef __cplusplus
 }
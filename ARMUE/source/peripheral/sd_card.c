@@ -0,0 +1,374 @@
+#include "sd_card.h"
+#include "mapped_image.h"
+#include "snapshot.h"
+#include "error_code.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * An SDHC card in SPI mode. The blocks are the mapped image: a read streams the
+ * bytes of the mapping after the start token, a write stores each byte of the data
+ * packet into it. The card is ready as soon as ACMD41 comes, it is never busy and
+ * it doesn't check the CRC, as SPI mode allows.
+ */
+
+#define SD_CARD_DEFAULT_SIZE    (64 * 1024 * 1024)
+#define SD_CARD_ALIGN           (512 * 1024)        // the unit of C_SIZE
+#define SD_BLOCK_SIZE           512
+
+#define R1_IDLE                 0x01
+#define R1_ILLEGAL_COMMAND      0x04
+#define R1_PARAMETER_ERROR      0x40
+
+#define SD_TOKEN_START          0xFE
+#define SD_TOKEN_MULTIPLE       0xFC    // a block of CMD25
+#define SD_TOKEN_STOP           0xFD
+#define SD_DATA_ACCEPTED        0x05
+
+#define SD_REG_SIZE             16
+
+enum sd_card_state_t{
+    SD_COMMAND,
+    SD_READ,                // sending a data packet
+    SD_WRITE,               // receiving a data packet
+};
+
+/* what the card got since the reset */
+typedef struct sd_card_bus_t{
+    uint8_t command[6];
+    uint8_t command_len;
+    uint8_t idle;
+    uint8_t app_command;    // the last command was CMD55
+    uint8_t state;
+    /* sent before anything else */
+    uint8_t response[6];
+    uint8_t response_len;
+    uint8_t response_pos;
+    /* the data transfer */
+    uint8_t source;         // the command that started the read
+    uint8_t multiple;
+    uint32_t block;
+    int32_t position;       // in the packet, -1 for the start token
+}sd_card_bus_t;
+
+typedef struct sd_card_t{
+    spi_device_t device;
+    mapped_image_t *image;
+    uint32_t blocks;
+    uint8_t csd[SD_REG_SIZE];
+    uint8_t cid[SD_REG_SIZE];
+    sd_card_bus_t bus;
+}sd_card_t;
+
+static void respond(sd_card_t *card, const uint8_t *response, int len)
+{
+    memcpy(card->bus.response, response, len);
+    card->bus.response_len = len;
+    card->bus.response_pos = 0;
+}
+
+static void respond_r1(sd_card_t *card, uint8_t r1)
+{
+    respond(card, &r1, 1);
+}
+
+static const uint8_t* packet(sd_card_t *card, int *len)
+{
+    sd_card_bus_t *bus = &card->bus;
+    switch(bus->source){
+    case 9:
+        *len = SD_REG_SIZE;
+        return card->csd;
+    case 10:
+        *len = SD_REG_SIZE;
+        return card->cid;
+    default:
+        *len = SD_BLOCK_SIZE;
+        return card->image->data + (uint64_t)bus->block * SD_BLOCK_SIZE;
+    }
+}
+
+/* the next block of a multiple block transfer, if the card has one */
+static void next_block(sd_card_t *card)
+{
+    sd_card_bus_t *bus = &card->bus;
+    if(bus->multiple && bus->block + 1 < card->blocks){
+        bus->block++;
+        bus->position = -1;
+    }else{
+        bus->state = SD_COMMAND;
+    }
+}
+
+static uint8_t send_data(sd_card_t *card)
+{
+    int len;
+    const uint8_t *data = packet(card, &len);
+    int32_t position = card->bus.position++;
+
+    if(position < 0){
+        return SD_TOKEN_START;
+    }
+    if(position < len){
+        return data[position];
+    }
+    if(position == len + 1){
+        next_block(card);
+    }
+    return SPI_IDLE_BYTE;
+}
+
+static void receive_data(sd_card_t *card, uint8_t out)
+{
+    sd_card_bus_t *bus = &card->bus;
+
+    if(bus->position < 0){
+        if(out == (bus->multiple ? SD_TOKEN_MULTIPLE : SD_TOKEN_START)){
+            bus->position = 0;
+        }else if(bus->multiple && out == SD_TOKEN_STOP){
+            bus->state = SD_COMMAND;
+        }
+        return;
+    }
+    if(bus->position < SD_BLOCK_SIZE){
+        uint64_t offset = (uint64_t)bus->block * SD_BLOCK_SIZE + bus->position;
+        mark_image_dirty(card->image, offset, 1);
+        card->image->data[offset] = out;
+    }
+    /* then the two bytes of the CRC */
+    if(++bus->position == SD_BLOCK_SIZE + 2){
+        respond_r1(card, SD_DATA_ACCEPTED);
+        next_block(card);
+    }
+}
+
+static void start_data(sd_card_t *card, int state, uint8_t source, uint32_t block, bool_t multiple)
+{
+    sd_card_bus_t *bus = &card->bus;
+    bus->state = state;
+    bus->source = source;
+    bus->block = block;
+    bus->multiple = multiple;
+    bus->position = -1;
+}
+
+static void execute(sd_card_t *card)
+{
+    sd_card_bus_t *bus = &card->bus;
+    uint8_t index = bus->command[0] & 0x3F;
+    uint32_t arg = ((uint32_t)bus->command[1] << 24) | ((uint32_t)bus->command[2] << 16) |
+                   ((uint32_t)bus->command[3] << 8) | bus->command[4];
+    bool_t app_command = bus->app_command;
+    uint8_t r1 = bus->idle ? R1_IDLE : 0;
+    uint8_t response[6];
+
+    bus->app_command = FALSE;
+    /* an ACMD the card doesn't have is taken as the CMD */
+    if(app_command){
+        switch(index){
+        case 41:
+            bus->idle = FALSE;
+            respond_r1(card, 0);
+            return;
+        case 23:
+            respond_r1(card, r1);
+            return;
+        }
+    }
+
+    switch(index){
+    case 0:
+        bus->idle = TRUE;
+        bus->state = SD_COMMAND;
+        respond_r1(card, R1_IDLE);
+        break;
+    case 1:
+        bus->idle = FALSE;
+        respond_r1(card, 0);
+        break;
+    case 8:
+        /* the voltage and the check pattern come back */
+        response[0] = r1;
+        response[1] = 0;
+        response[2] = 0;
+        response[3] = (arg >> 8) & 0xF;
+        response[4] = arg & 0xFF;
+        respond(card, response, 5);
+        break;
+    case 9:
+    case 10:
+        if(bus->idle){
+            respond_r1(card, r1 | R1_ILLEGAL_COMMAND);
+            break;
+        }
+        respond_r1(card, r1);
+        start_data(card, SD_READ, index, 0, FALSE);
+        break;
+    case 12:
+        /* a stuff byte comes first */
+        bus->state = SD_COMMAND;
+        response[0] = SPI_IDLE_BYTE;
+        response[1] = r1;
+        respond(card, response, 2);
+        break;
+    case 13:
+        response[0] = r1;
+        response[1] = 0;
+        respond(card, response, 2);
+        break;
+    case 16:
+        respond_r1(card, arg == SD_BLOCK_SIZE ? r1 : r1 | R1_PARAMETER_ERROR);
+        break;
+    case 17:
+    case 18:
+    case 24:
+    case 25:
+        /* SDHC takes block addresses */
+        if(bus->idle){
+            respond_r1(card, r1 | R1_ILLEGAL_COMMAND);
+        }else if(arg >= card->blocks){
+            respond_r1(card, r1 | R1_PARAMETER_ERROR);
+        }else{
+            respond_r1(card, r1);
+            start_data(card, index < 24 ? SD_READ : SD_WRITE, index, arg, index == 18 || index == 25);
+        }
+        break;
+    case 55:
+        bus->app_command = TRUE;
+        respond_r1(card, r1);
+        break;
+    case 58:
+        /* the OCR: powered up once ready, high capacity, 2.7-3.6V */
+        response[0] = r1;
+        response[1] = bus->idle ? 0x40 : 0xC0;
+        response[2] = 0xFF;
+        response[3] = 0x80;
+        response[4] = 0x00;
+        respond(card, response, 5);
+        break;
+    case 59:
+        respond_r1(card, r1);
+        break;
+    default:
+        respond_r1(card, r1 | R1_ILLEGAL_COMMAND);
+        break;
+    }
+}
+
+/* a command starts with 01 and takes six bytes */
+static void receive_command(sd_card_t *card, uint8_t out)
+{
+    sd_card_bus_t *bus = &card->bus;
+    if(bus->command_len == 0 && (out & 0xC0) != 0x40){
+        return;
+    }
+    bus->command[bus->command_len++] = out;
+    if(bus->command_len == sizeof(bus->command)){
+        bus->command_len = 0;
+        execute(card);
+    }
+}
+
+/* deselecting aborts what is being sent */
+static void sd_card_select(spi_device_t *device, bool_t selected)
+{
+    sd_card_t *card = (sd_card_t*)device;
+    if(!selected){
+        card->bus.command_len = 0;
+        card->bus.response_len = 0;
+        if(card->bus.state == SD_READ){
+            card->bus.state = SD_COMMAND;
+        }
+    }
+}
+
+static uint8_t sd_card_transfer(spi_device_t *device, uint8_t out)
+{
+    sd_card_t *card = (sd_card_t*)device;
+    sd_card_bus_t *bus = &card->bus;
+    uint8_t in = SPI_IDLE_BYTE;
+
+    if(bus->response_pos < bus->response_len){
+        in = bus->response[bus->response_pos++];
+    }else if(bus->state == SD_READ){
+        in = send_data(card);
+    }
+
+    if(bus->state == SD_WRITE){
+        receive_data(card, out);
+    }else{
+        receive_command(card, out);
+    }
+    return in;
+}
+
+static int sd_card_snapshot(spi_device_t *device, snapshot_t *snapshot)
+{
+    sd_card_t *card = (sd_card_t*)device;
+    return SNAPSHOT_PUT(snapshot, card->bus) < 0 ? -ERROR_CREATE : 0;
+}
+
+static int sd_card_restore(spi_device_t *device, snapshot_t *snapshot)
+{
+    sd_card_t *card = (sd_card_t*)device;
+    return SNAPSHOT_GET(snapshot, card->bus) < 0 ? -ERROR_SNAPSHOT : 0;
+}
+
+static void destory_sd_card(spi_device_t *device)
+{
+    sd_card_t *card = (sd_card_t*)device;
+    unmap_image_file(&card->image);
+    free(card);
+}
+
+/* CSD version 2.0, the capacity is (C_SIZE + 1) * 512KB */
+static void make_registers(sd_card_t *card)
+{
+    static const uint8_t csd[SD_REG_SIZE] = {0x40, 0x0E, 0x00, 0x32, 0x5B, 0x59, 0x00, 0x00,
+                                             0x00, 0x00, 0x7F, 0x80, 0x0A, 0x40, 0x00, 0x01};
+    static const uint8_t cid[SD_REG_SIZE] = {0x00, 'A', 'E', 'A', 'R', 'M', 'U', 'E',
+                                             0x10, 0x00, 0x00, 0x00, 0x01, 0x01, 0x01, 0x01};
+    uint32_t c_size = (uint32_t)(card->image->size / SD_CARD_ALIGN) - 1;
+
+    memcpy(card->csd, csd, SD_REG_SIZE);
+    card->csd[7] = (c_size >> 16) & 0x3F;
+    card->csd[8] = (c_size >> 8) & 0xFF;
+    card->csd[9] = c_size & 0xFF;
+    memcpy(card->cid, cid, SD_REG_SIZE);
+}
+
+spi_device_t* create_sd_card(const char *path, bool_t copy)
+{
+    sd_card_t *card = (sd_card_t*)calloc(1, sizeof(sd_card_t));
+    if(card == NULL){
+        goto card_null;
+    }
+    card->image = map_image_file(path, SD_CARD_DEFAULT_SIZE, SD_CARD_ALIGN, 0, copy);
+    if(card->image == NULL){
+        goto map_fail;
+    }
+    /* 32 bits of block address */
+    if(card->image->size / SD_BLOCK_SIZE > 0xFFFFFFFFul){
+        LOG(LOG_ERROR, "create_sd_card: %s is 2TB or larger\n", path);
+        goto size_fail;
+    }
+    card->blocks = card->image->size / SD_BLOCK_SIZE;
+    card->bus.idle = TRUE;
+    make_registers(card);
+
+    card->device.name = "sd card";
+    card->device.image = card->image;
+    card->device.select = sd_card_select;
+    card->device.transfer = sd_card_transfer;
+    card->device.snapshot = sd_card_snapshot;
+    card->device.restore = sd_card_restore;
+    card->device.destory = destory_sd_card;
+    return &card->device;
+
+size_fail:
+    unmap_image_file(&card->image);
+map_fail:
+    free(card);
+card_null:
+    return NULL;
+}
@@ -0,0 +1,16 @@
+#ifndef _SD_CARD_H_
+#define _SD_CARD_H_
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include "spi.h"
+
+/* an SDHC card in SPI mode stored in the image file, 64MB if the file is new, copy
+   leaves the file as it is (see mapped_image.h) */
+spi_device_t* create_sd_card(const char *path, bool_t copy);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,240 @@
+#include "shm_connect.h"
+#include "error_code.h"
+#include <stdlib.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define SHM_WAIT_US 10000
+
+/* the region is shared between processes, so the futex is not private */
+static void futex_wait(uint32_t *addr, uint32_t value, const struct timespec *timeout)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT, value, timeout, NULL, 0);
+}
+
+static void futex_wake(uint32_t *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/* Sleep until *addr is no longer value. The flag is raised before looking at *addr
+   again, and the other side looks at the flag after it changes *addr, so a wake
+   can't get lost. */
+static void wait_change(uint32_t *addr, uint32_t value, uint32_t *sleeping, const struct timespec *timeout)
+{
+    __atomic_store_n(sleeping, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(addr, __ATOMIC_SEQ_CST) == value){
+        futex_wait(addr, value, timeout);
+    }
+    __atomic_store_n(sleeping, 0, __ATOMIC_RELAXED);
+}
+
+static void publish(uint32_t *addr, uint32_t value, uint32_t *sleeping)
+{
+    __atomic_store_n(addr, value, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(sleeping, __ATOMIC_SEQ_CST)){
+        futex_wake(addr);
+    }
+}
+
+static shm_connect_t* map_region(const char *name, int flags)
+{
+    shm_connect_t *connect = (shm_connect_t*)calloc(1, sizeof(shm_connect_t));
+    if(connect == NULL){
+        goto connect_null;
+    }
+    /* "shm:/armue" is the object "/armue" */
+    connect->name = strdup(name + sizeof(SHM_CONNECT_PREFIX) - 1);
+    if(connect->name == NULL){
+        goto name_null;
+    }
+
+    int fd;
+    while((fd = shm_open(connect->name, flags, 0600)) < 0){
+        /* the core waits for the monitor to create it */
+        if(flags & O_CREAT){
+            LOG(LOG_ERROR, "Can't create shared memory %s\n", connect->name);
+            goto open_fail;
+        }
+        usleep(SHM_WAIT_US);
+    }
+    if((flags & O_CREAT) && ftruncate(fd, sizeof(shm_region_t)) < 0){
+        close(fd);
+        goto open_fail;
+    }
+    connect->region = (shm_region_t*)mmap(NULL, sizeof(shm_region_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(connect->region == MAP_FAILED){
+        LOG(LOG_ERROR, "Can't map shared memory %s\n", connect->name);
+        goto open_fail;
+    }
+    return connect;
+
+open_fail:
+    free(connect->name);
+name_null:
+    free(connect);
+connect_null:
+    return NULL;
+}
+
+shm_connect_t* shm_connect_monitor_side(const char *name)
+{
+    /* a region left by a monitor that died is not used */
+    shm_unlink(name + sizeof(SHM_CONNECT_PREFIX) - 1);
+    shm_connect_t *connect = map_region(name, O_RDWR | O_CREAT | O_EXCL);
+    if(connect == NULL){
+        return NULL;
+    }
+    connect->owner = TRUE;
+    connect->in = &connect->region->to_monitor;
+    connect->out = &connect->region->to_core;
+    __atomic_store_n(&connect->region->magic, SHM_CONNECT_MAGIC, __ATOMIC_SEQ_CST);
+
+    while(__atomic_load_n(&connect->region->core_attached, __ATOMIC_SEQ_CST) == 0){
+        futex_wait(&connect->region->core_attached, 0, NULL);
+    }
+    return connect;
+}
+
+shm_connect_t* shm_connect_core_side(const char *name)
+{
+    shm_connect_t *connect = map_region(name, O_RDWR);
+    if(connect == NULL){
+        return NULL;
+    }
+    /* the monitor may not have set the region up yet */
+    while(__atomic_load_n(&connect->region->magic, __ATOMIC_SEQ_CST) != SHM_CONNECT_MAGIC){
+        usleep(SHM_WAIT_US);
+    }
+    connect->in = &connect->region->to_core;
+    connect->out = &connect->region->to_monitor;
+    __atomic_store_n(&connect->region->core_attached, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&connect->region->core_attached);
+    return connect;
+}
+
+void destory_shm_connect(shm_connect_t **connect)
+{
+    if(connect == NULL || *connect == NULL){
+        return;
+    }
+    munmap((*connect)->region, sizeof(shm_region_t));
+    if((*connect)->owner){
+        shm_unlink((*connect)->name);
+    }
+    free((*connect)->name);
+    free(*connect);
+    *connect = NULL;
+}
+
+/* TRUE if there is something to receive, it waits for timeout_ms at most */
+bool_t shm_wait_input(shm_connect_t *connect, int timeout_ms)
+{
+    shm_ring_t *ring = connect->in;
+    struct timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if(head == ring->tail){
+        wait_change(&ring->head, head, &ring->consumer_sleeping, &timeout);
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    }
+    return head != ring->tail;
+}
+
+/* take what the other side has written, up to max_size */
+long int shm_recv(shm_connect_t *connect, char *buffer, long int max_size, bool_t block)
+{
+    shm_ring_t *ring = connect->in;
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    while(head == tail){
+        if(!block){
+            return 0;
+        }
+        wait_change(&ring->head, head, &ring->consumer_sleeping, NULL);
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    }
+
+    uint32_t len = head - tail;
+    if(len > (uint32_t)max_size){
+        len = max_size;
+    }
+    uint32_t start = tail & (SHM_RING_SIZE - 1);
+    uint32_t first = SHM_RING_SIZE - start < len ? SHM_RING_SIZE - start : len;
+    memcpy(buffer, &ring->data[start], first);
+    memcpy(buffer + first, ring->data, len - first);
+
+    publish(&ring->tail, tail + len, &ring->producer_sleeping);
+    return len;
+}
+
+/* like a pipe in blocking mode, it returns when all the data is in the ring */
+long int shm_send(shm_connect_t *connect, char *buffer, long int send_size)
+{
+    shm_ring_t *ring = connect->out;
+    uint32_t head = ring->head;
+    long int sent = 0;
+
+    while(sent < send_size){
+        uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        uint32_t space = SHM_RING_SIZE - (head - tail);
+        if(space == 0){
+            wait_change(&ring->tail, tail, &ring->producer_sleeping, NULL);
+            continue;
+        }
+
+        uint32_t len = (uint32_t)(send_size - sent) < space ? (uint32_t)(send_size - sent) : space;
+        uint32_t start = head & (SHM_RING_SIZE - 1);
+        uint32_t first = SHM_RING_SIZE - start < len ? SHM_RING_SIZE - start : len;
+        memcpy(&ring->data[start], buffer + sent, first);
+        memcpy(ring->data, buffer + sent + first, len - first);
+
+        head += len;
+        sent += len;
+        publish(&ring->head, head, &ring->consumer_sleeping);
+    }
+    return sent;
+}
+
+#else
+
+shm_connect_t* shm_connect_monitor_side(const char *name)
+{
+    LOG(LOG_ERROR, "Shared memory connect is only on Linux\n");
+    return NULL;
+}
+
+shm_connect_t* shm_connect_core_side(const char *name)
+{
+    LOG(LOG_ERROR, "Shared memory connect is only on Linux\n");
+    return NULL;
+}
+
+void destory_shm_connect(shm_connect_t **connect)
+{
+}
+
+bool_t shm_wait_input(shm_connect_t *connect, int timeout_ms)
+{
+    return FALSE;
+}
+
+long int shm_recv(shm_connect_t *connect, char *buffer, long int max_size, bool_t block)
+{
+    return -1;
+}
+
+long int shm_send(shm_connect_t *connect, char *buffer, long int send_size)
+{
+    return -1;
+}
+
+#endif
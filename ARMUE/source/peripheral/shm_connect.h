@@ -0,0 +1,70 @@
+#ifndef _SHM_CONNECT_H_
+#define _SHM_CONNECT_H_
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include "_types.h"
+
+/*
+ * The connect between the core and the peripheral monitor over shared memory, Linux
+ * only. The monitor creates the region, which holds one ring for each direction.
+ * Each ring has a single producer and a single consumer, so no lock is needed and
+ * nothing goes through the kernel unless one side has to sleep on a futex.
+ */
+
+#define SHM_CONNECT_PREFIX      "shm:"          // a pipe name like "shm:/armue" selects it
+#define SHM_CONNECT_MAGIC       0x434D5241      // "ARMC"
+#define SHM_RING_SIZE           (64 * 1024)     // a power of 2
+
+typedef struct shm_ring_t{
+    /* head and tail only grow, the index in data is taken modulo the size. They
+       sit in cache lines of their own, so the two sides don't share one. */
+    uint32_t head;              // written by the producer
+    uint8_t pad_head[60];
+    uint32_t tail;              // written by the consumer
+    uint8_t pad_tail[60];
+    uint32_t consumer_sleeping; // waiting on head to move
+    uint32_t producer_sleeping; // waiting on tail to move
+    uint8_t pad_sleeping[56];
+    uint8_t data[SHM_RING_SIZE];
+}shm_ring_t;
+
+typedef struct shm_region_t{
+    uint32_t magic;
+    uint32_t core_attached;     // set by the core, the monitor waits on it
+    uint8_t pad[56];
+    shm_ring_t to_monitor;
+    shm_ring_t to_core;
+}shm_region_t;
+
+typedef struct shm_connect_t{
+    shm_region_t *region;
+    shm_ring_t *in;
+    shm_ring_t *out;
+    bool_t owner;               // the monitor created the region and removes it
+    char *name;
+}shm_connect_t;
+
+static inline bool_t is_shm_connect_name(const char *name)
+{
+    return name != NULL && strncmp(name, SHM_CONNECT_PREFIX, sizeof(SHM_CONNECT_PREFIX) - 1) == 0;
+}
+
+/* the monitor creates the region and waits for the core, the core waits for the region */
+shm_connect_t* shm_connect_monitor_side(const char *name);
+shm_connect_t* shm_connect_core_side(const char *name);
+void destory_shm_connect(shm_connect_t **connect);
+
+bool_t shm_wait_input(shm_connect_t *connect, int timeout_ms);
+long int shm_recv(shm_connect_t *connect, char *buffer, long int max_size, bool_t block);
+long int shm_send(shm_connect_t *connect, char *buffer, long int send_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SHM_CONNECT_H_
@@ -0,0 +1,34 @@
+#ifndef _SPI_H_
+#define _SPI_H_
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include <stdint.h>
+#include "_types.h"
+
+/*
+ * A device on a SPI bus. The controller selects it through its chip select, then
+ * every frame sends one byte to it and takes the byte it returns in the same frame.
+ * The models embed it as their first member.
+ */
+struct snapshot_t;
+struct mapped_image_t;
+typedef struct spi_device_t{
+    const char *name;
+    struct mapped_image_t *image;   // the storage, saved with the memory, NULL if none
+    void (*select)(struct spi_device_t *device, bool_t selected);
+    uint8_t (*transfer)(struct spi_device_t *device, uint8_t out);
+    /* the state of the bus interface, the storage is in the image section */
+    int (*snapshot)(struct spi_device_t *device, struct snapshot_t *snapshot);
+    int (*restore)(struct spi_device_t *device, struct snapshot_t *snapshot);
+    void (*destory)(struct spi_device_t *device);
+}spi_device_t;
+
+/* the bus is pulled up, nothing driving it reads as 0xFF */
+#define SPI_IDLE_BYTE   0xFF
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,252 @@
+#include "spi_flash.h"
+#include "mapped_image.h"
+#include "snapshot.h"
+#include "error_code.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * A serial NOR flash with the common command set of the 25 series. The array is the
+ * mapped image: a read streams the bytes of the mapping, a page program ANDs the
+ * data into it, an erase is a memset to 0xFF. Programs and erases are done at once,
+ * the busy bit is never set. The protection bits of the status register are kept
+ * but protect nothing.
+ */
+
+#define SPI_FLASH_DEFAULT_SIZE  (4 * 1024 * 1024)
+#define SPI_FLASH_ALIGN         (64 * 1024)
+#define SPI_FLASH_PAGE_SIZE     256
+
+#define FLASH_WRSR          0x01
+#define FLASH_PP            0x02
+#define FLASH_READ          0x03
+#define FLASH_WRDI          0x04
+#define FLASH_RDSR          0x05
+#define FLASH_WREN          0x06
+#define FLASH_FAST_READ     0x0B
+#define FLASH_SE            0x20    // 4KB
+#define FLASH_BE32          0x52
+#define FLASH_CE            0x60
+#define FLASH_REMS          0x90    // manufacturer and device id
+#define FLASH_RDID          0x9F    // JEDEC id
+#define FLASH_RES           0xAB    // release from power-down, device id
+#define FLASH_CE_ALT        0xC7
+#define FLASH_BE64          0xD8
+
+#define STATUS_WEL          (1u << 1)
+#define STATUS_WRITABLE     0xFC    // BP0-BP2, TB, SEC, SRP
+
+#define FLASH_MANUFACTURER  0xEF
+#define FLASH_MEMORY_TYPE   0x40
+
+/* what the flash got since it was selected */
+typedef struct spi_flash_bus_t{
+    uint32_t count;         // frames, the first one is the command
+    uint32_t address;
+    uint8_t command;
+    uint8_t status;
+    uint8_t written;        // the first data byte, the new status of WRSR
+}spi_flash_bus_t;
+
+typedef struct spi_flash_t{
+    spi_device_t device;
+    mapped_image_t *image;
+    uint8_t capacity;       // log2 of the size
+    spi_flash_bus_t bus;
+}spi_flash_t;
+
+static bool_t has_address(uint8_t command)
+{
+    switch(command){
+    case FLASH_PP:
+    case FLASH_READ:
+    case FLASH_FAST_READ:
+    case FLASH_SE:
+    case FLASH_BE32:
+    case FLASH_BE64:
+    case FLASH_REMS:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+static uint8_t* flash_byte(spi_flash_t *flash, uint32_t address)
+{
+    return &flash->image->data[address % flash->image->size];
+}
+
+static void erase(spi_flash_t *flash, uint32_t size)
+{
+    uint32_t start = (flash->bus.address % flash->image->size) & ~(size - 1);
+    mark_image_dirty(flash->image, start, size);
+    memset(flash->image->data + start, 0xFF, size);
+}
+
+/* the write enable is taken by the first program or erase after it */
+static void execute(spi_flash_t *flash)
+{
+    spi_flash_bus_t *bus = &flash->bus;
+    bool_t enabled = (bus->status & STATUS_WEL) != 0;
+
+    switch(bus->command){
+    case FLASH_WREN:
+        bus->status |= STATUS_WEL;
+        break;
+    case FLASH_WRDI:
+        bus->status &= ~STATUS_WEL;
+        break;
+    case FLASH_WRSR:
+        if(enabled && bus->count > 1){
+            bus->status = (bus->status & ~STATUS_WRITABLE) | (bus->written & STATUS_WRITABLE);
+        }
+        bus->status &= ~STATUS_WEL;
+        break;
+    case FLASH_PP:
+        if(bus->count > 4){
+            bus->status &= ~STATUS_WEL;
+        }
+        break;
+    case FLASH_SE:
+    case FLASH_BE32:
+    case FLASH_BE64:
+        if(bus->count < 4){
+            break;
+        }
+        if(enabled){
+            erase(flash, bus->command == FLASH_SE ? 4 * 1024 : bus->command == FLASH_BE32 ? 32 * 1024 : 64 * 1024);
+        }
+        bus->status &= ~STATUS_WEL;
+        break;
+    case FLASH_CE:
+    case FLASH_CE_ALT:
+        if(enabled){
+            mark_image_dirty(flash->image, 0, flash->image->size);
+            memset(flash->image->data, 0xFF, flash->image->size);
+        }
+        bus->status &= ~STATUS_WEL;
+        break;
+    }
+}
+
+/* the commands take effect when the chip select goes high */
+static void spi_flash_select(spi_device_t *device, bool_t selected)
+{
+    spi_flash_t *flash = (spi_flash_t*)device;
+    if(!selected && flash->bus.count != 0){
+        execute(flash);
+    }
+    flash->bus.count = 0;
+}
+
+static uint8_t spi_flash_transfer(spi_device_t *device, uint8_t out)
+{
+    spi_flash_t *flash = (spi_flash_t*)device;
+    spi_flash_bus_t *bus = &flash->bus;
+    uint32_t index = bus->count++;
+    uint8_t *byte;
+
+    if(index == 0){
+        bus->command = out;
+        bus->address = 0;
+        return SPI_IDLE_BYTE;
+    }
+    if(has_address(bus->command) && index <= 3){
+        bus->address = (bus->address << 8) | out;
+        return SPI_IDLE_BYTE;
+    }
+
+    switch(bus->command){
+    case FLASH_WRSR:
+        if(index == 1){
+            bus->written = out;
+        }
+        break;
+    case FLASH_RDSR:
+        return bus->status;
+    case FLASH_RDID:
+        switch(index){
+        case 1: return FLASH_MANUFACTURER;
+        case 2: return FLASH_MEMORY_TYPE;
+        case 3: return flash->capacity;
+        }
+        break;
+    case FLASH_REMS:
+        /* the address selects which of the two comes first */
+        return (index - 4 + (bus->address & 1)) % 2 == 0 ? FLASH_MANUFACTURER : flash->capacity - 1;
+    case FLASH_RES:
+        return index > 3 ? flash->capacity - 1 : SPI_IDLE_BYTE;
+    case FLASH_FAST_READ:
+        if(index == 4){
+            return SPI_IDLE_BYTE;       // the dummy byte
+        }
+        /* fall through */
+    case FLASH_READ:
+        return *flash_byte(flash, bus->address++);
+    case FLASH_PP:
+        /* the address wraps in the page, NOR only clears bits */
+        if(bus->status & STATUS_WEL){
+            byte = flash_byte(flash, bus->address);
+            mark_image_dirty(flash->image, byte - flash->image->data, 1);
+            *byte &= out;
+        }
+        bus->address = (bus->address & ~(SPI_FLASH_PAGE_SIZE - 1)) | ((bus->address + 1) & (SPI_FLASH_PAGE_SIZE - 1));
+        break;
+    }
+    return SPI_IDLE_BYTE;
+}
+
+static int spi_flash_snapshot(spi_device_t *device, snapshot_t *snapshot)
+{
+    spi_flash_t *flash = (spi_flash_t*)device;
+    return SNAPSHOT_PUT(snapshot, flash->bus) < 0 ? -ERROR_CREATE : 0;
+}
+
+static int spi_flash_restore(spi_device_t *device, snapshot_t *snapshot)
+{
+    spi_flash_t *flash = (spi_flash_t*)device;
+    return SNAPSHOT_GET(snapshot, flash->bus) < 0 ? -ERROR_SNAPSHOT : 0;
+}
+
+static void destory_spi_flash(spi_device_t *device)
+{
+    spi_flash_t *flash = (spi_flash_t*)device;
+    unmap_image_file(&flash->image);
+    free(flash);
+}
+
+spi_device_t* create_spi_flash(const char *path, bool_t copy)
+{
+    spi_flash_t *flash = (spi_flash_t*)calloc(1, sizeof(spi_flash_t));
+    if(flash == NULL){
+        goto flash_null;
+    }
+    flash->image = map_image_file(path, SPI_FLASH_DEFAULT_SIZE, SPI_FLASH_ALIGN, 0xFF, copy);
+    if(flash->image == NULL){
+        goto map_fail;
+    }
+    /* 24 address bits */
+    if(flash->image->size > (1ul << 24)){
+        LOG(LOG_ERROR, "create_spi_flash: %s is larger than 16MB\n", path);
+        goto size_fail;
+    }
+    while((1ul << flash->capacity) < flash->image->size){
+        flash->capacity++;
+    }
+
+    flash->device.name = "spi flash";
+    flash->device.image = flash->image;
+    flash->device.select = spi_flash_select;
+    flash->device.transfer = spi_flash_transfer;
+    flash->device.snapshot = spi_flash_snapshot;
+    flash->device.restore = spi_flash_restore;
+    flash->device.destory = destory_spi_flash;
+    return &flash->device;
+
+size_fail:
+    unmap_image_file(&flash->image);
+map_fail:
+    free(flash);
+flash_null:
+    return NULL;
+}
@@ -0,0 +1,16 @@
+#ifndef _SPI_FLASH_H_
+#define _SPI_FLASH_H_
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include "spi.h"
+
+/* a serial NOR flash stored in the image file, 4MB if the file is new, copy leaves
+   the file as it is (see mapped_image.h) */
+spi_device_t* create_spi_flash(const char *path, bool_t copy);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
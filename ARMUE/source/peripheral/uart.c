@@ -1,4 +1,6 @@
 #include "uart.h"
+#include "snapshot.h"
+#include "uart_console.h"
 
 int uart_init(uart_t *uart, int buf_len)
 {
@@ -10,6 +12,14 @@ int uart_init(uart_t *uart, int buf_len)
     return 0;
 }
 
+void uart_destory(uart_t *uart)
+{
+    if(uart->in_buffer != NULL){
+        destory_fifo(&uart->in_buffer);
+    }
+    destory_uart_console(&uart->console);
+}
+
 /* Send configuration to other side. Generally be called when the configuration is changed
    so that the other side of the program can respond to the change.*/
 void uart_send_config(core_connect_t *connect, uart_t *uart, int index)
@@ -47,8 +57,11 @@ int uart_store_in_buffer(uart_t *uart, uint8_t *data, int len)
 /* Send data without the configuration information of the UART */
 void uart_send_data(core_connect_t *connect, int index, void *data, int len)
 {
-    make_pmp_data_packet(connect, PERI_UART, index, PMP_DATA_KIND_DENERIC, data, 1);
-    pmp_send(connect);
+    /* no monitor, e.g. when replaying */
+    if(connect == NULL){
+        return;
+    }
+    pmp_queue_data(connect, PERI_UART, index, PMP_DATA_KIND_DENERIC, data, len);
 }
 
 void uart_send_byte(core_connect_t *connect, int index, void *data)
@@ -56,8 +69,35 @@ void uart_send_byte(core_connect_t *connect, int index, void *data)
     uart_send_data(connect, index, data, 1);
 }
 
+/* a byte written by the guest */
+void uart_output(uart_t *uart, core_connect_t *connect, int index, uint8_t data)
+{
+    if(uart->console != NULL){
+        uart_console_write(uart->console, data);
+    }else{
+        uart_send_byte(connect, index, &data);
+    }
+}
+
 int uart_read_data(uart_t *uart, void *buffer)
 {
     return fifo_out(uart->in_buffer, buffer);
 }
 
+int uart_snapshot(uart_t *uart, snapshot_t *snapshot)
+{
+    if(SNAPSHOT_PUT(snapshot, uart->stop_bit) < 0 || SNAPSHOT_PUT(snapshot, uart->valid_type) < 0 ||
+       SNAPSHOT_PUT(snapshot, uart->data_len) < 0 || SNAPSHOT_PUT(snapshot, uart->baud) < 0){
+        return -1;
+    }
+    return snapshot_put_fifo(snapshot, uart->in_buffer);
+}
+
+int uart_restore(uart_t *uart, snapshot_t *snapshot)
+{
+    if(SNAPSHOT_GET(snapshot, uart->stop_bit) < 0 || SNAPSHOT_GET(snapshot, uart->valid_type) < 0 ||
+       SNAPSHOT_GET(snapshot, uart->data_len) < 0 || SNAPSHOT_GET(snapshot, uart->baud) < 0){
+        return -1;
+    }
+    return snapshot_get_fifo(snapshot, uart->in_buffer);
+}
@@ -22,6 +22,7 @@ typedef struct uart_t
     uint8_t data_len;
     int baud;
     fifo_t *in_buffer;
+    struct uart_console_t *console;     // the output goes to the host instead of the monitor, NULL if not
 }uart_t;
 
 #pragma pack(1)
@@ -34,10 +35,15 @@ struct uart_config_pkt_t{
 #pragma pack()
 
 int uart_init(uart_t *uart, int buf_len);
+void uart_destory(uart_t *uart);
 int uart_store_in_buffer(uart_t *uart, uint8_t *data, int len);
 void uart_send_data(core_connect_t *connect, int index, void *data, int len);
 void uart_send_byte(core_connect_t *connect, int index, void *data);
+void uart_output(uart_t *uart, core_connect_t *connect, int index, uint8_t data);
 int uart_read_data(uart_t *uart, void *buffer);
+struct snapshot_t;
+int uart_snapshot(uart_t *uart, struct snapshot_t *snapshot);
+int uart_restore(uart_t *uart, struct snapshot_t *snapshot);
 
 #ifdef __cplusplus
 }
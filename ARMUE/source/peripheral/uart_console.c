@@ -0,0 +1,270 @@
+#ifdef __linux__
+#define _GNU_SOURCE     // posix_openpt, ptsname and cfmakeraw
+#endif
+#include "uart_console.h"
+#include "peripheral.h"
+#include "error_code.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#else
+#include <windows.h>
+#include <conio.h>
+#endif
+
+#define UART_CONSOLE_IN_SIZE    256
+#define UART_CONSOLE_FULL_US    1000
+
+static void write_out(uart_console_t *console, uint8_t *data, uint32_t len)
+{
+    if(console->out != NULL){
+        fwrite(data, 1, len, console->out);
+        return;
+    }
+#ifdef __linux__
+    /* Nothing may be attached to the pty, the bytes are lost then like on a real
+       UART. The master is non-blocking. */
+    while(len > 0){
+        ssize_t written = write(console->in_fd, data, len);
+        if(written <= 0){
+            return;
+        }
+        data += written;
+        len -= written;
+    }
+#endif
+}
+
+static void flush_console(uart_console_t *console)
+{
+    uint32_t tail = console->tail;
+    uint32_t head = __atomic_load_n(&console->head, __ATOMIC_ACQUIRE);
+    if(tail == head){
+        return;
+    }
+    while(tail != head){
+        uint32_t start = tail & (UART_CONSOLE_BUF_SIZE - 1);
+        uint32_t len = UART_CONSOLE_BUF_SIZE - start < head - tail ? UART_CONSOLE_BUF_SIZE - start : head - tail;
+        write_out(console, &console->buffer[start], len);
+        tail += len;
+    }
+    if(console->out != NULL){
+        fflush(console->out);
+    }
+    __atomic_store_n(&console->tail, tail, __ATOMIC_RELEASE);
+}
+
+/* Wait UART_CONSOLE_FLUSH_MS for input. The length read, 0 if nothing came and -1
+   at the end of the input. */
+#ifdef __linux__
+static int read_input(uart_console_t *console, uint8_t *data, int size)
+{
+    struct pollfd in = {console->in_fd, POLLIN, 0};
+    if(poll(&in, 1, UART_CONSOLE_FLUSH_MS) <= 0){
+        return 0;
+    }
+    ssize_t len = read(console->in_fd, data, size);
+    if(len < 0 && errno == EAGAIN){
+        return 0;
+    }
+    return len > 0 ? len : -1;
+}
+#else
+/* A console is read a key at a time without echo, like the raw pty. A pipe is
+   peeked first, a read blocking on it would hold up the output. */
+static int read_input(uart_console_t *console, uint8_t *data, int size)
+{
+    HANDLE in = GetStdHandle(STD_INPUT_HANDLE);
+    DWORD type = GetFileType(in);
+    DWORD available, len;
+    int waited, i;
+
+    for(waited = 0; waited < UART_CONSOLE_FLUSH_MS; waited++){
+        if(type == FILE_TYPE_CHAR){
+            for(i = 0; i < size && _kbhit(); i++){
+                data[i] = (uint8_t)_getch();
+            }
+            if(i > 0){
+                return i;
+            }
+        }else if(type == FILE_TYPE_PIPE){
+            if(!PeekNamedPipe(in, NULL, 0, NULL, &available, NULL)){
+                return -1;
+            }
+            if(available > 0){
+                len = available < (DWORD)size ? available : (DWORD)size;
+                return ReadFile(in, data, len, &len, NULL) && len > 0 ? (int)len : -1;
+            }
+        }else{
+            /* a file never keeps the reader waiting */
+            return ReadFile(in, data, size, &len, NULL) && len > 0 ? (int)len : -1;
+        }
+        Sleep(1);
+    }
+    return 0;
+}
+#endif
+
+/* give the input to the UART if there is some */
+static void wait_input(uart_console_t *console)
+{
+    uint8_t data[UART_CONSOLE_IN_SIZE];
+    if(console->queue == NULL || console->in_fd < 0){
+        usleep(UART_CONSOLE_FLUSH_MS * 1000);
+        return;
+    }
+    int len = read_input(console, data, sizeof(data));
+    if(len == 0){
+        return;
+    }
+    /* the end of the input, only the output is left */
+    if(len < 0){
+        console->queue = NULL;
+        return;
+    }
+    pmp_parsed_pkt_t pkt;
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.pkt_kind = PMP_DATA;
+    pkt.peri_kind = PERI_UART;
+    pkt.peri_index = console->peri_index;
+    pkt.data_kind = PMP_DATA_KIND_DENERIC;
+    pkt.data = data;
+    pkt.data_len = len;
+    pkt.valid = TRUE;
+    queue_peri_io_event(console->io, console->queue, &pkt);
+}
+
+static void* uart_console_thread(void *arg)
+{
+    uart_console_t *console = (uart_console_t*)arg;
+    while(!__atomic_load_n(&console->stop, __ATOMIC_ACQUIRE)){
+        wait_input(console);
+        flush_console(console);
+    }
+    flush_console(console);
+    return NULL;
+}
+
+/* a pty in raw mode, so the output is not echoed back as input */
+static int open_pty(uart_console_t *console)
+{
+#ifdef __linux__
+    struct termios raw;
+    int master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if(master < 0){
+        goto master_fail;
+    }
+    if(grantpt(master) < 0 || unlockpt(master) < 0){
+        goto slave_fail;
+    }
+    console->pty_slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    if(console->pty_slave < 0){
+        goto slave_fail;
+    }
+    tcgetattr(console->pty_slave, &raw);
+    cfmakeraw(&raw);
+    tcsetattr(console->pty_slave, TCSANOW, &raw);
+
+    console->in_fd = master;
+    printf("UART%d is on %s\n", console->peri_index, ptsname(master));
+    fflush(stdout);
+    return 0;
+
+slave_fail:
+    close(master);
+master_fail:
+    LOG(LOG_ERROR, "Can't open a pty for UART%d\n", console->peri_index);
+    return -1;
+#else
+    LOG(LOG_ERROR, "The pty console is only on Linux\n");
+    return -1;
+#endif
+}
+
+uart_console_t* create_uart_console(const char *sink, peri_io_t *io, int peri_index)
+{
+    uart_console_t *console = (uart_console_t*)calloc(1, sizeof(uart_console_t));
+    if(console == NULL){
+        goto console_null;
+    }
+    console->in_fd = -1;
+    console->pty_slave = -1;
+    console->io = io;
+    console->peri_index = peri_index;
+
+    if(strcmp(sink, "stdio") == 0){
+        console->out = stdout;
+        console->in_fd = STDIN_FILENO;
+    }else if(strncmp(sink, "file:", 5) == 0){
+        /* output only, the UART gets no input */
+        console->out = fopen(sink + 5, "wb");
+        if(console->out == NULL){
+            LOG(LOG_ERROR, "Can't open %s for UART%d\n", sink + 5, peri_index);
+            goto sink_fail;
+        }
+        console->close_out = TRUE;
+    }else if(strcmp(sink, "pty") == 0){
+        if(open_pty(console) < 0){
+            goto sink_fail;
+        }
+    }else{
+        LOG(LOG_ERROR, "Unknown UART console %s\n", sink);
+        goto sink_fail;
+    }
+
+    if(console->in_fd >= 0 && io != NULL){
+        console->queue = add_peri_io_source(io);
+    }
+    if(pthread_create(&console->thread, NULL, uart_console_thread, console) != 0){
+        goto thread_fail;
+    }
+    return console;
+
+thread_fail:
+    if(console->close_out){
+        fclose(console->out);
+    }
+    if(console->pty_slave >= 0){
+        close(console->in_fd);
+        close(console->pty_slave);
+    }
+sink_fail:
+    free(console);
+console_null:
+    return NULL;
+}
+
+void destory_uart_console(uart_console_t **console)
+{
+    if(console == NULL || *console == NULL){
+        return;
+    }
+    __atomic_store_n(&(*console)->stop, TRUE, __ATOMIC_RELEASE);
+    pthread_join((*console)->thread, NULL);
+    if((*console)->close_out){
+        fclose((*console)->out);
+    }
+    if((*console)->pty_slave >= 0){
+        close((*console)->in_fd);
+        close((*console)->pty_slave);
+    }
+    free(*console);
+    *console = NULL;
+}
+
+/* On a cpu thread, the thread of the console writes it out later. There is one writer
+   at a time: the cores of a soc write the UART with the device lock held. */
+void uart_console_write(uart_console_t *console, uint8_t data)
+{
+    uint32_t head = console->head;
+    while(head - __atomic_load_n(&console->tail, __ATOMIC_ACQUIRE) >= UART_CONSOLE_BUF_SIZE){
+        usleep(UART_CONSOLE_FULL_US);
+    }
+    console->buffer[head & (UART_CONSOLE_BUF_SIZE - 1)] = data;
+    __atomic_store_n(&console->head, head + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,52 @@
+#ifndef _UART_CONSOLE_H_
+#define _UART_CONSOLE_H_
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include <stdio.h>
+#include <pthread.h>
+#include "_types.h"
+#include "peri_io.h"
+
+/*
+ * A UART wired to the host rather than to the peripheral monitor. The sink is one of
+ *     stdio            output to stdout, input from stdin, a key at a time from a
+ *                      Windows console
+ *     file:<path>      output to the file, the UART gets no input
+ *     pty              a pseudo-terminal, its name is printed (Linux only)
+ * The guest only puts the bytes in a buffer, a thread writes them out. The input is
+ * read on that thread too and comes to the UART as packets through peri_io.
+ */
+
+#define UART_CONSOLE_BUF_SIZE   (64 * 1024)     // a power of 2
+#define UART_CONSOLE_FLUSH_MS   10
+
+typedef struct uart_console_t{
+    FILE *out;                  // NULL for a pty, which is written through in_fd
+    int in_fd;                  // -1 if there is no input
+    int pty_slave;              // kept open so that the pty lives without a client, -1 if none
+    bool_t close_out;           // the sink was opened by the console
+
+    /* the guest writes at head, the thread takes from tail */
+    uint32_t head;
+    uint8_t pad[60];
+    uint32_t tail;
+    uint8_t buffer[UART_CONSOLE_BUF_SIZE];
+
+    peri_io_t *io;
+    spsc_queue_t *queue;        // the input packets, NULL if there is no input
+    int peri_index;
+    bool_t stop;                // set and read with __atomic
+    pthread_t thread;
+}uart_console_t;
+
+uart_console_t* create_uart_console(const char *sink, peri_io_t *io, int peri_index);
+/* everything written is flushed first */
+void destory_uart_console(uart_console_t **console);
+void uart_console_write(uart_console_t *console, uint8_t data);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
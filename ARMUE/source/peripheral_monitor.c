@@ -4,6 +4,11 @@
 #include "core_connect.h"
 #include <string.h>
 
+#ifdef __linux__
+#define DEFAULT_PIPE_NAME "/tmp/armue"
+#else
+#define DEFAULT_PIPE_NAME "\\\\.\\Pipe\\armue"
+
 typedef HANDLE process_id_t;
 
 process_id_t create_process()
@@ -41,6 +46,7 @@ void wait_close_child_process(process_id_t pid)
     // Close process and thread handles.
     CloseHandle( pid );
 }
+#endif
 
 
 
@@ -53,7 +59,8 @@ int main(int argc, char **argv)
 //        return -1;
 //    }
 
-    core_connect_t *core_connect = create_core_connect(1024, "\\\\.\\Pipe\\armue");
+    /* "shm:/<name>" connects through shared memory on Linux, other names are sockets there */
+    core_connect_t *core_connect = create_core_connect(1024, argc > 1 ? argv[1] : DEFAULT_PIPE_NAME);
     retval = connect_armue_core(core_connect);
     if(retval != SUCCESS){
         return -1;
@@ -76,7 +83,11 @@ int main(int argc, char **argv)
             // start input parsing loop
             pmp_parse_loop(core_connect){
                 result = pmp_parse_input(core_connect, &pmp_pkt);
-                if(result < 0){
+                /* the core sends in batches, the rest of a packet may come later */
+                if(result == -PMP_ERR_DATA_LEN){
+                    pmp_keep_unparsed(core_connect);
+                    break;
+                }else if(result < 0){
                     pmp_clear_recv_buffer(core_connect);
                     break;
                 }
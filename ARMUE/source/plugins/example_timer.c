@@ -0,0 +1,166 @@
+#include "armue_plugin.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * An example plug-in: a down counter that sets its status bit and raises an
+ * interrupt each time LOAD cycles pass, then starts over. Build it as a shared
+ * object and put it in the plug-in directory.
+ *
+ *     0x00 LOAD    cycles of a period, a write starts the period over
+ *     0x04 CTRL    bit 0 runs the counter, bit 1 enables the interrupt
+ *     0x08 STATUS  bit 0 is set at the end of a period, write 1 to clear
+ *     0x0C COUNT   periods since the counter was started, read only
+ */
+
+#define EXAMPLE_TIMER_BASE      0x50008000
+#define EXAMPLE_TIMER_LENGTH    0x10
+#define EXAMPLE_TIMER_IRQ       40
+#define EXAMPLE_TIMER_EVENT     0
+
+#define CTRL_RUN                (1ul)
+#define CTRL_IE                 (1ul << 1)
+#define STATUS_EXPIRED          (1ul)
+
+typedef struct example_timer_state_t{
+    uint32_t load;
+    uint32_t ctrl;
+    uint32_t status;
+    uint32_t count;
+}example_timer_state_t;
+
+typedef struct example_timer_t{
+    const armue_host_t *host;
+    example_timer_state_t state;
+}example_timer_t;
+
+static void restart(example_timer_t *timer)
+{
+    const armue_host_t *host = timer->host;
+    if((timer->state.ctrl & CTRL_RUN) && timer->state.load != 0){
+        host->schedule(host->context, EXAMPLE_TIMER_EVENT, timer->state.load);
+    }else{
+        host->cancel(host->context, EXAMPLE_TIMER_EVENT);
+    }
+}
+
+static void* example_timer_create(const armue_host_t *host)
+{
+    example_timer_t *timer = (example_timer_t*)calloc(1, sizeof(example_timer_t));
+    if(timer == NULL){
+        return NULL;
+    }
+    timer->host = host;
+    return timer;
+}
+
+static void example_timer_destory(void *instance)
+{
+    free(instance);
+}
+
+static int example_timer_read(void *instance, uint32_t offset, int size, uint32_t *value)
+{
+    example_timer_t *timer = (example_timer_t*)instance;
+    switch(offset){
+    case 0x00: *value = timer->state.load; break;
+    case 0x04: *value = timer->state.ctrl; break;
+    case 0x08: *value = timer->state.status; break;
+    case 0x0C: *value = timer->state.count; break;
+    default:
+        return -1;
+    }
+    return 0;
+}
+
+static int example_timer_write(void *instance, uint32_t offset, int size, uint32_t value)
+{
+    example_timer_t *timer = (example_timer_t*)instance;
+    switch(offset){
+    case 0x00:
+        timer->state.load = value;
+        restart(timer);
+        break;
+    case 0x04:
+        if((value & CTRL_RUN) && !(timer->state.ctrl & CTRL_RUN)){
+            timer->state.count = 0;
+        }
+        timer->state.ctrl = value & (CTRL_RUN | CTRL_IE);
+        restart(timer);
+        break;
+    case 0x08:
+        timer->state.status &= ~(value & STATUS_EXPIRED);
+        break;
+    case 0x0C:
+        break;
+    default:
+        return -1;
+    }
+    return 0;
+}
+
+static void example_timer_event(void *instance, uint32_t id)
+{
+    example_timer_t *timer = (example_timer_t*)instance;
+    const armue_host_t *host = timer->host;
+
+    timer->state.status |= STATUS_EXPIRED;
+    timer->state.count++;
+    if(timer->state.ctrl & CTRL_IE){
+        host->raise_irq(host->context, EXAMPLE_TIMER_IRQ);
+    }
+    restart(timer);
+}
+
+/* the pending event is kept by the emulator, only the registers are saved */
+static int example_timer_save(void *instance, uint8_t *buffer, int size)
+{
+    if(buffer == NULL){
+        return sizeof(example_timer_state_t);
+    }
+    if(size < (int)sizeof(example_timer_state_t)){
+        return -1;
+    }
+    memcpy(buffer, &((example_timer_t*)instance)->state, sizeof(example_timer_state_t));
+    return sizeof(example_timer_state_t);
+}
+
+static int example_timer_load(void *instance, const uint8_t *buffer, int size)
+{
+    if(size != sizeof(example_timer_state_t)){
+        return -1;
+    }
+    memcpy(&((example_timer_t*)instance)->state, buffer, sizeof(example_timer_state_t));
+    return 0;
+}
+
+static const armue_peripheral_ops_t example_timer_ops = {
+    .size = sizeof(armue_peripheral_ops_t),
+    .name = "example_timer",
+    .base = EXAMPLE_TIMER_BASE,
+    .length = EXAMPLE_TIMER_LENGTH,
+    .create = example_timer_create,
+    .destory = example_timer_destory,
+    .read = example_timer_read,
+    .write = example_timer_write,
+    .event = example_timer_event,
+    .save = example_timer_save,
+    .load = example_timer_load,
+};
+
+static const armue_peripheral_ops_t *const example_peripherals[] = {
+    &example_timer_ops,
+};
+
+static const armue_plugin_t example_plugin = {
+    .size = sizeof(armue_plugin_t),
+    .abi_version = ARMUE_PLUGIN_ABI_VERSION,
+    .name = "example_timer",
+    .peripheral_num = 1,
+    .peripherals = example_peripherals,
+};
+
+ARMUE_PLUGIN_EXPORT const armue_plugin_t* armue_plugin_v1(void)
+{
+    return &example_plugin;
+}
@@ -0,0 +1,564 @@
+#include "memory_map.h"
+#include "peripheral.h"
+#include "snapshot.h"
+#include "register_block.h"
+#include "cmsis_svd.h"
+#include "xml.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Register stubs generated from a CMSIS-SVD description, for the peripherals that
+ * have no model of their own. A register keeps the value written last, starting at
+ * its reset value. The read-only registers and fields ignore the writes, the
+ * write-only registers read as zero and the oneToClear fields are cleared by
+ * writing 1. Nothing behind the registers is modeled: the firmware can set up the
+ * clocks, the pins and the power, but a status bit only changes if it is written.
+ * The status bits that boot code waits on, the oscillator and PLL locks, are in
+ * svd_status_bits and always read as 1.
+ */
+
+enum svd_access_t{
+    SVD_READ_WRITE = 0,
+    SVD_READ_ONLY,
+    SVD_WRITE_ONLY,
+};
+
+/* the properties a register inherits from the device, the peripheral and the cluster */
+typedef struct svd_props_t{
+    uint32_t size;              // in bits
+    uint32_t reset_value;
+    uint32_t reset_mask;
+    int access;
+}svd_props_t;
+
+typedef struct svd_regs_t{
+    reg_desc_t *regs;
+    int num;
+    int cap;
+}svd_regs_t;
+
+typedef struct svd_peripheral_t{
+    char *name;
+    reg_desc_t *regs;
+    reg_block_t *registers;
+    memory_region_t *region;
+}svd_peripheral_t;
+
+static const svd_props_t svd_default_props = {32, 0, 0xFFFFFFFF, SVD_READ_WRITE};
+
+/* the bits read as 1, by register name */
+typedef struct svd_status_t{
+    const char *reg;
+    uint32_t mask;
+}svd_status_t;
+
+static const svd_status_t svd_status_bits[] = {
+    {"SCS",         0x00000040},    // OSCSTAT, the main oscillator is ready
+    {"PLL0STAT",    0x07000000},    // PLLE0_STAT, PLLC0_STAT, PLOCK0
+    {"PLL1STAT",    0x00000700},    // PLLE1_STAT, PLLC1_STAT, PLOCK1
+};
+
+static uint32_t status_mask(const char *name)
+{
+    int i;
+    for(i = 0; name != NULL && i < (int)(sizeof(svd_status_bits) / sizeof(svd_status_bits[0])); i++){
+        if(strcmp(svd_status_bits[i].reg, name) == 0){
+            return svd_status_bits[i].mask;
+        }
+    }
+    return 0;
+}
+
+/* scaledNonNegativeInteger: decimal, 0x hex or # binary, then k, M or G */
+static int svd_number(const char *text, uint32_t *value)
+{
+    unsigned long long number = 0;
+    char *end;
+
+    if(text == NULL || *text == '\0'){
+        return -1;
+    }
+    if(text[0] == '#'){
+        /* the don't care bits are taken as 0 */
+        for(end = (char*)text + 1; *end == '0' || *end == '1' || *end == 'x' || *end == 'X'; end++){
+            number = (number << 1) | (*end == '1');
+        }
+    }else if(text[0] == '0' && (text[1] == 'x' || text[1] == 'X')){
+        number = strtoull(text + 2, &end, 16);
+    }else{
+        number = strtoull(text, &end, 10);
+    }
+    switch(*end){
+    case 'k': case 'K': number <<= 10; end++; break;
+    case 'm': case 'M': number <<= 20; end++; break;
+    case 'g': case 'G': number <<= 30; end++; break;
+    }
+    if(*end != '\0' || end == text){
+        return -1;
+    }
+    *value = (uint32_t)number;
+    return 0;
+}
+
+/* the number in the child element, def if there is none */
+static uint32_t child_number(xml_node_t *node, const char *name, uint32_t def)
+{
+    const char *text = xml_child_text(node, name);
+    uint32_t value;
+
+    if(text == NULL){
+        return def;
+    }
+    if(svd_number(text, &value) < 0){
+        LOG(LOG_WARN, "svd: bad number %s in <%s>\n", text, name);
+        return def;
+    }
+    return value;
+}
+
+static int parse_access(const char *text, int def)
+{
+    if(text == NULL){
+        return def;
+    }
+    if(strcmp(text, "read-only") == 0){
+        return SVD_READ_ONLY;
+    }
+    if(strcmp(text, "write-only") == 0 || strcmp(text, "writeOnce") == 0){
+        return SVD_WRITE_ONLY;
+    }
+    return SVD_READ_WRITE;
+}
+
+static svd_props_t read_props(xml_node_t *node, const svd_props_t *parent)
+{
+    svd_props_t props;
+    props.size = child_number(node, "size", parent->size);
+    props.reset_value = child_number(node, "resetValue", parent->reset_value);
+    props.reset_mask = child_number(node, "resetMask", parent->reset_mask);
+    props.access = parse_access(xml_child_text(node, "access"), parent->access);
+    return props;
+}
+
+/* a field is given by bitOffset and bitWidth, by lsb and msb or by bitRange "[msb:lsb]" */
+static uint32_t field_mask(xml_node_t *field)
+{
+    const char *range = xml_child_text(field, "bitRange");
+    unsigned int lsb, msb;
+
+    if(range != NULL){
+        if(sscanf(range, "[%u:%u]", &msb, &lsb) != 2){
+            return 0;
+        }
+    }else if(xml_child(field, "lsb") != NULL){
+        lsb = child_number(field, "lsb", 0);
+        msb = child_number(field, "msb", lsb);
+    }else{
+        lsb = child_number(field, "bitOffset", 0);
+        msb = lsb + child_number(field, "bitWidth", 1) - 1;
+    }
+    if(msb < lsb || msb > 31){
+        return 0;
+    }
+    return (msb - lsb == 31 ? 0xFFFFFFFFul : (1ul << (msb - lsb + 1)) - 1) << lsb;
+}
+
+static int write_only_read(void *owner, const reg_desc_t *reg, uint32_t *value)
+{
+    *value = 0;
+    return 0;
+}
+
+static int append_reg(svd_regs_t *out, const reg_desc_t *reg)
+{
+    if(out->num == out->cap){
+        int cap = out->cap == 0 ? 16 : out->cap * 2;
+        reg_desc_t *grown = (reg_desc_t*)realloc(out->regs, cap * sizeof(reg_desc_t));
+        if(grown == NULL){
+            return -ERROR_CREATE;
+        }
+        out->regs = grown;
+        out->cap = cap;
+    }
+    out->regs[out->num++] = *reg;
+    return 0;
+}
+
+/* a register array is expanded to one register for each element */
+static int add_register(svd_regs_t *out, xml_node_t *node, uint32_t base, const svd_props_t *parent)
+{
+    svd_props_t props = read_props(node, parent);
+    uint32_t offset = child_number(node, "addressOffset", 0);
+    uint32_t dim = child_number(node, "dim", 1);
+    uint32_t increment = child_number(node, "dimIncrement", props.size / 8);
+    reg_desc_t reg = {0};
+    xml_node_t *field;
+    uint32_t i;
+
+    if(props.size != 8 && props.size != 16 && props.size != 32){
+        LOG(LOG_WARN, "svd: register %s of %d bits is not mapped\n", xml_child_text(node, "name"), props.size);
+        return 0;
+    }
+    reg.width = props.size / 8;
+    reg.reset_value = props.reset_value & props.reset_mask;
+    if(props.access == SVD_READ_ONLY){
+        reg.read_only_mask = 0xFFFFFFFF;
+    }else if(props.access == SVD_WRITE_ONLY){
+        reg.read = write_only_read;
+    }
+    reg.read_set_mask = status_mask(xml_child_text(node, "name"));
+    for_each_xml_child(field, xml_child(node, "fields"), "field"){
+        uint32_t mask = field_mask(field);
+        const char *modified = xml_child_text(field, "modifiedWriteValues");
+        if(parse_access(xml_child_text(field, "access"), SVD_READ_WRITE) == SVD_READ_ONLY){
+            reg.read_only_mask |= mask;
+        }
+        if(modified != NULL && strcmp(modified, "oneToClear") == 0){
+            reg.w1c_mask |= mask;
+        }
+    }
+
+    for(i = 0; i < dim; i++){
+        reg.offset = base + offset + i * increment;
+        if(append_reg(out, &reg) < 0){
+            return -ERROR_CREATE;
+        }
+    }
+    return 0;
+}
+
+static int add_registers(svd_regs_t *out, xml_node_t *node, uint32_t base, const svd_props_t *props);
+
+static int add_cluster(svd_regs_t *out, xml_node_t *node, uint32_t base, const svd_props_t *parent)
+{
+    svd_props_t props = read_props(node, parent);
+    uint32_t offset = child_number(node, "addressOffset", 0);
+    uint32_t dim = child_number(node, "dim", 1);
+    uint32_t increment = child_number(node, "dimIncrement", 0);
+    uint32_t i;
+
+    for(i = 0; i < dim; i++){
+        if(add_registers(out, node, base + offset + i * increment, &props) < 0){
+            return -ERROR_CREATE;
+        }
+    }
+    return 0;
+}
+
+/* the registers and the clusters of the node */
+static int add_registers(svd_regs_t *out, xml_node_t *node, uint32_t base, const svd_props_t *props)
+{
+    xml_node_t *child;
+    int retval = 0;
+
+    for(child = node->child; child != NULL && retval == 0; child = child->next){
+        if(strcmp(child->name, "register") == 0){
+            retval = add_register(out, child, base, props);
+        }else if(strcmp(child->name, "cluster") == 0){
+            retval = add_cluster(out, child, base, props);
+        }
+    }
+    return retval;
+}
+
+/* the block covers the address blocks and all the registers */
+static uint32_t block_size(xml_node_t *node, svd_regs_t *regs)
+{
+    xml_node_t *block;
+    uint32_t size = 0;
+    int i;
+
+    for_each_xml_child(block, node, "addressBlock"){
+        uint32_t end = child_number(block, "offset", 0) + child_number(block, "size", 0);
+        if(end > size){
+            size = end;
+        }
+    }
+    for(i = 0; i < regs->num; i++){
+        uint32_t end = regs->regs[i].offset + regs->regs[i].width;
+        if(end > size){
+            size = end;
+        }
+    }
+    return (size + 3) & ~3ul;
+}
+
+/* An alternate register, or one on the bytes of another register, is left to the
+   register described first. The 8 and 16 bit registers packed in a word are all kept. */
+static int drop_overlaps(svd_regs_t *regs, uint32_t size, const char *name)
+{
+    uint8_t *taken = (uint8_t*)calloc(size, 1);
+    int i, kept = 0;
+    uint32_t offset;
+
+    if(taken == NULL){
+        return -ERROR_CREATE;
+    }
+    for(i = 0; i < regs->num; i++){
+        reg_desc_t *reg = &regs->regs[i];
+        bool_t overlaps = reg->offset / 4 != (reg->offset + reg->width - 1) / 4;
+        for(offset = reg->offset; offset < reg->offset + reg->width && !overlaps; offset++){
+            overlaps = taken[offset];
+        }
+        if(overlaps){
+            LOG(LOG_DEBUG, "svd: %s+0x%x overlaps another register or crosses a word\n", name, reg->offset);
+            continue;
+        }
+        memset(taken + reg->offset, 1, reg->width);
+        regs->regs[kept++] = *reg;
+    }
+    regs->num = kept;
+    free(taken);
+    return 0;
+}
+
+static xml_node_t* find_svd_peripheral(xml_node_t *peripherals, const char *name)
+{
+    xml_node_t *node;
+    for_each_xml_child(node, peripherals, "peripheral"){
+        const char *text = xml_child_text(node, "name");
+        if(text != NULL && strcmp(text, name) == 0){
+            return node;
+        }
+    }
+    return NULL;
+}
+
+/* the registers not described read as zero and ignore the writes */
+static int cmsis_svd_unmodeled_read(void *owner, uint32_t offset, uint8_t *buffer, int size)
+{
+    memset(buffer, 0, size);
+    return size;
+}
+
+static int cmsis_svd_unmodeled_write(void *owner, uint32_t offset, uint8_t *buffer, int size)
+{
+    return size;
+}
+
+int cmsis_svd_read(uint32_t offset, uint8_t *buffer, int size, memory_region_t *region)
+{
+    svd_peripheral_t *peri = (svd_peripheral_t *)region->region_data;
+    if(peri == NULL){
+        return -1;
+    }
+    return reg_block_read(peri->registers, offset, buffer, size);
+}
+
+int cmsis_svd_write(uint32_t offset, uint8_t *buffer, int size, memory_region_t *region)
+{
+    svd_peripheral_t *peri = (svd_peripheral_t *)region->region_data;
+    if(peri == NULL){
+        return -1;
+    }
+    return reg_block_write(peri->registers, offset, buffer, size);
+}
+
+int cmsis_svd_snapshot(struct snapshot_t *snapshot, void *user_data)
+{
+    reg_block_t *block = ((svd_peripheral_t *)user_data)->registers;
+    if(snapshot_put(snapshot, block->values, block->reg_num * sizeof(uint32_t)) < 0){
+        return -ERROR_CREATE;
+    }
+    return 0;
+}
+
+int cmsis_svd_restore(struct snapshot_t *snapshot, void *user_data)
+{
+    reg_block_t *block = ((svd_peripheral_t *)user_data)->registers;
+    if(snapshot_get(snapshot, block->values, block->reg_num * sizeof(uint32_t)) < 0){
+        return -ERROR_SNAPSHOT;
+    }
+    return 0;
+}
+
+static void destory_svd_peripheral(svd_peripheral_t **peri)
+{
+    if(peri == NULL || *peri == NULL){
+        return;
+    }
+    destory_reg_block(&(*peri)->registers);
+    free((*peri)->regs);
+    free((*peri)->name);
+    free(*peri);
+    *peri = NULL;
+}
+
+/* A peripheral is skipped if its addresses are mapped already, by a model of its
+   own or by another peripheral of the file. *mapped is NULL then. */
+static int map_peripheral(memory_map_t *memory, xml_node_t *device, xml_node_t *node, svd_peripheral_t **mapped)
+{
+    xml_node_t *peripherals = xml_child(device, "peripherals");
+    const char *name = xml_child_text(node, "name");
+    const char *derived = xml_attr(node, "derivedFrom");
+    svd_props_t props = read_props(device, &svd_default_props);
+    xml_node_t *base_node = NULL, *registers, *blocks;
+    svd_regs_t regs = {0};
+    uint32_t base, size;
+    int retval;
+
+    *mapped = NULL;
+    if(name == NULL || svd_number(xml_child_text(node, "baseAddress"), &base) < 0){
+        LOG(LOG_WARN, "svd: peripheral %s has no base address\n", name != NULL ? name : "");
+        return 0;
+    }
+    if(derived != NULL){
+        base_node = find_svd_peripheral(peripherals, derived);
+        if(base_node == NULL){
+            LOG(LOG_WARN, "svd: %s is derived from the unknown %s\n", name, derived);
+            return 0;
+        }
+        props = read_props(base_node, &props);
+    }
+    props = read_props(node, &props);
+
+    /* a derived peripheral has the registers of its base unless it gives its own */
+    registers = xml_child(node, "registers");
+    if(registers == NULL && base_node != NULL){
+        registers = xml_child(base_node, "registers");
+    }
+    blocks = xml_child(node, "addressBlock") != NULL || base_node == NULL ? node : base_node;
+    if(registers != NULL && add_registers(&regs, registers, 0, &props) < 0){
+        retval = -ERROR_CREATE;
+        goto regs_fail;
+    }
+    size = block_size(blocks, &regs);
+    if(size == 0){
+        free(regs.regs);
+        return 0;
+    }
+    if(drop_overlaps(&regs, size, name) < 0){
+        retval = -ERROR_CREATE;
+        goto regs_fail;
+    }
+
+    svd_peripheral_t *peri = (svd_peripheral_t *)calloc(1, sizeof(svd_peripheral_t));
+    if(peri == NULL){
+        retval = -ERROR_CREATE;
+        goto regs_fail;
+    }
+    peri->regs = regs.regs;
+    peri->name = strdup(name);
+    peri->registers = create_reg_block(peri->regs, regs.num, size, peri);
+    if(peri->name == NULL || peri->registers == NULL){
+        retval = -ERROR_CREATE;
+        goto peri_fail;
+    }
+    peri->registers->fallback_read = cmsis_svd_unmodeled_read;
+    peri->registers->fallback_write = cmsis_svd_unmodeled_write;
+
+    memory_region_t *region = request_memory_region(memory, base, size);
+    if(region == NULL){
+        LOG(LOG_DEBUG, "svd: %s at 0x%x is mapped already\n", name, base);
+        destory_svd_peripheral(&peri);
+        return 0;
+    }
+    peri->region = region;
+    region->region_data = peri;
+    region->read = cmsis_svd_read;
+    region->write = cmsis_svd_write;
+    region->type = MEMORY_REGION_PERI;
+
+    LOG(LOG_DEBUG, "svd: %s at 0x%x, %d registers\n", name, base, regs.num);
+    *mapped = peri;
+    return 0;
+
+peri_fail:
+    destory_svd_peripheral(&peri);
+    return retval;
+regs_fail:
+    free(regs.regs);
+    return retval;
+}
+
+/* map the peripherals of the file, after the models of the soc */
+int cmsis_svd_init(soc_t *soc, const char *path)
+{
+    svd_peripheral_t **mapped = NULL;
+    xml_node_t *device, *node;
+    int retval, line, count = 0, num = 0, i;
+
+    memory_map_t *memory = shared_memory_map(soc->cpu[0]->memory_map);
+    if(memory == NULL){
+        retval = -ERROR_MEMORY_MAP;
+        goto no_memory;
+    }
+
+    device = xml_parse_file(path, &line);
+    if(device == NULL){
+        if(line == 0){
+            LOG(LOG_ERROR, "svd: can't read %s\n", path);
+            retval = -ERROR_INVALID_PATH;
+        }else{
+            LOG(LOG_ERROR, "svd: %s is malformed at line %d\n", path, line);
+            retval = -ERROR_SVD;
+        }
+        goto parse_fail;
+    }
+    if(strcmp(device->name, "device") != 0){
+        LOG(LOG_ERROR, "svd: %s doesn't describe a device\n", path);
+        retval = -ERROR_SVD;
+        goto device_fail;
+    }
+
+    xml_node_t *peripherals = xml_child(device, "peripherals");
+    for_each_xml_child(node, peripherals, "peripheral"){
+        count++;
+    }
+    mapped = (svd_peripheral_t **)calloc(count + 1, sizeof(svd_peripheral_t *));
+    if(mapped == NULL){
+        retval = -ERROR_CREATE;
+        goto device_fail;
+    }
+    for_each_xml_child(node, peripherals, "peripheral"){
+        retval = map_peripheral(memory, device, node, &mapped[num]);
+        if(retval < 0){
+            goto map_fail;
+        }
+        if(mapped[num] != NULL){
+            num++;
+        }
+    }
+
+    if(num > 0){
+        request_peripheral(soc, PERI_SVD, num);
+        for(i = 0; i < num; i++){
+            peripheral_t peri_svd = {
+                .user_data = mapped[i],
+                .snapshot = cmsis_svd_snapshot,
+                .restore = cmsis_svd_restore,
+            };
+            register_peripheral(soc, PERI_SVD, i, &peri_svd);
+        }
+    }
+    LOG(LOG_INFO, "svd: %d peripherals mapped from %s\n", num, path);
+    free(mapped);
+    xml_destory(&device);
+    return num;
+
+    /* the regions mapped stay in the memory map, they fail the accesses then */
+map_fail:
+    for(i = 0; i < num; i++){
+        mapped[i]->region->region_data = NULL;
+        destory_svd_peripheral(&mapped[i]);
+    }
+    free(mapped);
+device_fail:
+    xml_destory(&device);
+parse_fail:
+no_memory:
+    return retval;
+}
+
+void cmsis_svd_destory(soc_t *soc)
+{
+    int i;
+    for(i = 0; i < soc->peri_table[PERI_SVD].num; i++){
+        peripheral_t *peri_svd = find_peripheral(soc, PERI_SVD, i);
+        svd_peripheral_t *peri = (svd_peripheral_t *)peri_svd->user_data;
+        destory_svd_peripheral(&peri);
+        peri_svd->user_data = NULL;
+    }
+}
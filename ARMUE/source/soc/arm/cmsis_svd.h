@@ -0,0 +1,18 @@
+#ifndef _CMSIS_SVD_H_
+#define _CMSIS_SVD_H_
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include "soc.h"
+
+/* Map a register block for each peripheral of a CMSIS-SVD file that isn't mapped
+   yet. Returns the number of peripherals mapped. */
+int cmsis_svd_init(soc_t *soc, const char *path);
+void cmsis_svd_destory(soc_t *soc);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,580 @@
+#include "memory_map.h"
+#include "peripheral.h"
+#include "timer.h"
+#include "snapshot.h"
+#include "register_block.h"
+#include "lpc1768_gpdma.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The general purpose DMA controller. A channel copies one linked list item at a
+ * time: the whole item is moved as a bulk host copy when the timer of the channel
+ * matches, after the cycles the bus transfers would take. The peripherals are
+ * always ready, so the DMA requests and the flow control are not modeled.
+ */
+
+#define LPC1768_GPDMA_BASE      0x50004000
+#define LPC1768_GPDMA_SIZE      0x200
+#define LPC1768_GPDMA_CHANNELS  8
+#define LPC1768_GPDMA_VECTOR    (16 + 26)       // IRQ 26
+
+#define DMAC_CH_BASE            0x100
+#define DMAC_CH_SIZE            0x20
+
+#define DMAC_CONFIG_E           (1ul)
+
+#define CONTROL_TRANSFER_SIZE(control)  ((control) & 0xFFF)
+#define CONTROL_SWIDTH(control)         (((control) >> 18) & 0x7)
+#define CONTROL_DWIDTH(control)         (((control) >> 21) & 0x7)
+#define CONTROL_SI                      (1ul << 26)
+#define CONTROL_DI                      (1ul << 27)
+#define CONTROL_I                       (1ul << 31)
+
+#define CONFIG_E                (1ul)
+#define CONFIG_IE               (1ul << 14)
+#define CONFIG_ITC              (1ul << 15)
+#define CONFIG_A                (1ul << 17)
+#define CONFIG_MASK             0x7FFFF
+
+/* the cycles of one item: loading it, then a read and a write on the bus for each transfer */
+#define GPDMA_LLI_CYCLES        4
+#define GPDMA_MAX_BYTES         (0xFFF * 4)
+
+/* the registers of a channel in memory order, a linked list item has the same layout */
+typedef struct gpdma_lli_t{
+    uint32_t src_addr;
+    uint32_t dest_addr;
+    uint32_t lli;
+    uint32_t control;
+}gpdma_lli_t;
+
+struct lpc1768_gpdma_t;
+typedef struct gpdma_channel_t{
+    gpdma_lli_t regs;
+    uint32_t config;
+    timer_t *timer;             // matches when the current item is done, NULL if idle
+    int index;
+    struct lpc1768_gpdma_t *dma;
+}gpdma_channel_t;
+
+typedef struct lpc1768_gpdma_t{
+    uint32_t raw_tc;
+    uint32_t raw_err;
+    uint32_t config;
+    uint32_t sync;
+    gpdma_channel_t channel[LPC1768_GPDMA_CHANNELS];
+    soc_t *soc;
+    reg_block_t *registers;
+    uint8_t buffer[GPDMA_MAX_BYTES];
+}lpc1768_gpdma_t;
+
+static cpu_t* gpdma_cpu(lpc1768_gpdma_t *dma)
+{
+    return dma->soc->cpu[0];
+}
+
+static memory_map_t* gpdma_memory(lpc1768_gpdma_t *dma)
+{
+    return shared_memory_map(gpdma_cpu(dma)->memory_map);
+}
+
+static uint32_t int_tc_stat(lpc1768_gpdma_t *dma)
+{
+    uint32_t mask = 0;
+    int i;
+    for(i = 0; i < LPC1768_GPDMA_CHANNELS; i++){
+        if(dma->channel[i].config & CONFIG_ITC){
+            mask |= 1ul << i;
+        }
+    }
+    return dma->raw_tc & mask;
+}
+
+static uint32_t int_err_stat(lpc1768_gpdma_t *dma)
+{
+    uint32_t mask = 0;
+    int i;
+    for(i = 0; i < LPC1768_GPDMA_CHANNELS; i++){
+        if(dma->channel[i].config & CONFIG_IE){
+            mask |= 1ul << i;
+        }
+    }
+    return dma->raw_err & mask;
+}
+
+static cycle_t transfer_cycles(gpdma_channel_t *ch)
+{
+    memory_map_t *memory = gpdma_memory(ch->dma);
+    uint32_t control = ch->regs.control;
+    cycle_t count = CONTROL_TRANSFER_SIZE(control);
+    cycle_t writes = count * (1u << CONTROL_SWIDTH(control)) / (1u << CONTROL_DWIDTH(control));
+
+    return GPDMA_LLI_CYCLES + count * (1 + memory_wait_states(memory, ch->regs.src_addr)) +
+                              writes * (1 + memory_wait_states(memory, ch->regs.dest_addr));
+}
+
+/* Move the current item. The source is gathered into the buffer, then scattered
+   to the destination. A side that doesn't increment is a peripheral register and
+   is accessed once per transfer. */
+static int do_transfer(gpdma_channel_t *ch)
+{
+    memory_map_t *memory = gpdma_memory(ch->dma);
+    uint8_t *buffer = ch->dma->buffer;
+    uint32_t control = ch->regs.control;
+    uint32_t count = CONTROL_TRANSFER_SIZE(control);
+    uint32_t i;
+
+    if(CONTROL_SWIDTH(control) > 2 || CONTROL_DWIDTH(control) > 2){
+        return -1;
+    }
+    int swidth = 1 << CONTROL_SWIDTH(control);
+    int dwidth = 1 << CONTROL_DWIDTH(control);
+    int total = count * swidth;
+
+    if(control & CONTROL_SI){
+        if(read_memory_block(ch->regs.src_addr, buffer, total, memory) < 0){
+            return -1;
+        }
+        ch->regs.src_addr += total;
+    }else{
+        for(i = 0; i < count; i++){
+            if(read_memory(ch->regs.src_addr, buffer + i * swidth, swidth, memory) < 0){
+                return -1;
+            }
+        }
+    }
+
+    if(control & CONTROL_DI){
+        if(write_memory_block(ch->regs.dest_addr, buffer, total, memory) < 0){
+            return -1;
+        }
+        ch->regs.dest_addr += total;
+    }else{
+        for(i = 0; i < total / dwidth; i++){
+            if(write_memory(ch->regs.dest_addr, buffer + i * dwidth, dwidth, memory) < 0){
+                return -1;
+            }
+        }
+    }
+    ch->regs.control &= ~0xFFFul;
+    return 0;
+}
+
+static void stop_channel(gpdma_channel_t *ch)
+{
+    ch->config &= ~CONFIG_E;
+    if(ch->timer != NULL){
+        delete_timer(ch->timer);
+        ch->timer = NULL;
+    }
+}
+
+static void raise_interrupt(lpc1768_gpdma_t *dma)
+{
+    cpu_t *cpu = gpdma_cpu(dma);
+    cpu->exceptions->throw_exception(LPC1768_GPDMA_VECTOR, cpu->exceptions);
+}
+
+/* a bus error stops the channel */
+static void channel_error(gpdma_channel_t *ch)
+{
+    ch->dma->raw_err |= 1ul << ch->index;
+    stop_channel(ch);
+    if(ch->config & CONFIG_IE){
+        raise_interrupt(ch->dma);
+    }
+}
+
+int gpdma_do_match(timer_t *timer, cpu_t *cpu)
+{
+    gpdma_channel_t *ch = (gpdma_channel_t *)timer->user_data_ptr;
+    lpc1768_gpdma_t *dma = ch->dma;
+    uint32_t bit = 1ul << ch->index;
+
+    if(do_transfer(ch) < 0){
+        LOG(LOG_WARN, "gpdma: channel %d failed at 0x%x -> 0x%x\n", ch->index, ch->regs.src_addr, ch->regs.dest_addr);
+        channel_error(ch);
+        return 0;
+    }
+
+    if(ch->regs.control & CONTROL_I){
+        dma->raw_tc |= bit;
+        if(ch->config & CONFIG_ITC){
+            raise_interrupt(dma);
+        }
+    }
+
+    /* the next item of the list */
+    if(ch->regs.lli != 0){
+        gpdma_lli_t next;
+        if(read_memory_block(ch->regs.lli, (uint8_t *)&next, sizeof(gpdma_lli_t), gpdma_memory(dma)) < 0){
+            LOG(LOG_WARN, "gpdma: channel %d can't load the item at 0x%x\n", ch->index, ch->regs.lli);
+            channel_error(ch);
+            return 0;
+        }
+        ch->regs = next;
+        ch->regs.lli &= ~0x3ul;
+        start_timer(timer, cpu, transfer_cycles(ch), gpdma_do_match);
+    }else{
+        stop_channel(ch);
+    }
+    return 0;
+}
+
+/* on the thread of the core writing the channel, with the device lock of the soc held */
+static int start_channel(gpdma_channel_t *ch)
+{
+    cpu_t *cpu = gpdma_cpu(ch->dma);
+    timer_t *timer = create_timer(LPC1768_GPDMA_VECTOR);
+    if(timer == NULL){
+        return -1;
+    }
+    timer->user_data_ptr = ch;
+    start_timer(timer, cpu, transfer_cycles(ch), gpdma_do_match);
+    if(add_timer(timer, cpu->timer_queue) < 0){
+        destory_timer(&timer);
+        return -1;
+    }
+    ch->timer = timer;
+    return 0;
+}
+
+static gpdma_channel_t* reg_channel(lpc1768_gpdma_t *dma, const reg_desc_t *reg)
+{
+    return &dma->channel[(reg->offset - DMAC_CH_BASE) / DMAC_CH_SIZE];
+}
+
+static int channel_read(void *owner, const reg_desc_t *reg, uint32_t *value)
+{
+    gpdma_channel_t *ch = reg_channel((lpc1768_gpdma_t *)owner, reg);
+    switch((reg->offset - DMAC_CH_BASE) % DMAC_CH_SIZE){
+    case 0x00: *value = ch->regs.src_addr; break;
+    case 0x04: *value = ch->regs.dest_addr; break;
+    case 0x08: *value = ch->regs.lli; break;
+    case 0x0C: *value = ch->regs.control; break;
+    case 0x10: *value = ch->config | (ch->timer != NULL ? CONFIG_A : 0); break;
+    }
+    return 0;
+}
+
+static int channel_write(void *owner, const reg_desc_t *reg, uint32_t value)
+{
+    lpc1768_gpdma_t *dma = (lpc1768_gpdma_t *)owner;
+    gpdma_channel_t *ch = reg_channel(dma, reg);
+
+    switch((reg->offset - DMAC_CH_BASE) % DMAC_CH_SIZE){
+    case 0x00: ch->regs.src_addr = value; break;
+    case 0x04: ch->regs.dest_addr = value; break;
+    case 0x08: ch->regs.lli = value & ~0x3ul; break;
+    case 0x0C: ch->regs.control = value; break;
+    case 0x10:
+        /* the channel can only be enabled with the controller */
+        if(!(dma->config & DMAC_CONFIG_E)){
+            value &= ~CONFIG_E;
+        }
+        if(!(value & CONFIG_E)){
+            stop_channel(ch);
+        }else if(ch->timer == NULL && start_channel(ch) < 0){
+            value &= ~CONFIG_E;
+        }
+        ch->config = value & CONFIG_MASK & ~CONFIG_A;
+        break;
+    }
+    return 0;
+}
+
+static int DMACIntStat_read(void *owner, const reg_desc_t *reg, uint32_t *value)
+{
+    lpc1768_gpdma_t *dma = (lpc1768_gpdma_t *)owner;
+    *value = int_tc_stat(dma) | int_err_stat(dma);
+    return 0;
+}
+
+static int DMACIntTCStat_read(void *owner, const reg_desc_t *reg, uint32_t *value)
+{
+    *value = int_tc_stat((lpc1768_gpdma_t *)owner);
+    return 0;
+}
+
+static int DMACIntTCClear_write(void *owner, const reg_desc_t *reg, uint32_t value)
+{
+    ((lpc1768_gpdma_t *)owner)->raw_tc &= ~value;
+    return 0;
+}
+
+static int DMACIntErrStat_read(void *owner, const reg_desc_t *reg, uint32_t *value)
+{
+    *value = int_err_stat((lpc1768_gpdma_t *)owner);
+    return 0;
+}
+
+static int DMACIntErrClr_write(void *owner, const reg_desc_t *reg, uint32_t value)
+{
+    ((lpc1768_gpdma_t *)owner)->raw_err &= ~value;
+    return 0;
+}
+
+static int DMACRawIntTCStat_read(void *owner, const reg_desc_t *reg, uint32_t *value)
+{
+    *value = ((lpc1768_gpdma_t *)owner)->raw_tc;
+    return 0;
+}
+
+static int DMACRawIntErrStat_read(void *owner, const reg_desc_t *reg, uint32_t *value)
+{
+    *value = ((lpc1768_gpdma_t *)owner)->raw_err;
+    return 0;
+}
+
+static int DMACEnbldChns_read(void *owner, const reg_desc_t *reg, uint32_t *value)
+{
+    lpc1768_gpdma_t *dma = (lpc1768_gpdma_t *)owner;
+    int i;
+    *value = 0;
+    for(i = 0; i < LPC1768_GPDMA_CHANNELS; i++){
+        if(dma->channel[i].config & CONFIG_E){
+            *value |= 1ul << i;
+        }
+    }
+    return 0;
+}
+
+static int DMACConfig_read(void *owner, const reg_desc_t *reg, uint32_t *value)
+{
+    *value = ((lpc1768_gpdma_t *)owner)->config;
+    return 0;
+}
+
+/* disabling the controller halts the channels */
+static int DMACConfig_write(void *owner, const reg_desc_t *reg, uint32_t value)
+{
+    lpc1768_gpdma_t *dma = (lpc1768_gpdma_t *)owner;
+    int i;
+    dma->config = value & 0x3;
+    if(!(dma->config & DMAC_CONFIG_E)){
+        for(i = 0; i < LPC1768_GPDMA_CHANNELS; i++){
+            stop_channel(&dma->channel[i]);
+        }
+    }
+    return 0;
+}
+
+static int DMACSync_read(void *owner, const reg_desc_t *reg, uint32_t *value)
+{
+    *value = ((lpc1768_gpdma_t *)owner)->sync;
+    return 0;
+}
+
+static int DMACSync_write(void *owner, const reg_desc_t *reg, uint32_t value)
+{
+    ((lpc1768_gpdma_t *)owner)->sync = value & 0xFFFF;
+    return 0;
+}
+
+static int write_only_read(void *owner, const reg_desc_t *reg, uint32_t *value)
+{
+    *value = 0;
+    return 0;
+}
+
+#define GPDMA_CHANNEL_REGS(n) \
+    {DMAC_CH_BASE + (n) * DMAC_CH_SIZE + 0x00, 4, channel_read, channel_write, 0, 0},  /* DMACCxSrcAddr */\
+    {DMAC_CH_BASE + (n) * DMAC_CH_SIZE + 0x04, 4, channel_read, channel_write, 0, 0},  /* DMACCxDestAddr */\
+    {DMAC_CH_BASE + (n) * DMAC_CH_SIZE + 0x08, 4, channel_read, channel_write, 0, 0},  /* DMACCxLLI */\
+    {DMAC_CH_BASE + (n) * DMAC_CH_SIZE + 0x0C, 4, channel_read, channel_write, 0, 0},  /* DMACCxControl */\
+    {DMAC_CH_BASE + (n) * DMAC_CH_SIZE + 0x10, 4, channel_read, channel_write, 0, 0}   /* DMACCxConfig */
+
+/* the software requests are not modeled, they read as zero and ignore the writes */
+static const reg_desc_t lpc1768_gpdma_regs[] = {
+    {0x000, 4, DMACIntStat_read,        NULL,                   0,  0xFFFFFFFF},
+    {0x004, 4, DMACIntTCStat_read,      NULL,                   0,  0xFFFFFFFF},
+    {0x008, 4, write_only_read,         DMACIntTCClear_write,   0,  0},
+    {0x00C, 4, DMACIntErrStat_read,     NULL,                   0,  0xFFFFFFFF},
+    {0x010, 4, write_only_read,         DMACIntErrClr_write,    0,  0},
+    {0x014, 4, DMACRawIntTCStat_read,   NULL,                   0,  0xFFFFFFFF},
+    {0x018, 4, DMACRawIntErrStat_read,  NULL,                   0,  0xFFFFFFFF},
+    {0x01C, 4, DMACEnbldChns_read,      NULL,                   0,  0xFFFFFFFF},
+    {0x030, 4, DMACConfig_read,         DMACConfig_write,       0,  0},
+    {0x034, 4, DMACSync_read,           DMACSync_write,         0,  0},
+    GPDMA_CHANNEL_REGS(0),
+    GPDMA_CHANNEL_REGS(1),
+    GPDMA_CHANNEL_REGS(2),
+    GPDMA_CHANNEL_REGS(3),
+    GPDMA_CHANNEL_REGS(4),
+    GPDMA_CHANNEL_REGS(5),
+    GPDMA_CHANNEL_REGS(6),
+    GPDMA_CHANNEL_REGS(7),
+};
+
+static int lpc1768_gpdma_unmodeled_read(void *owner, uint32_t offset, uint8_t *buffer, int size)
+{
+    memset(buffer, 0, size);
+    return size;
+}
+
+static int lpc1768_gpdma_unmodeled_write(void *owner, uint32_t offset, uint8_t *buffer, int size)
+{
+    return size;
+}
+
+int lpc1768_gpdma_read(uint32_t offset, uint8_t *buffer, int size, memory_region_t *region)
+{
+    lpc1768_gpdma_t *dma = (lpc1768_gpdma_t *)region->region_data;
+    return reg_block_read(dma->registers, offset, buffer, size);
+}
+
+int lpc1768_gpdma_write(uint32_t offset, uint8_t *buffer, int size, memory_region_t *region)
+{
+    lpc1768_gpdma_t *dma = (lpc1768_gpdma_t *)region->region_data;
+    return reg_block_write(dma->registers, offset, buffer, size);
+}
+
+/* the registers, then the timer of each busy channel */
+int lpc1768_gpdma_snapshot(struct snapshot_t *snapshot, void *user_data)
+{
+    lpc1768_gpdma_t *dma = (lpc1768_gpdma_t *)user_data;
+    int i;
+
+    if(SNAPSHOT_PUT(snapshot, dma->raw_tc) < 0 || SNAPSHOT_PUT(snapshot, dma->raw_err) < 0 ||
+       SNAPSHOT_PUT(snapshot, dma->config) < 0 || SNAPSHOT_PUT(snapshot, dma->sync) < 0){
+        return -ERROR_CREATE;
+    }
+    for(i = 0; i < LPC1768_GPDMA_CHANNELS; i++){
+        gpdma_channel_t *ch = &dma->channel[i];
+        int32_t busy = ch->timer != NULL;
+        if(SNAPSHOT_PUT(snapshot, ch->regs) < 0 || SNAPSHOT_PUT(snapshot, ch->config) < 0 ||
+           SNAPSHOT_PUT(snapshot, busy) < 0){
+            return -ERROR_CREATE;
+        }
+        if(busy && (SNAPSHOT_PUT(snapshot, ch->timer->reload) < 0 || SNAPSHOT_PUT(snapshot, ch->timer->start) < 0 ||
+                    SNAPSHOT_PUT(snapshot, ch->timer->match) < 0)){
+            return -ERROR_CREATE;
+        }
+    }
+    return 0;
+}
+
+/* the timer of a channel is only created when the channel was idle */
+int lpc1768_gpdma_restore(struct snapshot_t *snapshot, void *user_data)
+{
+    lpc1768_gpdma_t *dma = (lpc1768_gpdma_t *)user_data;
+    cycle_t reload, start, match;
+    int32_t busy;
+    int i;
+
+    if(SNAPSHOT_GET(snapshot, dma->raw_tc) < 0 || SNAPSHOT_GET(snapshot, dma->raw_err) < 0 ||
+       SNAPSHOT_GET(snapshot, dma->config) < 0 || SNAPSHOT_GET(snapshot, dma->sync) < 0){
+        return -ERROR_SNAPSHOT;
+    }
+    for(i = 0; i < LPC1768_GPDMA_CHANNELS; i++){
+        gpdma_channel_t *ch = &dma->channel[i];
+        if(SNAPSHOT_GET(snapshot, ch->regs) < 0 || SNAPSHOT_GET(snapshot, ch->config) < 0 ||
+           SNAPSHOT_GET(snapshot, busy) < 0){
+            return -ERROR_SNAPSHOT;
+        }
+        if(!busy){
+            if(ch->timer != NULL){
+                delete_timer(ch->timer);
+                ch->timer = NULL;
+            }
+            continue;
+        }
+        if(SNAPSHOT_GET(snapshot, reload) < 0 || SNAPSHOT_GET(snapshot, start) < 0 ||
+           SNAPSHOT_GET(snapshot, match) < 0){
+            return -ERROR_SNAPSHOT;
+        }
+        if(ch->timer == NULL){
+            timer_t *timer = create_timer(LPC1768_GPDMA_VECTOR);
+            if(timer == NULL){
+                return -ERROR_CREATE;
+            }
+            timer->user_data_ptr = ch;
+            timer->do_match = gpdma_do_match;
+            load_timer(timer, reload, start, match);
+            if(add_timer(timer, gpdma_cpu(dma)->timer_queue) < 0){
+                destory_timer(&timer);
+                return -ERROR_CREATE;
+            }
+            ch->timer = timer;
+        }else{
+            load_timer(ch->timer, reload, start, match);
+        }
+    }
+    return 0;
+}
+
+/* initialize lpc1768 GPDMA of the soc */
+int lpc1768_gpdma_init(soc_t *soc)
+{
+    int retval, i;
+    memory_map_t *memory = shared_memory_map(soc->cpu[0]->memory_map);
+    if(memory == NULL){
+        retval = -ERROR_MEMORY_MAP;
+        goto no_memory;
+    }
+
+    memory_region_t *region = request_memory_region(memory, LPC1768_GPDMA_BASE, LPC1768_GPDMA_SIZE);
+    if(region == NULL){
+        retval = -ERROR_MEMORY_MAP;
+        goto get_region_fail;
+    }
+
+    lpc1768_gpdma_t *dma = (lpc1768_gpdma_t *)calloc(1, sizeof(lpc1768_gpdma_t));
+    if(dma == NULL){
+        retval = -ERROR_CREATE;
+        goto create_dma_fail;
+    }
+    dma->soc = soc;
+    for(i = 0; i < LPC1768_GPDMA_CHANNELS; i++){
+        dma->channel[i].index = i;
+        dma->channel[i].dma = dma;
+    }
+    dma->registers = create_reg_block(lpc1768_gpdma_regs, sizeof(lpc1768_gpdma_regs) / sizeof(lpc1768_gpdma_regs[0]),
+                                      LPC1768_GPDMA_SIZE, dma);
+    if(dma->registers == NULL){
+        retval = -ERROR_CREATE;
+        goto create_registers_fail;
+    }
+    dma->registers->fallback_read = lpc1768_gpdma_unmodeled_read;
+    dma->registers->fallback_write = lpc1768_gpdma_unmodeled_write;
+
+    region->region_data = dma;
+    region->read = lpc1768_gpdma_read;
+    region->write = lpc1768_gpdma_write;
+    region->type = MEMORY_REGION_PERI;
+
+    /* registered for the snapshots, it has no input */
+    peripheral_t peri_dma = {
+        .user_data = dma,
+        .snapshot = lpc1768_gpdma_snapshot,
+        .restore = lpc1768_gpdma_restore,
+    };
+    request_peripheral(soc, PERI_DMA, 1);
+    register_peripheral(soc, PERI_DMA, 0, &peri_dma);
+    return 0;
+
+create_registers_fail:
+    free(dma);
+create_dma_fail:
+get_region_fail:
+no_memory:
+    return retval;
+}
+
+void lpc1768_gpdma_destory(soc_t *soc)
+{
+    peripheral_t *peri_dma = find_peripheral(soc, PERI_DMA, 0);
+    if(peri_dma == NULL || peri_dma->user_data == NULL){
+        return;
+    }
+
+    lpc1768_gpdma_t *dma = (lpc1768_gpdma_t *)peri_dma->user_data;
+    int i;
+    for(i = 0; i < LPC1768_GPDMA_CHANNELS; i++){
+        stop_channel(&dma->channel[i]);
+    }
+    destory_reg_block(&dma->registers);
+    free(dma);
+    peri_dma->user_data = NULL;
+}
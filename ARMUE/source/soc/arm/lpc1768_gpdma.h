@@ -0,0 +1,16 @@
+#ifndef _LPC1768_GPDMA_H_
+#define _LPC1768_GPDMA_H_
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include "soc.h"
+
+int lpc1768_gpdma_init(soc_t *soc);
+void lpc1768_gpdma_destory(soc_t *soc);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,253 @@
+#include "memory_map.h"
+#include "peripheral.h"
+#include "snapshot.h"
+#include "register_block.h"
+#include "lpc1768_gpio.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The fast GPIO ports. Only the levels of the pins are modeled: an output drives
+ * its bit of FIOPIN, an input is pulled up. The models wired to a pin watch it,
+ * e.g. the chip selects of the SPI devices.
+ */
+
+#define LPC1768_GPIO_BASE       0x2009C000
+#define GPIO_PORT_SIZE          0x20
+#define LPC1768_GPIO_SIZE       (LPC1768_GPIO_PORTS * GPIO_PORT_SIZE)
+#define LPC1768_GPIO_WATCHES    8
+
+#define FIODIR                  0x00
+#define FIOMASK                 0x10
+#define FIOPIN                  0x14
+#define FIOSET                  0x18
+#define FIOCLR                  0x1C
+
+typedef struct gpio_port_t{
+    uint32_t dir;
+    uint32_t mask;
+    uint32_t out;
+}gpio_port_t;
+
+typedef struct gpio_watch_t{
+    int port;
+    uint32_t bit;
+    gpio_pin_func_t func;
+    void *data;
+}gpio_watch_t;
+
+typedef struct lpc1768_gpio_t{
+    gpio_port_t port[LPC1768_GPIO_PORTS];
+    gpio_watch_t watch[LPC1768_GPIO_WATCHES];
+    int watch_num;
+    reg_block_t *registers;
+}lpc1768_gpio_t;
+
+static uint32_t pin_levels(gpio_port_t *port)
+{
+    return (port->out & port->dir) | ~port->dir;
+}
+
+static void set_port(lpc1768_gpio_t *gpio, int index, uint32_t dir, uint32_t out)
+{
+    gpio_port_t *port = &gpio->port[index];
+    uint32_t before = pin_levels(port);
+    int i;
+
+    port->dir = dir;
+    port->out = out;
+    uint32_t levels = pin_levels(port);
+    for(i = 0; i < gpio->watch_num; i++){
+        gpio_watch_t *watch = &gpio->watch[i];
+        if(watch->port == index && ((before ^ levels) & watch->bit)){
+            watch->func(watch->data, (levels & watch->bit) != 0);
+        }
+    }
+}
+
+static int gpio_read(void *owner, const reg_desc_t *reg, uint32_t *value)
+{
+    gpio_port_t *port = &((lpc1768_gpio_t *)owner)->port[reg->offset / GPIO_PORT_SIZE];
+    switch(reg->offset % GPIO_PORT_SIZE){
+    case FIODIR:  *value = port->dir; break;
+    case FIOMASK: *value = port->mask; break;
+    case FIOPIN:  *value = pin_levels(port) & ~port->mask; break;
+    case FIOSET:  *value = port->out; break;
+    case FIOCLR:  *value = 0; break;
+    }
+    return 0;
+}
+
+/* a narrow write to FIOPIN leaves the other bytes of the output latch alone,
+   the levels read back would drive the input pins high */
+static int gpio_pin_merge(void *owner, const reg_desc_t *reg, uint32_t *value)
+{
+    *value = ((lpc1768_gpio_t *)owner)->port[reg->offset / GPIO_PORT_SIZE].out;
+    return 0;
+}
+
+/* the bits set in FIOMASK are left alone by FIOPIN, FIOSET and FIOCLR */
+static int gpio_write(void *owner, const reg_desc_t *reg, uint32_t value)
+{
+    lpc1768_gpio_t *gpio = (lpc1768_gpio_t *)owner;
+    int index = reg->offset / GPIO_PORT_SIZE;
+    gpio_port_t *port = &gpio->port[index];
+    uint32_t writable = ~port->mask;
+
+    switch(reg->offset % GPIO_PORT_SIZE){
+    case FIODIR:
+        set_port(gpio, index, value, port->out);
+        break;
+    case FIOMASK:
+        port->mask = value;
+        break;
+    case FIOPIN:
+        set_port(gpio, index, port->dir, (port->out & ~writable) | (value & writable));
+        break;
+    case FIOSET:
+        set_port(gpio, index, port->dir, port->out | (value & writable));
+        break;
+    case FIOCLR:
+        set_port(gpio, index, port->dir, port->out & ~(value & writable));
+        break;
+    }
+    return 0;
+}
+
+/* the byte and halfword registers write a part of the port */
+#define GPIO_PORT_REGS(n) \
+    {(n) * GPIO_PORT_SIZE + FIODIR,  4, gpio_read, gpio_write, 0, 0, 0, TRUE},   /* FIOxDIR */\
+    {(n) * GPIO_PORT_SIZE + FIOMASK, 4, gpio_read, gpio_write, 0, 0, 0, TRUE},   /* FIOxMASK */\
+    {(n) * GPIO_PORT_SIZE + FIOPIN,  4, gpio_read, gpio_write, 0, 0, 0, FALSE, 0, gpio_pin_merge},  /* FIOxPIN */\
+    {(n) * GPIO_PORT_SIZE + FIOSET,  4, gpio_read, gpio_write, 0, 0, 0, TRUE},   /* FIOxSET */\
+    {(n) * GPIO_PORT_SIZE + FIOCLR,  4, gpio_read, gpio_write, 0, 0, 0, TRUE}    /* FIOxCLR */
+
+static const reg_desc_t lpc1768_gpio_regs[] = {
+    GPIO_PORT_REGS(0),
+    GPIO_PORT_REGS(1),
+    GPIO_PORT_REGS(2),
+    GPIO_PORT_REGS(3),
+    GPIO_PORT_REGS(4),
+};
+
+/* the reserved words of the ports */
+static int lpc1768_gpio_unmodeled_read(void *owner, uint32_t offset, uint8_t *buffer, int size)
+{
+    memset(buffer, 0, size);
+    return size;
+}
+
+static int lpc1768_gpio_unmodeled_write(void *owner, uint32_t offset, uint8_t *buffer, int size)
+{
+    return size;
+}
+
+int lpc1768_gpio_read(uint32_t offset, uint8_t *buffer, int size, memory_region_t *region)
+{
+    lpc1768_gpio_t *gpio = (lpc1768_gpio_t *)region->region_data;
+    return reg_block_read(gpio->registers, offset, buffer, size);
+}
+
+int lpc1768_gpio_write(uint32_t offset, uint8_t *buffer, int size, memory_region_t *region)
+{
+    lpc1768_gpio_t *gpio = (lpc1768_gpio_t *)region->region_data;
+    return reg_block_write(gpio->registers, offset, buffer, size);
+}
+
+/* the watchers restore their own side of the pins */
+int lpc1768_gpio_snapshot(struct snapshot_t *snapshot, void *user_data)
+{
+    lpc1768_gpio_t *gpio = (lpc1768_gpio_t *)user_data;
+    return SNAPSHOT_PUT(snapshot, gpio->port) < 0 ? -ERROR_CREATE : 0;
+}
+
+int lpc1768_gpio_restore(struct snapshot_t *snapshot, void *user_data)
+{
+    lpc1768_gpio_t *gpio = (lpc1768_gpio_t *)user_data;
+    return SNAPSHOT_GET(snapshot, gpio->port) < 0 ? -ERROR_SNAPSHOT : 0;
+}
+
+int lpc1768_gpio_watch(soc_t *soc, int port, int pin, gpio_pin_func_t func, void *data)
+{
+    peripheral_t *peri_gpio = find_peripheral(soc, PERI_GPIO, 0);
+    if(peri_gpio == NULL || peri_gpio->user_data == NULL){
+        return -ERROR_NULL_POINTER;
+    }
+    lpc1768_gpio_t *gpio = (lpc1768_gpio_t *)peri_gpio->user_data;
+    if(port < 0 || port >= LPC1768_GPIO_PORTS || pin < 0 || pin >= 32 || gpio->watch_num >= LPC1768_GPIO_WATCHES){
+        return -ERROR_ADD;
+    }
+
+    gpio_watch_t *watch = &gpio->watch[gpio->watch_num++];
+    watch->port = port;
+    watch->bit = 1ul << pin;
+    watch->func = func;
+    watch->data = data;
+    return 0;
+}
+
+/* initialize lpc1768 GPIO of the soc */
+int lpc1768_gpio_init(soc_t *soc)
+{
+    int retval;
+    memory_map_t *memory = shared_memory_map(soc->cpu[0]->memory_map);
+    if(memory == NULL){
+        retval = -ERROR_MEMORY_MAP;
+        goto no_memory;
+    }
+
+    memory_region_t *region = request_memory_region(memory, LPC1768_GPIO_BASE, LPC1768_GPIO_SIZE);
+    if(region == NULL){
+        retval = -ERROR_MEMORY_MAP;
+        goto get_region_fail;
+    }
+
+    lpc1768_gpio_t *gpio = (lpc1768_gpio_t *)calloc(1, sizeof(lpc1768_gpio_t));
+    if(gpio == NULL){
+        retval = -ERROR_CREATE;
+        goto create_gpio_fail;
+    }
+    gpio->registers = create_reg_block(lpc1768_gpio_regs, sizeof(lpc1768_gpio_regs) / sizeof(lpc1768_gpio_regs[0]),
+                                       LPC1768_GPIO_SIZE, gpio);
+    if(gpio->registers == NULL){
+        retval = -ERROR_CREATE;
+        goto create_registers_fail;
+    }
+    gpio->registers->fallback_read = lpc1768_gpio_unmodeled_read;
+    gpio->registers->fallback_write = lpc1768_gpio_unmodeled_write;
+
+    region->region_data = gpio;
+    region->read = lpc1768_gpio_read;
+    region->write = lpc1768_gpio_write;
+    region->type = MEMORY_REGION_PERI;
+
+    /* registered for the snapshots and for the watchers, it has no input */
+    peripheral_t peri_gpio = {
+        .user_data = gpio,
+        .snapshot = lpc1768_gpio_snapshot,
+        .restore = lpc1768_gpio_restore,
+    };
+    request_peripheral(soc, PERI_GPIO, 1);
+    register_peripheral(soc, PERI_GPIO, 0, &peri_gpio);
+    return 0;
+
+create_registers_fail:
+    free(gpio);
+create_gpio_fail:
+get_region_fail:
+no_memory:
+    return retval;
+}
+
+void lpc1768_gpio_destory(soc_t *soc)
+{
+    peripheral_t *peri_gpio = find_peripheral(soc, PERI_GPIO, 0);
+    if(peri_gpio == NULL || peri_gpio->user_data == NULL){
+        return;
+    }
+
+    lpc1768_gpio_t *gpio = (lpc1768_gpio_t *)peri_gpio->user_data;
+    destory_reg_block(&gpio->registers);
+    free(gpio);
+    peri_gpio->user_data = NULL;
+}
@@ -0,0 +1,22 @@
+#ifndef _LPC1768_GPIO_H_
+#define _LPC1768_GPIO_H_
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include "soc.h"
+
+#define LPC1768_GPIO_PORTS  5
+
+/* level is the one the pin has now, an input is pulled up */
+typedef void (*gpio_pin_func_t)(void *data, bool_t level);
+
+int lpc1768_gpio_init(soc_t *soc);
+void lpc1768_gpio_destory(soc_t *soc);
+/* call func when the level of the pin changes, the pins start as inputs */
+int lpc1768_gpio_watch(soc_t *soc, int port, int pin, gpio_pin_func_t func, void *data);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,424 @@
+#include "memory_map.h"
+#include "peripheral.h"
+#include "snapshot.h"
+#include "register_block.h"
+#include "lpc1768_gpio.h"
+#include "lpc1768_ssp.h"
+#include "spi_flash.h"
+#include "sd_card.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The SSP controllers in SPI master mode. Writing DR exchanges the frame with the
+ * selected devices at once and puts what they return in the receive FIFO, so the
+ * transmit FIFO is always empty and the controller is never busy. A frame wider
+ * than 8 bits goes as two bytes, MSB first. The clock, the other frame formats and
+ * the DMA requests are not modeled.
+ */
+
+#define LPC1768_SSP0_BASE       0x40088000
+#define LPC1768_SSP1_BASE       0x40030000
+#define LPC1768_SSP_SIZE        0x28
+#define LPC1768_SSP0_VECTOR     (16 + 14)       // IRQ 14, SSP1 is the next one
+#define LPC1768_SSP_FIFO_DEPTH  8
+#define LPC1768_SSP_SLAVES      4
+
+/* the devices of the command line and their chip selects, as on the usual boards */
+#define SPI_FLASH_SSP           0
+#define SPI_FLASH_CS_PORT       0
+#define SPI_FLASH_CS_PIN        16      // SSEL0
+#define SD_CARD_SSP             1
+#define SD_CARD_CS_PORT         0
+#define SD_CARD_CS_PIN          6       // SSEL1
+
+enum lpc1768_ssp_reg_t{
+    SSP_CR0,
+    SSP_CR1,
+    SSP_DR,
+    SSP_SR,
+    SSP_CPSR,
+    SSP_IMSC,
+    SSP_RIS,
+    SSP_MIS,
+    SSP_ICR,
+    SSP_DMACR,
+};
+
+#define CR0_DSS(cr0)            ((cr0) & 0xF)   // bits of a frame - 1
+#define CR1_LBM                 (1ul)
+#define CR1_SSE                 (1ul << 1)
+
+#define SR_TFE                  (1ul)
+#define SR_TNF                  (1ul << 1)
+#define SR_RNE                  (1ul << 2)
+#define SR_RFF                  (1ul << 3)
+
+#define INT_ROR                 (1ul)
+#define INT_RT                  (1ul << 1)
+#define INT_RX                  (1ul << 2)      // the receive FIFO is half full
+#define INT_TX                  (1ul << 3)      // the transmit FIFO is half empty
+
+typedef struct ssp_slave_t{
+    spi_device_t *device;
+    bool_t selected;
+}ssp_slave_t;
+
+typedef struct lpc1768_ssp_t{
+    int index;
+    soc_t *soc;
+    reg_block_t *registers;
+    uint16_t rx[LPC1768_SSP_FIFO_DEPTH];
+    uint32_t rx_head;
+    uint32_t rx_count;
+    uint32_t raw_int;           // ROR and RT, the others follow the FIFOs
+    bool_t irq_level;           // the masked interrupt status is not zero
+    ssp_slave_t slave[LPC1768_SSP_SLAVES];
+    int slave_num;
+}lpc1768_ssp_t;
+
+static uint32_t ssp_reg(lpc1768_ssp_t *ssp, int reg)
+{
+    return reg_block_value(ssp->registers, &ssp->registers->regs[reg]);
+}
+
+static uint32_t raw_int(lpc1768_ssp_t *ssp)
+{
+    uint32_t ris = ssp->raw_int | INT_TX;
+    if(ssp->rx_count >= LPC1768_SSP_FIFO_DEPTH / 2){
+        ris |= INT_RX;
+    }
+    return ris;
+}
+
+/* the interrupt is a level: it is raised when the masked status turns non-zero
+   and is no longer pending when it goes back to zero */
+static void update_interrupt(lpc1768_ssp_t *ssp, uint32_t imsc)
+{
+    cpu_t *cpu = ssp->soc->cpu[0];
+    bool_t level = (raw_int(ssp) & imsc) != 0;
+
+    if(level && !ssp->irq_level){
+        cpu->exceptions->throw_exception(LPC1768_SSP0_VECTOR + ssp->index, cpu->exceptions);
+    }else if(!level && ssp->irq_level){
+        cpu->exceptions->clear_exception(LPC1768_SSP0_VECTOR + ssp->index, cpu->exceptions);
+    }
+    ssp->irq_level = level;
+}
+
+/* the bus is pulled up, two devices driving it give the AND of their bytes */
+static uint8_t exchange_byte(lpc1768_ssp_t *ssp, uint8_t out)
+{
+    uint8_t in = SPI_IDLE_BYTE;
+    int i;
+    for(i = 0; i < ssp->slave_num; i++){
+        ssp_slave_t *slave = &ssp->slave[i];
+        if(slave->selected){
+            in &= slave->device->transfer(slave->device, out);
+        }
+    }
+    return in;
+}
+
+static uint32_t exchange(lpc1768_ssp_t *ssp, uint32_t frame, int bits)
+{
+    uint32_t in;
+    if(bits <= 8){
+        in = exchange_byte(ssp, frame);
+    }else{
+        in = exchange_byte(ssp, frame >> 8) << 8;
+        in |= exchange_byte(ssp, frame & 0xFF);
+    }
+    return in & ((1ul << bits) - 1);
+}
+
+static int DR_read(void *owner, const reg_desc_t *reg, uint32_t *value)
+{
+    lpc1768_ssp_t *ssp = (lpc1768_ssp_t *)owner;
+    if(ssp->rx_count == 0){
+        *value = 0;
+        return 0;
+    }
+    *value = ssp->rx[ssp->rx_head];
+    ssp->rx_head = (ssp->rx_head + 1) % LPC1768_SSP_FIFO_DEPTH;
+    ssp->rx_count--;
+    update_interrupt(ssp, ssp_reg(ssp, SSP_IMSC));
+    return 0;
+}
+
+/* a frame that finds the receive FIFO full is lost */
+static int DR_write(void *owner, const reg_desc_t *reg, uint32_t value)
+{
+    lpc1768_ssp_t *ssp = (lpc1768_ssp_t *)owner;
+    uint32_t cr1 = ssp_reg(ssp, SSP_CR1);
+    int bits = CR0_DSS(ssp_reg(ssp, SSP_CR0)) + 1;
+
+    if(!(cr1 & CR1_SSE)){
+        return 0;
+    }
+    uint32_t frame = value & ((1ul << bits) - 1);
+    uint32_t in = (cr1 & CR1_LBM) ? frame : exchange(ssp, frame, bits);
+    if(ssp->rx_count == LPC1768_SSP_FIFO_DEPTH){
+        ssp->raw_int |= INT_ROR;
+    }else{
+        ssp->rx[(ssp->rx_head + ssp->rx_count) % LPC1768_SSP_FIFO_DEPTH] = in;
+        ssp->rx_count++;
+    }
+    update_interrupt(ssp, ssp_reg(ssp, SSP_IMSC));
+    return 0;
+}
+
+static int SR_read(void *owner, const reg_desc_t *reg, uint32_t *value)
+{
+    lpc1768_ssp_t *ssp = (lpc1768_ssp_t *)owner;
+    *value = SR_TFE | SR_TNF;
+    if(ssp->rx_count != 0){
+        *value |= SR_RNE;
+    }
+    if(ssp->rx_count == LPC1768_SSP_FIFO_DEPTH){
+        *value |= SR_RFF;
+    }
+    return 0;
+}
+
+static int IMSC_write(void *owner, const reg_desc_t *reg, uint32_t value)
+{
+    update_interrupt((lpc1768_ssp_t *)owner, value);
+    return 0;
+}
+
+static int RIS_read(void *owner, const reg_desc_t *reg, uint32_t *value)
+{
+    *value = raw_int((lpc1768_ssp_t *)owner);
+    return 0;
+}
+
+static int MIS_read(void *owner, const reg_desc_t *reg, uint32_t *value)
+{
+    lpc1768_ssp_t *ssp = (lpc1768_ssp_t *)owner;
+    *value = raw_int(ssp) & ssp_reg(ssp, SSP_IMSC);
+    return 0;
+}
+
+static int ICR_write(void *owner, const reg_desc_t *reg, uint32_t value)
+{
+    lpc1768_ssp_t *ssp = (lpc1768_ssp_t *)owner;
+    ssp->raw_int &= ~(value & (INT_ROR | INT_RT));
+    update_interrupt(ssp, ssp_reg(ssp, SSP_IMSC));
+    return 0;
+}
+
+static int write_only_read(void *owner, const reg_desc_t *reg, uint32_t *value)
+{
+    *value = 0;
+    return 0;
+}
+
+/* in the order of enum lpc1768_ssp_reg_t */
+static const reg_desc_t lpc1768_ssp_regs[] = {
+    [SSP_CR0]   = {0x00, 2, NULL,               NULL,       0,  0},
+    [SSP_CR1]   = {0x04, 1, NULL,               NULL,       0,  0xF0},
+    [SSP_DR]    = {0x08, 2, DR_read,            DR_write,   0,  0},
+    [SSP_SR]    = {0x0C, 1, SR_read,            NULL,       0,  0xFF},
+    [SSP_CPSR]  = {0x10, 1, NULL,               NULL,       0,  0},
+    [SSP_IMSC]  = {0x14, 1, NULL,               IMSC_write, 0,  0xF0},
+    [SSP_RIS]   = {0x18, 1, RIS_read,           NULL,       0,  0xFF},
+    [SSP_MIS]   = {0x1C, 1, MIS_read,           NULL,       0,  0xFF},
+    [SSP_ICR]   = {0x20, 1, write_only_read,    ICR_write,  0,  0},
+    [SSP_DMACR] = {0x24, 1, NULL,               NULL,       0,  0xFC},
+};
+
+int lpc1768_ssp_read(uint32_t offset, uint8_t *buffer, int size, memory_region_t *region)
+{
+    lpc1768_ssp_t *ssp = (lpc1768_ssp_t *)region->region_data;
+    return reg_block_read(ssp->registers, offset, buffer, size);
+}
+
+int lpc1768_ssp_write(uint32_t offset, uint8_t *buffer, int size, memory_region_t *region)
+{
+    lpc1768_ssp_t *ssp = (lpc1768_ssp_t *)region->region_data;
+    return reg_block_write(ssp->registers, offset, buffer, size);
+}
+
+/* the registers, the receive FIFO, then the bus side of each device */
+int lpc1768_ssp_snapshot(struct snapshot_t *snapshot, void *user_data)
+{
+    lpc1768_ssp_t *ssp = (lpc1768_ssp_t *)user_data;
+    reg_block_t *block = ssp->registers;
+    int i;
+
+    if(snapshot_put(snapshot, block->values, block->reg_num * sizeof(uint32_t)) < 0 ||
+       SNAPSHOT_PUT(snapshot, ssp->rx) < 0 || SNAPSHOT_PUT(snapshot, ssp->rx_head) < 0 ||
+       SNAPSHOT_PUT(snapshot, ssp->rx_count) < 0 || SNAPSHOT_PUT(snapshot, ssp->raw_int) < 0 ||
+       SNAPSHOT_PUT(snapshot, ssp->slave_num) < 0){
+        return -ERROR_CREATE;
+    }
+    for(i = 0; i < ssp->slave_num; i++){
+        spi_device_t *device = ssp->slave[i].device;
+        if(SNAPSHOT_PUT(snapshot, ssp->slave[i].selected) < 0 || device->snapshot(device, snapshot) < 0){
+            return -ERROR_CREATE;
+        }
+    }
+    return 0;
+}
+
+/* the devices must be attached as they were */
+int lpc1768_ssp_restore(struct snapshot_t *snapshot, void *user_data)
+{
+    lpc1768_ssp_t *ssp = (lpc1768_ssp_t *)user_data;
+    reg_block_t *block = ssp->registers;
+    int slave_num, i;
+
+    if(snapshot_get(snapshot, block->values, block->reg_num * sizeof(uint32_t)) < 0 ||
+       SNAPSHOT_GET(snapshot, ssp->rx) < 0 || SNAPSHOT_GET(snapshot, ssp->rx_head) < 0 ||
+       SNAPSHOT_GET(snapshot, ssp->rx_count) < 0 || SNAPSHOT_GET(snapshot, ssp->raw_int) < 0 ||
+       SNAPSHOT_GET(snapshot, slave_num) < 0 || slave_num != ssp->slave_num){
+        return -ERROR_SNAPSHOT;
+    }
+    for(i = 0; i < ssp->slave_num; i++){
+        spi_device_t *device = ssp->slave[i].device;
+        if(SNAPSHOT_GET(snapshot, ssp->slave[i].selected) < 0 || device->restore(device, snapshot) < 0){
+            return -ERROR_SNAPSHOT;
+        }
+    }
+    /* the pending interrupt comes back with the NVIC */
+    ssp->irq_level = (raw_int(ssp) & ssp_reg(ssp, SSP_IMSC)) != 0;
+    return 0;
+}
+
+static void ssp_chip_select(void *data, bool_t level)
+{
+    ssp_slave_t *slave = (ssp_slave_t *)data;
+    slave->selected = !level;
+    slave->device->select(slave->device, slave->selected);
+}
+
+int lpc1768_ssp_attach(soc_t *soc, int index, spi_device_t *device, int cs_port, int cs_pin)
+{
+    peripheral_t *peri_ssp = find_peripheral(soc, PERI_SPI, index);
+    if(peri_ssp == NULL || peri_ssp->user_data == NULL){
+        return -ERROR_NULL_POINTER;
+    }
+    lpc1768_ssp_t *ssp = (lpc1768_ssp_t *)peri_ssp->user_data;
+    if(ssp->slave_num >= LPC1768_SSP_SLAVES){
+        return -ERROR_ADD;
+    }
+
+    /* the storage goes back with the checkpoints */
+    if(device->image != NULL && add_soc_image(soc, device->image) < 0){
+        return -ERROR_ADD;
+    }
+    ssp_slave_t *slave = &ssp->slave[ssp->slave_num];
+    slave->device = device;
+    slave->selected = FALSE;
+    int retval = lpc1768_gpio_watch(soc, cs_port, cs_pin, ssp_chip_select, slave);
+    if(retval < 0){
+        remove_soc_image(soc, device->image);
+        return retval;
+    }
+    ssp->slave_num++;
+    return 0;
+}
+
+/* the device is destroyed if it can't be attached */
+static int attach_device(soc_t *soc, int index, spi_device_t *device, int cs_port, int cs_pin)
+{
+    if(device == NULL){
+        return -ERROR_CREATE;
+    }
+    int retval = lpc1768_ssp_attach(soc, index, device, cs_port, cs_pin);
+    if(retval < 0){
+        device->destory(device);
+    }
+    return retval;
+}
+
+static lpc1768_ssp_t* create_ssp(soc_t *soc, memory_map_t *memory, int index, uint32_t base)
+{
+    memory_region_t *region = request_memory_region(memory, base, LPC1768_SSP_SIZE);
+    if(region == NULL){
+        goto get_region_fail;
+    }
+
+    lpc1768_ssp_t *ssp = (lpc1768_ssp_t *)calloc(1, sizeof(lpc1768_ssp_t));
+    if(ssp == NULL){
+        goto create_ssp_fail;
+    }
+    ssp->index = index;
+    ssp->soc = soc;
+    ssp->registers = create_reg_block(lpc1768_ssp_regs, sizeof(lpc1768_ssp_regs) / sizeof(lpc1768_ssp_regs[0]),
+                                      LPC1768_SSP_SIZE, ssp);
+    if(ssp->registers == NULL){
+        goto create_registers_fail;
+    }
+
+    region->region_data = ssp;
+    region->read = lpc1768_ssp_read;
+    region->write = lpc1768_ssp_write;
+    region->type = MEMORY_REGION_PERI;
+    return ssp;
+
+create_registers_fail:
+    free(ssp);
+create_ssp_fail:
+get_region_fail:
+    return NULL;
+}
+
+/* initialize lpc1768 SSP0 and SSP1 of the soc */
+int lpc1768_ssp_init(soc_t *soc)
+{
+    static const uint32_t base[LPC1768_SSP_NUM] = {LPC1768_SSP0_BASE, LPC1768_SSP1_BASE};
+    int i;
+
+    memory_map_t *memory = shared_memory_map(soc->cpu[0]->memory_map);
+    if(memory == NULL){
+        return -ERROR_MEMORY_MAP;
+    }
+    request_peripheral(soc, PERI_SPI, LPC1768_SSP_NUM);
+    for(i = 0; i < LPC1768_SSP_NUM; i++){
+        lpc1768_ssp_t *ssp = create_ssp(soc, memory, i, base[i]);
+        if(ssp == NULL){
+            return -ERROR_CREATE;
+        }
+        /* registered for the snapshots and for attaching the devices, it has no input */
+        peripheral_t peri_ssp = {
+            .user_data = ssp,
+            .snapshot = lpc1768_ssp_snapshot,
+            .restore = lpc1768_ssp_restore,
+        };
+        register_peripheral(soc, PERI_SPI, i, &peri_ssp);
+    }
+
+    /* the children of a fork and a replay mustn't change the image the others start from */
+    bool_t copy = soc->forked || soc->config.replay_path != NULL;
+    if(soc->config.spi_flash != NULL &&
+       attach_device(soc, SPI_FLASH_SSP, create_spi_flash(soc->config.spi_flash, copy), SPI_FLASH_CS_PORT, SPI_FLASH_CS_PIN) < 0){
+        return -ERROR_CREATE;
+    }
+    if(soc->config.sd_card != NULL &&
+       attach_device(soc, SD_CARD_SSP, create_sd_card(soc->config.sd_card, copy), SD_CARD_CS_PORT, SD_CARD_CS_PIN) < 0){
+        return -ERROR_CREATE;
+    }
+    return 0;
+}
+
+void lpc1768_ssp_destory(soc_t *soc)
+{
+    int i, j;
+    for(i = 0; i < LPC1768_SSP_NUM; i++){
+        peripheral_t *peri_ssp = find_peripheral(soc, PERI_SPI, i);
+        if(peri_ssp == NULL || peri_ssp->user_data == NULL){
+            continue;
+        }
+
+        lpc1768_ssp_t *ssp = (lpc1768_ssp_t *)peri_ssp->user_data;
+        for(j = 0; j < ssp->slave_num; j++){
+            remove_soc_image(soc, ssp->slave[j].device->image);
+            ssp->slave[j].device->destory(ssp->slave[j].device);
+        }
+        destory_reg_block(&ssp->registers);
+        free(ssp);
+        peri_ssp->user_data = NULL;
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef _LPC1768_SSP_H_
+#define _LPC1768_SSP_H_
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include "soc.h"
+#include "spi.h"
+
+#define LPC1768_SSP_NUM 2
+
+/* SSP0 and SSP1, the chip selects of the devices need the GPIO */
+int lpc1768_ssp_init(soc_t *soc);
+void lpc1768_ssp_destory(soc_t *soc);
+/* the device is selected while the pin is low, the ssp destroys it with itself */
+int lpc1768_ssp_attach(soc_t *soc, int index, spi_device_t *device, int cs_port, int cs_pin);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
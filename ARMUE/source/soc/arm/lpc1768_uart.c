@@ -2,7 +2,11 @@
 #include "peripheral.h"
 #include "core_connect.h"
 #include "uart.h"
-#include "ARMUE.h"
+#include "lpc1768_uart.h"
+#include "uart_console.h"
+#include "register_block.h"
+#include <stdlib.h>
+#include <string.h>
 
 #define LPC1768_UART0_BASE 0x4000C000
 #define LPC1768_UART0_SIZE 0x34
@@ -12,12 +16,10 @@ typedef struct lpc1768_uart_t
 {
     uart_t generic_uart;
     int index;
+    soc_t *soc;
+    reg_block_t *registers;
 }lpc1768_uart_t;
 
-lpc1768_uart_t lpc1768_uart0;
-//lpc1768_uart_t lpc1768_uart2;
-//lpc1768_uart_t lpc1768_uart3;
-
 /* this will be called when some UART data is received */
 int lpc1768_uart_data_process(int data_kind, uint8_t *data, unsigned int len, void *user_data)
 {
@@ -32,78 +34,77 @@ int lpc1768_uart_data_process(int data_kind, uint8_t *data, unsigned int len, vo
     return 0;
 }
 
-/* peripheral_t is the structure for peripheral register */
-peripheral_t peri_lpc1768_uart0 = {
-    .user_data = &lpc1768_uart0,
-    .data_process = lpc1768_uart_data_process,
-};
+int lpc1768_uart_snapshot(struct snapshot_t *snapshot, void *user_data)
+{
+    lpc1768_uart_t *uart = (lpc1768_uart_t *)user_data;
+    return uart_snapshot(&uart->generic_uart, snapshot);
+}
+
+int lpc1768_uart_restore(struct snapshot_t *snapshot, void *user_data)
+{
+    lpc1768_uart_t *uart = (lpc1768_uart_t *)user_data;
+    return uart_restore(&uart->generic_uart, snapshot);
+}
 
 /* All the register read and write function */
-void URBR(uint8_t *buffer, int rw_flag, lpc1768_uart_t *uart)
+static int URBR_read(void *owner, const reg_desc_t *reg, uint32_t *value)
 {
-    int result;
-    if(rw_flag == MEM_READ){
-        // TODO: some other operation to corresponding PE FE and BI bits
-        result = uart_read_data(&uart->generic_uart, buffer);
-        if(result < 0){
-            *buffer = 0;
-        }
-    }else{
-        // read only
+    lpc1768_uart_t *uart = (lpc1768_uart_t *)owner;
+    uint8_t data;
+    // TODO: some other operation to corresponding PE FE and BI bits
+    if(uart_read_data(&uart->generic_uart, &data) < 0){
+        data = 0;
     }
+    *value = data;
+    return 0;
 }
 
-void UTHR(uint8_t *buffer, int rw_flag, lpc1768_uart_t *uart)
+static int UTHR_write(void *owner, const reg_desc_t *reg, uint32_t value)
 {
-    if(rw_flag == MEM_READ){
-        // write only
-    }else{
-        uart_send_byte(armue_get_peri_connect(), uart->index, buffer);
+    lpc1768_uart_t *uart = (lpc1768_uart_t *)owner;
+    /* it went out the first time round */
+    if(!uart->soc->rerunning){
+        uart_output(&uart->generic_uart, uart->soc->peri_connect, uart->index, value);
     }
+    return 0;
+}
+
+/* The divisor latches behind DLAB are not modeled. URBR is read only, UTHR write only. */
+static const reg_desc_t lpc1768_uart_regs[] = {
+    {0x00, 1, URBR_read,    NULL,       0,  0xFF},
+    {0x04, 1, NULL,         UTHR_write, 0,  0},
+};
+
+/* the registers not modeled read as zero and ignore the writes */
+static int lpc1768_uart_unmodeled_read(void *owner, uint32_t offset, uint8_t *buffer, int size)
+{
+    memset(buffer, 0, size);
+    return size;
 }
 
-#define GET_DLAB() 0
-
-// the register access runtine
-// TODO: is there some better way?
-#define LPC1768_UART_REGS_ACCESS(offset, buffer, rw_flag, user_defined_access, region_data)\
-switch(offset){\
-case 0x00:\
-    if(GET_DLAB() == 0){\
-        URBR(buffer, rw_flag, region_data);\
-    }else{\
-        /*UDLL(buffer, rw_flag, region_data);*/\
-    }\
-    break;\
-case 0x04:\
-    if(GET_DLAB() == 0){\
-        UTHR(buffer, rw_flag, region_data);\
-    }else{\
-        /*UDLM(buffer, rw_flag, region_data);*/\
-    }\
-    break;\
-}\
+static int lpc1768_uart_unmodeled_write(void *owner, uint32_t offset, uint8_t *buffer, int size)
+{
+    return size;
+}
 
 int lpc1768_uart_read(uint32_t offset, uint8_t *buffer, int size, memory_region_t *region)
 {
     lpc1768_uart_t *uart = (lpc1768_uart_t *)region->region_data;
-    LPC1768_UART_REGS_ACCESS(offset, buffer, MEM_READ, NULL, uart);
-    return 4;
+    return reg_block_read(uart->registers, offset, buffer, size);
 }
 
 int lpc1768_uart_write(uint32_t offset, uint8_t *buffer, int size, memory_region_t *region)
 {
     lpc1768_uart_t *uart = (lpc1768_uart_t *)region->region_data;
-    LPC1768_UART_REGS_ACCESS(offset, buffer, MEM_WRITE, NULL, uart);
-    return 4;
+    return reg_block_write(uart->registers, offset, buffer, size);
 }
 
-/* initialize lpc1768 uart */
-int lpc1768_uart_init(cpu_t *cpu)
+/* initialize lpc1768 uart of the soc */
+int lpc1768_uart_init(soc_t *soc)
 {
     int retval;
-    // get memory first
-    memory_map_t *memory = cpu->memory_map;
+    // get memory first, the uart is shared by all the cores
+    memory_map_t *memory = shared_memory_map(soc->cpu[0]->memory_map);
     if(memory == NULL){
         retval = -ERROR_MEMORY_MAP;
         goto no_memory;
@@ -117,22 +118,69 @@ int lpc1768_uart_init(cpu_t *cpu)
     }
 
     // initialize custom data
-    uart_init(&lpc1768_uart0.generic_uart, LPC1768_UART_BUFFER_LEN);
-    lpc1768_uart0.index = 0;
+    lpc1768_uart_t *uart0 = (lpc1768_uart_t *)calloc(1, sizeof(lpc1768_uart_t));
+    if(uart0 == NULL){
+        retval = -ERROR_CREATE;
+        goto create_uart_fail;
+    }
+    uart_init(&uart0->generic_uart, LPC1768_UART_BUFFER_LEN);
+    uart0->index = 0;
+    uart0->soc = soc;
+    uart0->registers = create_reg_block(lpc1768_uart_regs, sizeof(lpc1768_uart_regs) / sizeof(lpc1768_uart_regs[0]),
+                                        LPC1768_UART0_SIZE, uart0);
+    if(uart0->registers == NULL){
+        retval = -ERROR_CREATE;
+        goto create_registers_fail;
+    }
+    uart0->registers->fallback_read = lpc1768_uart_unmodeled_read;
+    uart0->registers->fallback_write = lpc1768_uart_unmodeled_write;
+    if(soc->config.uart_console != NULL){
+        uart0->generic_uart.console = create_uart_console(soc->config.uart_console, soc->peri_io, 0);
+        if(uart0->generic_uart.console == NULL){
+            retval = -ERROR_CREATE;
+            goto create_console_fail;
+        }
+    }
 
     // set memory region interfaces
-    region_uart0->region_data = &lpc1768_uart0;
+    region_uart0->region_data = uart0;
     region_uart0->read = lpc1768_uart_read;
     region_uart0->write = lpc1768_uart_write;
     region_uart0->type = MEMORY_REGION_PERI;
 
     /* request for listening to the input */
-    request_peripheral(PERI_UART, 3);
-    register_peripheral(PERI_UART, 0, &peri_lpc1768_uart0);
+    peripheral_t peri_uart0 = {
+        .user_data = uart0,
+        .data_process = lpc1768_uart_data_process,
+        .snapshot = lpc1768_uart_snapshot,
+        .restore = lpc1768_uart_restore,
+    };
+    request_peripheral(soc, PERI_UART, 3);
+    register_peripheral(soc, PERI_UART, 0, &peri_uart0);
     return 0;
 
+create_console_fail:
+    destory_reg_block(&uart0->registers);
+create_registers_fail:
+    uart_destory(&uart0->generic_uart);
+    free(uart0);
+create_uart_fail:
 get_region_fail:
 no_memory:
     return retval;
 }
 
+void lpc1768_uart_destory(soc_t *soc)
+{
+    peripheral_t *peri_uart0 = find_peripheral(soc, PERI_UART, 0);
+    if(peri_uart0 == NULL || peri_uart0->user_data == NULL){
+        return;
+    }
+
+    lpc1768_uart_t *uart0 = (lpc1768_uart_t *)peri_uart0->user_data;
+    destory_reg_block(&uart0->registers);
+    uart_destory(&uart0->generic_uart);
+    free(uart0);
+    peri_uart0->user_data = NULL;
+}
+
@@ -4,7 +4,10 @@
 extern "C"{
 #endif
 
-int lpc1768_uart_init(cpu_t *cpu);
+#include "soc.h"
+
+int lpc1768_uart_init(soc_t *soc);
+void lpc1768_uart_destory(soc_t *soc);
 
 
 #ifdef __cplusplus
@@ -256,6 +256,7 @@ int main(int argc, char **argv)
     soc_conf.memories[0] = memory_map;
     soc_conf.exclusive_high_address = 0xFFFFFFFF;
     soc_conf.exclusive_low_address = 0;
+    soc_conf.sync_quantum = 0;
 
     // ROM
     rom_t* rom = alloc_rom();
@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <string.h>
+#include "module_helper.h"
+#include "soc.h"
+#include "semihost.h"
+#include "checkpoint.h"
+#include "peri_io.h"
+#include "lpc1768_uart.h"
+#include "arm_v7m_ins_implement.h"
+
+/*
+ * Stepping back from the checkpoints, to states that must be the ones recorded on
+ * the way.
+ *
+ * The semihosting firmware copies a host file to another one through SYS_READ and
+ * SYS_WRITE, 16 bytes at a time, and exits with the sum of the bytes. Halfway
+ * through, the test steps back and runs back to an earlier SYS_READ, then lets the
+ * program finish. The output must hold the input once.
+ *
+ * The input firmware folds what the UART receives into a register while the test
+ * queues a byte every few hundred instructions. A byte queued before stepping back
+ * must wait for the live run.
+ */
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do{ \
+        if(!(cond)){ \
+            printf("FAIL line %d: %s\n", __LINE__, #cond); \
+            failures++; \
+        } \
+    }while(0)
+
+#define TEST_IN_PATH        "checkpoint_test.in"
+#define TEST_OUT_PATH       "checkpoint_test.out"
+#define TEST_IN_SIZE        100
+#define TEST_CODE_BASE      0x100
+#define TEST_READ_PC        (TEST_CODE_BASE + 0x24)
+#define TEST_INTERVAL       100
+#define TEST_STEPS          700
+#define TEST_STEP_BACK      20
+
+#define TEST_INPUT_INTERVAL 5000
+#define TEST_INPUT_STEPS    30000
+#define TEST_INPUT_EVERY    701
+#define TEST_INPUT_LIVE     300
+
+/* the parameter blocks and the names are put in the SRAM by the test */
+#define TEST_OPEN_IN        0x10000000
+#define TEST_OPEN_OUT       0x10000010
+#define TEST_IN_NAME        0x10000040
+#define TEST_OUT_NAME       0x10000060
+
+static const uint8_t semihost_firmware[] = {
+    /* reset */
+    0x01, 0x20,                 /* 0000: movs r0, #1 */
+    0x4f, 0xf0, 0x80, 0x51,     /* 0002: mov.w r1, #268435456 */
+    0xab, 0xbe,                 /* 0006: bkpt #171 */
+    0x06, 0x46,                 /* 0008: mov r6, r0 */
+    0x01, 0x20,                 /* 000a: movs r0, #1 */
+    0x19, 0x49,                 /* 000c: ldr r1, [pc, #100] */
+    0xab, 0xbe,                 /* 000e: bkpt #171 */
+    0x07, 0x46,                 /* 0010: mov r7, r0 */
+    0x00, 0x24,                 /* 0012: movs r4, #0 */
+    0x18, 0x4d,                 /* 0014: ldr r5, [pc, #96] */
+    /* next */
+    0x2e, 0x60,                 /* 0016: str r6, [r5] */
+    0x18, 0x4a,                 /* 0018: ldr r2, [pc, #96] */
+    0x6a, 0x60,                 /* 001a: str r2, [r5, #4] */
+    0x10, 0x22,                 /* 001c: movs r2, #16 */
+    0xaa, 0x60,                 /* 001e: str r2, [r5, #8] */
+    0x06, 0x20,                 /* 0020: movs r0, #6 */
+    0x29, 0x46,                 /* 0022: mov r1, r5 */
+    0xab, 0xbe,                 /* 0024: bkpt #171 */
+    0x10, 0x23,                 /* 0026: movs r3, #16 */
+    0x1b, 0x1a,                 /* 0028: subs r3, r3, r0 */
+    0x00, 0xd1,                 /* 002a: bne 0x2e <got> */
+    0x11, 0xe0,                 /* 002c: b 0x52 <done> */
+    /* got */
+    0x13, 0x4a,                 /* 002e: ldr r2, [pc, #76] */
+    0x00, 0x21,                 /* 0030: movs r1, #0 */
+    /* sum */
+    0x12, 0xf8, 0x01, 0x00,     /* 0032: ldrb.w r0, [r2, r1] */
+    0x24, 0x18,                 /* 0036: adds r4, r4, r0 */
+    0x01, 0x31,                 /* 0038: adds r1, #1 */
+    0x99, 0x42,                 /* 003a: cmp r1, r3 */
+    0xf9, 0xd1,                 /* 003c: bne 0x32 <sum> */
+    0x2f, 0x60,                 /* 003e: str r7, [r5] */
+    0x6a, 0x60,                 /* 0040: str r2, [r5, #4] */
+    0xab, 0x60,                 /* 0042: str r3, [r5, #8] */
+    0x05, 0x20,                 /* 0044: movs r0, #5 */
+    0x29, 0x46,                 /* 0046: mov r1, r5 */
+    0xab, 0xbe,                 /* 0048: bkpt #171 */
+    0x32, 0x21,                 /* 004a: movs r1, #50 */
+    /* spin */
+    0x01, 0x39,                 /* 004c: subs r1, #1 */
+    0xfd, 0xd1,                 /* 004e: bne 0x4c <spin> */
+    0xe1, 0xe7,                 /* 0050: b 0x16 <next> */
+    /* done */
+    0x2e, 0x60,                 /* 0052: str r6, [r5] */
+    0x02, 0x20,                 /* 0054: movs r0, #2 */
+    0x29, 0x46,                 /* 0056: mov r1, r5 */
+    0xab, 0xbe,                 /* 0058: bkpt #171 */
+    0x2f, 0x60,                 /* 005a: str r7, [r5] */
+    0x02, 0x20,                 /* 005c: movs r0, #2 */
+    0x29, 0x46,                 /* 005e: mov r1, r5 */
+    0xab, 0xbe,                 /* 0060: bkpt #171 */
+    0x07, 0x4a,                 /* 0062: ldr r2, [pc, #28] */
+    0x07, 0x4b,                 /* 0064: ldr r3, [pc, #28] */
+    0x13, 0x60,                 /* 0066: str r3, [r2] */
+    0x54, 0x60,                 /* 0068: str r4, [r2, #4] */
+    0x20, 0x20,                 /* 006a: movs r0, #32 */
+    0x11, 0x46,                 /* 006c: mov r1, r2 */
+    0xab, 0xbe,                 /* 006e: bkpt #171 */
+    /* hang */
+    0xfe, 0xe7,                 /* 0070: b 0x70 <hang> */
+    0x00, 0x00,                 /* 0072: padding */
+    0x10, 0x00, 0x00, 0x10,     /* 0074: .word 0x10000010 */
+    0x20, 0x00, 0x00, 0x10,     /* 0078: .word 0x10000020 */
+    0x00, 0x01, 0x00, 0x10,     /* 007c: .word 0x10000100 */
+    0x30, 0x00, 0x00, 0x10,     /* 0080: .word 0x10000030 */
+    0x26, 0x00, 0x02, 0x00,     /* 0084: .word 0x00020026 */
+};
+
+static const uint8_t input_firmware[] = {
+    /* reset */
+    0x04, 0x48,                 /* 0000: ldr r0, [pc, #16] */
+    0x00, 0x24,                 /* 0002: movs r4, #0 */
+    0x00, 0x25,                 /* 0004: movs r5, #0 */
+    /* loop */
+    0x90, 0xf8, 0x00, 0x20,     /* 0006: ldrb.w r2, [r0] */
+    0x4f, 0xea, 0xf4, 0x74,     /* 000a: ror.w r4, r4, #31 */
+    0x14, 0x44,                 /* 000e: add r4, r2 */
+    0x01, 0x35,                 /* 0010: adds r5, #1 */
+    0xf8, 0xe7,                 /* 0012: b 0x6 <loop> */
+    0x00, 0xc0, 0x00, 0x40,     /* 0014: .word 0x4000c000 */
+};
+
+static arm_reg_t history[TEST_INPUT_STEPS];
+static cycle_t history_cycle[TEST_INPUT_STEPS];
+
+static void write_word(memory_map_t *memory, uint32_t addr, uint32_t value)
+{
+    write_memory_block(addr, (uint8_t*)&value, 4, memory);
+}
+
+static void write_open_block(memory_map_t *memory, uint32_t block, uint32_t name_addr, const char *name, uint32_t mode)
+{
+    write_memory_block(name_addr, (uint8_t*)name, strlen(name) + 1, memory);
+    write_word(memory, block, name_addr);
+    write_word(memory, block + 4, mode);
+    write_word(memory, block + 8, strlen(name));
+}
+
+static bool_t any_instruction(soc_t *soc, cycle_t cycle, uint32_t pc, void *data)
+{
+    return TRUE;
+}
+
+static bool_t at_read(soc_t *soc, cycle_t cycle, uint32_t pc, void *data)
+{
+    return pc == TEST_READ_PC;
+}
+
+static bool_t same_state(cpu_t *cpu, int step)
+{
+    return cpu->cycle == history_cycle[step] && memcmp(ARMv7m_GET_REGS(cpu), &history[step], sizeof(arm_reg_t)) == 0;
+}
+
+static soc_t* create_test_soc(const uint8_t *firmware, size_t size)
+{
+    memory_map_t *memory_map = create_memory_map();
+    soc_conf_t soc_conf;
+    memset(&soc_conf, 0, sizeof(soc_conf));
+    soc_conf.cpu_num = 1;
+    soc_conf.cpu_name = "arm_cm3";
+    soc_conf.exception_num = 255;
+    soc_conf.nested_level = 10;
+    soc_conf.memory_map_num = 1;
+    soc_conf.memories[0] = memory_map;
+    soc_conf.exclusive_high_address = 0xFFFFFFFF;
+
+    setup_memory_map_ram(memory_map, create_ram(0x1000), 0);
+    setup_memory_map_ram(memory_map, create_ram(0x8000), 0x10000000);
+    write_word(memory_map, 0, 0x10008000);
+    write_word(memory_map, 4, TEST_CODE_BASE | 1);
+    write_memory_block(TEST_CODE_BASE, (uint8_t*)firmware, size, memory_map);
+    return create_soc(&soc_conf);
+}
+
+static void test_semihost(void)
+{
+    uint8_t input[TEST_IN_SIZE], output[TEST_IN_SIZE + 1];
+    uint32_t sum = 0;
+    int i, step;
+
+    for(i = 0; i < TEST_IN_SIZE; i++){
+        input[i] = (uint8_t)(i * 7 + 3);
+        sum += input[i];
+    }
+    FILE *file = fopen(TEST_IN_PATH, "wb");
+    CHECK(file != NULL && fwrite(input, 1, TEST_IN_SIZE, file) == TEST_IN_SIZE);
+    if(file == NULL){
+        return;
+    }
+    fclose(file);
+    remove(TEST_OUT_PATH);
+
+    soc_t *soc = create_test_soc(semihost_firmware, sizeof(semihost_firmware));
+    CHECK(soc != NULL);
+    if(soc == NULL){
+        return;
+    }
+    cpu_t *cpu = soc->cpu[0];
+    memory_map_t *memory_map = cpu->memory_map;
+    write_open_block(memory_map, TEST_OPEN_IN, TEST_IN_NAME, TEST_IN_PATH, 1);      // "rb"
+    write_open_block(memory_map, TEST_OPEN_OUT, TEST_OUT_NAME, TEST_OUT_PATH, 5);   // "wb"
+    soc->semihost = create_semihost();
+    cpu->semihost = soc->semihost;
+    CHECK(startup_soc(soc) == SUCCESS);
+    soc->checkpoints = create_checkpoint_list(soc, TEST_INTERVAL);
+    CHECK(soc->checkpoints != NULL);
+    if(soc->checkpoints == NULL){
+        destory_soc(&soc);
+        return;
+    }
+
+    for(step = 0; step < TEST_STEPS; step++){
+        history[step] = *ARMv7m_GET_REGS(cpu);
+        history_cycle[step] = cpu->cycle;
+        run_soc(soc);
+    }
+    CHECK(!soc->semihost->exited);
+    CHECK(soc->checkpoints->num > 1);
+
+    /* reverse steps */
+    for(i = 0; i < TEST_STEP_BACK; i++){
+        step--;
+        CHECK(rewind_checkpoint(soc, soc->checkpoints, cpu->cycle, any_instruction, NULL) == 1);
+        CHECK(same_state(cpu, step));
+    }
+
+    /* reverse continue to the last SYS_READ before */
+    for(step--; step >= 0 && history[step].PC != TEST_READ_PC; step--);
+    CHECK(step >= 0);
+    CHECK(rewind_checkpoint(soc, soc->checkpoints, cpu->cycle, at_read, NULL) == 1);
+    CHECK(step >= 0 && same_state(cpu, step));
+
+    /* forward again, the reads give back what they gave and nothing is written twice */
+    for(i = 0; !soc->semihost->exited && i < 100000; i++){
+        run_soc(soc);
+    }
+    CHECK(soc->semihost->exited && soc->semihost->exit_code == (int)sum);
+
+    destory_soc(&soc);
+
+    file = fopen(TEST_OUT_PATH, "rb");
+    CHECK(file != NULL);
+    if(file != NULL){
+        CHECK(fread(output, 1, sizeof(output), file) == TEST_IN_SIZE);
+        CHECK(memcmp(input, output, TEST_IN_SIZE) == 0);
+        fclose(file);
+    }
+}
+
+static void give_input(soc_t *soc, spsc_queue_t *queue, uint8_t byte)
+{
+    pmp_parsed_pkt_t pkt = {PMP_DATA, PMP_DATA_KIND_DENERIC, 0, PERI_UART, &byte, 1, TRUE};
+    queue_peri_io_event(soc->peri_io, queue, &pkt);
+}
+
+static void test_input(void)
+{
+    int i, step;
+
+    soc_t *soc = create_test_soc(input_firmware, sizeof(input_firmware));
+    CHECK(soc != NULL);
+    if(soc == NULL){
+        return;
+    }
+    cpu_t *cpu = soc->cpu[0];
+    lpc1768_uart_init(soc);
+    soc->peri_io = create_peri_io(NULL);
+    CHECK(soc->peri_io != NULL);
+    spsc_queue_t *queue = soc->peri_io != NULL ? add_peri_io_source(soc->peri_io) : NULL;
+    CHECK(queue != NULL);
+    CHECK(startup_soc(soc) == SUCCESS);
+    soc->checkpoints = create_checkpoint_list(soc, TEST_INPUT_INTERVAL);
+    CHECK(soc->checkpoints != NULL);
+    if(queue == NULL || soc->checkpoints == NULL){
+        lpc1768_uart_destory(soc);
+        destory_soc(&soc);
+        return;
+    }
+
+    for(step = 0; step < TEST_INPUT_STEPS; step++){
+        if(step % TEST_INPUT_EVERY == 7){
+            give_input(soc, queue, (uint8_t)(step * 7 + 1));
+        }
+        history[step] = *ARMv7m_GET_REGS(cpu);
+        history_cycle[step] = cpu->cycle;
+        run_soc(soc);
+    }
+
+    /* the stretches run again take the input kept, not this one */
+    give_input(soc, queue, 0x77);
+    for(i = 0; i < TEST_STEP_BACK; i++){
+        step--;
+        CHECK(rewind_checkpoint(soc, soc->checkpoints, cpu->cycle, any_instruction, NULL) == 1);
+        CHECK(same_state(cpu, step));
+    }
+    CHECK(peri_io_pending(soc->peri_io));
+
+    uint32_t folded = ARMv7m_GET_REGS(cpu)->R[4];
+    for(i = 0; i < TEST_INPUT_LIVE; i++){
+        run_soc(soc);
+    }
+    CHECK(!peri_io_pending(soc->peri_io));
+    CHECK(ARMv7m_GET_REGS(cpu)->R[4] != folded);
+
+    lpc1768_uart_destory(soc);
+    destory_soc(&soc);
+}
+
+int main(int argc, char **argv)
+{
+    register_all_modules();
+    test_semihost();
+    test_input();
+    unregister_all_modules();
+
+    printf("%s\n", failures == 0 ? "OK" : "FAIL");
+    return failures != 0;
+}
@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <string.h>
+#include "module_helper.h"
+#include "soc.h"
+#include "semihost.h"
+#include "lpc1768_uart.h"
+#include "lpc1768_gpdma.h"
+
+/*
+ * Two cores run the same firmware from ROM. Both count a word to 5000 with
+ * LDREX/STREX, storing next to it as well, then take a role. One writes the UART
+ * and waits for the other, which writes the UART too and runs 50 DMA copies, each
+ * finished with an interrupt to the first core. The first core stops the program
+ * with a semihosting exit code of 0 once it saw the 50 interrupts.
+ */
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do{ \
+        if(!(cond)){ \
+            printf("FAIL line %d: %s\n", __LINE__, #cond); \
+            failures++; \
+        } \
+    }while(0)
+
+#define TEST_ROM_PATH       "multicore_test.rom"
+#define TEST_UART_PATH      "multicore_test.uart"
+#define TEST_CODE_BASE      0x100
+#define TEST_RESET          (TEST_CODE_BASE + 0x10)
+#define TEST_DMA_IRQ        (TEST_CODE_BASE + 0x00)
+#define TEST_DMA_VECTOR     (16 + 26)
+
+#define TEST_SHARED_COUNT   0x10000208
+#define TEST_IRQ_COUNT      0x10004000
+
+static const uint8_t firmware[] = {
+    /* dma_irq */
+    0x31, 0x48,                 /* 0000: ldr r0, [pc, #196] */
+    0x41, 0x68,                 /* 0002: ldr r1, [r0, #4] */
+    0x81, 0x60,                 /* 0004: str r1, [r0, #8] */
+    0x31, 0x4b,                 /* 0006: ldr r3, [pc, #196] */
+    0x1a, 0x68,                 /* 0008: ldr r2, [r3] */
+    0x01, 0x32,                 /* 000a: adds r2, #1 */
+    0x1a, 0x60,                 /* 000c: str r2, [r3] */
+    0x70, 0x47,                 /* 000e: bx lr */
+    /* reset */
+    0x2f, 0x4a,                 /* 0010: ldr r2, [pc, #188] */
+    0x41, 0xf2, 0x88, 0x35,     /* 0012: movw r5, #5000 */
+    /* count */
+    0x52, 0xe8, 0x00, 0x3f,     /* 0016: ldrex r3, [r2] */
+    0x01, 0x33,                 /* 001a: adds r3, #1 */
+    0x42, 0xe8, 0x00, 0x34,     /* 001c: strex r4, r3, [r2] */
+    0x00, 0x2c,                 /* 0020: cmp r4, #0 */
+    0xf8, 0xd1,                 /* 0022: bne 0x16 <count> */
+    0x55, 0x60,                 /* 0024: str r5, [r2, #4] */
+    0x01, 0x3d,                 /* 0026: subs r5, #1 */
+    0x00, 0x2d,                 /* 0028: cmp r5, #0 */
+    0xf4, 0xd1,                 /* 002a: bne 0x16 <count> */
+    0x29, 0x4a,                 /* 002c: ldr r2, [pc, #164] */
+    /* role */
+    0x52, 0xe8, 0x00, 0x3f,     /* 002e: ldrex r3, [r2] */
+    0x5c, 0x1c,                 /* 0032: adds r4, r3, #1 */
+    0x42, 0xe8, 0x00, 0x45,     /* 0034: strex r5, r4, [r2] */
+    0x00, 0x2d,                 /* 0038: cmp r5, #0 */
+    0xf8, 0xd1,                 /* 003a: bne 0x2e <role> */
+    0x26, 0x48,                 /* 003c: ldr r0, [pc, #152] */
+    0x00, 0x2b,                 /* 003e: cmp r3, #0 */
+    0x1d, 0xd1,                 /* 0040: bne 0x7e <role1> */
+    0x4f, 0xf4, 0x96, 0x75,     /* 0042: mov.w r5, #300 */
+    0x61, 0x21,                 /* 0046: movs r1, #97 */
+    /* a_loop */
+    0x41, 0x60,                 /* 0048: str r1, [r0, #4] */
+    0x01, 0x3d,                 /* 004a: subs r5, #1 */
+    0x00, 0x2d,                 /* 004c: cmp r5, #0 */
+    0xfb, 0xd1,                 /* 004e: bne 0x48 <a_loop> */
+    0x22, 0x4a,                 /* 0050: ldr r2, [pc, #136] */
+    /* wait_done */
+    0x13, 0x68,                 /* 0052: ldr r3, [r2] */
+    0x01, 0x2b,                 /* 0054: cmp r3, #1 */
+    0xfc, 0xd1,                 /* 0056: bne 0x52 <wait_done> */
+    0x1c, 0x4a,                 /* 0058: ldr r2, [pc, #112] */
+    0x21, 0x4e,                 /* 005a: ldr r6, [pc, #132] */
+    /* wait_irq */
+    0x13, 0x68,                 /* 005c: ldr r3, [r2] */
+    0x32, 0x2b,                 /* 005e: cmp r3, #50 */
+    0x01, 0xd1,                 /* 0060: bne 0x66 <not_yet> */
+    0x00, 0x21,                 /* 0062: movs r1, #0 */
+    0x03, 0xe0,                 /* 0064: b 0x6e <exit> */
+    /* not_yet */
+    0x01, 0x3e,                 /* 0066: subs r6, #1 */
+    0x00, 0x2e,                 /* 0068: cmp r6, #0 */
+    0xf7, 0xd1,                 /* 006a: bne 0x5c <wait_irq> */
+    0x01, 0x21,                 /* 006c: movs r1, #1 */
+    /* exit */
+    0x1d, 0x4a,                 /* 006e: ldr r2, [pc, #116] */
+    0x1d, 0x4b,                 /* 0070: ldr r3, [pc, #116] */
+    0x13, 0x60,                 /* 0072: str r3, [r2] */
+    0x51, 0x60,                 /* 0074: str r1, [r2, #4] */
+    0x20, 0x20,                 /* 0076: movs r0, #32 */
+    0x11, 0x46,                 /* 0078: mov r1, r2 */
+    0xab, 0xbe,                 /* 007a: bkpt #171 */
+    0xfe, 0xe7,                 /* 007c: b 0x7c */
+    /* role1 */
+    0x12, 0x4e,                 /* 007e: ldr r6, [pc, #72] */
+    0x01, 0x21,                 /* 0080: movs r1, #1 */
+    0x31, 0x63,                 /* 0082: str r1, [r6, #48] */
+    0x19, 0x4f,                 /* 0084: ldr r7, [pc, #100] */
+    0x32, 0x25,                 /* 0086: movs r5, #50 */
+    /* b_loop */
+    0x62, 0x21,                 /* 0088: movs r1, #98 */
+    0x41, 0x60,                 /* 008a: str r1, [r0, #4] */
+    0x00, 0x21,                 /* 008c: movs r1, #0 */
+    0x39, 0x60,                 /* 008e: str r1, [r7] */
+    0x4f, 0xf0, 0x10, 0x21,     /* 0090: mov.w r1, #268439552 */
+    0x79, 0x60,                 /* 0094: str r1, [r7, #4] */
+    0x00, 0x21,                 /* 0096: movs r1, #0 */
+    0xb9, 0x60,                 /* 0098: str r1, [r7, #8] */
+    0x15, 0x49,                 /* 009a: ldr r1, [pc, #84] */
+    0xf9, 0x60,                 /* 009c: str r1, [r7, #12] */
+    0x48, 0xf2, 0x01, 0x01,     /* 009e: movw r1, #32769 */
+    0x39, 0x61,                 /* 00a2: str r1, [r7, #16] */
+    /* busy */
+    0xf1, 0x69,                 /* 00a4: ldr r1, [r6, #28] */
+    0x00, 0x29,                 /* 00a6: cmp r1, #0 */
+    0xfc, 0xd1,                 /* 00a8: bne 0xa4 <busy> */
+    0x01, 0x3d,                 /* 00aa: subs r5, #1 */
+    0x00, 0x2d,                 /* 00ac: cmp r5, #0 */
+    0xeb, 0xd1,                 /* 00ae: bne 0x88 <b_loop> */
+    0x4f, 0xf0, 0xfa, 0x05,     /* 00b0: mov.w r5, #250 */
+    0x62, 0x21,                 /* 00b4: movs r1, #98 */
+    /* b_rest */
+    0x41, 0x60,                 /* 00b6: str r1, [r0, #4] */
+    0x01, 0x3d,                 /* 00b8: subs r5, #1 */
+    0x00, 0x2d,                 /* 00ba: cmp r5, #0 */
+    0xfb, 0xd1,                 /* 00bc: bne 0xb6 <b_rest> */
+    0x07, 0x4a,                 /* 00be: ldr r2, [pc, #28] */
+    0x01, 0x21,                 /* 00c0: movs r1, #1 */
+    0x11, 0x60,                 /* 00c2: str r1, [r2] */
+    0xfe, 0xe7,                 /* 00c4: b 0xc4 */
+    0x00, 0x00,                 /* 00c6: padding */
+    0x00, 0x40, 0x00, 0x50,     /* 00c8: .word 0x50004000 */
+    0x00, 0x40, 0x00, 0x10,     /* 00cc: .word 0x10004000 */
+    0x08, 0x02, 0x00, 0x10,     /* 00d0: .word 0x10000208 */
+    0x00, 0x02, 0x00, 0x10,     /* 00d4: .word 0x10000200 */
+    0x00, 0xc0, 0x00, 0x40,     /* 00d8: .word 0x4000c000 */
+    0x04, 0x02, 0x00, 0x10,     /* 00dc: .word 0x10000204 */
+    0x40, 0x0d, 0x03, 0x00,     /* 00e0: .word 0x00030d40 */
+    0x10, 0x40, 0x00, 0x10,     /* 00e4: .word 0x10004010 */
+    0x26, 0x00, 0x02, 0x00,     /* 00e8: .word 0x00020026 */
+    0x00, 0x41, 0x00, 0x50,     /* 00ec: .word 0x50004100 */
+    0x10, 0x00, 0x48, 0x8c,     /* 00f0: .word 0x8c480010 */
+};
+
+static uint32_t read_word(memory_map_t *memory, uint32_t addr)
+{
+    uint32_t value = 0;
+    read_memory(addr, (uint8_t*)&value, 4, memory);
+    return value;
+}
+
+static void write_word(memory_map_t *memory, uint32_t addr, uint32_t value)
+{
+    write_memory_block(addr, (uint8_t*)&value, 4, memory);
+}
+
+int main(int argc, char **argv)
+{
+    register_all_modules();
+    memory_map_t *memory_map = create_memory_map();
+
+    soc_conf_t soc_conf;
+    memset(&soc_conf, 0, sizeof(soc_conf));
+    soc_conf.cpu_num = 2;
+    soc_conf.cpu_name = "arm_cm3";
+    soc_conf.exception_num = 255;
+    soc_conf.nested_level = 10;
+    soc_conf.memory_map_num = 1;
+    soc_conf.memories[0] = memory_map;
+    soc_conf.exclusive_high_address = 0xFFFFFFFF;
+
+    /* the cores fetch from the one ROM file */
+    remove(TEST_ROM_PATH);
+    rom_t *rom = alloc_rom();
+    set_rom_size(rom, 0x1000);
+    if(open_rom(TEST_ROM_PATH, rom) != SUCCESS){
+        printf("FAIL: can't create %s\n", TEST_ROM_PATH);
+        return 1;
+    }
+    setup_memory_map_rom(memory_map, rom, 0);
+    setup_memory_map_ram(memory_map, create_ram(0x8000), 0x10000000);
+    write_word(memory_map, 0, 0x10008000);
+    write_word(memory_map, 4, TEST_RESET | 1);
+    write_word(memory_map, TEST_DMA_VECTOR * 4, TEST_DMA_IRQ | 1);
+    write_memory_block(TEST_CODE_BASE, (uint8_t*)firmware, sizeof(firmware), memory_map);
+
+    soc_t *soc = create_soc(&soc_conf);
+    CHECK(soc != NULL);
+    if(soc == NULL){
+        return 1;
+    }
+    soc->config.uart_console = "file:" TEST_UART_PATH;
+    soc->semihost = create_semihost();
+    soc->cpu[0]->semihost = soc->semihost;
+    soc->cpu[1]->semihost = soc->semihost;
+    CHECK(lpc1768_uart_init(soc) == 0);
+    CHECK(lpc1768_gpdma_init(soc) == 0);
+    CHECK(startup_soc(soc) == SUCCESS);
+    CHECK(run_soc_parallel(soc) == SUCCESS);
+
+    CHECK(soc->semihost->exited && soc->semihost->exit_code == 0);
+    CHECK(read_word(memory_map, TEST_SHARED_COUNT) == 10000);
+    CHECK(read_word(memory_map, TEST_IRQ_COUNT) == 50);
+
+    /* the console is flushed when it is destoried, the soc owns the memory map */
+    lpc1768_gpdma_destory(soc);
+    lpc1768_uart_destory(soc);
+    destory_soc(&soc);
+
+    int a = 0, b = 0, c;
+    FILE *uart = fopen(TEST_UART_PATH, "rb");
+    CHECK(uart != NULL);
+    if(uart != NULL){
+        while((c = fgetc(uart)) != EOF){
+            a += c == 'a';
+            b += c == 'b';
+        }
+        fclose(uart);
+    }
+    CHECK(a == 300 && b == 300);
+
+    destory_rom(&rom);
+    remove(TEST_ROM_PATH);
+    remove(TEST_UART_PATH);
+
+    printf("%s\n", failures == 0 ? "OK" : "FAIL");
+    return failures != 0;
+}
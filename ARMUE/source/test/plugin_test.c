@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <string.h>
+#include "module_helper.h"
+#include "soc.h"
+#include "semihost.h"
+#include "plugin.h"
+#include "peripheral.h"
+
+/*
+ * Loads the example plug-in from the plug-in directory, the one given on the
+ * command line or the one of the build. The firmware starts its counter with a
+ * period of 200 cycles, takes three of its interrupts, then stops it and exits
+ * with the number of periods the counter saw.
+ */
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do{ \
+        if(!(cond)){ \
+            printf("FAIL line %d: %s\n", __LINE__, #cond); \
+            failures++; \
+        } \
+    }while(0)
+
+#ifndef PLUGIN_TEST_DIR
+#define PLUGIN_TEST_DIR     "plugins"
+#endif
+
+#define TEST_CODE_BASE      0x100
+#define TEST_RESET          (TEST_CODE_BASE + 0x10)
+#define TEST_TIMER_IRQ      (TEST_CODE_BASE + 0x00)
+#define TEST_TIMER_VECTOR   (16 + 40)
+#define TEST_TIMER_BASE     0x50008000
+
+#define TEST_IRQ_COUNT      0x10004000
+
+static const uint8_t firmware[] = {
+    /* timer_irq */
+    0x10, 0x48,                 /* 0000: ldr r0, [pc, #64] */
+    0x01, 0x21,                 /* 0002: movs r1, #1 */
+    0x81, 0x60,                 /* 0004: str r1, [r0, #8] */
+    0x10, 0x4b,                 /* 0006: ldr r3, [pc, #64] */
+    0x1a, 0x68,                 /* 0008: ldr r2, [r3] */
+    0x01, 0x32,                 /* 000a: adds r2, #1 */
+    0x1a, 0x60,                 /* 000c: str r2, [r3] */
+    0x70, 0x47,                 /* 000e: bx lr */
+    /* reset */
+    0x0c, 0x48,                 /* 0010: ldr r0, [pc, #48] */
+    0xc8, 0x21,                 /* 0012: movs r1, #200 */
+    0x01, 0x60,                 /* 0014: str r1, [r0] */
+    0x03, 0x21,                 /* 0016: movs r1, #3 */
+    0x41, 0x60,                 /* 0018: str r1, [r0, #4] */
+    0x0b, 0x4a,                 /* 001a: ldr r2, [pc, #44] */
+    0x0b, 0x4e,                 /* 001c: ldr r6, [pc, #44] */
+    /* wait */
+    0x13, 0x68,                 /* 001e: ldr r3, [r2] */
+    0x03, 0x2b,                 /* 0020: cmp r3, #3 */
+    0x03, 0xd1,                 /* 0022: bne 0x2c <not_yet> */
+    0x00, 0x21,                 /* 0024: movs r1, #0 */
+    0x41, 0x60,                 /* 0026: str r1, [r0, #4] */
+    0xc1, 0x68,                 /* 0028: ldr r1, [r0, #12] */
+    0x03, 0xe0,                 /* 002a: b 0x34 <exit> */
+    /* not_yet */
+    0x01, 0x3e,                 /* 002c: subs r6, #1 */
+    0x00, 0x2e,                 /* 002e: cmp r6, #0 */
+    0xf5, 0xd1,                 /* 0030: bne 0x1e <wait> */
+    0xff, 0x21,                 /* 0032: movs r1, #255 */
+    /* exit */
+    0x06, 0x4a,                 /* 0034: ldr r2, [pc, #24] */
+    0x07, 0x4b,                 /* 0036: ldr r3, [pc, #28] */
+    0x13, 0x60,                 /* 0038: str r3, [r2] */
+    0x51, 0x60,                 /* 003a: str r1, [r2, #4] */
+    0x20, 0x20,                 /* 003c: movs r0, #32 */
+    0x11, 0x46,                 /* 003e: mov r1, r2 */
+    0xab, 0xbe,                 /* 0040: bkpt #171 */
+    /* hang */
+    0xfe, 0xe7,                 /* 0042: b 0x42 <hang> */
+    0x00, 0x80, 0x00, 0x50,     /* 0044: .word 0x50008000 */
+    0x00, 0x40, 0x00, 0x10,     /* 0048: .word 0x10004000 */
+    0xa0, 0x86, 0x01, 0x00,     /* 004c: .word 0x000186a0 */
+    0x10, 0x40, 0x00, 0x10,     /* 0050: .word 0x10004010 */
+    0x26, 0x00, 0x02, 0x00,     /* 0054: .word 0x00020026 */
+};
+
+static uint32_t read_word(memory_map_t *memory, uint32_t addr)
+{
+    uint32_t value = 0;
+    read_memory(addr, (uint8_t*)&value, 4, memory);
+    return value;
+}
+
+static void write_word(memory_map_t *memory, uint32_t addr, uint32_t value)
+{
+    write_memory_block(addr, (uint8_t*)&value, 4, memory);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = argc > 1 ? argv[1] : PLUGIN_TEST_DIR;
+
+    register_all_modules();
+    CHECK(load_plugin_modules(dir) == 1);
+
+    memory_map_t *memory_map = create_memory_map();
+    soc_conf_t soc_conf;
+    memset(&soc_conf, 0, sizeof(soc_conf));
+    soc_conf.cpu_num = 1;
+    soc_conf.cpu_name = "arm_cm3";
+    soc_conf.exception_num = 255;
+    soc_conf.nested_level = 10;
+    soc_conf.memory_map_num = 1;
+    soc_conf.memories[0] = memory_map;
+    soc_conf.exclusive_high_address = 0xFFFFFFFF;
+
+    setup_memory_map_ram(memory_map, create_ram(0x1000), 0);
+    setup_memory_map_ram(memory_map, create_ram(0x8000), 0x10000000);
+    write_word(memory_map, 0, 0x10008000);
+    write_word(memory_map, 4, TEST_RESET | 1);
+    write_word(memory_map, TEST_TIMER_VECTOR * 4, TEST_TIMER_IRQ | 1);
+    write_memory_block(TEST_CODE_BASE, (uint8_t*)firmware, sizeof(firmware), memory_map);
+
+    soc_t *soc = create_soc(&soc_conf);
+    CHECK(soc != NULL);
+    if(soc == NULL){
+        return 1;
+    }
+    soc->semihost = create_semihost();
+    soc->cpu[0]->semihost = soc->semihost;
+    CHECK(plugin_peripherals_init(soc) == 0);
+    CHECK(soc->peri_table[PERI_PLUGIN].num == 1);
+    CHECK(startup_soc(soc) == SUCCESS);
+
+    int steps = 0;
+    while(!soc->semihost->exited && steps++ < 100000){
+        run_soc(soc);
+    }
+    CHECK(soc->semihost->exited && soc->semihost->exit_code == 3);
+    CHECK(read_word(memory_map, TEST_IRQ_COUNT) == 3);
+    /* the registers of the instance are mapped at its base */
+    CHECK(read_word(memory_map, TEST_TIMER_BASE) == 200);
+    CHECK(read_word(memory_map, TEST_TIMER_BASE + 0x08) == 0);
+
+    plugin_peripherals_destory(soc);
+    destory_soc(&soc);
+    unregister_all_modules();
+
+    printf("%s\n", failures == 0 ? "OK" : "FAIL");
+    return failures != 0;
+}
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <string.h>
+#include "core_connect.h"
+
+/*
+ * The core queues one byte UART writes to the monitor over a unix domain socket
+ * with a small send buffer, not blocking on the core side. The monitor reads only
+ * now and then, so the sends often go out in part. Every byte has to come back
+ * once and in order.
+ */
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do{ \
+        if(!(cond)){ \
+            printf("FAIL line %d: %s\n", __LINE__, #cond); \
+            failures++; \
+        } \
+    }while(0)
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <fcntl.h>
+
+#define TEST_BYTES          300000
+#define TEST_SEND_BUF       4096
+#define TEST_CORE_BUF       65536
+
+#define test_byte(n)        ((uint8_t)((n) * 13))
+
+static int received = 0;
+static int wrong = 0;
+
+/* read what is there once, a packet split by the read is kept for the next one */
+static void drain_monitor(core_connect_t *monitor)
+{
+    pmp_parsed_pkt_t pkt;
+    uint32_t i;
+    if(pmp_recv(monitor, FALSE) <= 0){
+        return;
+    }
+    pmp_parse_loop(monitor){
+        int result = pmp_parse_input(monitor, &pkt);
+        if(result == -PMP_ERR_DATA_LEN){
+            pmp_keep_unparsed(monitor);
+            break;
+        }else if(result < 0){
+            wrong++;
+            pmp_clear_recv_buffer(monitor);
+            break;
+        }
+        for(i = 0; i < pkt.data_len; i++){
+            if(pkt.data[i] != test_byte(received)){
+                wrong++;
+            }
+            received++;
+        }
+    }
+}
+
+static void test_partial_send()
+{
+    int fds[2];
+    int partial = 0, rounds = 0, i;
+    int send_buf = TEST_SEND_BUF;
+    core_connect_t *core, *monitor;
+
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &send_buf, sizeof(send_buf));
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+    core = create_core_connect(TEST_CORE_BUF, "pmp_test");
+    monitor = create_core_connect(TEST_CORE_BUF, "pmp_test");
+    core->in_pipe = core->out_pipe = fds[0];
+    monitor->in_pipe = monitor->out_pipe = fds[1];
+    // the test sends by itself, the monitor reads only when the socket is full
+    core->batch_size = TEST_CORE_BUF;
+
+    for(i = 0; i < TEST_BYTES; i++){
+        uint8_t data = test_byte(i);
+        if(pmp_queue_data(core, PERI_UART, 0, PMP_DATA_KIND_DENERIC, &data, 1) != 0){
+            CHECK(!"queued");
+            break;
+        }
+        if(core->send_len > TEST_CORE_BUF / 2){
+            int len = core->send_len;
+            int sent = pmp_send(core);
+            if(sent > 0 && sent < len){
+                partial++;
+            }
+            if(sent < len){
+                drain_monitor(monitor);
+            }
+        }
+    }
+    while(core->send_len > 0 && rounds++ < 100000){
+        pmp_send(core);
+        drain_monitor(monitor);
+    }
+    while(received < TEST_BYTES && rounds++ < 100000){
+        drain_monitor(monitor);
+    }
+
+    CHECK(partial > 0);
+    CHECK(core->send_len == 0);
+    CHECK(received == TEST_BYTES);
+    CHECK(wrong == 0);
+
+    destory_core_connect(&core);
+    destory_core_connect(&monitor);
+}
+#endif
+
+int main(int argc, char **argv)
+{
+#ifdef __linux__
+    test_partial_send();
+#else
+    printf("skipped, the test needs a unix domain socket\n");
+#endif
+    printf("%s\n", failures == 0 ? "OK" : "FAIL");
+    return failures != 0;
+}
@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <string.h>
+#include "register_block.h"
+
+/*
+ * Checks of the register block: the narrow registers packed in a word, the bytes
+ * after a register, the write 1 to clear bits, the bits read as set, the merge of the
+ * narrow writes and the fallback.
+ */
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do{ \
+        if(!(cond)){ \
+            printf("FAIL line %d: %s\n", __LINE__, #cond); \
+            failures++; \
+        } \
+    }while(0)
+
+static int read_count = 0;
+static int fallback_count = 0;
+
+static int counted_read(void *owner, const reg_desc_t *reg, uint32_t *value)
+{
+    read_count++;
+    *value = 0xA5;
+    return 0;
+}
+
+static int test_fallback(void *owner, uint32_t offset, uint8_t *buffer, int size)
+{
+    fallback_count++;
+    memset(buffer, 0xEE, size);
+    return size;
+}
+
+static const reg_desc_t test_regs[] = {
+    {0x00, 1, NULL,         NULL,   0,      0,      0},
+    {0x01, 1, NULL,         NULL,   0,      0,      0},
+    {0x02, 1, NULL,         NULL,   0,      0,      0},
+    {0x03, 1, NULL,         NULL,   0,      0xF0,   0},     // the high bits are read only
+    {0x04, 2, NULL,         NULL,   0,      0,      0},
+    {0x06, 1, NULL,         NULL,   0,      0,      0},
+    {0x08, 4, NULL,         NULL,   0xFF,   0,      0x0F},  // write 1 to clear the low bits
+    {0x0C, 1, NULL,         NULL,   0,      0,      0},
+    {0x11, 1, counted_read, NULL,   0,      0,      0},
+    {0x12, 1, counted_read, NULL,   0,      0,      0},
+};
+#define TEST_REG_NUM    (sizeof(test_regs) / sizeof(test_regs[0]))
+#define TEST_SIZE       0x18
+
+static uint32_t read32(reg_block_t *block, uint32_t offset)
+{
+    uint32_t value = 0;
+    CHECK(reg_block_read(block, offset, (uint8_t*)&value, 4) == 4);
+    return value;
+}
+
+static void write32(reg_block_t *block, uint32_t offset, uint32_t value)
+{
+    CHECK(reg_block_write(block, offset, (uint8_t*)&value, 4) == 4);
+}
+
+static void test_packed(reg_block_t *block)
+{
+    uint8_t byte = 0x5A;
+    uint16_t half;
+
+    /* a word write reaches the four byte registers */
+    write32(block, 0x00, 0x44332211);
+    CHECK(reg_block_value(block, &test_regs[0]) == 0x11);
+    CHECK(reg_block_value(block, &test_regs[1]) == 0x22);
+    CHECK(reg_block_value(block, &test_regs[2]) == 0x33);
+    CHECK(reg_block_value(block, &test_regs[3]) == 0x04);
+    CHECK(read32(block, 0x00) == 0x04332211);
+
+    /* a byte write leaves the others alone */
+    CHECK(reg_block_write(block, 0x01, &byte, 1) == 1);
+    CHECK(read32(block, 0x00) == 0x04335A11);
+    CHECK(reg_block_read(block, 0x02, &byte, 1) == 1 && byte == 0x33);
+
+    /* a halfword register and a byte register, the last byte is the tail of the byte one */
+    write32(block, 0x04, 0xAABBCCDD);
+    CHECK(reg_block_value(block, &test_regs[4]) == 0xCCDD);
+    CHECK(reg_block_value(block, &test_regs[5]) == 0xBB);
+    CHECK(read32(block, 0x04) == 0x00BBCCDD);
+    CHECK(reg_block_read(block, 0x04, (uint8_t*)&half, 2) == 2 && half == 0xCCDD);
+
+    /* an access across two words */
+    CHECK(reg_block_read(block, 0x02, (uint8_t*)&half, 2) == 2 && half == 0x0433);
+    uint32_t value = 0;
+    CHECK(reg_block_read(block, 0x03, (uint8_t*)&value, 4) == 4 && value == 0xBBCCDD04);
+}
+
+static void test_tail(reg_block_t *block)
+{
+    uint8_t byte = 0x12;
+
+    /* the bytes after a byte register read as zero */
+    write32(block, 0x0C, 0x12345678);
+    CHECK(read32(block, 0x0C) == 0x00000078);
+
+    /* a word register takes the bytes it covers */
+    CHECK(read32(block, 0x08) == 0xFF);
+    CHECK(reg_block_write(block, 0x09, &byte, 1) == 1);
+    CHECK(read32(block, 0x08) == 0x12FF);
+}
+
+/* the block is in its reset state */
+static void test_w1c(reg_block_t *block)
+{
+    uint8_t byte = 0xF1;
+
+    CHECK(reg_block_write(block, 0x08, &byte, 1) == 1);
+    CHECK(read32(block, 0x08) == 0xFE);
+    /* the bits that are not write 1 to clear take the value */
+    write32(block, 0x08, 0x00000300);
+    CHECK(read32(block, 0x08) == 0x30E);
+}
+
+static void test_fallback_and_handlers(reg_block_t *block)
+{
+    uint32_t value;
+
+    /* 0x10 has no register before the one at 0x11, 0x13 is the tail of 0x12 */
+    CHECK(reg_block_read(block, 0x10, (uint8_t*)&value, 4) == -1);
+    block->fallback_read = test_fallback;
+    block->fallback_write = test_fallback;
+    read_count = 0;
+    value = read32(block, 0x10);
+    CHECK(value == 0x00A5A5EE);
+    CHECK(read_count == 2 && fallback_count == 1);
+
+    /* past the block */
+    CHECK(reg_block_read(block, TEST_SIZE, (uint8_t*)&value, 4) == 4 && value == 0xEEEEEEEE);
+    CHECK(fallback_count == 2);
+    write32(block, 0x14, 0);
+    CHECK(fallback_count == 3);
+}
+
+static void test_create(void)
+{
+    static const reg_desc_t overlap_regs[] = {
+        {0x00, 2, NULL, NULL, 0, 0, 0},
+        {0x01, 1, NULL, NULL, 0, 0, 0},
+    };
+    static const reg_desc_t cross_regs[] = {
+        {0x02, 4, NULL, NULL, 0, 0, 0},
+    };
+    reg_block_t *block = create_reg_block(overlap_regs, 2, 8, NULL);
+    CHECK(block == NULL);
+    block = create_reg_block(cross_regs, 1, 8, NULL);
+    CHECK(block == NULL);
+}
+
+static void test_read_set(void)
+{
+    static const reg_desc_t status_regs[] = {
+        {0x00, 4, NULL, NULL, 0, 0, 0, FALSE, 0x04000040},
+        {0x04, 1, NULL, NULL, 0, 0, 0, FALSE, 0x01},
+    };
+    reg_block_t *block = create_reg_block(status_regs, 2, 8, NULL);
+    uint8_t byte = 0;
+
+    CHECK(block != NULL);
+    if(block == NULL){
+        return;
+    }
+    /* the bits are set from reset and stay set when written with 0 */
+    CHECK(read32(block, 0x00) == 0x04000040);
+    write32(block, 0x00, 0x00000003);
+    CHECK(read32(block, 0x00) == 0x04000043);
+    CHECK(reg_block_value(block, &status_regs[0]) == 0x00000003);
+    CHECK(reg_block_read(block, 0x03, &byte, 1) == 1 && byte == 0x04);
+    CHECK(read32(block, 0x04) == 0x01);
+    destory_reg_block(&block);
+}
+
+static uint32_t merged_value = 0;
+static uint32_t written_value = 0;
+
+static int merge_source(void *owner, const reg_desc_t *reg, uint32_t *value)
+{
+    *value = merged_value;
+    return 0;
+}
+
+static int read_other(void *owner, const reg_desc_t *reg, uint32_t *value)
+{
+    *value = 0xFFFFFFFF;
+    return 0;
+}
+
+static int record_write(void *owner, const reg_desc_t *reg, uint32_t value)
+{
+    written_value = value;
+    return 0;
+}
+
+/* a narrow write takes the other bytes from merge rather than from the read */
+static void test_merge(void)
+{
+    static const reg_desc_t merge_regs[] = {
+        {0x00, 4, read_other, record_write, 0, 0, 0, TRUE, 0, merge_source},
+    };
+    reg_block_t *block = create_reg_block(merge_regs, 1, 4, NULL);
+    uint8_t byte = 0x5A;
+
+    CHECK(block != NULL);
+    if(block == NULL){
+        return;
+    }
+    merged_value = 0x11223344;
+    CHECK(reg_block_write(block, 0x01, &byte, 1) == 1);
+    CHECK(written_value == 0x11225A44);
+    /* a whole write merges with nothing */
+    write32(block, 0x00, 0x01020304);
+    CHECK(written_value == 0x01020304);
+    destory_reg_block(&block);
+}
+
+int main(int argc, char **argv)
+{
+    reg_block_t *block = create_reg_block(test_regs, TEST_REG_NUM, TEST_SIZE, NULL);
+    CHECK(block != NULL);
+    if(block == NULL){
+        return 1;
+    }
+
+    test_packed(block);
+    test_tail(block);
+    test_fallback_and_handlers(block);
+    test_create();
+    test_read_set();
+    test_merge();
+
+    reset_reg_block(block);
+    CHECK(read32(block, 0x00) == 0);
+    CHECK(read32(block, 0x08) == 0xFF);
+    test_w1c(block);
+    destory_reg_block(&block);
+
+    printf("%s\n", failures == 0 ? "OK" : "FAIL");
+    return failures != 0;
+}
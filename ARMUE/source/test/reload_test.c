@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <string.h>
+#include "module_helper.h"
+#include "soc.h"
+#include "reload.h"
+#include "replay.h"
+#include "arm_v7m_ins_implement.h"
+
+/*
+ * One soc runs the first image and is asked to load the second one halfway, while
+ * its run is recorded. The images count in a register at different steps and keep a
+ * count in the SRAM that goes on across the reload. A second soc replays the log
+ * without being asked, so the reload must come from the log: its registers, cycles,
+ * flash and SRAM must be the ones of the first soc.
+ */
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do{ \
+        if(!(cond)){ \
+            printf("FAIL line %d: %s\n", __LINE__, #cond); \
+            failures++; \
+        } \
+    }while(0)
+
+#define TEST_IMAGE_PATH     "reload_test_1.bin"
+#define TEST_NEW_IMAGE_PATH "reload_test_2.bin"
+#define TEST_LOG_PATH       "reload_test.log"
+#define TEST_CODE_BASE      0x100
+#define TEST_STEP_OFFSET    0x06        // the immediate of the adds in the loop
+#define TEST_FLASH_SIZE     0x1000
+#define TEST_SRAM_SIZE      0x8000
+#define TEST_STEPS          30000
+#define TEST_RELOAD_STEP    12000
+
+static const uint8_t firmware[] = {
+    /* reset */
+    0x4f, 0xf0, 0x80, 0x50,     /* 0000: mov.w r0, #268435456 */
+    0x00, 0x24,                 /* 0004: movs r4, #0 */
+    /* loop */
+    0x01, 0x34,                 /* 0006: adds r4, #1 */
+    0x04, 0x60,                 /* 0008: str r4, [r0] */
+    0x41, 0x68,                 /* 000a: ldr r1, [r0, #4] */
+    0x01, 0x31,                 /* 000c: adds r1, #1 */
+    0x41, 0x60,                 /* 000e: str r1, [r0, #4] */
+    0xf9, 0xe7,                 /* 0010: b 0x6 <loop> */
+};
+
+typedef struct test_machine_t{
+    soc_t *soc;
+    ram_t *flash;
+    ram_t *sram;
+}test_machine_t;
+
+/* the vectors, then the code, with the count step of the loop */
+static int write_image(const char *path, uint8_t step)
+{
+    uint8_t image[TEST_CODE_BASE + sizeof(firmware)];
+    uint32_t vectors[2] = {0x10008000, TEST_CODE_BASE | 1};
+
+    memset(image, 0, sizeof(image));
+    memcpy(image, vectors, sizeof(vectors));
+    memcpy(image + TEST_CODE_BASE, firmware, sizeof(firmware));
+    image[TEST_CODE_BASE + TEST_STEP_OFFSET] = step;
+
+    FILE *file = fopen(path, "wb");
+    if(file == NULL){
+        return -1;
+    }
+    int retval = fwrite(image, 1, sizeof(image), file) == sizeof(image) ? 0 : -1;
+    fclose(file);
+    return retval;
+}
+
+static int create_machine(test_machine_t *machine, replay_mode_t mode)
+{
+    memory_map_t *memory_map = create_memory_map();
+    soc_conf_t soc_conf;
+    memset(&soc_conf, 0, sizeof(soc_conf));
+    soc_conf.cpu_num = 1;
+    soc_conf.cpu_name = "arm_cm3";
+    soc_conf.exception_num = 255;
+    soc_conf.nested_level = 10;
+    soc_conf.memory_map_num = 1;
+    soc_conf.memories[0] = memory_map;
+    soc_conf.exclusive_high_address = 0xFFFFFFFF;
+
+    machine->flash = create_ram(TEST_FLASH_SIZE);
+    machine->sram = create_ram(TEST_SRAM_SIZE);
+    fill_ram_with_bin(machine->flash, 0, TEST_IMAGE_PATH);
+    setup_memory_map_ram(memory_map, machine->flash, 0);
+    setup_memory_map_ram(memory_map, machine->sram, 0x10000000);
+
+    machine->soc = create_soc(&soc_conf);
+    if(machine->soc == NULL || startup_soc(machine->soc) != SUCCESS){
+        return -1;
+    }
+    machine->soc->reload = create_reload(machine->soc, TEST_IMAGE_PATH, 0);
+    machine->soc->replay = create_replay(TEST_LOG_PATH, mode);
+    return machine->soc->reload != NULL && machine->soc->replay != NULL ? 0 : -1;
+}
+
+static void destory_machine(test_machine_t *machine)
+{
+    if(machine->soc != NULL){
+        destory_replay(&machine->soc->replay);
+        destory_reload(&machine->soc->reload);
+        destory_soc(&machine->soc);
+    }
+    destory_ram(&machine->flash);
+    destory_ram(&machine->sram);
+}
+
+int main(int argc, char **argv)
+{
+    test_machine_t recorded, replayed;
+    int i;
+
+    if(write_image(TEST_IMAGE_PATH, 1) < 0 || write_image(TEST_NEW_IMAGE_PATH, 3) < 0){
+        printf("FAIL: can't create the images\n");
+        return 1;
+    }
+    register_all_modules();
+
+    CHECK(create_machine(&recorded, REPLAY_RECORD) == 0);
+    for(i = 0; recorded.soc != NULL && i < TEST_STEPS; i++){
+        if(i == TEST_RELOAD_STEP){
+            request_reload(recorded.soc, TEST_NEW_IMAGE_PATH);
+        }
+        run_soc(recorded.soc);
+    }
+    /* the log is complete once it is closed */
+    destory_replay(&recorded.soc->replay);
+
+    CHECK(create_machine(&replayed, REPLAY_PLAY) == 0);
+    for(i = 0; replayed.soc != NULL && i < TEST_STEPS; i++){
+        run_soc(replayed.soc);
+    }
+
+    if(recorded.soc != NULL && replayed.soc != NULL){
+        CHECK(recorded.soc->cpu[0]->cycle == replayed.soc->cpu[0]->cycle);
+        CHECK(memcmp(ARMv7m_GET_REGS(recorded.soc->cpu[0]), ARMv7m_GET_REGS(replayed.soc->cpu[0]), sizeof(arm_reg_t)) == 0);
+        CHECK(memcmp(recorded.flash->data, replayed.flash->data, TEST_FLASH_SIZE) == 0);
+        CHECK(memcmp(recorded.sram->data, replayed.sram->data, TEST_SRAM_SIZE) == 0);
+        /* the second image ran */
+        CHECK(replayed.flash->data[TEST_CODE_BASE + TEST_STEP_OFFSET] == 3);
+    }
+
+    destory_machine(&recorded);
+    destory_machine(&replayed);
+    unregister_all_modules();
+
+    printf("%s\n", failures == 0 ? "OK" : "FAIL");
+    return failures != 0;
+}
@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <string.h>
+#include "module_helper.h"
+#include "soc.h"
+#include "semihost.h"
+#include "checkpoint.h"
+#include "mapped_image.h"
+#include "lpc1768_gpio.h"
+#include "lpc1768_ssp.h"
+
+/*
+ * The storage images of the SPI flash and the SD card.
+ *
+ * A private image reads the file and then the fill, keeps its writes from the
+ * other copies and leaves the file as it is. A shared image grows and writes the
+ * file.
+ *
+ * The firmware goes through a script the test puts in the SRAM: bytes for the
+ * selected SSP, chip selects and runs of counting bytes. It programs and erases
+ * the flash, then writes a block of the SD card. Restoring each checkpoint from
+ * the last one to the first must give back the images of that time, and running
+ * again from the first one must end with the same images.
+ */
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do{ \
+        if(!(cond)){ \
+            printf("FAIL line %d: %s\n", __LINE__, #cond); \
+            failures++; \
+        } \
+    }while(0)
+
+#define TEST_IMAGE_PATH     "storage_test.img"
+#define TEST_MISSING_PATH   "storage_test.missing"
+#define TEST_FLASH_PATH     "storage_test.flash"
+#define TEST_SD_PATH        "storage_test.sd"
+#define TEST_FLASH_FILE     0x2000      // the rest of the 64KB reads erased
+#define TEST_SD_SIZE        (512 * 1024)
+#define TEST_CODE_BASE      0x100
+#define TEST_SCRIPT         0x10001000
+#define TEST_INTERVAL       400
+#define TEST_CHECKPOINTS    64
+
+/* the script, one word each */
+#define SELECT_FLASH        0x1000
+#define SELECT_SD           0x2000
+#define DESELECT            0x3000
+#define COUNT(n)            (0x4000 | (n))
+#define END                 0xF000
+
+static const uint8_t firmware[] = {
+    /* reset */
+    0x1b, 0x4d,                 /* 0000: ldr r5, [pc, #108] */
+    0x1c, 0x48,                 /* 0002: ldr r0, [pc, #112] */
+    0xa8, 0x61,                 /* 0004: str r0, [r5, #24] */
+    0x28, 0x60,                 /* 0006: str r0, [r5] */
+    0x1b, 0x4e,                 /* 0008: ldr r6, [pc, #108] */
+    0x1c, 0x4f,                 /* 000a: ldr r7, [pc, #112] */
+    0x07, 0x20,                 /* 000c: movs r0, #7 */
+    0x30, 0x60,                 /* 000e: str r0, [r6] */
+    0x38, 0x60,                 /* 0010: str r0, [r7] */
+    0x02, 0x20,                 /* 0012: movs r0, #2 */
+    0x70, 0x60,                 /* 0014: str r0, [r6, #4] */
+    0x78, 0x60,                 /* 0016: str r0, [r7, #4] */
+    0x4f, 0xf0, 0x10, 0x24,     /* 0018: mov.w r4, #268439552 */
+    0x31, 0x46,                 /* 001c: mov r1, r6 */
+    /* next */
+    0x22, 0x68,                 /* 001e: ldr r2, [r4] */
+    0x04, 0x34,                 /* 0020: adds r4, #4 */
+    0x13, 0x0b,                 /* 0022: lsrs r3, r2, #12 */
+    0x00, 0x2b,                 /* 0024: cmp r3, #0 */
+    0x02, 0xd1,                 /* 0026: bne 0x2e <select_flash> */
+    0x8a, 0x60,                 /* 0028: str r2, [r1, #8] */
+    0x88, 0x68,                 /* 002a: ldr r0, [r1, #8] */
+    0xf7, 0xe7,                 /* 002c: b 0x1e <next> */
+    /* select_flash */
+    0x01, 0x2b,                 /* 002e: cmp r3, #1 */
+    0x04, 0xd1,                 /* 0030: bne 0x3c <select_sd> */
+    0x31, 0x46,                 /* 0032: mov r1, r6 */
+    0x4f, 0xf4, 0x80, 0x30,     /* 0034: mov.w r0, #65536 */
+    0xe8, 0x61,                 /* 0038: str r0, [r5, #28] */
+    0xf0, 0xe7,                 /* 003a: b 0x1e <next> */
+    /* select_sd */
+    0x02, 0x2b,                 /* 003c: cmp r3, #2 */
+    0x03, 0xd1,                 /* 003e: bne 0x48 <deselect> */
+    0x39, 0x46,                 /* 0040: mov r1, r7 */
+    0x40, 0x20,                 /* 0042: movs r0, #64 */
+    0xe8, 0x61,                 /* 0044: str r0, [r5, #28] */
+    0xea, 0xe7,                 /* 0046: b 0x1e <next> */
+    /* deselect */
+    0x03, 0x2b,                 /* 0048: cmp r3, #3 */
+    0x02, 0xd1,                 /* 004a: bne 0x52 <count> */
+    0x09, 0x48,                 /* 004c: ldr r0, [pc, #36] */
+    0xa8, 0x61,                 /* 004e: str r0, [r5, #24] */
+    0xe5, 0xe7,                 /* 0050: b 0x1e <next> */
+    /* count */
+    0x04, 0x2b,                 /* 0052: cmp r3, #4 */
+    0x08, 0xd1,                 /* 0054: bne 0x68 <done> */
+    0x13, 0x05,                 /* 0056: lsls r3, r2, #20 */
+    0x1b, 0x0d,                 /* 0058: lsrs r3, r3, #20 */
+    0x00, 0x22,                 /* 005a: movs r2, #0 */
+    /* count_loop */
+    0x8a, 0x60,                 /* 005c: str r2, [r1, #8] */
+    0x88, 0x68,                 /* 005e: ldr r0, [r1, #8] */
+    0x01, 0x32,                 /* 0060: adds r2, #1 */
+    0x01, 0x3b,                 /* 0062: subs r3, #1 */
+    0xfa, 0xd1,                 /* 0064: bne 0x5c <count_loop> */
+    0xda, 0xe7,                 /* 0066: b 0x1e <next> */
+    /* done */
+    0x18, 0x20,                 /* 0068: movs r0, #24 */
+    0x05, 0x49,                 /* 006a: ldr r1, [pc, #20] */
+    0xab, 0xbe,                 /* 006c: bkpt #171 */
+    /* hang */
+    0xfe, 0xe7,                 /* 006e: b 0x6e <hang> */
+    0x00, 0xc0, 0x09, 0x20,     /* 0070: .word 0x2009c000 */
+    0x40, 0x00, 0x01, 0x00,     /* 0074: .word 0x00010040 */
+    0x00, 0x80, 0x08, 0x40,     /* 0078: .word 0x40088000 */
+    0x00, 0x00, 0x03, 0x40,     /* 007c: .word 0x40030000 */
+    0x26, 0x00, 0x02, 0x00,     /* 0080: .word 0x00020026 */
+};
+
+static const uint32_t script[] = {
+    /* write enable, program 4 bytes at 0x2000 */
+    SELECT_FLASH, 0x06, DESELECT,
+    SELECT_FLASH, 0x02, 0x00, 0x20, 0x00, 0x12, 0x34, 0x56, 0x78, DESELECT,
+    /* write enable, erase the sector at 0x1000 */
+    SELECT_FLASH, 0x06, DESELECT,
+    SELECT_FLASH, 0x20, 0x00, 0x10, 0x00, DESELECT,
+    /* CMD1 leaves the idle state, CMD24 writes block 3 with 0, 1, 2... */
+    SELECT_SD, 0x41, 0x00, 0x00, 0x00, 0x00, 0xF9, 0xFF, 0xFF,
+    0x58, 0x00, 0x00, 0x00, 0x03, 0xFF, 0xFF, 0xFF, 0xFE, COUNT(512), 0xFF, 0xFF, 0xFF, 0xFF, DESELECT,
+    /* write enable, program a page at 0x3000 with 0, 1, 2... */
+    SELECT_FLASH, 0x06, DESELECT,
+    SELECT_FLASH, 0x02, 0x00, 0x30, 0x00, COUNT(256), DESELECT,
+    END,
+};
+
+static void write_word(memory_map_t *memory, uint32_t addr, uint32_t value)
+{
+    write_memory_block(addr, (uint8_t*)&value, 4, memory);
+}
+
+static long file_size(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if(file == NULL){
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+static int first_byte(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if(file == NULL){
+        return -1;
+    }
+    int c = fgetc(file);
+    fclose(file);
+    return c;
+}
+
+static bool_t write_pattern(const char *path, uint32_t size, uint8_t step)
+{
+    FILE *file = fopen(path, "wb");
+    uint32_t i;
+    if(file == NULL){
+        return FALSE;
+    }
+    for(i = 0; i < size; i++){
+        fputc((uint8_t)(i * step), file);
+    }
+    fclose(file);
+    return TRUE;
+}
+
+static uint64_t image_hash(mapped_image_t *image)
+{
+    uint64_t hash = 1469598103934665603ull;
+    uint64_t i;
+    for(i = 0; i < image->size; i++){
+        hash = (hash ^ image->data[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+static void test_image_copy(void)
+{
+    FILE *file = fopen(TEST_IMAGE_PATH, "wb");
+    CHECK(file != NULL && fwrite("0123456789", 1, 10, file) == 10);
+    if(file == NULL){
+        return;
+    }
+    fclose(file);
+
+    /* the file then the fill, each copy on its own */
+    mapped_image_t *a = map_image_file(TEST_IMAGE_PATH, 4096, 65536, 0xFF, TRUE);
+    mapped_image_t *b = map_image_file(TEST_IMAGE_PATH, 4096, 65536, 0xFF, TRUE);
+    CHECK(a != NULL && b != NULL);
+    if(a == NULL || b == NULL){
+        unmap_image_file(&a);
+        unmap_image_file(&b);
+        return;
+    }
+    CHECK(a->size == 65536);
+    CHECK(memcmp(a->data, "0123456789", 10) == 0);
+    CHECK(a->data[10] == 0xFF && a->data[65535] == 0xFF);
+    a->data[0] = 'X';
+    a->data[70] = 1;
+    CHECK(b->data[0] == '0' && b->data[70] == 0xFF);
+    unmap_image_file(&a);
+    unmap_image_file(&b);
+    CHECK(file_size(TEST_IMAGE_PATH) == 10);
+    CHECK(first_byte(TEST_IMAGE_PATH) == '0');
+
+    /* a missing file is not created */
+    remove(TEST_MISSING_PATH);
+    a = map_image_file(TEST_MISSING_PATH, 4096, 4096, 0xFF, TRUE);
+    CHECK(a != NULL && a->size == 4096 && a->data[5] == 0xFF);
+    unmap_image_file(&a);
+    CHECK(file_size(TEST_MISSING_PATH) < 0);
+
+    /* shared, the file is the storage */
+    a = map_image_file(TEST_IMAGE_PATH, 4096, 65536, 0xFF, FALSE);
+    CHECK(a != NULL);
+    if(a != NULL){
+        CHECK(a->data[100] == 0xFF);
+        a->data[0] = 'S';
+        unmap_image_file(&a);
+    }
+    CHECK(file_size(TEST_IMAGE_PATH) == 65536);
+    CHECK(first_byte(TEST_IMAGE_PATH) == 'S');
+}
+
+static void run_to_exit(soc_t *soc)
+{
+    int i;
+    for(i = 0; !soc->semihost->exited && i < 100000; i++){
+        run_soc(soc);
+    }
+}
+
+static void test_checkpoint(void)
+{
+    uint64_t flash_hash[TEST_CHECKPOINTS], sd_hash[TEST_CHECKPOINTS];
+    int taken, i;
+
+    CHECK(write_pattern(TEST_FLASH_PATH, TEST_FLASH_FILE, 7));
+    CHECK(write_pattern(TEST_SD_PATH, TEST_SD_SIZE, 3));
+
+    memory_map_t *memory_map = create_memory_map();
+    soc_conf_t soc_conf;
+    memset(&soc_conf, 0, sizeof(soc_conf));
+    soc_conf.cpu_num = 1;
+    soc_conf.cpu_name = "arm_cm3";
+    soc_conf.exception_num = 255;
+    soc_conf.nested_level = 10;
+    soc_conf.memory_map_num = 1;
+    soc_conf.memories[0] = memory_map;
+    soc_conf.exclusive_high_address = 0xFFFFFFFF;
+
+    setup_memory_map_ram(memory_map, create_ram(0x1000), 0);
+    setup_memory_map_ram(memory_map, create_ram(0x8000), 0x10000000);
+    write_word(memory_map, 0, 0x10008000);
+    write_word(memory_map, 4, TEST_CODE_BASE | 1);
+    write_memory_block(TEST_CODE_BASE, (uint8_t*)firmware, sizeof(firmware), memory_map);
+    write_memory_block(TEST_SCRIPT, (uint8_t*)script, sizeof(script), memory_map);
+
+    soc_t *soc = create_soc(&soc_conf);
+    CHECK(soc != NULL);
+    if(soc == NULL){
+        return;
+    }
+    soc->config.spi_flash = TEST_FLASH_PATH;
+    soc->config.sd_card = TEST_SD_PATH;
+    soc->semihost = create_semihost();
+    soc->cpu[0]->semihost = soc->semihost;
+    CHECK(lpc1768_gpio_init(soc) == 0);
+    CHECK(lpc1768_ssp_init(soc) == 0);
+    CHECK(soc->image_num == 2);
+    CHECK(startup_soc(soc) == SUCCESS);
+    soc->checkpoints = create_checkpoint_list(soc, TEST_INTERVAL);
+    CHECK(soc->checkpoints != NULL);
+    if(soc->image_num != 2 || soc->checkpoints == NULL){
+        goto cleanup;
+    }
+    mapped_image_t *flash = soc->images[0], *sd = soc->images[1];
+
+    /* the images when each checkpoint is taken */
+    flash_hash[0] = image_hash(flash);
+    sd_hash[0] = image_hash(sd);
+    taken = 1;
+    for(i = 0; !soc->semihost->exited && i < 100000; i++){
+        run_soc(soc);
+        if(soc->checkpoints->num > taken && taken < TEST_CHECKPOINTS){
+            flash_hash[taken] = image_hash(flash);
+            sd_hash[taken] = image_hash(sd);
+            taken++;
+        }
+    }
+    CHECK(soc->semihost->exited && soc->semihost->exit_code == 0);
+    CHECK(taken > 4 && taken < TEST_CHECKPOINTS);
+
+    /* what the script wrote */
+    CHECK(memcmp(flash->data + 0x2000, "\x12\x34\x56\x78", 4) == 0);
+    CHECK(flash->data[0x1000] == 0xFF && flash->data[0x1FFF] == 0xFF);
+    CHECK(flash->data[0x3000] == 0 && flash->data[0x30FF] == 0xFF);
+    CHECK(sd->data[3 * 512] == 0 && sd->data[3 * 512 + 511] == 0xFF);
+    uint64_t flash_end = image_hash(flash), sd_end = image_hash(sd);
+
+    for(i = taken - 1; i >= 0; i--){
+        CHECK(restore_checkpoint(soc, soc->checkpoints, i) >= 0);
+        CHECK(image_hash(flash) == flash_hash[i]);
+        CHECK(image_hash(sd) == sd_hash[i]);
+    }
+
+    soc->semihost->exited = FALSE;
+    run_to_exit(soc);
+    CHECK(soc->semihost->exited && soc->semihost->exit_code == 0);
+    CHECK(image_hash(flash) == flash_end);
+    CHECK(image_hash(sd) == sd_end);
+
+cleanup:
+    lpc1768_ssp_destory(soc);
+    lpc1768_gpio_destory(soc);
+    destory_soc(&soc);
+}
+
+int main(int argc, char **argv)
+{
+    register_all_modules();
+    test_image_copy();
+    test_checkpoint();
+    unregister_all_modules();
+
+    printf("%s\n", failures == 0 ? "OK" : "FAIL");
+    return failures != 0;
+}
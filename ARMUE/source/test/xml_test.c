@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <string.h>
+#include "xml.h"
+
+/*
+ * Checks of the XML reader on small documents written to a scratch file: the
+ * tree, the attributes, the entities and CDATA, the skipped parts and the errors.
+ */
+
+#define XML_TEST_FILE   "xml_test.tmp"
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do{ \
+        if(!(cond)){ \
+            printf("FAIL line %d: %s\n", __LINE__, #cond); \
+            failures++; \
+        } \
+    }while(0)
+
+static xml_node_t* parse_text(const char *text, int *line)
+{
+    FILE *file = fopen(XML_TEST_FILE, "wb");
+    if(file == NULL){
+        printf("can't write %s\n", XML_TEST_FILE);
+        return NULL;
+    }
+    fwrite(text, 1, strlen(text), file);
+    fclose(file);
+    xml_node_t *root = xml_parse_file(XML_TEST_FILE, line);
+    remove(XML_TEST_FILE);
+    return root;
+}
+
+static void test_document(void)
+{
+    static const char document[] =
+        "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+        "<!DOCTYPE device>\n"
+        "<!-- a comment -->\n"
+        "<device schemaVersion=\"1.1\" vendor='NXP'>\n"
+        "  <name> LPC17xx </name>\n"
+        "  <peripherals>\n"
+        "    <peripheral derivedFrom=\"UART0\"><name>UART1</name><baseAddress>0x40010000</baseAddress></peripheral>\n"
+        "    <!-- between two -->\n"
+        "    <peripheral><name>A&amp;B &lt;&#65;&#x42;&gt;</name></peripheral>\n"
+        "  </peripherals>\n"
+        "  <description><![CDATA[x < y]]> and z</description>\n"
+        "  <empty/>\n"
+        "</device>\n";
+    xml_node_t *node;
+    int line = -1, count = 0;
+
+    xml_node_t *root = parse_text(document, &line);
+    CHECK(root != NULL);
+    if(root == NULL){
+        return;
+    }
+    CHECK(strcmp(root->name, "device") == 0);
+    CHECK(xml_attr(root, "schemaVersion") != NULL && strcmp(xml_attr(root, "schemaVersion"), "1.1") == 0);
+    CHECK(xml_attr(root, "vendor") != NULL && strcmp(xml_attr(root, "vendor"), "NXP") == 0);
+    CHECK(xml_attr(root, "missing") == NULL);
+    CHECK(strcmp(xml_child_text(root, "name"), "LPC17xx") == 0);
+    CHECK(strcmp(xml_child_text(root, "description"), "x < y and z") == 0);
+    CHECK(xml_child(root, "empty") != NULL && strcmp(xml_child(root, "empty")->text, "") == 0);
+    CHECK(xml_child(root, "missing") == NULL && xml_child_text(root, "missing") == NULL);
+
+    for_each_xml_child(node, xml_child(root, "peripherals"), "peripheral"){
+        count++;
+    }
+    CHECK(count == 2);
+    node = xml_child(xml_child(root, "peripherals"), "peripheral");
+    CHECK(strcmp(xml_attr(node, "derivedFrom"), "UART0") == 0);
+    CHECK(strcmp(xml_child_text(node, "baseAddress"), "0x40010000") == 0);
+    node = xml_next(node, "peripheral");
+    CHECK(node != NULL && strcmp(xml_child_text(node, "name"), "A&B <AB>") == 0);
+
+    xml_destory(&root);
+    CHECK(root == NULL);
+}
+
+static void test_errors(void)
+{
+    int line = -1;
+
+    /* the line of the end tag that doesn't match */
+    CHECK(parse_text("<a>\n<b>\n</a>\n", &line) == NULL);
+    CHECK(line == 3);
+
+    /* the document ends in the middle of a character reference */
+    line = -1;
+    CHECK(parse_text("<a>&#", &line) == NULL);
+    CHECK(line == 1);
+
+    line = -1;
+    CHECK(xml_parse_file("no_such_file.xml", &line) == NULL);
+    CHECK(line == 0);
+}
+
+int main(int argc, char **argv)
+{
+    test_document();
+    test_errors();
+
+    printf("%s\n", failures == 0 ? "OK" : "FAIL");
+    return failures != 0;
+}
@@ -31,6 +31,16 @@ heap_null:
     return NULL;
 }
 
+void bheap_destory(bheap_t **heap)
+{
+    if(heap == NULL || *heap == NULL){
+        return;
+    }
+    free((*heap)->data);
+    free(*heap);
+    *heap = NULL;
+}
+
 int bheap_insert(bheap_t *heap, void *data_in, bheap_compare_t compare)
 {
     if(heap->current_length == heap->total_length){
@@ -17,6 +17,7 @@ typedef int (*bheap_compare_t)(void *a, void *b);
 int bheap_compare_int_smaller(void *a, void *b);
 
 bheap_t* bheap_create(int total_length, int data_size);
+void bheap_destory(bheap_t **heap);
 int bheap_insert(bheap_t *heap, void *data_in, bheap_compare_t compare);
 int bheap_peek_top(bheap_t *heap, void *data_out);
 int bheap_delete_top(bheap_t *heap, void *data_out, bheap_compare_t compare);
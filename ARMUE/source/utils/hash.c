@@ -160,3 +160,31 @@ void hash_dump(hash_t *hash, hash_func_t do_hash)
         printf("\n");
     }
 }
+
+uint64_t hash_fnv(const void *data, size_t size, uint64_t hash)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    size_t i;
+    for(i = 0; i < size; i++){
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+int hash_file(const char *path, uint64_t *hash)
+{
+    uint8_t buf[4096];
+    size_t len;
+    FILE *file = fopen(path, "rb");
+    if(file == NULL){
+        return -1;
+    }
+    *hash = HASH_FNV_INIT;
+    while((len = fread(buf, 1, sizeof(buf), file)) > 0){
+        *hash = hash_fnv(buf, len, *hash);
+    }
+    int retval = ferror(file) ? -1 : 0;
+    fclose(file);
+    return retval;
+}
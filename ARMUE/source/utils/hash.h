@@ -4,6 +4,9 @@
 extern "C"{
 #endif
 
+#include <stdint.h>
+#include <stddef.h>
+
 typedef union hash_data_t{
     int idata;
     unsigned int uidata;
@@ -35,6 +38,11 @@ int             hash_insert(hash_t *hash, int key, hash_data_t data, hash_func_t
 hash_element_t *hash_delete(hash_t *hash, int key, hash_func_t do_hash);
 void            hash_dump(hash_t *hash, hash_func_t do_hash);
 
+/* FNV-1a of some content, e.g. to tell whether a file has changed */
+#define HASH_FNV_INIT   0xcbf29ce484222325ull
+uint64_t        hash_fnv(const void *data, size_t size, uint64_t hash);
+int             hash_file(const char *path, uint64_t *hash);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,60 @@
+#include <stdlib.h>
+#include "spsc_queue.h"
+
+spsc_queue_t* create_spsc_queue(uint32_t length)
+{
+    /* round up to a power of 2 */
+    uint32_t size = 1;
+    while(size < length){
+        size <<= 1;
+    }
+
+    spsc_queue_t *queue = (spsc_queue_t*)calloc(1, sizeof(spsc_queue_t));
+    if(queue == NULL){
+        goto queue_null;
+    }
+    queue->slots = (void**)calloc(size, sizeof(void*));
+    if(queue->slots == NULL){
+        goto slots_null;
+    }
+    queue->mask = size - 1;
+    return queue;
+
+slots_null:
+    free(queue);
+queue_null:
+    return NULL;
+}
+
+void destory_spsc_queue(spsc_queue_t **queue)
+{
+    if(queue == NULL || *queue == NULL){
+        return;
+    }
+    free((*queue)->slots);
+    free(*queue);
+    *queue = NULL;
+}
+
+int spsc_push(spsc_queue_t *queue, void *item)
+{
+    uint32_t head = queue->head;
+    if(head - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) > queue->mask){
+        return -1;
+    }
+    queue->slots[head & queue->mask] = item;
+    /* the item is visible before the index that hands it over */
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void* spsc_pop(spsc_queue_t *queue)
+{
+    uint32_t tail = queue->tail;
+    if(tail == __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE)){
+        return NULL;
+    }
+    void *item = queue->slots[tail & queue->mask];
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+    return item;
+}
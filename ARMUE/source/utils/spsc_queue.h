@@ -0,0 +1,29 @@
+#ifndef _SPSC_QUEUE_H_
+#define _SPSC_QUEUE_H_
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include <stdint.h>
+
+/* A queue of pointers between one producer thread and one consumer thread, without
+   a lock. Each side only writes its own index. */
+typedef struct spsc_queue_t{
+    uint32_t head;          // written by the producer
+    uint8_t pad[60];
+    uint32_t tail;          // written by the consumer
+    uint32_t mask;          // length - 1, the length is a power of 2
+    void **slots;
+}spsc_queue_t;
+
+spsc_queue_t* create_spsc_queue(uint32_t length);
+void destory_spsc_queue(spsc_queue_t **queue);
+/* -1 if full */
+int spsc_push(spsc_queue_t *queue, void *item);
+/* NULL if empty */
+void* spsc_pop(spsc_queue_t *queue);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include "work_pool.h"
+
+typedef struct work_worker_t{
+    work_pool_t *pool;
+    int id;
+    pthread_t thread;
+}work_worker_t;
+
+/* take the next task of the own queue, -1 if it is empty */
+static int take_own_task(work_queue_t *queue)
+{
+    int index = -1;
+
+    pthread_mutex_lock(&queue->lock);
+    if(queue->head < queue->tail){
+        index = queue->head++;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return index;
+}
+
+/* steal the back half of the tasks of some other worker, -1 if every queue is empty */
+static int steal_task(work_pool_t *pool, int id)
+{
+    work_queue_t *own = &pool->queues[id];
+    int i, start = 0, end = 0;
+
+    for(i = 1; i < pool->worker_num && start == end; i++){
+        work_queue_t *victim = &pool->queues[(id + i) % pool->worker_num];
+
+        pthread_mutex_lock(&victim->lock);
+        int left = victim->tail - victim->head;
+        if(left > 0){
+            end = victim->tail;
+            start = end - (left + 1) / 2;
+            victim->tail = start;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    if(start == end){
+        return -1;
+    }
+
+    /* run the first one now and let the others be stolen again */
+    pthread_mutex_lock(&own->lock);
+    own->head = start + 1;
+    own->tail = end;
+    pthread_mutex_unlock(&own->lock);
+    return start;
+}
+
+static void* work_thread(void *arg)
+{
+    work_worker_t *worker = (work_worker_t*)arg;
+    work_pool_t *pool = worker->pool;
+    int index;
+
+    for(;;){
+        index = take_own_task(&pool->queues[worker->id]);
+        if(index < 0){
+            /* tasks are never added, so nothing to steal means all of them are taken */
+            index = steal_task(pool, worker->id);
+            if(index < 0){
+                break;
+            }
+        }
+        pool->func(index, pool->data);
+    }
+    return NULL;
+}
+
+int run_work_pool(int task_num, int worker_num, work_func_t func, void *data)
+{
+    int i, started = 0;
+
+    if(worker_num <= 0 || func == NULL){
+        return -1;
+    }
+    if(worker_num > task_num){
+        worker_num = task_num > 0 ? task_num : 1;
+    }
+
+    work_pool_t pool;
+    pool.worker_num = worker_num;
+    pool.func = func;
+    pool.data = data;
+    pool.queues = (work_queue_t*)calloc(worker_num, sizeof(work_queue_t));
+    if(pool.queues == NULL){
+        goto queues_null;
+    }
+    work_worker_t *workers = (work_worker_t*)calloc(worker_num, sizeof(work_worker_t));
+    if(workers == NULL){
+        goto workers_null;
+    }
+
+    for(i = 0; i < worker_num; i++){
+        pthread_mutex_init(&pool.queues[i].lock, NULL);
+        pool.queues[i].head = (long long)task_num * i / worker_num;
+        pool.queues[i].tail = (long long)task_num * (i + 1) / worker_num;
+    }
+
+    /* the tasks of a worker failing to start are stolen by the others */
+    for(i = 0; i < worker_num; i++){
+        workers[i].pool = &pool;
+        workers[i].id = i;
+        if(pthread_create(&workers[i].thread, NULL, work_thread, &workers[i]) != 0){
+            workers[i].pool = NULL;
+            continue;
+        }
+        started++;
+    }
+    if(started == 0){
+        /* no thread at all, run everything here */
+        workers[0].pool = &pool;
+        for(i = 0; i < worker_num; i++){
+            workers[0].id = i;
+            work_thread(&workers[0]);
+        }
+    }
+
+    for(i = 0; i < worker_num; i++){
+        if(started != 0 && workers[i].pool != NULL){
+            pthread_join(workers[i].thread, NULL);
+        }
+        pthread_mutex_destroy(&pool.queues[i].lock);
+    }
+
+    free(workers);
+    free(pool.queues);
+    return 0;
+
+workers_null:
+    free(pool.queues);
+queues_null:
+    return -1;
+}
@@ -0,0 +1,33 @@
+#ifndef _WORK_POOL_H_
+#define _WORK_POOL_H_
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include <pthread.h>
+
+/* run the task with the index, called from the worker threads */
+typedef void (*work_func_t)(int index, void *data);
+
+/* the tasks [head, tail) a worker still has to run */
+typedef struct work_queue_t{
+    pthread_mutex_t lock;
+    int head;   // the owner takes from here
+    int tail;   // the thieves take from here
+}work_queue_t;
+
+typedef struct work_pool_t{
+    int worker_num;
+    work_queue_t *queues;
+    work_func_t func;
+    void *data;
+}work_pool_t;
+
+/* Run task 0..task_num-1 on worker_num threads and return when all of them are done.
+   Tasks are split evenly at first, an idle worker steals half of the tasks of a busy one. */
+int run_work_pool(int task_num, int worker_num, work_func_t func, void *data);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,429 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "xml.h"
+
+typedef struct xml_parser_t{
+    char *pos;
+    char *end;
+    int line;
+}xml_parser_t;
+
+typedef struct xml_text_t{
+    char *data;
+    int len;
+    int cap;
+}xml_text_t;
+
+static int text_append(xml_text_t *text, const char *data, int len)
+{
+    if(text->len + len + 1 > text->cap){
+        int cap = text->cap == 0 ? 64 : text->cap;
+        while(text->len + len + 1 > cap){
+            cap *= 2;
+        }
+        char *grown = (char*)realloc(text->data, cap);
+        if(grown == NULL){
+            return -1;
+        }
+        text->data = grown;
+        text->cap = cap;
+    }
+    memcpy(text->data + text->len, data, len);
+    text->len += len;
+    text->data[text->len] = '\0';
+    return 0;
+}
+
+/* append the text with the entities replaced */
+static int text_append_decoded(xml_text_t *text, const char *data, int len)
+{
+    static const struct{
+        const char *entity;
+        char c;
+    }entities[] = {{"&lt;", '<'}, {"&gt;", '>'}, {"&amp;", '&'}, {"&quot;", '"'}, {"&apos;", '\''}};
+    int i, start = 0, e;
+
+    for(i = 0; i < len; i++){
+        if(data[i] != '&'){
+            continue;
+        }
+        if(text_append(text, data + start, i - start) < 0){
+            return -1;
+        }
+        char c = '&';
+        int skip = 1;
+        if(i + 2 < len && data[i + 1] == '#'){
+            char *stop;
+            long code = data[i + 2] == 'x' ? strtol(data + i + 3, &stop, 16) : strtol(data + i + 2, &stop, 10);
+            if(stop < data + len && *stop == ';'){
+                c = code < 0x80 ? (char)code : '?';
+                skip = stop - (data + i) + 1;
+            }
+        }else{
+            for(e = 0; e < (int)(sizeof(entities) / sizeof(entities[0])); e++){
+                int elen = strlen(entities[e].entity);
+                if(i + elen <= len && strncmp(data + i, entities[e].entity, elen) == 0){
+                    c = entities[e].c;
+                    skip = elen;
+                    break;
+                }
+            }
+        }
+        if(text_append(text, &c, 1) < 0){
+            return -1;
+        }
+        i += skip - 1;
+        start = i + 1;
+    }
+    return text_append(text, data + start, len - start);
+}
+
+static void advance(xml_parser_t *parser, int n)
+{
+    while(n-- > 0 && parser->pos < parser->end){
+        if(*parser->pos++ == '\n'){
+            parser->line++;
+        }
+    }
+}
+
+static void skip_space(xml_parser_t *parser)
+{
+    while(parser->pos < parser->end && isspace((unsigned char)*parser->pos)){
+        advance(parser, 1);
+    }
+}
+
+static int starts_with(xml_parser_t *parser, const char *s)
+{
+    int len = strlen(s);
+    return parser->end - parser->pos >= len && strncmp(parser->pos, s, len) == 0;
+}
+
+/* move after the next s, -1 if there is none */
+static int skip_past(xml_parser_t *parser, const char *s)
+{
+    while(parser->pos < parser->end){
+        if(starts_with(parser, s)){
+            advance(parser, strlen(s));
+            return 0;
+        }
+        advance(parser, 1);
+    }
+    return -1;
+}
+
+static int is_name_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == ':' || c == '.' || c == '-';
+}
+
+static char* parse_name(xml_parser_t *parser)
+{
+    char *start = parser->pos;
+    while(parser->pos < parser->end && is_name_char(*parser->pos)){
+        parser->pos++;
+    }
+    int len = parser->pos - start;
+    if(len == 0){
+        return NULL;
+    }
+    char *name = (char*)malloc(len + 1);
+    if(name != NULL){
+        memcpy(name, start, len);
+        name[len] = '\0';
+    }
+    return name;
+}
+
+static void destory_attrs(xml_attr_t *attr)
+{
+    while(attr != NULL){
+        xml_attr_t *next = attr->next;
+        free(attr->name);
+        free(attr->value);
+        free(attr);
+        attr = next;
+    }
+}
+
+static xml_attr_t* parse_attr(xml_parser_t *parser)
+{
+    xml_text_t value = {0};
+    xml_attr_t *attr = (xml_attr_t*)calloc(1, sizeof(xml_attr_t));
+    if(attr == NULL){
+        return NULL;
+    }
+    attr->name = parse_name(parser);
+    if(attr->name == NULL){
+        goto attr_fail;
+    }
+    skip_space(parser);
+    if(!starts_with(parser, "=")){
+        goto attr_fail;
+    }
+    advance(parser, 1);
+    skip_space(parser);
+    if(!starts_with(parser, "\"") && !starts_with(parser, "'")){
+        goto attr_fail;
+    }
+    char quote = *parser->pos;
+    advance(parser, 1);
+    char *start = parser->pos;
+    while(parser->pos < parser->end && *parser->pos != quote){
+        advance(parser, 1);
+    }
+    if(parser->pos == parser->end || text_append_decoded(&value, start, parser->pos - start) < 0){
+        goto attr_fail;
+    }
+    advance(parser, 1);
+    attr->value = value.data;
+    return attr;
+
+attr_fail:
+    free(value.data);
+    destory_attrs(attr);
+    return NULL;
+}
+
+/* the white space around the text is dropped */
+static char* trim_text(xml_text_t *text)
+{
+    if(text->data == NULL){
+        return (char*)calloc(1, 1);
+    }
+    int start = 0, end = text->len;
+    while(start < end && isspace((unsigned char)text->data[start])){
+        start++;
+    }
+    while(end > start && isspace((unsigned char)text->data[end - 1])){
+        end--;
+    }
+    memmove(text->data, text->data + start, end - start);
+    text->data[end - start] = '\0';
+    return text->data;
+}
+
+/* the parser is at the '<' of the start tag */
+static xml_node_t* parse_element(xml_parser_t *parser)
+{
+    xml_text_t text = {0};
+    xml_node_t *last_child = NULL;
+    xml_attr_t *last_attr = NULL;
+
+    xml_node_t *node = (xml_node_t*)calloc(1, sizeof(xml_node_t));
+    if(node == NULL){
+        return NULL;
+    }
+    advance(parser, 1);
+    node->name = parse_name(parser);
+    if(node->name == NULL){
+        goto element_fail;
+    }
+
+    for(;;){
+        skip_space(parser);
+        if(starts_with(parser, "/>")){
+            advance(parser, 2);
+            goto element_done;
+        }
+        if(starts_with(parser, ">")){
+            advance(parser, 1);
+            break;
+        }
+        xml_attr_t *attr = parse_attr(parser);
+        if(attr == NULL){
+            goto element_fail;
+        }
+        if(last_attr == NULL){
+            node->attrs = attr;
+        }else{
+            last_attr->next = attr;
+        }
+        last_attr = attr;
+    }
+
+    /* the content up to the end tag */
+    for(;;){
+        if(parser->pos >= parser->end){
+            goto element_fail;
+        }
+        if(starts_with(parser, "</")){
+            advance(parser, 2);
+            int len = strlen(node->name);
+            if(!starts_with(parser, node->name) || is_name_char(parser->pos[len])){
+                goto element_fail;
+            }
+            advance(parser, len);
+            skip_space(parser);
+            if(!starts_with(parser, ">")){
+                goto element_fail;
+            }
+            advance(parser, 1);
+            break;
+        }else if(starts_with(parser, "<!--")){
+            if(skip_past(parser, "-->") < 0){
+                goto element_fail;
+            }
+        }else if(starts_with(parser, "<![CDATA[")){
+            advance(parser, 9);
+            char *start = parser->pos;
+            if(skip_past(parser, "]]>") < 0 || text_append(&text, start, parser->pos - 3 - start) < 0){
+                goto element_fail;
+            }
+        }else if(starts_with(parser, "<?")){
+            if(skip_past(parser, "?>") < 0){
+                goto element_fail;
+            }
+        }else if(starts_with(parser, "<")){
+            xml_node_t *child = parse_element(parser);
+            if(child == NULL){
+                goto element_fail;
+            }
+            if(last_child == NULL){
+                node->child = child;
+            }else{
+                last_child->next = child;
+            }
+            last_child = child;
+        }else{
+            char *start = parser->pos;
+            while(parser->pos < parser->end && *parser->pos != '<'){
+                advance(parser, 1);
+            }
+            if(text_append_decoded(&text, start, parser->pos - start) < 0){
+                goto element_fail;
+            }
+        }
+    }
+
+element_done:
+    node->text = trim_text(&text);
+    if(node->text == NULL){
+        goto element_fail;
+    }
+    return node;
+
+element_fail:
+    free(text.data);
+    xml_destory(&node);
+    return NULL;
+}
+
+static char* read_file(const char *path, long *size)
+{
+    FILE *file = fopen(path, "rb");
+    if(file == NULL){
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *data = (char*)malloc(*size + 1);
+    if(data != NULL && fread(data, 1, *size, file) != (size_t)*size){
+        free(data);
+        data = NULL;
+    }
+    /* the parser may look one byte past the end, e.g. strtol on "&#" */
+    if(data != NULL){
+        data[*size] = '\0';
+    }
+    fclose(file);
+    return data;
+}
+
+xml_node_t* xml_parse_file(const char *path, int *line)
+{
+    xml_node_t *root = NULL;
+    long size;
+
+    *line = 0;
+    char *data = read_file(path, &size);
+    if(data == NULL){
+        return NULL;
+    }
+
+    xml_parser_t parser = {data, data + size, 1};
+    /* the prolog before the root element */
+    for(;;){
+        skip_space(&parser);
+        if(starts_with(&parser, "<?")){
+            if(skip_past(&parser, "?>") < 0){
+                break;
+            }
+        }else if(starts_with(&parser, "<!--")){
+            if(skip_past(&parser, "-->") < 0){
+                break;
+            }
+        }else if(starts_with(&parser, "<!")){
+            if(skip_past(&parser, ">") < 0){
+                break;
+            }
+        }else{
+            if(starts_with(&parser, "<")){
+                root = parse_element(&parser);
+            }
+            break;
+        }
+    }
+    if(root == NULL){
+        *line = parser.line;
+    }
+    free(data);
+    return root;
+}
+
+void xml_destory(xml_node_t **node)
+{
+    if(node == NULL || *node == NULL){
+        return;
+    }
+    xml_node_t *child = (*node)->child;
+    while(child != NULL){
+        xml_node_t *next = child->next;
+        xml_destory(&child);
+        child = next;
+    }
+    destory_attrs((*node)->attrs);
+    free((*node)->name);
+    free((*node)->text);
+    free(*node);
+    *node = NULL;
+}
+
+static xml_node_t* find_from(xml_node_t *node, const char *name)
+{
+    while(node != NULL && strcmp(node->name, name) != 0){
+        node = node->next;
+    }
+    return node;
+}
+
+xml_node_t* xml_child(xml_node_t *node, const char *name)
+{
+    return node == NULL ? NULL : find_from(node->child, name);
+}
+
+xml_node_t* xml_next(xml_node_t *node, const char *name)
+{
+    return find_from(node->next, name);
+}
+
+const char* xml_child_text(xml_node_t *node, const char *name)
+{
+    xml_node_t *child = xml_child(node, name);
+    return child == NULL ? NULL : child->text;
+}
+
+const char* xml_attr(xml_node_t *node, const char *name)
+{
+    xml_attr_t *attr;
+    for(attr = node->attrs; attr != NULL; attr = attr->next){
+        if(strcmp(attr->name, name) == 0){
+            return attr->value;
+        }
+    }
+    return NULL;
+}
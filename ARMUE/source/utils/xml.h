@@ -0,0 +1,44 @@
+#ifndef _XML_H_
+#define _XML_H_
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*
+ * A small reader for description files such as CMSIS-SVD. The whole document is
+ * loaded into a tree of elements. Comments, processing instructions and the
+ * DOCTYPE are skipped, the text of an element is the concatenation of its text
+ * and CDATA with the surrounding white space removed.
+ */
+
+typedef struct xml_attr_t{
+    char *name;
+    char *value;
+    struct xml_attr_t *next;
+}xml_attr_t;
+
+typedef struct xml_node_t{
+    char *name;
+    char *text;                 // "" if the element has no text
+    xml_attr_t *attrs;
+    struct xml_node_t *child;   // first child
+    struct xml_node_t *next;    // next sibling
+}xml_node_t;
+
+/* line is set to where the document is malformed, 0 if the file can't be read */
+xml_node_t* xml_parse_file(const char *path, int *line);
+void xml_destory(xml_node_t **node);
+
+/* NULL if there is none */
+xml_node_t* xml_child(xml_node_t *node, const char *name);
+xml_node_t* xml_next(xml_node_t *node, const char *name);
+const char* xml_child_text(xml_node_t *node, const char *name);
+const char* xml_attr(xml_node_t *node, const char *name);
+
+#define for_each_xml_child(cur, node, name) \
+for((cur) = xml_child(node, name); (cur) != NULL; (cur) = xml_next(cur, name))
+
+#ifdef __cplusplus
+}
+#endif
+#endif // _XML_H_